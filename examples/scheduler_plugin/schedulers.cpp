@@ -0,0 +1,87 @@
+/* Copyright 2024 P4lang Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <bm/bm_sim/native_scheduler.h>
+
+#include <algorithm>
+#include <vector>
+
+// pFabric: the packet of the shortest flow goes first. The packet size stands
+// for the remaining flow size, ties are broken by arrival.
+class PFabric : public bm::NativeScheduler {
+ public:
+  explicit PFabric(const std::vector<uint32_t> &weights) {
+    (void) weights;
+  }
+
+  bm::CalendarKey calculate_rank(const bm::CalendarItem &item) override {
+    return {static_cast<int>(item.get_packet_size()), ++last_time};
+  }
+
+  bm::CalendarKey evaluate_predicate(
+      const bm::NodeCalendar &calendar) override {
+    bm::CalendarKey key;
+    if (calendar.lowest(&key) == nullptr) return {0, 0};
+    return key;
+  }
+
+ private:
+  int last_time{0};
+};
+BM_REGISTER_NATIVE_SCHEDULER_W_NAME(PFABRIC, PFabric)
+
+// SP-PIFO: approximates a PIFO on the packet priority with strict priority
+// queues (one calendar day each) whose rank bounds adapt to the traffic. The
+// "weights" give the number of queues, 8 by default.
+class SpPifo : public bm::NativeScheduler {
+ public:
+  explicit SpPifo(const std::vector<uint32_t> &weights)
+      : bounds(weights.empty() ? 8 : std::max<uint32_t>(weights[0], 1), 0),
+        last_time(bounds.size(), 0) {}
+
+  bm::CalendarKey calculate_rank(const bm::CalendarItem &item) override {
+    const uint32_t rank = item.get_priority();
+    // Push-up: lowest priority queue whose bound the rank reaches
+    for (int queue = static_cast<int>(bounds.size()) - 1; queue >= 0;
+         queue--) {
+      if (rank >= bounds[queue] || queue == 0) {
+        // Push-down: an inversion in the highest priority queue lowers all
+        // the bounds by its cost
+        if (queue == 0 && rank < bounds[0]) {
+          const uint32_t cost = bounds[0] - rank;
+          for (auto &bound : bounds) bound -= std::min(bound, cost);
+        }
+        bounds[queue] = rank;
+        return {queue, ++last_time[queue]};
+      }
+    }
+    return {0, ++last_time[0]};
+  }
+
+  bm::CalendarKey evaluate_predicate(
+      const bm::NodeCalendar &calendar) override {
+    bm::CalendarKey key;
+    for (size_t queue = 0; queue < bounds.size(); queue++) {
+      if (calendar.lowest_for_day(static_cast<int>(queue), 1, &key) != nullptr)
+        return key;
+    }
+    return {0, 0};
+  }
+
+ private:
+  std::vector<uint32_t> bounds;
+  std::vector<int> last_time;
+};
+BM_REGISTER_NATIVE_SCHEDULER_W_NAME(SP_PIFO, SpPifo)
@@ -0,0 +1,147 @@
+#ifndef BM_BM_SIM_BUFFER_MANAGER_H_
+#define BM_BM_SIM_BUFFER_MANAGER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace bm {
+
+// Nodes with a larger id are only accounted at the port and shared levels
+constexpr size_t BUFFER_MAX_NODES = 4096;
+
+/**
+ * @brief Limits of one level of the buffer (an egress port, a leaf Node).
+ * A packet is dropped when it would take the level past max_packets or
+ * max_bytes, or when the level already holds more than alpha times the free
+ * shared buffer (dynamic threshold). 0 disables a limit.
+ */
+struct BufferLimits {
+  size_t max_packets{0};
+  size_t max_bytes{0};
+  double alpha{0.0};
+};
+
+/**
+ * @brief Shared buffer of the TrafficManager: its capacity (0 is unlimited)
+ * and the limits applied to every egress port.
+ */
+struct BufferConfig {
+  size_t max_packets{0};
+  size_t max_bytes{0};
+  BufferLimits port{};
+};
+
+struct BufferOccupancy {
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+/**
+ * @brief Levels of the buffer a packet is accounted in, the scope argument of
+ * the get_buffer_occupancy() extern method.
+ */
+enum class BufferScope : size_t { Node = 0, Port, Shared, NbScopes };
+
+using BufferOccupancies =
+    std::array<BufferOccupancy, static_cast<size_t>(BufferScope::NbScopes)>;
+
+/**
+ * @brief Why a packet was not admitted, see BufferManager::check().
+ */
+enum class AdmitVerdict : size_t {
+  Admit = 0,
+  DropShared,  /**< Shared buffer full */
+  DropPort,    /**< Limit or dynamic threshold of the egress port */
+  DropNode,    /**< Limit or dynamic threshold of the leaf */
+  DropAqm,     /**< Dropped by the admit action of the scheduler */
+  DropNoLeaf,  /**< No leaf of the hierarchy serves the egress port */
+  NbVerdicts
+};
+
+/**
+ * @brief Counters of one level of the buffer.
+ */
+struct BufferStats {
+  uint64_t packets;      /**< Current occupancy */
+  uint64_t bytes;
+  uint64_t peak_packets; /**< Highest occupancy so far */
+  uint64_t peak_bytes;
+  uint64_t nb_admitted;
+  uint64_t nb_drops;     /**< Packets of the level not admitted */
+};
+
+/**
+ * @brief Admission control of the TrafficManager buffer.
+ *
+ * A packet is accounted in the shared buffer, in its egress port and in the
+ * leaf Node it is classified to, from its admission until it leaves the TM.
+ * The dynamic thresholds let a congested port or leaf take a share of the
+ * buffer proportional to what is left free, so that it cannot starve the
+ * others (Choudhury and Hahne).
+ *
+ * check() and admit() must be serialized by the caller (the TM calls them
+ * under its enqueue lock), so a check is never invalidated before the
+ * admission. release() and the getters are safe from any thread.
+ */
+class BufferManager {
+ public:
+  explicit BufferManager(size_t nb_ports);
+
+  /* Delete copy/move operators */
+  BufferManager(const BufferManager &) = delete;
+  BufferManager &operator=(const BufferManager &) = delete;
+  BufferManager(BufferManager &&) = delete;
+  BufferManager &operator=(BufferManager &&) = delete;
+
+  // Applies to the next admissions, the packets in the buffer stay accounted
+  void configure(const BufferConfig &config);
+  BufferConfig get_config() const { return config; }
+
+  AdmitVerdict check(uint32_t port, int node_id,
+                     const BufferLimits &node_limits, size_t bytes) const;
+  void admit(uint32_t port, int node_id, size_t bytes);
+  void release(uint32_t port, int node_id, size_t bytes);
+  // Count a packet that was not admitted
+  void count_drop(uint32_t port, int node_id, AdmitVerdict verdict);
+
+  BufferOccupancies get_occupancies(uint32_t port, int node_id) const;
+  BufferStats get_shared_stats() const { return shared.get_stats(); }
+  BufferStats get_port_stats(uint32_t port) const;
+  BufferStats get_node_stats(int node_id) const;
+  uint64_t get_nb_drops(AdmitVerdict verdict) const;
+
+ private:
+  struct Account {
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> peak_packets{0};
+    std::atomic<uint64_t> peak_bytes{0};
+    std::atomic<uint64_t> nb_admitted{0};
+    std::atomic<uint64_t> nb_drops{0};
+
+    void add(size_t nb_bytes);
+    void remove(size_t nb_bytes);
+    BufferStats get_stats() const;
+  };
+
+  Account *port_account(uint32_t port) const;
+  Account *node_account(int node_id) const;
+  bool exceeds(const Account &account, const BufferLimits &limits,
+               size_t bytes) const;
+
+  BufferConfig config{};
+  Account shared;
+  size_t nb_ports;
+  std::unique_ptr<Account[]> ports;
+  std::unique_ptr<Account[]> nodes;
+  std::array<std::atomic<uint64_t>,
+             static_cast<size_t>(AdmitVerdict::NbVerdicts)>
+      nb_verdicts{};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_BUFFER_MANAGER_H_
@@ -2,35 +2,103 @@
 #define BM_BM_SIM_CALENDAR_ITEM_H_
 
 #include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/packet_store.h>  // PacketHandle
 #include <bm/bm_sim/phv.h>
 #ifdef BM_ENABLE_TM_DEBUG
 #include <bm/bm_sim/logger.h>
 #endif
 
-#include <memory>   // std::shared_ptr
+#include <array>
+#include <cstdint>
+#include <string>
 #include <utility>  // std::pair
 
 namespace bm {
 
+class Node;
+class CalendarItem;
+class CalendarItemPool;
+
+/**
+ * @brief Scheduler-visible fields of a CalendarItem.
+ */
+enum class CalendarItemField : size_t {
+  EgressPort = 0,
+  PacketSize,
+  Priority,
+  Dscp,
+  Color,
+  VlanId,
+  Sport,
+  Dport,
+  NbFields
+};
+
+/**
+ * @brief Where each scheduler-visible field of a CalendarItem comes from in
+ * the PHV. Field names ("hdr.field") are resolved once to a (header id,
+ * offset) pair with resolve(), extract() then indexes the PHV directly for
+ * every packet. Fields absent from the P4 program, or of an invalid header,
+ * are left to 0.
+ */
+class CalendarItemFieldMap {
+ public:
+  //! Default names, matching the simple_switch programs
+  CalendarItemFieldMap();
+
+  //! Name of the field in tmconfig ("egress_port", "dscp", ...)
+  static bool field_from_string(const std::string &name,
+                                CalendarItemField *field);
+
+  //! An empty name disables the field. Invalidates the resolution.
+  void set_field_name(CalendarItemField field, const std::string &name);
+  const std::string &get_field_name(CalendarItemField field) const;
+
+  //! Resolve the names against the layout of @p phv, returns the number of
+  //! fields found
+  size_t resolve(const PHV &phv);
+  bool is_resolved() const { return resolved; }
+
+  void extract(const PHV &phv, CalendarItem *item) const;
+
+ private:
+  struct Binding {
+    std::string name{};
+    header_id_t header_id{0};
+    int offset{0};
+    bool found{false};
+  };
+
+  std::array<Binding, static_cast<size_t>(CalendarItemField::NbFields)>
+      bindings{};
+  bool resolved{false};
+};
+
 /**
  * @brief CalendarItem class
  * This class is used to represent an item in the calendar, which is the packet
- * descriptor.
+ * descriptor. The packet itself stays owned by the TM packet store, the item
+ * only refers to it, and to its slot in the store through its handle.
+ *
+ * Items on the packet path come from a CalendarItemPool and are handed from
+ * node to node as plain pointers: exactly one task or calendar holds an item
+ * at any time, until the TM gives it back with CalendarItemPool::release().
  */
 class CalendarItem {
  public:
-  CalendarItem(std::shared_ptr<bm::Packet> pkt_ptr)
-      : rank(0, 0),
-        packet_id(0u),
-        packet_ptr(pkt_ptr),
-        egress_port(0),
-        packet_size(0),
-        priority(0),
-        dscp(0),
-        color(0),
-        vlan_id(0),
-        sport(0),
-        dport(0) {
+  CalendarItem() = default;
+
+  explicit CalendarItem(bm::Packet *pkt_ptr) { reset(pkt_ptr); }
+
+  CalendarItem(bm::Packet *pkt_ptr, const CalendarItemFieldMap &fields) {
+    reset(pkt_ptr, fields);
+  }
+
+  //! Re-initialize the item for a new packet, keeps the owning pool
+  void reset(bm::Packet *pkt_ptr) {
+    rank = {0, 0};
+    packet_ptr = pkt_ptr;
+    packet_handle = INVALID_PACKET_HANDLE;
     packet_id = pkt_ptr->get_packet_id();
 #ifdef BM_ENABLE_TM_DEBUG
     BMLOG_DEBUG("Packet for CalItem egress port : {}",
@@ -38,23 +106,20 @@ class CalendarItem {
 #endif
     egress_port = pkt_ptr->get_egress_port();
     packet_size = pkt_ptr->get_data_size();
-    const auto* phv = pkt_ptr->get_phv();
-    if (phv->has_field("standard_metadata.egress_port")) {
-      egress_port = phv->get_field("standard_metadata.egress_port").get_uint();
-    }
-    if (phv->has_field("intrinsic_metadata.packet_length")) {
-      packet_size =
-          phv->get_field("intrinsic_metadata.packet_length").get_uint();
-    }
-    if (phv->has_field("intrinsic_metadata.priority")) {
-      priority = phv->get_field("intrinsic_metadata.priority").get_uint();
-    }
-    if (phv->has_field("ipv4.diffserv")) {
-      dscp = phv->get_field("ipv4.diffserv").get_uint();
-    }
-    if (phv->has_field("scalars.metadata.color")) {
-      color = phv->get_field("scalars.metadata.color").get_uint();
-    }
+    priority = 0;
+    dscp = 0;
+    color = 0;
+    vlan_id = 0;
+    sport = 0;
+    dport = 0;
+    source_node = nullptr;
+    leaf_id = -1;
+    egress_priority = 0;
+  }
+
+  void reset(bm::Packet *pkt_ptr, const CalendarItemFieldMap &fields) {
+    reset(pkt_ptr);
+    fields.extract(*pkt_ptr->get_phv(), this);
   }
 
   // Getters
@@ -66,9 +131,13 @@ class CalendarItem {
   std::uint8_t get_dscp() const { return dscp; }
   std::uint8_t get_color() const { return color; }
   std::uint16_t get_vlan_id() const { return vlan_id; }
-  std::uint8_t get_sport() const { return sport; }
-  std::uint8_t get_dport() const { return dport; }
-  bm::Packet* get_packet_ptr() const { return packet_ptr.get(); }
+  std::uint16_t get_sport() const { return sport; }
+  std::uint16_t get_dport() const { return dport; }
+  bm::Packet* get_packet_ptr() const { return packet_ptr; }
+  PacketHandle get_packet_handle() const { return packet_handle; }
+  bm::Node* get_source_node() const { return source_node; }
+  int get_leaf_id() const { return leaf_id; }
+  std::uint8_t get_egress_priority() const { return egress_priority; }
 
   // Setters
   void set_rank(const std::pair<int, int>& r) { rank = r; }
@@ -79,23 +148,42 @@ class CalendarItem {
   void set_dscp(std::uint8_t d) { dscp = d; }
   void set_color(std::uint8_t c) { color = c; }
   void set_vlan_id(std::uint16_t vlan) { vlan_id = vlan; }
-  void set_sport(std::uint8_t s) { sport = s; }
-  void set_dport(std::uint8_t d) { dport = d; }
+  void set_sport(std::uint16_t s) { sport = s; }
+  void set_dport(std::uint16_t d) { dport = d; }
+  void set_source_node(bm::Node* node) { source_node = node; }
+  void set_leaf_id(int id) { leaf_id = id; }
+  void set_egress_priority(std::uint8_t prio) { egress_priority = prio; }
+  void set_packet_handle(PacketHandle handle) { packet_handle = handle; }
 
  private:
-  std::pair<int, int> rank;
-  std::uint32_t packet_id;
-  std::shared_ptr<bm::Packet> packet_ptr;
+  friend class CalendarItemPool;
+
+  std::pair<int, int> rank{0, 0};
+  std::uint32_t packet_id{0};
+  bm::Packet *packet_ptr{nullptr};
+  /* Slot of the packet in the TM packet store */
+  PacketHandle packet_handle{INVALID_PACKET_HANDLE};
 
   /* P4 User accessible data */
-  std::uint32_t egress_port;
-  size_t packet_size;
-  std::uint8_t priority;
-  std::uint8_t dscp;
-  std::uint8_t color;
-  std::uint16_t vlan_id;
-  std::uint8_t sport;
-  std::uint8_t dport;
+  std::uint32_t egress_port{0};
+  size_t packet_size{0};
+  std::uint8_t priority{0};
+  std::uint8_t dscp{0};
+  std::uint8_t color{0};
+  std::uint16_t vlan_id{0};
+  std::uint16_t sport{0};
+  std::uint16_t dport{0};
+
+  /* Hierarchy: child Node the item was received from (nullptr at a leaf) */
+  bm::Node* source_node{nullptr};
+  /* Leaf the packet is accounted in by the buffer manager, -1 if none */
+  int leaf_id{-1};
+  /* Priority queue of the egress buffer the target enqueued the packet for,
+     not visible to the schedulers */
+  std::uint8_t egress_priority{0};
+
+  /* Pool the item goes back to, nullptr when heap-allocated */
+  CalendarItemPool *pool{nullptr};
 };
 
 }  // namespace bm
@@ -0,0 +1,76 @@
+#ifndef BM_BM_SIM_CALENDAR_ITEM_POOL_H_
+#define BM_BM_SIM_CALENDAR_ITEM_POOL_H_
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/mpsc_ring.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>  // std::unique_ptr
+#include <vector>
+
+namespace bm {
+
+/** Default number of CalendarItems of a pool */
+constexpr size_t CALENDAR_ITEM_POOL_CAPACITY = 1024;
+
+/**
+ * @brief Fixed-size slab of CalendarItems, recycled across packets so that
+ * the TM packet path does not allocate in steady state.
+ *
+ * Items are acquired by a single thread at a time (the TM enqueue, under its
+ * lock). They come back two ways:
+ * - recycle(), from the one thread transmitting the packets of the pool (the
+ *   dequeue worker of the shard). It fills a single-producer ring, without
+ *   CAS.
+ * - release(), from any thread (a node dropping the item, the enqueue
+ *   itself). It goes through an MPSCRing.
+ * Both are sized for the whole slab, so they never fill up. Each item
+ * remembers its pool, so neither needs a pool argument. When the slab is
+ * exhausted, acquire() falls back to the heap and the item is deleted when
+ * given back; get_nb_overflows() counts these.
+ */
+class CalendarItemPool {
+ public:
+  explicit CalendarItemPool(size_t capacity = CALENDAR_ITEM_POOL_CAPACITY);
+
+  /* Delete copy/move operators */
+  CalendarItemPool(const CalendarItemPool &) = delete;
+  CalendarItemPool &operator=(const CalendarItemPool &) = delete;
+  CalendarItemPool(CalendarItemPool &&) = delete;
+  CalendarItemPool &operator=(CalendarItemPool &&) = delete;
+
+  //! Must not be called concurrently with itself
+  CalendarItem *acquire(bm::Packet *pkt, const CalendarItemFieldMap &fields);
+
+  //! Give @p item back to its pool (or delete it). Safe from any thread.
+  static void release(CalendarItem *item);
+  //! Same as release(), but must only be called by a single thread per pool,
+  //! the one transmitting its packets
+  static void recycle(CalendarItem *item);
+
+  size_t get_capacity() const { return capacity; }
+  uint64_t get_nb_overflows() const {
+    return nb_overflows.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Move the items given back since the last call to free_items
+  void collect();
+
+  const size_t capacity;
+  std::unique_ptr<CalendarItem[]> slab;
+  // Only touched by acquire(), reserved for the whole slab
+  std::vector<CalendarItem *> free_items;
+  MPSCRing<CalendarItem *> released_items;
+  // Single-producer ring of recycle()
+  const size_t recycled_mask;
+  std::unique_ptr<CalendarItem *[]> recycled_items;
+  alignas(64) std::atomic<size_t> recycled_tail{0};
+  alignas(64) size_t recycled_head{0};
+  std::atomic<uint64_t> nb_overflows{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_CALENDAR_ITEM_POOL_H_
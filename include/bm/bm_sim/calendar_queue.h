@@ -0,0 +1,517 @@
+#ifndef BM_BM_SIM_CALENDAR_QUEUE_H_
+#define BM_BM_SIM_CALENDAR_QUEUE_H_
+
+#include <algorithm>   // std::lower_bound
+#include <cstdint>
+#include <functional>  // std::function
+#include <iterator>    // std::next
+#include <limits>      // std::numeric_limits
+#include <map>         // std::map
+#include <memory>      // std::unique_ptr
+#include <stdexcept>   // std::invalid_argument
+#include <string>
+#include <utility>  // std::pair
+#include <vector>
+
+namespace bm {
+
+/**
+ * @brief Key of an item in a calendar: (day, time).
+ * Items are ordered lexicographically, first by day then by time.
+ */
+using CalendarKey = std::pair<int, int>;
+
+/**
+ * @brief Backend used by a Node to store its calendar items.
+ * Map is the original ordered map (O(log n) per operation), Bucket is a
+ * calendar queue (ring of day buckets, O(1) amortized enqueue / min).
+ */
+enum class CalendarStoreType { Map, Bucket };
+
+/**
+ * @brief Parse a calendar store type from its tmconfig name ("map" or
+ * "bucket"). Throws std::invalid_argument for any other name.
+ */
+inline CalendarStoreType calendar_store_type_from_string(
+    const std::string &name) {
+  if (name == "map") return CalendarStoreType::Map;
+  if (name == "bucket") return CalendarStoreType::Bucket;
+  throw std::invalid_argument("Unknown calendar: " + name);
+}
+
+/**
+ * @brief Interface of a calendar store.
+ * A calendar store holds at most one item per (day, time) key, like the
+ * std::map it replaces: inserting an already present key is rejected.
+ */
+template <typename T>
+class CalendarStore {
+ public:
+  using VisitFn = std::function<void(const CalendarKey &, const T &)>;
+
+  virtual ~CalendarStore() = default;
+
+  /// Insert @p value at @p key. Return false if the key is already used.
+  virtual bool insert(const CalendarKey &key, T value) = 0;
+  /// Remove the item at @p key and move it to @p value (if non null).
+  /// Return false if there is no such item.
+  virtual bool take(const CalendarKey &key, T *value) = 0;
+  /// Return a pointer to the lowest-ranked item (nullptr if empty), and
+  /// optionally its key.
+  virtual const T *lowest(CalendarKey *key = nullptr) const = 0;
+  /// Return the first item of @p day whose time is >= @p min_time.
+  virtual const T *lowest_for_day(int day, int min_time = 0,
+                                  CalendarKey *key = nullptr) const = 0;
+  virtual bool has_day(int day) const = 0;
+  virtual size_t size() const = 0;
+  bool empty() const { return size() == 0; }
+  virtual void clear() = 0;
+  /// Visit every item, for debugging purposes only.
+  virtual void for_each(const VisitFn &fn) const = 0;
+};
+
+/**
+ * @brief Calendar store backed by an ordered std::map. Kept as a reference
+ * implementation and for workloads with very sparse days.
+ */
+template <typename T>
+class MapCalendarStore final : public CalendarStore<T> {
+ public:
+  using typename CalendarStore<T>::VisitFn;
+
+  bool insert(const CalendarKey &key, T value) override {
+    return store.emplace(key, std::move(value)).second;
+  }
+
+  bool take(const CalendarKey &key, T *value) override {
+    auto it = store.find(key);
+    if (it == store.end()) return false;
+    if (value) *value = std::move(it->second);
+    store.erase(it);
+    return true;
+  }
+
+  const T *lowest(CalendarKey *key = nullptr) const override {
+    if (store.empty()) return nullptr;
+    auto it = store.begin();
+    if (key) *key = it->first;
+    return &it->second;
+  }
+
+  const T *lowest_for_day(int day, int min_time = 0,
+                          CalendarKey *key = nullptr) const override {
+    auto it = store.lower_bound(std::make_pair(day, min_time));
+    if (it == store.end() || it->first.first != day) return nullptr;
+    if (key) *key = it->first;
+    return &it->second;
+  }
+
+  bool has_day(int day) const override {
+    return lowest_for_day(day, std::numeric_limits<int>::min()) != nullptr;
+  }
+
+  size_t size() const override { return store.size(); }
+
+  void clear() override { store.clear(); }
+
+  void for_each(const VisitFn &fn) const override {
+    for (const auto &entry : store) fn(entry.first, entry.second);
+  }
+
+ private:
+  std::map<CalendarKey, T> store;
+};
+
+/**
+ * @brief Calendar queue: a ring of day buckets.
+ *
+ * Day d lives in bucket (d % nb_days). The ring covers a sliding window of
+ * nb_days consecutive days starting at base_day, which is always the lowest
+ * occupied day, so the minimum is the front of the base bucket. Within a
+ * bucket, items are kept sorted by time; the common case (time increasing
+ * within a day) is a push_back. An occupancy bitmap is used to find the next
+ * non-empty day when the base bucket runs dry. Items whose day does not fit
+ * in the window go to a small overflow map. Whenever base_day advances, the
+ * overflow days that now fit in the window are migrated back into the ring.
+ *
+ * The storage is kept from one item to the next: a bucket keeps the capacity
+ * of its vector when it empties, and the nodes erased from the overflow map
+ * are reused for the next far items. A store that stays below the depth it
+ * already reached does not allocate.
+ */
+template <typename T>
+class BucketCalendarStore final : public CalendarStore<T> {
+ public:
+  using typename CalendarStore<T>::VisitFn;
+
+  static constexpr size_t default_nb_days = 64;
+
+  explicit BucketCalendarStore(size_t nb_days = default_nb_days)
+      : buckets(round_up_pow2(nb_days)),
+        occupancy((buckets.size() + 63) / 64, 0),
+        mask(buckets.size() - 1) {}
+
+  bool insert(const CalendarKey &key, T value) override {
+    const int day = key.first;
+    if (!overflow.empty() && overflow.count(key)) return false;
+    if (!fits_window(day)) {
+      bool inserted = insert_overflow(key, std::move(value));
+      count += inserted;
+      return inserted;
+    }
+    if (!place(key, std::move(value))) return false;
+    count++;
+    return true;
+  }
+
+  bool take(const CalendarKey &key, T *value) override {
+    const int day = key.first;
+    if (in_window > 0 && in_window_range(day)) {
+      auto &bucket = buckets[index(day)];
+      if (!bucket.empty() && bucket.day == day) {
+        auto it = bucket.begin();
+        // Fast path: the item taken is almost always the first of its day
+        if (it->time != key.second) it = bucket.find(key.second);
+        if (it != bucket.end() && it->time == key.second) {
+          if (value) *value = std::move(it->value);
+          bucket.erase(it);
+          in_window--;
+          count--;
+          if (bucket.empty()) on_bucket_emptied(day);
+          return true;
+        }
+      }
+    }
+    if (overflow.empty()) return false;
+    auto it = overflow.find(key);
+    if (it == overflow.end()) return false;
+    if (value) *value = std::move(it->second);
+    recycle(it);
+    count--;
+    return true;
+  }
+
+  const T *lowest(CalendarKey *key = nullptr) const override {
+    const T *best = nullptr;
+    if (in_window > 0) {
+      const auto &front = buckets[index(base_day)].front();
+      if (key) *key = std::make_pair(base_day, front.time);
+      best = &front.value;
+      if (overflow.empty()) return best;
+      auto it = overflow.begin();
+      if (it->first < std::make_pair(base_day, front.time)) {
+        if (key) *key = it->first;
+        best = &it->second;
+      }
+      return best;
+    }
+    if (overflow.empty()) return nullptr;
+    auto it = overflow.begin();
+    if (key) *key = it->first;
+    return &it->second;
+  }
+
+  const T *lowest_for_day(int day, int min_time = 0,
+                          CalendarKey *key = nullptr) const override {
+    const T *best = nullptr;
+    int best_time = 0;
+    if (in_window > 0 && in_window_range(day)) {
+      const auto &bucket = buckets[index(day)];
+      if (!bucket.empty() && bucket.day == day) {
+        auto it = bucket.begin();
+        if (it->time < min_time) it = bucket.find(min_time);
+        if (it != bucket.end()) {
+          best = &it->value;
+          best_time = it->time;
+        }
+      }
+    }
+    if (!overflow.empty()) {
+      auto it = overflow.lower_bound(std::make_pair(day, min_time));
+      if (it != overflow.end() && it->first.first == day &&
+          (best == nullptr || it->first.second < best_time)) {
+        best = &it->second;
+        best_time = it->first.second;
+      }
+    }
+    if (best && key) *key = std::make_pair(day, best_time);
+    return best;
+  }
+
+  bool has_day(int day) const override {
+    if (in_window > 0 && in_window_range(day)) {
+      const auto &bucket = buckets[index(day)];
+      if (!bucket.empty() && bucket.day == day) return true;
+    }
+    if (overflow.empty()) return false;
+    auto it = overflow.lower_bound(
+        std::make_pair(day, std::numeric_limits<int>::min()));
+    return it != overflow.end() && it->first.first == day;
+  }
+
+  size_t size() const override { return count; }
+
+  void clear() override {
+    for (auto &bucket : buckets) bucket.clear();
+    std::fill(occupancy.begin(), occupancy.end(), 0);
+    overflow.clear();
+    spare_nodes.clear();
+    in_window = 0;
+    count = 0;
+  }
+
+  void for_each(const VisitFn &fn) const override {
+    if (in_window > 0) {
+      for (int day = base_day; day <= max_day; day++) {
+        const auto &bucket = buckets[index(day)];
+        if (bucket.empty() || bucket.day != day) continue;
+        for (const auto &entry : bucket)
+          fn(std::make_pair(day, entry.time), entry.value);
+      }
+    }
+    for (const auto &entry : overflow) fn(entry.first, entry.second);
+  }
+
+  size_t nb_days() const { return buckets.size(); }
+  /// Number of items currently held outside of the ring.
+  size_t overflow_size() const { return overflow.size(); }
+
+ private:
+  struct Entry {
+    int time;
+    T value;
+  };
+
+  // Items of a day, sorted by time. Taking the first item only moves head
+  // forward, the room before head is reused by the items inserted in front
+  // or reclaimed before the vector would grow.
+  struct Bucket {
+    using Iterator = typename std::vector<Entry>::iterator;
+    using ConstIterator = typename std::vector<Entry>::const_iterator;
+
+    int day{0};
+    size_t head{0};
+    std::vector<Entry> entries{};
+
+    bool empty() const { return head == entries.size(); }
+    Iterator begin() { return entries.begin() + head; }
+    Iterator end() { return entries.end(); }
+    ConstIterator begin() const { return entries.begin() + head; }
+    ConstIterator end() const { return entries.end(); }
+    const Entry &front() const { return entries[head]; }
+
+    // First item whose time is >= time
+    Iterator find(int time) {
+      return std::lower_bound(begin(), end(), time, entry_before);
+    }
+    ConstIterator find(int time) const {
+      return std::lower_bound(begin(), end(), time, entry_before);
+    }
+
+    // Return false if time is already used
+    bool insert(int time, T value) {
+      if (empty() || entries.back().time < time) {
+        reclaim_if_full();
+        entries.push_back({time, std::move(value)});
+        return true;
+      }
+      auto it = find(time);
+      if (it != end() && it->time == time) return false;
+      if (it == begin() && head > 0) {
+        entries[--head] = {time, std::move(value)};
+        return true;
+      }
+      if (reclaim_if_full()) it = find(time);
+      entries.insert(it, {time, std::move(value)});
+      return true;
+    }
+
+    void erase(Iterator it) {
+      if (it == begin()) {
+        // No copy of the value is kept alive by the room before head
+        it->value = T();
+        head++;
+      } else {
+        entries.erase(it);
+      }
+      if (empty()) clear();
+    }
+
+    // Keeps the capacity of the vector
+    void clear() {
+      entries.clear();
+      head = 0;
+    }
+
+    // Move the items down to the room before head instead of growing the
+    // vector, return true if the items moved
+    bool reclaim_if_full() {
+      if (head == 0 || entries.size() < entries.capacity()) return false;
+      entries.erase(entries.begin(), begin());
+      head = 0;
+      return true;
+    }
+
+    static bool entry_before(const Entry &e, int time) { return e.time < time; }
+  };
+
+  using Overflow = std::map<CalendarKey, T>;
+
+  static size_t round_up_pow2(size_t n) {
+    size_t p = 64;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  size_t index(int day) const {
+    return static_cast<size_t>(static_cast<unsigned int>(day)) & mask;
+  }
+
+  bool in_window_range(int day) const {
+    return day >= base_day && day <= max_day;
+  }
+
+  // Check whether day can be stored in the ring, sliding the window down or
+  // extending it up when possible
+  bool fits_window(int day) {
+    const auto span = static_cast<int64_t>(buckets.size());
+    if (in_window == 0) {
+      base_day = day;
+      max_day = day;
+      return true;
+    }
+    if (day >= base_day) {
+      if (static_cast<int64_t>(day) - base_day >= span) return false;
+      if (day > max_day) max_day = day;
+      return true;
+    }
+    if (static_cast<int64_t>(max_day) - day >= span) return false;
+    base_day = day;
+    return true;
+  }
+
+  void set_occupied(size_t idx) {
+    occupancy[idx / 64] |= (uint64_t{1} << (idx % 64));
+  }
+
+  void clear_occupied(size_t idx) {
+    occupancy[idx / 64] &= ~(uint64_t{1} << (idx % 64));
+  }
+
+  // Return the distance (in days) from idx to the next occupied bucket,
+  // scanning the ring forward. The ring must not be empty.
+  size_t next_occupied_distance(size_t idx) const {
+    const size_t nb_words = occupancy.size();
+    size_t word = idx / 64;
+    uint64_t bits = occupancy[word] & (~uint64_t{0} << (idx % 64));
+    for (size_t i = 0; i <= nb_words; i++) {
+      if (bits) {
+        size_t found = word * 64 + __builtin_ctzll(bits);
+        return (found - idx) & mask;
+      }
+      word = (word + 1) % nb_words;
+      bits = occupancy[word];
+    }
+    return 0;
+  }
+
+  // File value in the bucket of its day, which must fit in the window.
+  // Return false if the key is already used.
+  bool place(const CalendarKey &key, T value) {
+    const int day = key.first;
+    auto &bucket = buckets[index(day)];
+    const bool was_empty = bucket.empty();
+    if (!bucket.insert(key.second, std::move(value))) return false;
+    if (was_empty) {
+      bucket.day = day;
+      set_occupied(index(day));
+    }
+    if (day > max_day) max_day = day;
+    in_window++;
+    return true;
+  }
+
+  void on_bucket_emptied(int day) {
+    clear_occupied(index(day));
+    if (in_window == 0) {
+      if (overflow.empty()) return;
+      base_day = overflow.begin()->first.first;
+      max_day = base_day;
+      migrate_overflow();
+      return;
+    }
+    if (day == base_day) {
+      base_day += static_cast<int>(next_occupied_distance(index(base_day)));
+      if (!overflow.empty()) migrate_overflow();
+    } else if (day == max_day) {
+      // max_day is only an upper bound, walk it back to an occupied day
+      while (max_day > base_day) {
+        const auto &bucket = buckets[index(max_day)];
+        if (!bucket.empty() && bucket.day == max_day) break;
+        max_day--;
+      }
+    }
+  }
+
+  // Move the overflow days that fit in the window starting at base_day into
+  // the ring. Overflow days below base_day stay there, lowest() compares
+  // them with the ring.
+  void migrate_overflow() {
+    const auto end = static_cast<int64_t>(base_day) +
+        static_cast<int64_t>(buckets.size());
+    auto it = overflow.lower_bound(
+        std::make_pair(base_day, std::numeric_limits<int>::min()));
+    while (it != overflow.end() && it->first.first < end) {
+      place(it->first, std::move(it->second));
+      it = recycle(it);
+    }
+  }
+
+  bool insert_overflow(const CalendarKey &key, T value) {
+    if (spare_nodes.empty())
+      return overflow.emplace(key, std::move(value)).second;
+    auto node = std::move(spare_nodes.back());
+    spare_nodes.pop_back();
+    node.key() = key;
+    node.mapped() = std::move(value);
+    auto result = overflow.insert(std::move(node));
+    if (!result.inserted) spare_nodes.push_back(std::move(result.node));
+    return result.inserted;
+  }
+
+  // Erase it from the overflow map, its node is kept for the next far item.
+  // Return the next item.
+  typename Overflow::iterator recycle(typename Overflow::iterator it) {
+    auto next = std::next(it);
+    spare_nodes.push_back(overflow.extract(it));
+    spare_nodes.back().mapped() = T();
+    return next;
+  }
+
+  std::vector<Bucket> buckets;
+  std::vector<uint64_t> occupancy;
+  size_t mask;
+  int base_day{0};
+  int max_day{0};
+  size_t in_window{0};
+  size_t count{0};
+  Overflow overflow{};
+  std::vector<typename Overflow::node_type> spare_nodes{};
+};
+
+/**
+ * @brief Create a calendar store of the requested type.
+ */
+template <typename T>
+std::unique_ptr<CalendarStore<T>> make_calendar_store(
+    CalendarStoreType type,
+    size_t nb_days = BucketCalendarStore<T>::default_nb_days) {
+  if (type == CalendarStoreType::Map) {
+    return std::unique_ptr<CalendarStore<T>>(new MapCalendarStore<T>());
+  }
+  return std::unique_ptr<CalendarStore<T>>(new BucketCalendarStore<T>(nb_days));
+}
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_CALENDAR_QUEUE_H_
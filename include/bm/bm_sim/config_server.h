@@ -1,42 +1,129 @@
 #ifndef BM_BM_SIM_CONFIG_SERVER_H_
 #define BM_BM_SIM_CONFIG_SERVER_H_
 
+#include <bm/bm_sim/hierarchy.h>
 #include <bm/bm_sim/node.h>
+#include <bm/bm_sim/scheduler_params.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace bm {
 
 const int MAX_RECONFIGURATION_NUMBER = 3;
 
+// Largest message a configuration client can send, the session is closed
+// beyond it
+constexpr size_t CONFIG_SERVER_MAX_MESSAGE_SIZE = 64 << 20;
+
+// Scheduler parameters of a node to update at runtime
+struct NodeParamsUpdate {
+  int node_id;
+  SchedulerParams::Updates updates;
+};
+
+// Output rate of a node to update at runtime, see Node::set_shaping()
+struct NodeShaping {
+  int node_id;
+  uint64_t rate_bps;
+  uint64_t burst_bytes;
+};
+
+// Nodes of a "tmedit" the runtime updates of the previous hierarchy no
+// longer apply to, see ConfigParser::apply_edit()
+struct EditedNodes {
+  std::vector<int> removed;      // remove_node
+  std::vector<int> rescheduled;  // set_scheduler, new scheduler parameters
+};
+
+// Optional section of a "tmconfig" configuration, as read by
+// ConfigParser::parse_fields() and ConfigParser::parse_buffer()
+enum class ConfigSection { Absent, Valid, Invalid };
+
+// Message received by the ConfigServer, answered with ConfigServer::reply()
+struct ConfigMessage {
+  uint64_t session_id;
+  std::string text;
+};
+
+/**
+ * @brief TCP configuration service of the TrafficManager.
+ *
+ * A single thread serves all the client sessions with epoll. A session stays
+ * open until the client closes it and can carry any number of messages; each
+ * message is a JSON object, the objects delimit themselves (no length
+ * prefix, a configuration file can be sent as is) and can be of any size up
+ * to CONFIG_SERVER_MAX_MESSAGE_SIZE. The messages are handed over in order to
+ * the consumer blocked in wait_message(), which answers each of them with
+ * reply(): a session is only closed once all its messages are answered.
+ * Socket errors only close the session they happen on.
+ */
 class ConfigServer final {
  public:
-  ConfigServer();
-  ConfigServer(int port);
+  // Port 0 picks an ephemeral port, see get_port()
+  explicit ConfigServer(int port);
   ~ConfigServer();
 
-  void bind_and_listen();
-  void accept_and_read();
-  void start_accept_and_read_thread();
-  void parse_config(const std::string &config);
+  ConfigServer(const ConfigServer &) = delete;
+  ConfigServer &operator=(const ConfigServer &) = delete;
+
+  // Bind the port and start the server thread, false on error
+  bool start();
+  // Stop the server thread, close all the sessions and wake up
+  // wait_message(). Called by the destructor
+  void stop();
+  int get_port() const { return port; }
+
+  // Next message of any session, false on timeout or once stopped
+  bool wait_message(ConfigMessage *message, std::chrono::milliseconds timeout);
+  // Answer to a message of @p session_id, an empty @p error if it was
+  // applied. Dropped if the session is gone. Safe from any thread
+  void reply(uint64_t session_id, const std::string &error);
 
-  bool is_config_ready() const;
-  std::string get_config() const {return config;};
-  void clear_config() {config = "";};
-  // std::vector<std::shared_ptr<Node>> get_hierarchy() const;
-  std::vector<std::unique_ptr<Node>> get_hierarchy();
+  size_t get_nb_sessions() const;
 
  private:
-  int ntw_socket;
+  struct Session;
+
+  void serve();
+  void accept_sessions();
+  void read_session(Session *session);
+  void write_session(Session *session);
+  void flush_replies();
+  void update_events(Session *session);
+  void close_session(Session *session);
+  void wake() const;
+
   int port;
-  bool config_ready = false;
-  std::thread accept_and_read_thread;
+  int listen_socket{-1};
+  int epoll_fd{-1};
+  // Wakes up the server thread, on new replies and on stop()
+  int event_fd{-1};
+  std::thread server_thread;
+  std::atomic<bool> running{false};
+
+  // Sessions by id, only used by the server thread
+  std::unordered_map<uint64_t, std::unique_ptr<Session>> sessions;
+  uint64_t next_session_id{1};
+  std::atomic<size_t> nb_sessions{0};
 
-  std::string config = "";
+  // Messages received, waiting for the consumer
+  std::mutex messages_mutex;
+  std::condition_variable messages_cv;
+  std::deque<ConfigMessage> messages;
 
-  std::vector<std::unique_ptr<Node>> hierarchy;
-  // std::vector<std::shared_ptr<Node>> hierarchy;
+  // Replies of the consumer, waiting for the server thread
+  std::mutex replies_mutex;
+  std::vector<ConfigMessage> replies;
 };
 
 class ConfigParser final {
@@ -44,10 +131,26 @@ class ConfigParser final {
   ConfigParser();
   ~ConfigParser();
 
-  static std::vector<std::unique_ptr<Node>> parse(const std::string &config);
+  static Hierarchy parse(const std::string &config,
+                         TrafficManager *owner = nullptr);
+  static ConfigSection parse_fields(const std::string &config,
+                                    CalendarItemFieldMap *fields);
+  static ConfigSection parse_buffer(const std::string &config,
+                                    BufferConfig *buffer);
+  static bool parse_params(const std::string &config,
+                           std::vector<NodeParamsUpdate> *updates);
+  static bool parse_shaping(const std::string &config,
+                            std::vector<NodeShaping> *updates);
+  // "tmtrace" message, @p path is empty to stop the trace
+  static bool parse_trace(const std::string &message, std::string *path);
+  // Apply a "tmedit" message to @p config, see the definition
+  static bool is_edit(const std::string &message);
+  static bool apply_edit(const std::string &config, const std::string &edit,
+                         std::string *new_config, std::string *error,
+                         EditedNodes *edited = nullptr);
   // static std::vector<std::shared_ptr<Node>> parse(const std::string &config);
 };
 
 }  // namespace bm
 
-#endif  // BM_BM_SIM_CONFIG_SERVER_H_
\ No newline at end of file
+#endif  // BM_BM_SIM_CONFIG_SERVER_H_
@@ -0,0 +1,64 @@
+#ifndef BM_BM_SIM_HIERARCHY_H_
+#define BM_BM_SIM_HIERARCHY_H_
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/node.h>
+
+#include <memory>  // std::unique_ptr
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bm {
+
+/**
+ * @brief Tree of Nodes of the TrafficManager.
+ * Packets are enqueued to a leaf, each level pushes its predicate winner to
+ * its parent, and the roots (one per egress port) hand the packets over to
+ * the TrafficManager. Owns the nodes.
+ */
+class Hierarchy {
+ public:
+  using NodeList = std::vector<std::unique_ptr<Node>>;
+
+  Hierarchy() = default;
+  // Nodes push tasks to each other, all of them are stopped before any is
+  // destroyed
+  ~Hierarchy();
+  Hierarchy(Hierarchy &&other) = default;
+  Hierarchy &operator=(Hierarchy &&other);
+
+  void add_node(std::unique_ptr<Node> node);
+  bool link(int parent_id, int child_id, std::string *error);
+  bool finalize(std::string *error);
+
+  Node *get_node(int id) const;
+  Node *find_leaf(const CalendarItem &item) const;
+  const std::vector<Node *> &get_leaves() const { return leaves; }
+  const std::vector<Node *> &get_roots() const { return roots; }
+  size_t get_depth() const { return depth; }
+
+  NodeList::iterator begin() { return nodes.begin(); }
+  NodeList::iterator end() { return nodes.end(); }
+  NodeList::const_iterator begin() const { return nodes.begin(); }
+  NodeList::const_iterator end() const { return nodes.end(); }
+  size_t size() const { return nodes.size(); }
+  bool empty() const { return nodes.empty(); }
+
+ private:
+  void stop_nodes();
+
+  NodeList nodes{};
+  std::unordered_map<int, Node *> nodes_by_id{};
+  std::vector<Node *> roots{};
+  std::vector<Node *> leaves{};
+  // Leaves under the root of each egress port, in configuration order
+  std::unordered_map<int, std::vector<Node *>> leaves_by_port{};
+  // Leaves under a root without egress port, used for every port
+  std::vector<Node *> portless_leaves{};
+  size_t depth{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_HIERARCHY_H_
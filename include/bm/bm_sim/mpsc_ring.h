@@ -0,0 +1,194 @@
+#ifndef BM_BM_SIM_MPSC_RING_H_
+#define BM_BM_SIM_MPSC_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>   // std::unique_ptr
+#include <mutex>
+#include <thread>   // std::this_thread::yield
+#include <utility>  // std::move
+
+namespace bm {
+
+/**
+ * @brief Bounded lock-free multi-producer / single-consumer ring.
+ *
+ * Producers reserve a slot with a CAS on the tail and publish it through a
+ * per-slot sequence number (Vyukov's bounded queue), so pushes from several
+ * threads never take a lock. The single consumer drains items in batches.
+ * A mutex / condition variable pair is only used to park the consumer when
+ * the ring is empty; producers touch it only when the consumer is asleep.
+ *
+ * @tparam T item type, must be default constructible and move assignable.
+ */
+template <typename T>
+class MPSCRing {
+ public:
+  explicit MPSCRing(size_t capacity = 1024)
+      : capacity(round_up_pow2(capacity)),
+        mask(this->capacity - 1),
+        slots(new Slot[this->capacity]) {
+    for (size_t i = 0; i < this->capacity; i++)
+      slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  /* Delete copy/move operators */
+  MPSCRing(const MPSCRing &) = delete;
+  MPSCRing &operator=(const MPSCRing &) = delete;
+  MPSCRing(MPSCRing &&) = delete;
+  MPSCRing &operator=(MPSCRing &&) = delete;
+
+  /**
+   * @brief Try to push an item. Safe to call from any number of threads.
+   * @return false if the ring is full (the item is left untouched).
+   */
+  bool try_push(T &&item) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots[pos & mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) -
+                  static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    slot->item = std::move(item);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    wake_consumer();
+    return true;
+  }
+
+  /**
+   * @brief Push an item, yielding while the ring is full.
+   */
+  void push(T &&item) {
+    while (!try_push(std::move(item))) std::this_thread::yield();
+  }
+
+  /**
+   * @brief Pop up to @p max items into @p out without blocking.
+   * Must only be called from the consumer thread.
+   * @return the number of items popped.
+   */
+  size_t pop_batch(T *out, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+      Slot *slot = &slots[head & mask];
+      if (slot->seq.load(std::memory_order_acquire) != head + 1) break;
+      out[n++] = std::move(slot->item);
+      slot->seq.store(head + capacity, std::memory_order_release);
+      head++;
+    }
+    return n;
+  }
+
+  /**
+   * @brief Pop up to @p max items, parking the consumer until at least one
+   * item is available or wake() is called.
+   * @return the number of items popped (0 only after a wake()).
+   */
+  size_t wait_pop_batch(T *out, size_t max) {
+    size_t n = pop_batch(out, max);
+    if (n > 0) return n;
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    consumer_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while ((n = pop_batch(out, max)) == 0 && !woken) {
+      wait_cv.wait(lock);
+    }
+    woken = false;
+    consumer_waiting.store(false, std::memory_order_relaxed);
+    return n;
+  }
+
+  /**
+   * @brief Same as wait_pop_batch(), but gives up after @p timeout.
+   */
+  template <typename Rep, typename Period>
+  size_t wait_pop_batch_for(T *out, size_t max,
+                            const std::chrono::duration<Rep, Period> &timeout) {
+    size_t n = pop_batch(out, max);
+    if (n > 0) return n;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    consumer_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while ((n = pop_batch(out, max)) == 0 && !woken) {
+      if (wait_cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+        n = pop_batch(out, max);
+        break;
+      }
+    }
+    woken = false;
+    consumer_waiting.store(false, std::memory_order_relaxed);
+    return n;
+  }
+
+  /**
+   * @brief Wake up the consumer even if the ring is empty (e.g. on stop).
+   */
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(wait_mutex);
+      woken = true;
+    }
+    wait_cv.notify_one();
+  }
+
+  /**
+   * @brief Approximate emptiness check, exact from the consumer thread.
+   */
+  bool empty() const {
+    return slots[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+  }
+
+  size_t get_capacity() const { return capacity; }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<size_t> seq{0};
+    T item{};
+  };
+
+  static size_t round_up_pow2(size_t n) {
+    size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  void wake_consumer() {
+    // Pairs with the fence in wait_pop_batch: either the consumer sees
+    // the new item when it re-checks the ring, or we see it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumer_waiting.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(wait_mutex);
+      wait_cv.notify_one();
+    }
+  }
+
+  const size_t capacity;
+  const size_t mask;
+  std::unique_ptr<Slot[]> slots;
+
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) size_t head{0};
+
+  alignas(64) std::atomic<bool> consumer_waiting{false};
+  std::mutex wait_mutex;
+  std::condition_variable wait_cv;
+  bool woken{false};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_MPSC_RING_H_
@@ -0,0 +1,242 @@
+#ifndef BM_BM_SIM_NATIVE_SCHEDULER_H_
+#define BM_BM_SIM_NATIVE_SCHEDULER_H_
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/calendar_queue.h>
+#include <bm/bm_sim/scheduler_params.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>  // std::unique_ptr
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>  // std::move
+#include <vector>
+
+//! Version of the scheduler plugin ABI: the NativeScheduler interface and the
+//! layout of what its hooks see (CalendarItem, NodeCalendar,
+//! SchedulerParams). Bumped whenever one of them changes, modules built
+//! against another version are rejected.
+#define BM_NATIVE_SCHEDULER_ABI_VERSION 2
+
+namespace bm {
+
+using NodeCalendar = CalendarStore<CalendarItem *>;
+
+/**
+ * @brief Scheduler of a Node implemented in C++ instead of P4 actions.
+ *
+ * Same hooks as the P4 schedulers ("<scheduler>_<hook>" actions), without the
+ * interpreter nor the TrafficManagerInterface registers. The Node calls the
+ * hooks with its calendar locked, a scheduler instance belongs to one Node
+ * and needs no synchronization of its own.
+ *
+ * Ranks use time 0 for the null predicate, like the P4 schedulers: the times
+ * handed out start at 1.
+ *
+ * The hooks only get the CalendarItem of the packet, the compact descriptor
+ * the Node keeps in its calendar (size, port, color, priority, flow fields),
+ * not the packet itself. Schedulers outside of bmv2 (PIFO, pFabric, ...) are
+ * built as modules loaded with --load-modules and registered with
+ * BM_REGISTER_NATIVE_SCHEDULER().
+ */
+class NativeScheduler {
+ public:
+  virtual ~NativeScheduler() = default;
+
+  //! Rank of @p item, entering the calendar of the Node
+  virtual CalendarKey calculate_rank(const CalendarItem &item) = 0;
+  //! Rank of the next item to release, {0, 0} if none
+  virtual CalendarKey evaluate_predicate(const NodeCalendar &calendar) = 0;
+  //! @p item was released to the parent (or the TM)
+  virtual void dequeued(const CalendarItem &item) { (void) item; }
+  virtual void periodic_timeout() {}
+  //! The scheduler parameters of the Node were updated at runtime, called
+  //! before the next hook. By convention parameter 0 holds the per-color
+  //! weights.
+  virtual void set_params(const SchedulerParams::Snapshot &params) {
+    (void) params;
+  }
+
+  /**
+   * @brief Native implementation of a scheduler type: "FIFO", "SP", "WRR",
+   * "DRR" or a type registered by a module, see NativeSchedulerMap. Throws
+   * std::invalid_argument for other types.
+   *
+   * @param type Scheduler type.
+   * @param weights Per-color weights (WRR, packets per round) or quanta (DRR,
+   * bytes per round). Defaults are used when empty, ignored by FIFO and SP.
+   * Passed as is to the schedulers of modules.
+   */
+  static std::unique_ptr<NativeScheduler> make(
+      const std::string &type, const std::vector<uint32_t> &weights = {});
+
+  /**
+   * @brief Advance an arrival counter and return the time of the next rank.
+   * Times go from 1 to INT_MAX, the counter then restarts at 1 (as the
+   * bit<32> rank register of the P4 schedulers wraps) and never hands out
+   * time 0, the null predicate. Packets ranked right after the wrap go
+   * ahead of the ones still queued in the same day. The counters are not
+   * renormalized when the calendar empties: calculate_rank() runs under the
+   * calendar lock but does not see the calendar, and a Node that is never
+   * empty would wrap all the same.
+   */
+  static int next_time(uint32_t *last_time);
+};
+
+/**
+ * @brief FIFO_* actions: rank (0, arrival), the lowest time of day 0 goes
+ * first.
+ */
+class FifoScheduler final : public NativeScheduler {
+ public:
+  CalendarKey calculate_rank(const CalendarItem &item) override;
+  CalendarKey evaluate_predicate(const NodeCalendar &calendar) override;
+
+ private:
+  uint32_t last_time{0};
+};
+
+/**
+ * @brief SP_* actions: strict priority on the packet color, rank (color,
+ * arrival in the color). Color 0 is served first, among the first
+ * NB_PRIORITIES colors (MAX_DAY of the P4 program); higher colors share the
+ * lowest priority.
+ */
+class StrictPriorityScheduler final : public NativeScheduler {
+ public:
+  static constexpr int NB_PRIORITIES = 3;
+
+  CalendarKey calculate_rank(const CalendarItem &item) override;
+  CalendarKey evaluate_predicate(const NodeCalendar &calendar) override;
+
+ private:
+  uint32_t last_time[NB_PRIORITIES]{};
+};
+
+/**
+ * @brief Round-based schedulers: the day of a rank is the round the packet is
+ * sent in, its time the arrival order. A color idle for a while restarts at
+ * the round being served, it does not get credit for the rounds it missed.
+ * The lowest rank of the calendar goes first.
+ */
+class RoundScheduler : public NativeScheduler {
+ public:
+  CalendarKey calculate_rank(const CalendarItem &item) override;
+  CalendarKey evaluate_predicate(const NodeCalendar &calendar) override;
+  void dequeued(const CalendarItem &item) override;
+  //! New weights from parameter 0, if set. The packets already in the
+  //! calendar keep their round.
+  void set_params(const SchedulerParams::Snapshot &params) override;
+
+ protected:
+  explicit RoundScheduler(std::vector<uint32_t> weights);
+
+  // Cost of @p item in the budget of its color for one round
+  virtual uint32_t cost(const CalendarItem &item) const = 0;
+
+ private:
+  void set_weights(std::vector<uint32_t> new_weights);
+
+  // Last round of a color and its budget left in that round
+  struct Flow {
+    bool active{false};
+    int round{0};
+    uint64_t budget{0};
+  };
+
+  std::vector<uint32_t> weights;
+  std::vector<Flow> flows;
+  int current_round{0};
+  uint32_t last_time{0};
+};
+
+/**
+ * @brief Weighted round robin on the packet color: color c sends weights[c]
+ * packets per round.
+ */
+class WrrScheduler final : public RoundScheduler {
+ public:
+  explicit WrrScheduler(std::vector<uint32_t> weights)
+      : RoundScheduler(std::move(weights)) {}
+
+ private:
+  uint32_t cost(const CalendarItem &item) const override;
+};
+
+/**
+ * @brief Deficit round robin on the packet color: color c sends up to
+ * weights[c] bytes per round, the unused part is carried over to its next
+ * round.
+ */
+class DrrScheduler final : public RoundScheduler {
+ public:
+  static constexpr uint32_t DEFAULT_QUANTUM = 1500;
+
+  explicit DrrScheduler(std::vector<uint32_t> quanta)
+      : RoundScheduler(std::move(quanta)) {}
+
+ private:
+  uint32_t cost(const CalendarItem &item) const override;
+};
+
+/**
+ * @brief Scheduler types with a native implementation, by name.
+ *
+ * The built-in schedulers are registered first and cannot be replaced. A
+ * registration made against another BM_NATIVE_SCHEDULER_ABI_VERSION is
+ * rejected, NativeScheduler::make() then reports the mismatch for its name.
+ */
+class NativeSchedulerMap {
+ public:
+  //! Builds a scheduler from the "weights" of its tmconfig node
+  using FactoryFn = std::function<std::unique_ptr<NativeScheduler>(
+      const std::vector<uint32_t> &weights)>;
+
+  static NativeSchedulerMap *get_instance();
+
+  //! Returns false if @p name is already taken or @p abi_version is not
+  //! BM_NATIVE_SCHEDULER_ABI_VERSION
+  bool register_scheduler(const char *name, int abi_version, FactoryFn fn);
+
+  //! nullptr if no scheduler is registered as @p name
+  std::unique_ptr<NativeScheduler> get_scheduler(
+      const std::string &name, const std::vector<uint32_t> &weights) const;
+
+  //! Names of all the registered schedulers, built-in ones first
+  std::vector<std::string> get_names() const;
+
+ private:
+  NativeSchedulerMap();
+
+  std::unordered_map<std::string, FactoryFn> map_{};
+  std::vector<std::string> names_{};
+  // ABI version of the rejected registrations, by name
+  std::unordered_map<std::string, int> rejected_{};
+
+  friend class NativeScheduler;
+};
+
+}  // namespace bm
+
+//! Registers @p scheduler__, a NativeScheduler constructible from the
+//! per-color weights, under @p scheduler_name. To be called once in the module
+//! defining the scheduler.
+#define BM_REGISTER_NATIVE_SCHEDULER_W_NAME(scheduler_name, scheduler__)   \
+  static_assert(std::is_constructible<scheduler__,                         \
+                                      const std::vector<uint32_t> &>::value, \
+                "Native scheduler " #scheduler__                           \
+                " needs a constructor taking the per-color weights");      \
+  bool _native_scheduler_##scheduler_name##_create_ =                      \
+      ::bm::NativeSchedulerMap::get_instance()->register_scheduler(        \
+          #scheduler_name, BM_NATIVE_SCHEDULER_ABI_VERSION,                \
+          [](const std::vector<uint32_t> &weights) {                       \
+            return std::unique_ptr<::bm::NativeScheduler>(                 \
+                new scheduler__(weights));                                 \
+          });
+
+#define BM_REGISTER_NATIVE_SCHEDULER(scheduler_name) \
+  BM_REGISTER_NATIVE_SCHEDULER_W_NAME(scheduler_name, scheduler_name)
+
+#endif  // BM_BM_SIM_NATIVE_SCHEDULER_H_
@@ -2,17 +2,25 @@
 #define BM_BM_SIM_NODE_H
 
 #include <bm/bm_sim/actions.h>  // bm::ActionFnEntry
+#include <bm/bm_sim/buffer_manager.h>
 #include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/calendar_queue.h>
+#include <bm/bm_sim/native_scheduler.h>
+#include <bm/bm_sim/node_executor.h>
 #include <bm/bm_sim/task.h>  // Task
+#include <bm/bm_sim/timer_wheel.h>
+#include <bm/bm_sim/token_bucket.h>
 #include <bm/config.h>
 
-#include <condition_variable>
+#include <array>
+#include <chrono>
 #include <fstream>  // std::ofstream
 #include <iostream>
 #include <map>      // std::map
 #include <memory>   // std::shared_ptr
-#include <queue>    // std::queue
+#include <mutex>    // std::recursive_mutex
 #include <string>   // std::string
+#include <unordered_map>
 #include <utility>  // std::pair
 #include <vector>   // std::vector
 
@@ -22,13 +30,77 @@ namespace bm {
 
 class TrafficManagerInterface;
 class TrafficManager;
-using PredicateCallback = std::function<void()>;
+
+// Period of the predicate re-evaluation of a Node whose scheduler holds back
+// packets it could send (e.g. time-based predicates). Nodes that are empty
+// or waiting for a credit (of their parent, or of the egress port for a
+// root) are never woken up by a timer.
+constexpr std::chrono::microseconds NODE_IDLE_POLL_INTERVAL{100};
+
+// Tick of the timer wheel firing the periodic_timeout hook of the nodes, the
+// timeout intervals are multiples of it
+constexpr std::chrono::milliseconds NODE_TIMER_TICK{1};
+
+/**
+ * @brief Activity counters of a Node, see Node::get_stats().
+ */
+struct NodeStats {
+  uint64_t nb_enqueued;               /**< Packets entering the calendar */
+  uint64_t nb_dequeued;               /**< Packets handed to the parent/TM */
+  uint64_t nb_predicate_requests;     /**< State changes asking for one */
+  uint64_t nb_predicate_evaluations;  /**< Evaluations, after coalescing */
+  uint64_t nb_timer_evaluations;      /**< Evaluations due to the timer */
+  uint64_t nb_timeouts;               /**< periodic_timeout executions */
+  uint64_t cpu_time_ns;               /**< Time the workers ran the Node */
+};
+
+// Binding the extern of a Node to a P4 action writes the action, the nodes
+// running one action take turns on its mutex. Owned by the TrafficManager
+using ActionMutexMap = std::unordered_map<const ActionFn *, std::mutex>;
+
+/**
+ * @brief P4 actions a scheduler implements, as "<scheduler>_<hook>".
+ */
+enum class SchedulerHook : size_t {
+  CalculateRank = 0,
+  EvaluatePredicate,
+  Dequeued,
+  PeriodicTimeout,
+  Admit,
+  NbHooks
+};
+
+/**
+ * @brief Classifier of a leaf Node. Tells which packets are enqueued to the
+ * leaf, based on one of the CalendarItem fields. A leaf without classifier
+ * (field None) accepts every packet of its egress port.
+ */
+struct NodeClassifier {
+  enum class Field {
+    None,
+    EgressPort,
+    Priority,
+    Dscp,
+    Color,
+    VlanId,
+    Sport,
+    Dport
+  };
+
+  Field field{Field::None};
+  std::vector<uint32_t> values{};
+
+  static Field field_from_string(const std::string &name);
+  bool matches(const bm::CalendarItem &item) const;
+};
 
 /**
  * @brief Node class. Base class of the traffic manager.
  * Act as a mini-version of the TrafficManager class. Can have children
  * and a parent (one only). If no parent is set, the node is a root node, linked
  * to an output port.
+ * A Node has no thread, it is executed by the NodeExecutor of its
+ * TrafficManager (or the default one) whenever it has work.
  */
 class Node {
  public:
@@ -45,117 +117,189 @@ class Node {
   Node(Node &&) = delete;
   Node &operator=(Node &&) = delete;
 
-  void run(); /* Main Node's loop */
+  void push_task(Task &&task);
+  // Same for @p nb_tasks tasks, the Node is scheduled once for all of them
+  void push_tasks(Task *tasks, size_t nb_tasks);
   void enqueue(Task &&task);
   void dequeue(std::pair<int, int> pred_to_dq);
-  std::pair<int, int> calculate_rank(
-      std::shared_ptr<bm::CalendarItem>);  // void ?
+  std::pair<int, int> calculate_rank(bm::CalendarItem *cal_item);
   void eval_predicate();
-  void predicate_worker();
+  void request_predicate();
   void periodic_timeout();
+  bool admit(bm::CalendarItem *cal_item,
+             const BufferOccupancies &occupancies);
+  // Stop executing the Node, waits for a running execution. Called by the
+  // destructor, tasks pushed afterwards are never processed
+  void stop();
 
   // Setup functions
-  void set_actions(std::unordered_map<std::string, bm::ActionFn *> *actions);
+  // False if the Node cannot schedule: its scheduler is not native and lacks
+  // a calculate_rank or evaluate_predicate action
+  bool set_actions(std::unordered_map<std::string, bm::ActionFn *> *actions,
+                   ActionMutexMap *action_mutexes);
+  // Run the scheduler in C++ instead of its P4 actions
+  void set_native_scheduler(std::unique_ptr<NativeScheduler> scheduler);
+  bool is_native() const { return native_scheduler != nullptr; }
+  // Publish new scheduler parameters, taken into account by the next hook
+  // without stopping the Node. Safe from any thread
+  bool set_scheduler_params(const SchedulerParams::Updates &updates);
   void set_parent(Node *parent);
-  void set_children(const std::vector<std::shared_ptr<Node>> &children);
+  void set_children(const std::vector<Node *> &children);
+  void add_child(Node *child);
+  void set_classifier(NodeClassifier classifier);
+  void set_window(int window);
+  // Limits of the buffer taken by the packets of a leaf, see BufferManager
+  void set_buffer_limits(const BufferLimits &limits) {
+    buffer_limits = limits;
+  }
+  const BufferLimits &get_buffer_limits() const { return buffer_limits; }
+  // Shape the packets leaving the Node to @p rate_bps bits per second, with
+  // bursts of up to @p burst_bytes, 0 removes the limit. Safe from any thread
+  void set_shaping(uint64_t rate_bps, uint64_t burst_bytes = 0);
+  void release_credit();
+  // Interval of the periodic_timeout hook in NODE_TIMER_TICKs, 0 disables it
+  void set_timeout_interval(uint64_t interval) { timeout_interval = interval; }
+  uint64_t get_timeout_interval() const { return timeout_interval; }
+  void start_periodic_timeout(TimerWheel *wheel);
+  void set_calendar_store(
+      CalendarStoreType type,
+      size_t nb_days = BucketCalendarStore<bm::CalendarItem *>::default_nb_days);
+  // Run on the worker of @p port, the egress port the Node feeds (-1 if it
+  // has none). Must be called before the Node gets any work
+  void set_affinity(int port);
 
   // Access node related information
-  std::shared_ptr<bm::CalendarItem> get_lowest_for_day(int day) const;
-  std::shared_ptr<bm::CalendarItem> get_lowest() const;
+  bm::CalendarItem *get_lowest_for_day(int day) const;
+  bm::CalendarItem *get_lowest() const;
   bool has_packets_for_day(int day) const;
-  bool ready() { return !calendar_store.empty() && predicate_set; }
+  bool ready() { return !calendar_store->empty() && predicate_set; }
+  // True when no packet is queued or in the calendar. Safe from any thread
+  bool is_idle() const {
+    return pending_packets.load(std::memory_order_acquire) == 0;
+  }
   int get_id() const { return id; }
   std::string get_scheduler_type() { return scheduler_type; }
+  int get_egress_port() const { return egress_port; }
+  NodeStats get_stats() const;
+  Node *get_parent() const { return parent; }
+  const std::vector<Node *> &get_children() const { return children; }
+  bool is_leaf() const { return children.empty(); }
+  bool accepts(const bm::CalendarItem &item) const {
+    return classifier.matches(item);
+  }
 
  private:
-  int id;
-  bool root;
+  friend class NodeExecutor;
+
+  // Process the pending tasks, then the predicate. Called by the executor
+  void execute();
+  void execute_action(SchedulerHook hook, bm::Packet *pkt);
+  NativeScheduler *get_native_scheduler();
+  // Executor of the owner (or the default one), worker of the egress port
+  void bind_executor();
+  bool calendar_empty() const {
+    std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+    return calendar_store->empty();
+  }
+  // The calendar holds packets the parent (or the egress port) could take
+  // right now. A root without transmit credit is woken up by the egress sink
+  bool can_send() const {
+    if (parent == nullptr && waiting_tx_credit) return false;
+    return !calendar_empty() &&
+           (parent == nullptr || upstream_credits.load() > 0);
+  }
+
+  int id{0};
+  bool root{false};
   std::string scheduler_type;
-  int egress_port;
+  int egress_port{-1};
 
   std::unique_ptr<TrafficManagerInterface> node_p4_interface;
-  std::map<std::pair<int, int>, std::shared_ptr<bm::CalendarItem>>
-      calendar_store;
-  TaskQueue task_queue;
+  using NodeCalendarStore = CalendarStore<bm::CalendarItem *>;
+  std::unique_ptr<NodeCalendarStore> calendar_store;
+  // Serializes the calendar between the run and predicate threads. Recursive
+  // because the P4 actions query the calendar through the extern.
+  mutable std::recursive_mutex calendar_mutex;
+  TaskQueue task_queue{TASK_QUEUE_CAPACITY};
+  std::vector<bm::Task> task_batch;
+  // Packets pushed to the Node and not handed over yet
+  std::atomic<size_t> pending_packets{0};
 
   // Second item to 0 = nullptr predicate
   std::pair<int, int> predicate_rank;
   bool flag = false;
   std::atomic<bool> predicate_set{false};
-  PredicateCallback predicate_callback;
-  std::mutex eval_predicate_mutex;
-
-  std::thread run_thread;
-  std::thread predicate_thread;
-  std::queue<std::function<void()>> predicate_tasks;
-  std::mutex predicate_mutex;
-  std::condition_variable predicate_cv;
-  bool predicate_running = true;
 
-  // P4 actions
-  std::unordered_map<std::string, bm::ActionFnEntry *> actions_map;
-  std::unordered_map<std::string, bm::ActionFn *> actionsfn_map;
+  // Execution of the Node, see NodeExecutor
+  NodeExecutor *executor{nullptr};
+  size_t worker{0};
+  std::atomic<uint32_t> exec_state{0};
+  // The poll timer expired, only used by the worker of the Node
+  bool timer_fired{false};
+  // Root held back by the lack of transmit credit on its last dequeue, only
+  // used by the worker of the Node
+  bool waiting_tx_credit{false};
+  // Predicate evaluation requests, coalesced: any number of state changes
+  // before the Node is executed trigger a single evaluation
+  std::atomic<bool> predicate_requested{false};
 
-  // Hierarchy management
-  Node *parent;
-  std::vector<std::shared_ptr<Node>> children;
-  bm::TrafficManager *owner;
+  // Counters, see NodeStats
+  std::atomic<uint64_t> nb_enqueued{0};
+  std::atomic<uint64_t> nb_dequeued{0};
+  std::atomic<uint64_t> nb_predicate_requests{0};
+  std::atomic<uint64_t> nb_predicate_evaluations{0};
+  std::atomic<uint64_t> nb_timer_evaluations{0};
+  std::atomic<uint64_t> nb_timeouts{0};
+  std::atomic<uint64_t> busy_ns{0};
 
-  // Thread safe access management
-  std::condition_variable cv;  // Condition variable for task_queue
-  std::mutex mtx;              // Mutex for task_queue
+  // periodic_timeout hook, fired by the timer wheel of the TM
+  uint64_t timeout_interval{0};
+  TimerWheel *timer_wheel{nullptr};
+  TimerWheel::TimerId timer_id{0};
+  // A Timeout task is in the task queue, timeouts do not pile up
+  std::atomic<bool> timeout_pending{false};
 
-#ifdef BM_ENABLE_TM_DEBUG
-  // Logs packet IDs and info to CSV
-  std::ofstream csv_tm_dump_in;
-  std::ofstream csv_tm_dump_out;  // Logs packet IDs and info to CSV
+  // P4 actions of the scheduler, resolved by set_actions()
+  struct HookEntry {
+    bm::ActionFn *action_fn{nullptr};
+    std::unique_ptr<bm::ActionFnEntry> entry{nullptr};
+    std::mutex *mutex{nullptr};
+  };
+  std::array<HookEntry, static_cast<size_t>(SchedulerHook::NbHooks)> hooks{};
+  // Replaces the P4 actions when set, see set_native_scheduler()
+  std::unique_ptr<NativeScheduler> native_scheduler{nullptr};
+  // Version of the scheduler parameters the native scheduler last got
+  uint64_t native_params_version{0};
 
-  std::string current_time();
-  void dump_packet_info(std::ofstream &csv, bm::CalendarItem *cal_item);
+  // Hierarchy management
+  Node *parent{nullptr};
+  std::vector<Node *> children;
+  bm::TrafficManager *owner{nullptr};
+  NodeClassifier classifier;
+  BufferLimits buffer_limits{};
+  // Output rate of the Node, see set_shaping(). Under calendar_mutex
+  TokenBucket shaper{};
+  // Packets sent to the parent and not forwarded by it yet
+  std::atomic<int> upstream_credits{1};
 
+#ifdef BM_ENABLE_TM_DEBUG
   std::string calendar_store_to_string() const {
     std::stringstream ss;
     ss << "Calendar Store Contents:\n";
-    for (const auto &entry : calendar_store) {
-      ss << "Key: (" << entry.first.first << ", " << entry.first.second
-         << ") -> ";
-      if (entry.second != nullptr) {
-        ss << "PacketID: "
-           << entry.second->get_packet_id();  // assuming get_packet_id() exists
-      } else {
-        ss << "nullptr";
-      }
-      ss << "\n";
-    }
+    calendar_store->for_each(
+        [&ss](const CalendarKey &key, bm::CalendarItem *const &item) {
+          ss << "Key: (" << key.first << ", " << key.second << ") -> ";
+          if (item != nullptr) {
+            ss << "PacketID: " << item->get_packet_id();
+          } else {
+            ss << "nullptr";
+          }
+          ss << "\n";
+        });
     return ss.str();
   }
-
-  // Vectors to store accumulated log entries
-  std::vector<std::string> accumulated_logs_in;
-  std::vector<std::string> accumulated_logs_out;
-
-  void dump_packet_info_vector(std::vector<std::string> &vec,
-                               bm::CalendarItem *cal_item);
-
- public:
-  void write_accumulated_logs() {
-    // Write accumulated incoming logs to file
-    for (const auto &entry : accumulated_logs_in) {
-      csv_tm_dump_in << entry << std::endl;
-    }
-    csv_tm_dump_in.flush();
-
-    // Write accumulated outgoing logs to file
-    for (const auto &entry : accumulated_logs_out) {
-      csv_tm_dump_out << entry << std::endl;
-    }
-    csv_tm_dump_out.flush();
-
-    // Clear the accumulated logs
-    accumulated_logs_in.clear();
-    accumulated_logs_out.clear();
-  }
 #endif
+
  private:
   int drank = 0;  // debug rank only
   int pkt_dequeued = 0;
@@ -0,0 +1,94 @@
+#ifndef BM_BM_SIM_NODE_EXECUTOR_H_
+#define BM_BM_SIM_NODE_EXECUTOR_H_
+
+#include <bm/bm_sim/mpsc_ring.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bm {
+
+class Node;
+class VirtualClock;
+
+// Workers of the executor used by the nodes without TrafficManager
+constexpr size_t NODE_EXECUTOR_DEFAULT_WORKERS = 4;
+
+// Nodes a worker can have queued without taking the overflow lock
+constexpr size_t NODE_EXECUTOR_QUEUE_CAPACITY = 4096;
+
+/**
+ * @brief Fixed pool of threads executing the Nodes of the TrafficManager.
+ *
+ * A Node has no thread of its own: when it gets work (a task, a predicate
+ * request, an expired poll timer) it is queued once on its worker, which
+ * runs Node::execute() until the Node has nothing left to do. A Node always
+ * runs on the same worker, chosen from the egress port it feeds (see
+ * get_worker()), so the executions of a Node are serialized and the nodes
+ * of a port hand their packets over without leaving the core of the worker.
+ * The number of nodes is not limited by the number of threads.
+ *
+ * In virtual time (see TMSimulator) the executor has a single worker and no
+ * thread: the nodes run in run_pending(), on the calling thread, in the
+ * order they were scheduled, and the poll timers expire in the time of a
+ * VirtualClock. The executions are then the same from one run to the other.
+ */
+class NodeExecutor {
+ public:
+  explicit NodeExecutor(size_t nb_workers = NODE_EXECUTOR_DEFAULT_WORKERS);
+  // Virtual time, @p clock must outlive the executor
+  explicit NodeExecutor(const VirtualClock &clock);
+  ~NodeExecutor();
+
+  NodeExecutor(const NodeExecutor &) = delete;
+  NodeExecutor &operator=(const NodeExecutor &) = delete;
+
+  // Executor of the nodes without TrafficManager, never destroyed
+  static NodeExecutor *get_default();
+
+  size_t get_nb_workers() const { return workers.size(); }
+  bool is_virtual() const { return clock != nullptr; }
+  // Time of the nodes in ns: the VirtualClock in virtual time, the steady
+  // clock otherwise
+  uint64_t now_ns() const;
+  // Worker of a node feeding egress port @p port (-1 if unknown): one worker
+  // per port modulo the number of workers, by node id without port
+  size_t get_worker(int port, int node_id) const;
+
+  // Queue @p node on its worker, unless it already is or is stopped. Safe
+  // from any thread
+  void schedule(Node *node);
+  // Schedule @p node again after @p delay, from its own execution only. At
+  // most one timer per node
+  void schedule_after(Node *node, std::chrono::nanoseconds delay);
+  // No execution of @p node is queued, running or pending on a timer when
+  // this returns, and none ever will be
+  void stop(Node *node);
+
+  // Virtual time only: execute the nodes whose timer expired, then the
+  // queued nodes, until none is left. Returns the number of executions
+  size_t run_pending();
+  // Virtual time only: expiry of the earliest poll timer, false if none
+  bool get_next_timer(uint64_t *time_ns) const;
+
+ private:
+  struct Worker;
+
+  void run_worker(Worker *worker);
+  void execute(Node *node);
+  void fire_timer(Node *node);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> running{true};
+  const VirtualClock *clock{nullptr};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_NODE_EXECUTOR_H_
@@ -0,0 +1,76 @@
+#ifndef BM_BM_SIM_PACKET_STORE_H_
+#define BM_BM_SIM_PACKET_STORE_H_
+
+#include <bm/bm_sim/packet.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>  // std::unique_ptr
+#include <mutex>
+#include <vector>
+
+namespace bm {
+
+//! Slot index in the low 32 bits, generation of the slot in the high ones
+using PacketHandle = uint64_t;
+//! Never returned by PacketStore::insert()
+constexpr PacketHandle INVALID_PACKET_HANDLE = 0;
+
+/**
+ * @brief Slot map of the packets held by the TM while their CalendarItem goes
+ * through the hierarchy.
+ *
+ * insert() files a packet in a free slot and returns a handle to it, carried
+ * by the CalendarItem of the packet; take() removes exactly that packet in
+ * O(1), whichever order the scheduler picks the packets in. A handle becomes
+ * stale once its packet is taken: the slot generation is bumped on every
+ * insertion, so a reused slot is never mistaken for an old packet.
+ *
+ * The store has a fixed capacity, insert() blocks while it is full. All the
+ * methods are thread-safe.
+ */
+class PacketStore {
+ public:
+  explicit PacketStore(size_t capacity);
+
+  /* Delete copy/move operators */
+  PacketStore(const PacketStore &) = delete;
+  PacketStore &operator=(const PacketStore &) = delete;
+  PacketStore(PacketStore &&) = delete;
+  PacketStore &operator=(PacketStore &&) = delete;
+
+  //! Waits for a free slot if the store is full
+  PacketHandle insert(std::unique_ptr<Packet> &&packet);
+  //! Same for the first of @p nb_packets packets, as many as there are free
+  //! slots, under a single lock. Waits for a free slot if the store is full,
+  //! returns the number of packets filed (at least 1)
+  size_t insert_batch(std::unique_ptr<Packet> *packets, size_t nb_packets,
+                      PacketHandle *handles);
+  //! Remove the packet of @p handle, nullptr if the handle is stale
+  std::unique_ptr<Packet> take(PacketHandle handle);
+  //! The packet stays in the store, nullptr if the handle is stale
+  Packet *get(PacketHandle handle) const;
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  size_t get_capacity() const { return slots.size(); }
+
+ private:
+  struct Slot {
+    std::unique_ptr<Packet> packet{nullptr};
+    uint32_t generation{0};
+  };
+
+  // Caller must hold the mutex
+  const Slot *find(PacketHandle handle) const;
+
+  mutable std::mutex mutex;
+  std::condition_variable not_full;
+  std::vector<Slot> slots;
+  // Reused last in, first out, the hot slots stay in cache
+  std::vector<uint32_t> free_slots;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_PACKET_STORE_H_
@@ -30,6 +30,8 @@
 #ifndef BM_BM_SIM_QUEUEING_H_
 #define BM_BM_SIM_QUEUEING_H_
 
+#include <bm/bm_sim/token_bucket.h>
+
 #include <algorithm>  // for std::max
 #include <chrono>
 #include <condition_variable>
@@ -361,6 +363,16 @@ class QueueingLogicRL {
     return q_info.size;
   }
 
+  //! Get the number of elements logical queue with id \p queue_id can still
+  //! accept before push_front() returns `0`.
+  size_t free_slots(size_t queue_id) const {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end()) return capacity;
+    auto &q_info = it->second;
+    return (q_info.size >= q_info.capacity) ? 0 : q_info.capacity - q_info.size;
+  }
+
   //! Set the capacity of the logical queue with id \p queue_id to \p c
   //! elements.
   void set_capacity(size_t queue_id, size_t c) {
@@ -503,7 +515,8 @@ class QueueingLogicRL {
 //! queues for each logical queue. Priority queues are numbered from `0` to
 //! `nb_priorities-1` (see QueueingLogicPriRL::QueueingLogicPriRL()). Priority
 //! `0` is the lowest priority queue. Each priority queue can have its own rate
-//! and its own capacity. Queues will be served in order of priority, until
+//! (in elements and / or in bits per second, see set_rate_bps()) and its own
+//! capacity. Queues will be served in order of priority, until
 //! their respective maximum rate is reached. If no maximum rate is set, queues
 //! with a high priority can starve lower-priority queues. For example, if
 //! the queue with priority `nb_priorities - 1` always contains at least one
@@ -538,14 +551,17 @@ class QueueingLogicPriRL {
   //! the queue and the function will return `1`. If \p queue_id or \p priority
   //! are incorrect, an exception of type std::out_of_range will be thrown (same
   //! if the FMap object provided to the constructor does not behave correctly).
-  int push_front(size_t queue_id, size_t priority, const T &item) {
+  //! \p bytes is the size of the element for the rate set with set_rate_bps(),
+  //! elements without a size do not consume any of it.
+  int push_front(size_t queue_id, size_t priority, const T &item,
+                 size_t bytes = 0) {
     size_t worker_id = map_to_worker(queue_id);
     LockType lock(mutex);
     auto &q_info = get_queue(queue_id);
     auto &w_info = workers_info.at(worker_id);
     auto &q_info_pri = q_info.at(priority);
     if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
+    q_info_pri.last_sent = get_next_tp(&q_info_pri, bytes);
     w_info.queues[priority].emplace(item, queue_id, q_info_pri.last_sent,
                                     w_info.wrapping_counter++);
     q_info_pri.size++;
@@ -559,16 +575,18 @@ class QueueingLogicPriRL {
     return push_front(queue_id, 0, item);
   }
 
-  //! Same as push_front(size_t queue_id, size_t priority, const T &item), but
-  //! \p item is moved instead of copied.
-  int push_front(size_t queue_id, size_t priority, T &&item) {
+  //! Same as
+  //! push_front(size_t queue_id, size_t priority, const T &item, size_t bytes),
+  //! but \p item is moved instead of copied.
+  int push_front(size_t queue_id, size_t priority, T &&item,
+                 size_t bytes = 0) {
     size_t worker_id = map_to_worker(queue_id);
     LockType lock(mutex);
     auto &q_info = get_queue(queue_id);
     auto &w_info = workers_info.at(worker_id);
     auto &q_info_pri = q_info.at(priority);
     if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
+    q_info_pri.last_sent = get_next_tp(&q_info_pri, bytes);
     w_info.queues[priority].emplace(std::move(item), queue_id,
                                     q_info_pri.last_sent,
                                     w_info.wrapping_counter++);
@@ -661,6 +679,17 @@ class QueueingLogicPriRL {
     return q_info_pri.size;
   }
 
+  //! Get the number of elements priority queue \p priority for logical queue
+  //! with id \p queue_id can still accept before push_front() returns `0`.
+  size_t free_slots(size_t queue_id, size_t priority) const {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end()) return capacity;
+    auto &q_info_pri = it->second.at(priority);
+    return (q_info_pri.size >= q_info_pri.capacity)
+        ? 0 : q_info_pri.capacity - q_info_pri.size;
+  }
+
   //! Set the capacity of all the priority queues for logical queue \p queue_id
   //! to \p c elements.
   void set_capacity(size_t queue_id, size_t c) {
@@ -707,6 +736,31 @@ class QueueingLogicPriRL {
     queue_rate_pps = pps;
   }
 
+  //! Set the maximum rate of all the priority queues for logical queue \p
+  //! queue_id to \p bps bits per second, counted on the sizes given to
+  //! push_front(): each element leaves once the bits of the previous ones are
+  //! sent at that rate, whatever their sizes. A rate of 0 removes the limit.
+  //! The limit adds up with the one of set_rate(), elements wait for both.
+  void set_rate_bps(size_t queue_id, uint64_t bps) {
+    LockType lock(mutex);
+    for_each_q(queue_id, SetRateBpsFn(bps));
+  }
+
+  //! Same as set_rate_bps(size_t queue_id, uint64_t bps) but only applies to
+  //! the given priority queue.
+  void set_rate_bps(size_t queue_id, size_t priority, uint64_t bps) {
+    LockType lock(mutex);
+    for_one_q(queue_id, priority, SetRateBpsFn(bps));
+  }
+
+  //! Set the rate in bits per second of all the priority queues of all
+  //! logical queues to \p bps.
+  void set_rate_bps_for_all(uint64_t bps) {
+    LockType lock(mutex);
+    for (auto &p : queues_info) for_each_q(p.first, SetRateBpsFn(bps));
+    queue_rate_bps = bps;
+  }
+
   //! Deleted copy constructor
   QueueingLogicPriRL(const QueueingLogicPriRL &) = delete;
   //! Deleted copy assignment operator
@@ -751,23 +805,29 @@ class QueueingLogicPriRL {
   using MyQ = std::priority_queue<QE, std::deque<QE>, QEComp>;
 
   struct QueueInfoPri {
-    QueueInfoPri(size_t capacity, uint64_t queue_rate_pps)
+    QueueInfoPri(size_t capacity, uint64_t queue_rate_pps,
+                 uint64_t queue_rate_bps)
         : capacity(capacity),
           queue_rate_pps(queue_rate_pps),
           pkt_delay_ticks(rate_to_ticks(queue_rate_pps)),
-          last_sent(clock::now()) {}
+          last_sent(clock::now()) {
+      shaper.set_rate(queue_rate_bps);
+    }
 
     size_t size{0};
     size_t capacity;
     uint64_t queue_rate_pps;
     ticks pkt_delay_ticks;
     clock::time_point last_sent;
+    TokenBucket shaper{};
   };
 
   struct QueueInfo : public std::vector<QueueInfoPri> {
-    QueueInfo(size_t capacity, uint64_t queue_rate_pps, size_t nb_priorities)
-        : std::vector<QueueInfoPri>(nb_priorities,
-                                    QueueInfoPri(capacity, queue_rate_pps)) {}
+    QueueInfo(size_t capacity, uint64_t queue_rate_pps,
+              uint64_t queue_rate_bps, size_t nb_priorities)
+        : std::vector<QueueInfoPri>(
+              nb_priorities,
+              QueueInfoPri(capacity, queue_rate_pps, queue_rate_bps)) {}
 
     size_t size{0};
   };
@@ -783,7 +843,8 @@ class QueueingLogicPriRL {
     auto it = queues_info.find(queue_id);
     if (it != queues_info.end()) return it->second;
     auto p = queues_info.emplace(
-        queue_id, QueueInfo(capacity, queue_rate_pps, nb_priorities));
+        queue_id,
+        QueueInfo(capacity, queue_rate_pps, queue_rate_bps, nb_priorities));
     return p.first->second;
   }
 
@@ -795,9 +856,18 @@ class QueueingLogicPriRL {
     return queues_info.at(queue_id);
   }
 
-  clock::time_point get_next_tp(const QueueInfoPri &q_info_pri) {
-    return std::max(clock::now(),
-                    q_info_pri.last_sent + q_info_pri.pkt_delay_ticks);
+  // Departure of an element of \p bytes pushed now, which consumes the byte
+  // rate of the queue
+  clock::time_point get_next_tp(QueueInfoPri *q_info_pri, size_t bytes) {
+    auto next = std::max(clock::now(),
+                         q_info_pri->last_sent + q_info_pri->pkt_delay_ticks);
+    TokenBucket &shaper = q_info_pri->shaper;
+    if (!shaper.is_limited()) return next;
+    using std::chrono::duration_cast;
+    uint64_t next_ns = shaper.conform_time(
+        duration_cast<ticks>(next.time_since_epoch()).count());
+    shaper.consume(next_ns, bytes);
+    return clock::time_point(duration_cast<clock::duration>(ticks(next_ns)));
   }
 
   template <typename Function>
@@ -841,10 +911,21 @@ class QueueingLogicPriRL {
     ticks pkt_delay_ticks;
   };
 
+  struct SetRateBpsFn {
+    explicit SetRateBpsFn(uint64_t bps) : bps(bps) {}
+
+    void operator()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
+      info.shaper.set_rate(bps);
+    }
+
+    uint64_t bps;
+  };
+
   mutable MutexType mutex;
   size_t nb_workers;
   size_t capacity;             // default capacity
   uint64_t queue_rate_pps{0};  // default rate
+  uint64_t queue_rate_bps{0};  // default rate in bits per second
   std::unordered_map<size_t, QueueInfo> queues_info{};
   std::vector<WorkerInfo> workers_info{};
   std::vector<MyQ> queues{};
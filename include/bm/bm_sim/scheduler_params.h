@@ -0,0 +1,97 @@
+#ifndef BM_BM_SIM_SCHEDULER_PARAMS_H_
+#define BM_BM_SIM_SCHEDULER_PARAMS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>  // std::pair
+#include <vector>
+
+namespace bm {
+
+/**
+ * @brief Scheduler parameters of a Node (weights, quanta, thresholds...),
+ * updated by the control plane while the scheduler keeps running.
+ *
+ * The parameters are double-buffered: the scheduler reads the front buffer,
+ * an update copies it to the back buffer, applies the new values there and
+ * publishes the result by bumping the version. A reader pins the front buffer
+ * for the duration of a scheduler hook (see Pin), so all the parameters it
+ * reads come from the same version. Readers never block and take no lock;
+ * a writer waits for the readers of the back buffer of the previous version,
+ * and writers are serialized among themselves.
+ */
+class SchedulerParams {
+ public:
+  static constexpr size_t MAX_PARAMS = 32;
+  static constexpr size_t MAX_VALUES = 16;
+
+  //! One version of all the parameters
+  struct Snapshot {
+    uint64_t values[MAX_PARAMS][MAX_VALUES];
+    //! Number of values of each parameter, 0 if not set
+    size_t sizes[MAX_PARAMS];
+  };
+
+  //! New values of some parameters, published together
+  using Updates = std::vector<std::pair<size_t, std::vector<uint64_t>>>;
+
+  /**
+   * @brief Front buffer pinned for the lifetime of the object, not
+   * thread-safe itself.
+   */
+  class Pin {
+   public:
+    explicit Pin(const SchedulerParams &params);
+    ~Pin();
+
+    Pin(const Pin &) = delete;
+    Pin &operator=(const Pin &) = delete;
+
+    const Snapshot *operator->() const { return snapshot; }
+    const Snapshot &operator*() const { return *snapshot; }
+    uint64_t get_version() const { return version; }
+
+   private:
+    const SchedulerParams &params;
+    const Snapshot *snapshot;
+    uint64_t version;
+  };
+
+  SchedulerParams();
+
+  SchedulerParams(const SchedulerParams &) = delete;
+  SchedulerParams &operator=(const SchedulerParams &) = delete;
+
+  //! Replace parameter @p param, false if @p param or the number of values is
+  //! out of bounds
+  bool set(size_t param, const std::vector<uint64_t> &values);
+  //! Publish all of @p updates in one version, none if one is out of bounds
+  bool set(const Updates &updates);
+  //! The parameters and numbers of values of @p updates are all in bounds
+  static bool in_bounds(const Updates &updates);
+  //! Remove all the parameters
+  void clear();
+
+  //! Bumped by each update, 0 until the first one
+  uint64_t get_version() const {
+    return version.load(std::memory_order_acquire);
+  }
+
+ private:
+  // Caller holds write_mutex, @p apply edits the back buffer
+  template <typename Fn>
+  void publish(Fn apply);
+
+  Snapshot buffers[2];
+  // The front buffer is buffers[version & 1]
+  std::atomic<uint64_t> version{0};
+  // Pins of each buffer
+  mutable std::atomic<uint32_t> readers[2];
+  std::mutex write_mutex;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_SCHEDULER_PARAMS_H_
@@ -2,6 +2,7 @@
 #define BM_BM_SIM_TASK_H_
 
 #include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/mpsc_ring.h>
 
 #include <memory>
 #include <vector>
@@ -12,24 +13,29 @@ namespace bm {
  * @brief An enum representing the type of task to be executed by the task
  * scheduler.
  */
-enum TaskType { Enqueue, Dequeue /*, Reenqueue, Drop, Transmit */ };
+enum TaskType {
+  Enqueue,
+  Dequeue,
+  Timeout /**< Periodic timeout of the Node, no calendar item */
+  /*, Reenqueue, Drop, Transmit */
+};
 
 /**
  * @brief A struct representing a task to be executed by the task scheduler.
  */
 struct Task {
   TaskType type; /**< The type of task to be executed. */
-  std::shared_ptr<bm::CalendarItem> cal_item; /**< A shared pointer to the
-                                      calendar item associated with the task. */
+  bm::CalendarItem *cal_item; /**< The calendar item associated with the task,
+                                 owned by the task until it is handed over. */
   int node_id;      /**< The ID of the leaf node associated with the task. */
   bool transmitted; /**< A boolean indicating whether the packet has been
                        transmitted. */
 
   // Default constructor, enqueue by default
   Task() : type(Enqueue), cal_item(nullptr), node_id(0) { transmitted = false; }
-  Task(TaskType type, std::shared_ptr<bm::CalendarItem> cal_item, int node_id)
+  Task(TaskType type, bm::CalendarItem *cal_item, int node_id)
       : type(type), cal_item(cal_item), node_id(node_id) {}
-  Task(TaskType type, std::shared_ptr<bm::CalendarItem> cal_item, int node_id,
+  Task(TaskType type, bm::CalendarItem *cal_item, int node_id,
        bool transmitted)
       : type(type),
         cal_item(cal_item),
@@ -39,7 +45,7 @@ struct Task {
   // Copy constructor
   Task(const Task &other)
       : type(other.type),
-        cal_item(other.cal_item),  // Copy the shared_ptr
+        cal_item(other.cal_item),
         node_id(other.node_id),
         transmitted(other.transmitted) {}
 
@@ -51,7 +57,6 @@ struct Task {
       node_id = other.node_id;
       transmitted = other.transmitted;
 
-      // Copy the shared_ptr
       cal_item = other.cal_item;
     }
     return *this;
@@ -60,10 +65,10 @@ struct Task {
   // Move constructor
   Task(Task &&other) noexcept
       : type(other.type),
-        cal_item(other.cal_item),  // Copy the shared_ptr
+        cal_item(other.cal_item),
         node_id(other.node_id),
         transmitted(other.transmitted) {
-    // Set the source's cal_item to nullptr to avoid double deletion
+    // Only one task holds the item, see CalendarItemPool
     other.cal_item = nullptr;
   }
 
@@ -75,17 +80,26 @@ struct Task {
       node_id = std::move(other.node_id);
       transmitted = std::move(other.transmitted);
 
-      // Copy the shared_ptr
       cal_item = other.cal_item;
 
-      // Set the source's cal_item to nullptr to avoid double deletion
+      // Only one task holds the item, see CalendarItemPool
       other.cal_item = nullptr;
     }
     return *this;
   }
 };
 
-using TaskQueue = std::vector<Task>;
+/**
+ * @brief Bounded lock-free task ring, fed by any number of producers (TM
+ * ingress, nodes) and drained in batches by a single consumer thread.
+ */
+using TaskQueue = MPSCRing<Task>;
+
+/** Capacity of a TaskQueue (rounded up to a power of 2) */
+constexpr size_t TASK_QUEUE_CAPACITY = 1024;
+
+/** Maximum number of tasks drained from a TaskQueue at once */
+constexpr size_t TASK_BATCH_SIZE = 32;
 
 }  // namespace bm
 
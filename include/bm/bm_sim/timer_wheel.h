@@ -0,0 +1,87 @@
+#ifndef BM_BM_SIM_TIMER_WHEEL_H_
+#define BM_BM_SIM_TIMER_WHEEL_H_
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace bm {
+
+/**
+ * @brief Hierarchical timer wheel of periodic timers, in ticks.
+ *
+ * Level l has TIMER_WHEEL_SLOTS slots of TIMER_WHEEL_SLOTS^l ticks each. A
+ * timer is filed in the lowest level that covers its expiry, and cascades one
+ * level down each time the level below wraps around, so advancing the wheel
+ * costs O(1) per tick plus the timers that expire, whatever the number of
+ * timers. Timers farther than the whole wheel wait in the top level.
+ *
+ * Callbacks run on the thread calling advance(), with the wheel locked: they
+ * must be short (e.g. push a task) and must not call back into the wheel.
+ * Once remove() returns, the callback of the timer is not running and will
+ * never run again.
+ */
+class TimerWheel {
+ public:
+  using Callback = std::function<void()>;
+  //! Slot index in the low 32 bits, generation of the slot in the high ones
+  using TimerId = uint64_t;
+
+  static constexpr size_t TIMER_WHEEL_BITS = 6;
+  static constexpr size_t TIMER_WHEEL_SLOTS = 1u << TIMER_WHEEL_BITS;
+  static constexpr size_t TIMER_WHEEL_LEVELS = 4;
+
+  TimerWheel() = default;
+
+  /* Delete copy/move operators */
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+  TimerWheel(TimerWheel &&) = delete;
+  TimerWheel &operator=(TimerWheel &&) = delete;
+
+  //! Fire @p callback every @p interval ticks (at least 1), starting
+  //! @p interval ticks from now
+  TimerId add(uint64_t interval, Callback callback);
+  //! Returns false if @p id is not an active timer
+  bool remove(TimerId id);
+
+  //! Move the time forward by @p nb_ticks, firing the expired timers in order
+  void advance(uint64_t nb_ticks);
+
+  uint64_t get_now() const;
+  size_t size() const;
+
+ private:
+  struct Timer {
+    uint64_t interval{0};
+    uint64_t expiry{0};
+    Callback callback{};
+    uint32_t generation{0};
+    bool active{false};
+  };
+
+  // Timers are never unlinked from the slots on remove(), stale entries are
+  // recognized by their generation
+  struct Entry {
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  void file(uint32_t index);
+  void tick(std::vector<uint32_t> *expired);
+
+  mutable std::mutex mutex;
+  uint64_t now{0};
+  std::vector<Timer> timers{};
+  std::vector<uint32_t> free_indexes{};
+  size_t nb_active{0};
+  std::array<std::array<std::vector<Entry>, TIMER_WHEEL_SLOTS>,
+             TIMER_WHEEL_LEVELS>
+      levels{};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_TIMER_WHEEL_H_
@@ -0,0 +1,199 @@
+#ifndef BM_BM_SIM_TM_ADAPTER_H_
+#define BM_BM_SIM_TM_ADAPTER_H_
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/queue.h>
+#include <bm/bm_sim/queueing.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bm {
+
+class ActionFn;
+class Node;
+class P4Objects;
+
+/**
+ * @brief Egress side of the target a TrafficManager runs in: where the
+ * packets released by the roots of the hierarchy go, usually the egress
+ * buffers in front of the egress pipeline. Called concurrently by the dequeue
+ * workers of the TM, one worker per egress shard.
+ *
+ * A root whose port has no free slot waits for the sink: the target calls
+ * slot_freed() when it takes a packet out of its egress buffer, which wakes
+ * up the roots of the port held back by the TM (see
+ * TrafficManager::acquire_tx_credit()).
+ */
+class TMEgressSink {
+ public:
+  virtual ~TMEgressSink() = default;
+
+  //! Packets priority queue @p priority of @p egress_port can still take, the
+  //! transmit credits of the roots of the port, see
+  //! TrafficManager::acquire_tx_credit()
+  virtual size_t get_free_slots(uint32_t egress_port, size_t priority) = 0;
+  //! Hand a packet of @p bytes scheduled by a root to priority queue
+  //! @p priority of @p egress_port, false if it was dropped. The priority is
+  //! the one the target enqueued the packet with, see TrafficManager::enqueue()
+  virtual bool transmit(uint32_t egress_port, size_t priority,
+                        std::unique_ptr<Packet> &&packet, size_t bytes) = 0;
+
+  //! A slot of @p egress_port was freed, wakes up the roots waiting for one.
+  //! Safe from any thread, a single atomic load when no root waits
+  void slot_freed(uint32_t egress_port);
+  //! Same for an egress buffer shared by all the ports
+  void slot_freed();
+
+  // Used by the TM: @p root is woken up by the next slot_freed() of
+  // @p egress_port, then forgotten
+  void wait_for_slot(uint32_t egress_port, Node *root);
+  // @p root is being destroyed, it is never woken up once this returns
+  void cancel_wait(Node *root);
+
+ private:
+  void wake(bool all_ports, uint32_t egress_port);
+
+  std::mutex waiters_mutex;
+  std::vector<std::pair<uint32_t, Node *>> waiters;
+  std::atomic<size_t> nb_waiters{0};
+};
+
+/**
+ * @brief Egress sink of a QueueingLogicPriRL: the packets go to the priority
+ * queue the target enqueued them with, in the logical queue of their port,
+ * where the byte rate of the queue applies. The priority must be lower than
+ * the number of priorities of the queues.
+ */
+template <typename FMap>
+class PriQueueingEgressSink : public TMEgressSink {
+ public:
+  using Queues = QueueingLogicPriRL<std::unique_ptr<Packet>, FMap>;
+
+  //! @p queues must outlive the sink
+  explicit PriQueueingEgressSink(Queues *queues) : queues(queues) {}
+
+  size_t get_free_slots(uint32_t egress_port, size_t priority) override {
+    return queues->free_slots(egress_port, priority);
+  }
+
+  bool transmit(uint32_t egress_port, size_t priority,
+                std::unique_ptr<Packet> &&packet, size_t bytes) override {
+    return queues->push_front(egress_port, priority, std::move(packet),
+                              bytes) != 0;
+  }
+
+ private:
+  Queues *queues;
+};
+
+/**
+ * @brief Egress sink of a QueueingLogicRL, one logical queue per port. The
+ * priorities of the packets are ignored.
+ */
+template <typename FMap>
+class QueueingEgressSink : public TMEgressSink {
+ public:
+  using Queues = QueueingLogicRL<std::unique_ptr<Packet>, FMap>;
+
+  //! @p queues must outlive the sink
+  explicit QueueingEgressSink(Queues *queues) : queues(queues) {}
+
+  size_t get_free_slots(uint32_t egress_port,
+                        size_t /* priority */) override {
+    return queues->free_slots(egress_port);
+  }
+
+  bool transmit(uint32_t egress_port, size_t /* priority */,
+                std::unique_ptr<Packet> &&packet,
+                size_t /* bytes */) override {
+    return queues->push_front(egress_port, std::move(packet)) != 0;
+  }
+
+ private:
+  Queues *queues;
+};
+
+/**
+ * @brief Egress sink of a blocking Queue shared by all the ports. A full queue
+ * holds the dequeue worker (or the enqueue() of a TM in pass-through) back
+ * until the target makes room, no packet is dropped.
+ */
+class BlockingQueueEgressSink : public TMEgressSink {
+ public:
+  using Packets = Queue<std::unique_ptr<Packet>>;
+
+  //! @p queue must outlive the sink, @p capacity is the capacity of @p queue
+  BlockingQueueEgressSink(Packets *queue, size_t capacity)
+      : queue(queue), capacity(capacity) {}
+
+  size_t get_free_slots(uint32_t /* egress_port */,
+                        size_t /* priority */) override {
+    const size_t size = queue->size();
+    return size < capacity ? capacity - size : 0;
+  }
+
+  bool transmit(uint32_t /* egress_port */, size_t /* priority */,
+                std::unique_ptr<Packet> &&packet,
+                size_t /* bytes */) override {
+    queue->push_front(std::move(packet));
+    return true;
+  }
+
+ private:
+  Packets *queue;
+  size_t capacity;
+};
+
+/**
+ * @brief Where the TrafficManager finds the P4 actions implementing the hooks
+ * of the schedulers, see TrafficManager::bind_program().
+ */
+class TMActionSource {
+ public:
+  virtual ~TMActionSource() = default;
+
+  //! Action implementing @p name ("<scheduler>_<hook>", e.g.
+  //! "SP_calculate_rank"), nullptr if the program has none
+  virtual ActionFn *get_action(const std::string &name) const = 0;
+};
+
+/**
+ * @brief Actions of a P4 program named "<control>.<name>", looked up in each
+ * of the given controls in turn: the controls the target lets the program
+ * define its scheduler actions in ("MyIngress" for simple_switch).
+ */
+class P4ActionSource : public TMActionSource {
+ public:
+  //! @p objects must outlive the source
+  P4ActionSource(const P4Objects *objects, std::vector<std::string> controls);
+
+  ActionFn *get_action(const std::string &name) const override;
+
+ private:
+  const P4Objects *objects;
+  std::vector<std::string> controls;
+};
+
+/**
+ * @brief What a TrafficManager needs from its target at creation time. The
+ * actions come later, with the P4 program, see TrafficManager::bind_program().
+ */
+struct TMAdapter {
+  //! Egress side of the target, must outlive the TM
+  TMEgressSink *egress_sink{nullptr};
+  //! Fields of the target the scheduler-visible fields are read from, the
+  //! "fields" of a tmconfig override them
+  CalendarItemFieldMap fields{};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_TM_ADAPTER_H_
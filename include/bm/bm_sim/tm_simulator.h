@@ -0,0 +1,181 @@
+#ifndef BM_BM_SIM_TM_SIMULATOR_H_
+#define BM_BM_SIM_TM_SIMULATOR_H_
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/headers.h>
+#include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/phv.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/tm_adapter.h>
+#include <bm/bm_sim/virtual_clock.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bm {
+
+class TrafficManager;
+
+// Virtual time a run waits for packets held in the TM once the input and the
+// egress ports are drained, e.g. by a scheduler that never releases them
+constexpr uint64_t TM_SIM_STALL_TIMEOUT_NS = 1000000000;
+
+/**
+ * @brief Arrival of a packet at the TM in a simulation, with the fields the
+ * schedulers see. See TMSimulator::read_csv() and TMSimulator::read_pcap().
+ */
+struct SimPacket {
+  uint64_t time_ns;    /**< Arrival, from the start of the simulation */
+  uint64_t packet_id;  /**< Id in the input, reported with the departure */
+  uint32_t egress_port;
+  uint32_t packet_size;
+  uint8_t priority;
+  uint8_t dscp;
+  uint8_t color;
+  uint16_t vlan_id;
+  uint16_t sport;
+  uint16_t dport;
+};
+
+/**
+ * @brief Egress port of a simulation, standing for the egress buffer of the
+ * switch: the packets released by the roots of the port are serialized on a
+ * link of rate_bps bits per second (0 for an infinitely fast link). The port
+ * takes capacity packets from the TM, including the one on the link, the
+ * roots keep the others in their calendars.
+ */
+struct SimPortConfig {
+  uint64_t rate_bps{10000000000};
+  size_t capacity{2};
+};
+
+struct SimStats {
+  uint64_t nb_arrivals;
+  uint64_t nb_departures;
+  uint64_t nb_drops;       /**< Not admitted or dropped by the TM */
+  uint64_t nb_left;        /**< Still in the TM when the run gave up */
+  uint64_t end_time_ns;    /**< Virtual time of the last event */
+  uint64_t nb_executions;  /**< Node executions */
+};
+
+/**
+ * @brief Discrete-event simulation of the TrafficManager in virtual time.
+ *
+ * The simulator owns a TrafficManager without any thread. Its event loop
+ * jumps from one event to the next: the arrival of a packet, the end of a
+ * transmission on an egress port, a poll timer of a node or a tick of the
+ * timer wheel of the periodic timeouts. At each event the nodes run on the
+ * calling thread until the TM is idle, in an order that only depends on the
+ * input. A run takes as long as the CPU needs, whatever the simulated time,
+ * and gives the same departures, at the same times, every time.
+ *
+ * The schedulers must be native ("impl": "native"), the P4 actions of a
+ * program are not loaded. The simulator is the egress sink of its TM.
+ */
+class TMSimulator : public TMEgressSink {
+ public:
+  //! Called for every packet leaving an egress port, in departure order
+  using DepartureFn =
+      std::function<void(const SimPacket &packet, uint64_t departure_ns)>;
+
+  TMSimulator();
+  ~TMSimulator() override;
+
+  /* Delete copy/move operators */
+  TMSimulator(const TMSimulator &) = delete;
+  TMSimulator &operator=(const TMSimulator &) = delete;
+  TMSimulator(TMSimulator &&) = delete;
+  TMSimulator &operator=(TMSimulator &&) = delete;
+
+  //! Apply a "tmconfig" message: hierarchy, fields and buffer. Must be
+  //! called before run(), false and @p error if it cannot be applied
+  bool configure(const std::string &config, std::string *error);
+  //! Ports without a configuration of their own
+  void set_default_port(const SimPortConfig &config);
+  void set_port(uint32_t egress_port, const SimPortConfig &config);
+
+  //! Run @p packets, sorted by arrival time, until every packet left the TM
+  //! (or gave up for TM_SIM_STALL_TIMEOUT_NS). Can only be called once
+  SimStats run(const std::vector<SimPacket> &packets,
+               const DepartureFn &on_departure);
+
+  TrafficManager *get_tm() const { return tm.get(); }
+  const VirtualClock &get_clock() const { return clock; }
+
+  //! Packets the port can take, see TrafficManager::acquire_tx_credit(). A
+  //! port has a single queue, the priorities are ignored
+  size_t get_free_slots(uint32_t egress_port, size_t priority) override;
+  //! Queue a packet released by a root on its link
+  bool transmit(uint32_t egress_port, size_t priority,
+                std::unique_ptr<Packet> &&packet, size_t bytes) override;
+
+  //! Append the packets of a CSV file with the columns of the packet logs,
+  //! Timestamp, PacketID, EgressPort, PacketSize, then optionally
+  //! Priority, DSCP, Color, VLANID, Sport and Dport. The timestamp is in ns,
+  //! or the HH:MM:SS.mmm.nnnnnn local time of the packet logs (a log crossing
+  //! midnight is not supported). Lines not starting with a digit are skipped
+  static bool read_csv(const std::string &path,
+                       std::vector<SimPacket> *packets, std::string *error);
+  //! Append the packets of a pcap file, all going to @p egress_port. The
+  //! fields are read from the headers: DSCP is the whole diffserv byte (as
+  //! the ipv4.diffserv field), Priority the PCP of the VLAN tag, Sport and
+  //! Dport the TCP or UDP ports
+  static bool read_pcap(const std::string &path, uint32_t egress_port,
+                        std::vector<SimPacket> *packets, std::string *error);
+  //! Sort by arrival time, keeping the order of simultaneous arrivals, and
+  //! make the simulation start with the first one
+  static void normalize(std::vector<SimPacket> *packets);
+
+ private:
+  struct Port {
+    SimPortConfig config;
+    // End of transmission and index of the packets taken by the port
+    std::deque<std::pair<uint64_t, uint64_t>> queue{};
+    uint64_t busy_until{0};
+    // Sub-ns part of the transmission times, so that they do not drift
+    uint64_t remainder{0};
+  };
+
+  Port &get_port(uint32_t egress_port);
+  void build_phv(const CalendarItemFieldMap &fields);
+  std::unique_ptr<Packet> make_packet(const SimPacket &packet,
+                                      uint64_t index);
+
+  VirtualClock clock;
+
+  // PHVs the TM reads the fields of the packets from: every field of the
+  // field map, 32-bit wide, in metadata headers
+  std::vector<std::unique_ptr<HeaderType>> header_types;
+  PHVFactory phv_factory;
+  std::unique_ptr<PHVSourceIface> phv_source;
+  struct FieldLocation {
+    header_id_t header_id{0};
+    int offset{0};
+    bool found{false};
+  };
+  std::array<FieldLocation, static_cast<size_t>(CalendarItemField::NbFields)>
+      field_locations{};
+
+  SimPortConfig default_port{};
+  // Ordered, the simultaneous departures are in port order
+  std::map<uint32_t, Port> ports;
+
+  const std::vector<SimPacket> *packets{nullptr};
+  bool configured{false};
+  bool ran{false};
+
+  // Destroyed first, its nodes may still transmit
+  std::unique_ptr<TrafficManager> tm;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_TM_SIMULATOR_H_
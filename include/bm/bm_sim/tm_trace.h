@@ -0,0 +1,137 @@
+#ifndef BM_BM_SIM_TM_TRACE_H_
+#define BM_BM_SIM_TM_TRACE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bm {
+
+class CalendarItem;
+
+// Records a thread can have pending before the writer drains them, a power
+// of two. Records pushed to a full ring are lost (and counted)
+constexpr size_t TM_TRACE_RING_SIZE = 16384;
+
+// "BMTMTRC" followed by the version, at the start of a trace file
+constexpr char TM_TRACE_MAGIC[8] = {'B', 'M', 'T', 'M', 'T', 'R', 'C', '1'};
+
+enum class TraceEvent : uint8_t {
+  Clock = 0,  /**< Pairs a timestamp with the wall-clock time, in packet_id */
+  Enqueue,    /**< Packet entering the calendar of a node */
+  Dequeue,    /**< Packet leaving a node, to its parent or the egress port */
+  Drop        /**< Packet dropped by the TM */
+};
+
+/**
+ * @brief One event of the trace, written as is to the file (native byte
+ * order). The timestamp is in ticks of TMTrace::now(), converted offline
+ * with the Clock records. See tools/tm_trace_to_csv.py.
+ */
+struct TraceRecord {
+  uint64_t timestamp;
+  uint64_t packet_id;
+  int32_t node_id;
+  int32_t rank_day;
+  int32_t rank_time;
+  uint32_t packet_size;
+  uint16_t egress_port;
+  uint16_t vlan_id;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t event;
+  uint8_t priority;
+  uint8_t dscp;
+  uint8_t color;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 48, "TraceRecord is a file format");
+
+/**
+ * @brief Binary trace of the TrafficManager scheduling events.
+ *
+ * Always compiled in and disabled by default: record() costs a relaxed load
+ * until start() is called. Each thread recording events gets its own
+ * single-producer ring, so recording takes no lock and shares no cache line
+ * with the other threads. A background writer drains the rings into the
+ * trace file every millisecond, with a Clock record every second to convert
+ * the timestamps offline. Nothing is formatted nor flushed on the packet
+ * path.
+ */
+class TMTrace {
+ public:
+  // Records of one thread, see tm_trace.cpp
+  struct Ring;
+
+  // The trace of the process, never destroyed (nodes may record events from
+  // static destructors). The file is closed at exit
+  static TMTrace *get();
+
+  /* Delete copy/move operators */
+  TMTrace(const TMTrace &) = delete;
+  TMTrace &operator=(const TMTrace &) = delete;
+  TMTrace(TMTrace &&) = delete;
+  TMTrace &operator=(TMTrace &&) = delete;
+
+  // Trace to @p path, replacing the current trace file if any. False if the
+  // file cannot be created
+  bool start(const std::string &path);
+  // Write the pending records and close the file
+  void stop();
+  bool is_enabled() const {
+    return enabled.load(std::memory_order_relaxed);
+  }
+
+  static void record(TraceEvent event, int node_id, const CalendarItem &item) {
+    TMTrace *trace = get();
+    if (trace->is_enabled()) trace->push(event, node_id, item);
+  }
+
+  // Timestamp of the records: the TSC on x86, steady_clock ns elsewhere
+  static uint64_t now();
+
+  // Since the last start()
+  uint64_t get_nb_records() const;
+  uint64_t get_nb_lost() const;
+
+ private:
+  TMTrace() = default;
+  ~TMTrace() = default;
+
+  void push(TraceEvent event, int node_id, const CalendarItem &item);
+  Ring *get_ring();
+  void run_writer();
+  void stop_writer();
+  // Write the records of all the rings, forget the rings of exited threads
+  void drain();
+  void write_clock();
+
+  std::atomic<bool> enabled{false};
+  // Serializes start() and stop()
+  std::mutex control_mutex;
+
+  // Rings of the threads, registered on their first record
+  mutable std::mutex rings_mutex;
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  std::FILE *file{nullptr};
+  std::vector<TraceRecord> write_buffer;
+  std::atomic<uint64_t> nb_records{0};
+
+  std::thread writer;
+  std::mutex writer_mutex;
+  std::condition_variable writer_cv;
+  bool writer_stop{false};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_TM_TRACE_H_
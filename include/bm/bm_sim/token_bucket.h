@@ -0,0 +1,68 @@
+#ifndef BM_BM_SIM_TOKEN_BUCKET_H_
+#define BM_BM_SIM_TOKEN_BUCKET_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bm {
+
+/**
+ * @brief Byte-rate shaper: a token bucket of burst_bytes filled at rate_bps
+ * bits per second, in its virtual scheduling form. The bucket keeps the time
+ * at which all the bytes sent so far are paid for; a packet may leave once
+ * less than burst_bytes are still owed, i.e. right away after an idle period
+ * and at the rate afterwards. With no burst, packets are paced one after the
+ * other, each taking the time of its bits at the rate.
+ *
+ * Times are in ns, on any clock the caller sticks to. The sub-ns part of the
+ * packet times is carried over, the rate holds exactly over any number of
+ * packets of any size. Not thread-safe.
+ */
+class TokenBucket {
+ public:
+  //! A rate of 0 disables the shaper, every packet conforms. The state is
+  //! reset, the next packet conforms
+  void set_rate(uint64_t rate_bps, uint64_t burst_bytes = 0) {
+    this->rate_bps = rate_bps;
+    this->burst_bytes = burst_bytes;
+    tolerance_ns = rate_bps == 0 ? 0 : burst_bytes * 8000000000 / rate_bps;
+    paid_until_ns = 0;
+    remainder = 0;
+  }
+
+  bool is_limited() const { return rate_bps != 0; }
+  uint64_t get_rate_bps() const { return rate_bps; }
+  uint64_t get_burst_bytes() const { return burst_bytes; }
+
+  //! Earliest time, not before @p now_ns, the next packet may leave
+  uint64_t conform_time(uint64_t now_ns) const {
+    if (paid_until_ns <= now_ns + tolerance_ns) return now_ns;
+    return paid_until_ns - tolerance_ns;
+  }
+
+  //! A packet of @p bytes leaves at @p now_ns, see conform_time()
+  void consume(uint64_t now_ns, size_t bytes) {
+    if (rate_bps == 0) return;
+    if (paid_until_ns < now_ns) {
+      // Idle, the bucket is full
+      paid_until_ns = now_ns;
+      remainder = 0;
+    }
+    // bits * 1e9 / rate, exactly
+    uint64_t scaled = static_cast<uint64_t>(bytes) * 8000000000 + remainder;
+    paid_until_ns += scaled / rate_bps;
+    remainder = scaled % rate_bps;
+  }
+
+ private:
+  uint64_t rate_bps{0};
+  uint64_t burst_bytes{0};
+  uint64_t tolerance_ns{0};
+  uint64_t paid_until_ns{0};
+  // In 1 / rate_bps ns
+  uint64_t remainder{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_TOKEN_BUCKET_H_
@@ -2,26 +2,52 @@
 #define BM_BM_SIM_TRAFFIC_MANAGER_H_
 
 #include <bm/bm_sim/actions.h>
+#include <bm/bm_sim/buffer_manager.h>
 #include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/calendar_item_pool.h>
 #include <bm/bm_sim/config_server.h>  // ConfigServer
+#include <bm/bm_sim/hierarchy.h>
 #include <bm/bm_sim/node.h>
+#include <bm/bm_sim/node_executor.h>
 #include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/packet_store.h>
+#include <bm/bm_sim/periodic_task.h>
+#include <bm/bm_sim/phv_source.h>
 #include <bm/bm_sim/queueing.h>
 #include <bm/bm_sim/task.h>
 #include <bm/bm_sim/thread_mapper.h>
+#include <bm/bm_sim/timer_wheel.h>
+#include <bm/bm_sim/tm_adapter.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 
 #define EGRESS_PORT_NUMBER 4
+// Threads executing the nodes, one per egress shard by default
+#define TM_NODE_WORKER_NUMBER EGRESS_PORT_NUMBER
+#define TM_PACKET_STORE_CAPACITY 1024
+// Egress ports with transmit credits and counters, packets to higher ports
+// are handed to the egress buffers without credit
+#define TM_MAX_EGRESS_PORTS 512
+#define TM_CONFIG_SERVER_PORT 41200
+// Period the drained hierarchies are freed at while no configuration message
+// comes in
+#define TM_CONFIG_POLL_INTERVAL_MS 10
 
 namespace bm {
 
+class TMSimulator;
+
 // Analog to the EgressThreadMapper from simple_switch
 struct TrafficManagerEgressThreadMapper {
   explicit TrafficManagerEgressThreadMapper(size_t nb_threads)
@@ -34,65 +60,301 @@ struct TrafficManagerEgressThreadMapper {
   size_t nb_threads;
 };
 
-using Hierarchy = std::vector<std::unique_ptr<bm::Node>>;
+/**
+ * @brief Reconfiguration metrics of the TrafficManager.
+ * The stall is the time an enqueue() waited for the TM lock across a
+ * reconfiguration: the swap happened during the wait, or the previous
+ * hierarchy was still draining. The last stall is the longest wait since the
+ * last reconfiguration. The drain is the time the previous hierarchy needed
+ * to flush its in-flight calendar items in the background.
+ */
+struct ReconfigurationStats {
+  uint64_t nb_reconfigurations;
+  uint64_t last_stall_ns;
+  uint64_t max_stall_ns;
+  uint64_t last_drain_ns;
+};
+
+/**
+ * @brief Transmit counters of one egress port of the TrafficManager.
+ * A credit stall is a predicate winner a root kept in its calendar because
+ * the egress buffer of the port was full.
+ */
+struct TxPortStats {
+  uint64_t nb_transmitted;    /**< Packets pushed to the egress buffer */
+  uint64_t nb_drops;          /**< Egress buffer full despite the credit */
+  uint64_t nb_credit_stalls;  /**< Dequeues held back, no credit left */
+};
+
+/**
+ * @brief A packet of a batch handed to TrafficManager::enqueue_batch().
+ */
+struct TMPacket {
+  uint32_t egress_port;
+  std::unique_ptr<Packet> packet;
+  //! Priority queue of the egress buffer of the port, see TMEgressSink
+  size_t egress_priority{0};
+};
 
 class TrafficManager {
  public:
-  TrafficManager();
+  explicit TrafficManager(size_t nb_node_workers = TM_NODE_WORKER_NUMBER);
+  // TM of a target, see TMAdapter. A negative config_port disables the
+  // configuration server, the hierarchy is then only changed through
+  // reconfigure(). Until then, the packets go straight to the egress sink
+  // unless the program implements the default SP scheduler
+  explicit TrafficManager(const TMAdapter &adapter,
+                          int config_port = TM_CONFIG_SERVER_PORT,
+                          size_t nb_node_workers = TM_NODE_WORKER_NUMBER);
+  // Same with the egress buffers of simple_switch as egress sink
   TrafficManager(
-      bm::QueueingLogicPriRL<std::unique_ptr<Packet>, EgressThreadMapper> *);
+      bm::QueueingLogicPriRL<std::unique_ptr<Packet>, EgressThreadMapper> *,
+      int config_port = TM_CONFIG_SERVER_PORT,
+      size_t nb_node_workers = TM_NODE_WORKER_NUMBER);
+  // Virtual time: no thread, the nodes, the timeouts and the egress ports
+  // are driven by the event loop of @p simulator, see TMSimulator
+  explicit TrafficManager(TMSimulator *simulator);
   ~TrafficManager();
 
-  void dequeue_();
+  void dequeue_(size_t shard);
 
-  void enqueue(uint32_t egress_port, std::unique_ptr<Packet> &&packet);
+  void enqueue(uint32_t egress_port, std::unique_ptr<Packet> &&packet,
+               size_t egress_priority = 0);
+  // Same for @p nb_packets packets at once (multicast copies, ingress burst),
+  // the packets are moved from
+  void enqueue_batch(TMPacket *packets, size_t nb_packets);
   // std::unique_ptr<Packet> dequeue();
   void push_task(Task &&task);
+  // Discard a packet that left the hierarchy without being scheduled
+  void drop(bm::CalendarItem *cal_item);
+  // Taken by a root before it releases a predicate winner, false if the
+  // egress buffer of the port cannot take one more packet. @p root is then
+  // woken up when the target frees a slot of the port
+  bool acquire_tx_credit(uint32_t egress_port, size_t egress_priority,
+                         Node *root = nullptr);
+  // @p root is being destroyed, see TMEgressSink::cancel_wait()
+  void cancel_tx_wait(Node *root);
+  // The target took a packet of @p egress_port out of its egress buffer, or
+  // raised its capacity, see TMEgressSink::slot_freed()
+  void egress_slot_freed(uint32_t egress_port);
+  // Same for all the ports
+  void egress_slot_freed();
+  size_t get_shard(uint32_t egress_port) const {
+    return shard_mapper(egress_port);
+  }
+  // Threads the nodes of the TM run on
+  NodeExecutor *get_node_executor() const { return node_executor.get(); }
+  // Port of the configuration server, -1 without one
+  int get_config_port() const {
+    return config_server ? config_server->get_port() : -1;
+  }
   void reconfigure(Hierarchy new_hier);
+  // Update scheduler parameters of a node of the active hierarchy, without
+  // reconfiguration. False if there is no such node or a parameter is out of
+  // bounds
+  bool set_scheduler_params(int node_id,
+                            const SchedulerParams::Updates &updates);
+  // Parameters of several nodes, as a "tmparams" message: all of them are
+  // updated, or none if one would fail (@p error says why)
+  bool set_scheduler_params(const std::vector<NodeParamsUpdate> &updates,
+                            std::string *error);
+  // Output rate of a node of the active hierarchy, see Node::set_shaping().
+  // False if there is no such node
+  bool set_node_shaping(int node_id, uint64_t rate_bps,
+                        uint64_t burst_bytes = 0);
+  // Output rates of several nodes, as a "tmshaping" message: all of them
+  // are shaped, or none if one of the nodes does not exist
+  bool set_node_shaping(const std::vector<NodeShaping> &updates,
+                        std::string *error);
+  // Applied to the next packets, see apply_pending_config()
+  void set_calendar_fields(const CalendarItemFieldMap &fields);
+  // Capacity of the shared buffer and limits of the ports, applied to the
+  // next packets. The limits of the leaves come with the hierarchy
+  void set_buffer_config(const BufferConfig &config);
+  // Occupancy and drop counters of the buffer
+  const BufferManager &get_buffer_manager() const { return buffer_manager; }
+  void resolve_calendar_fields(const PHV &phv);
+  // PHVs of the P4 program, needed to run the periodic_timeout actions
+  void set_phv_factory(const PHVFactory *factory);
+  Packet *get_timer_packet() const { return timer_packet.get(); }
+  std::mutex *get_timer_packet_mutex() { return &timer_packet_mutex; }
+  ReconfigurationStats get_reconfiguration_stats() const;
+  // CalendarItems allocated on the heap because a shard pool was exhausted
+  uint64_t get_nb_calendar_item_overflows() const;
+  // Activity counters of the nodes of the active hierarchy, by node id
+  std::vector<std::pair<int, NodeStats>> get_node_stats();
+  TxPortStats get_port_stats(uint32_t egress_port) const;
 
   void run();
 
   void add_action(const std::string &type, ActionFn *action_fn);
-  void set_node_action(std::string &type, int node_id);
   void set_actions();
-  void set_actions(bool swapped);
+  // Load the scheduler actions of a P4 program from @p actions and the PHV
+  // layout of the program, once it is loaded by the target
+  void bind_program(const TMActionSource &actions, const PHVFactory &factory);
 
  private:
-  bm::QueueingLogic<std::unique_ptr<bm::Packet>,
-                    TrafficManagerEgressThreadMapper>
-      pkt_store;
-  bm::QueueingLogicPriRL<std::unique_ptr<Packet>, EgressThreadMapper>
-      *egress_buf;
-
-  Hierarchy nodes_hierarchy;
-  Hierarchy reconf_hierarchy;
-  bool swapped = false;
+  friend class TMSimulator;
+
+  // A hierarchy replaced by a reconfiguration, still draining its nodes
+  struct RetiredHierarchy {
+    std::unique_ptr<Hierarchy> hierarchy;
+    std::chrono::steady_clock::time_point retired_at;
+  };
+
+  // Nodes and queues common to all the modes
+  explicit TrafficManager(std::unique_ptr<NodeExecutor> executor);
+
+  // Packets of a batch admitted to a shard, not in its packet store yet
+  struct ShardBatch {
+    std::vector<std::unique_ptr<Packet>> packets;
+    std::vector<CalendarItem *> cal_items;
+    std::vector<Node *> leaves;
+    std::vector<PacketHandle> handles;
+    std::vector<Task> tasks;
+  };
+
+  // Hand the scheduled packets to @p sink and start the threads
+  void start(TMEgressSink *sink, int config_port);
+  // File the admitted packets of @p shard and push them to their leaves,
+  // enqueue_mutex held
+  void push_shard_batch(size_t shard);
+  // Take the fields and buffer configuration set since the last batch,
+  // enqueue_mutex held
+  void apply_pending_config();
+  // Apply it right away unless an enqueue is running, which applies it
+  void try_apply_pending_config();
+  // Wait of an enqueue() for the TM lock, counted in the reconfiguration
+  // stall if a swap happened meanwhile (@p epoch) or is still draining
+  void record_enqueue_wait(uint64_t epoch,
+                           std::chrono::steady_clock::time_point start);
+  void reap_retired_hierarchies();
+  // Hand a packet scheduled by a root to its egress port
+  void transmit(bm::CalendarItem *cal_item);
+  // Same for packets no hierarchy scheduled, see pass_through
+  void transmit_batch(TMPacket *packets, size_t nb_packets);
+  // Give back the buffer of a packet leaving the TM
+  void release_buffer(const CalendarItem &cal_item);
+  void timer_tick();
+  // Apply the runtime updates to the nodes of @p hierarchy, see
+  // node_updates. Caller holds node_updates_mutex
+  void apply_node_updates(const Hierarchy &hierarchy);
+  // Apply a message of the configuration server, false and @p error if it
+  // could not be applied
+  bool apply_config_message(const std::string &message, std::string *error);
+  void warn_missing_actions(Node &node);
+
+  // Egress buffers of the target, or egress ports of the simulator
+  TMEgressSink *egress_sink{nullptr};
+  std::unique_ptr<TMEgressSink> owned_egress_sink;
+  // Clock in virtual time
+  TMSimulator *simulator{nullptr};
+  // No hierarchy able to schedule yet: the default SP root has no actions
+  // in the program of the target. Cleared by reconfigure()
+  std::atomic<bool> pass_through{false};
+  // The actions of the P4 program are known, see bind_program()
+  std::atomic<bool> program_bound{false};
+
+  // Created first and destroyed last, after all the nodes
+  std::unique_ptr<NodeExecutor> node_executor;
+
+  // Transmit credits of an egress port: a root only releases a packet when
+  // the egress buffer has a free slot for it and for the packets already
+  // released, which keep the backlog in the calendars instead of dropping it
+  struct TxPort {
+    // Released by the roots, not pushed to the egress buffer yet
+    std::atomic<size_t> in_flight{0};
+    std::atomic<uint64_t> nb_transmitted{0};
+    std::atomic<uint64_t> nb_drops{0};
+    std::atomic<uint64_t> nb_credit_stalls{0};
+  };
+  std::array<TxPort, TM_MAX_EGRESS_PORTS> tx_ports;
+
+  // RCU-style hierarchy: enqueue() reads the active hierarchy under
+  // enqueue_mutex, reconfigure() publishes a new one with a single pointer
+  // swap. The previous hierarchy is retired and destroyed only once all its
+  // nodes are drained (the enqueue_mutex acquisition acts as grace period).
+  std::atomic<Hierarchy *> active_hierarchy{nullptr};
+  std::unique_ptr<Hierarchy> active_hierarchy_owner;
+  std::vector<RetiredHierarchy> retired_hierarchies;
+  std::mutex reconfiguration_mutex;
   std::unique_ptr<bm::ConfigServer> config_server;
-  std::thread config_server_thread;
   std::atomic_bool stop_server{false};
-  std::condition_variable enqueue_cv;
+  // Last configuration applied by the configuration server, the base of the
+  // incremental edits. Only used by the configuration thread
+  std::string active_config;
+  // Runtime updates of a node, applied again to the node built by a "tmedit"
+  struct NodeRuntimeUpdates {
+    SchedulerParams::Updates params;
+    bool shaped{false};
+    uint64_t rate_bps{0};
+    uint64_t burst_bytes{0};
+  };
+  // By node id, cleared by a new configuration. Guarded by
+  // node_updates_mutex, taken before reconfiguration_mutex
+  std::unordered_map<int, NodeRuntimeUpdates> node_updates;
+  std::mutex node_updates_mutex;
   std::mutex enqueue_mutex;
-  std::mutex pkt_store_mutex;
-  std::condition_variable pkt_store_empty_cv;
-  bool ready_to_enqueue{true};
+  // Scheduler-visible fields of the packets, guarded by enqueue_mutex
+  CalendarItemFieldMap calendar_fields;
+  // Admissions and configuration guarded by enqueue_mutex, the packets are
+  // released by the dequeue workers
+  BufferManager buffer_manager{TM_MAX_EGRESS_PORTS};
+  // Fields and buffer configuration waiting for enqueue_mutex. The
+  // configuration thread never takes it: an enqueue() waiting for room in a
+  // full packet store holds it for as long
+  struct PendingConfig {
+    std::unique_ptr<CalendarItemFieldMap> fields;
+    std::unique_ptr<BufferConfig> buffer;
+  };
+  PendingConfig pending_config;
+  std::atomic<bool> has_pending_config{false};
+  // Last fields set, the base of the next "fields" section of a tmconfig.
+  // Guarded by pending_config_mutex, taken after enqueue_mutex
+  CalendarItemFieldMap configured_fields;
+  std::mutex pending_config_mutex;
+
+  std::atomic<uint64_t> nb_reconfigurations{0};
+  // From a swap until the previous hierarchies are drained
+  std::atomic<bool> reconfiguring{false};
+  std::atomic<uint64_t> last_stall_ns{0};
+  std::atomic<uint64_t> max_stall_ns{0};
+  std::atomic<uint64_t> last_drain_ns{0};
 
   std::thread reconfiguration_thread;
 
-  std::mutex tm_mutex;
-  std::mutex tq_mutex;
-  std::condition_variable cv;
-  std::thread dequeue_thread;
+  // One dequeue worker and one task ring per egress shard, a root node only
+  // ever feeds the shard of its egress port
+  TrafficManagerEgressThreadMapper shard_mapper{EGRESS_PORT_NUMBER};
+  std::vector<std::unique_ptr<TaskQueue>> task_queues;
+  // Packets of each shard, the calendar items carry their handle so that the
+  // dequeue worker transmits exactly the packet the root scheduled
+  std::vector<std::unique_ptr<PacketStore>> packet_stores;
+  // Calendar items of the packets of each shard, acquired by enqueue() and
+  // released by the dequeue worker
+  std::vector<std::unique_ptr<CalendarItemPool>> calendar_item_pools;
+  // Guarded by enqueue_mutex, kept from one batch to the next so that
+  // enqueue_batch() does not allocate in steady state
+  std::vector<ShardBatch> shard_batches;
+  std::vector<std::thread> dequeue_threads;
   std::atomic<bool> stop_dequeue_thread{false};
 
-  std::unordered_map<std::string, ActionFnEntry *> actions_map;
+  // Fires the periodic_timeout hook of all the nodes, advanced by a single
+  // PeriodicTask every NODE_TIMER_TICK
+  TimerWheel timer_wheel;
+  std::chrono::steady_clock::time_point timer_start;
+  std::unique_ptr<PeriodicTask> timer_task;
+  // Packet the periodic_timeout actions run on, one action at a time under
+  // timer_packet_mutex
+  std::unique_ptr<PHVSourceIface> timer_phv_source;
+  std::unique_ptr<Packet> timer_packet;
+  std::mutex timer_packet_mutex;
+
+  // Scheduler P4 actions by name, each Node resolves its own hooks from it
   std::unordered_map<std::string, ActionFn *> actionsfn_map;
+  ActionMutexMap action_mutexes;
 
   int drank = 0;  // debug rank only
-
-  int pkt_in_store = 0;
-  bool has_packet = false;
-
-  TaskQueue task_queue;
 };
 
 }  // namespace bm
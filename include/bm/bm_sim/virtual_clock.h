@@ -0,0 +1,28 @@
+#ifndef BM_BM_SIM_VIRTUAL_CLOCK_H_
+#define BM_BM_SIM_VIRTUAL_CLOCK_H_
+
+#include <cstdint>
+
+namespace bm {
+
+/**
+ * @brief Simulated time of a TrafficManager running in virtual time, in ns
+ * since the start of the simulation. Only moved forward by the event loop of
+ * the TMSimulator, which is also the only thread reading it.
+ */
+class VirtualClock {
+ public:
+  uint64_t now() const { return now_ns; }
+
+  //! Time never goes back, earlier times are ignored
+  void advance_to(uint64_t time_ns) {
+    if (time_ns > now_ns) now_ns = time_ns;
+  }
+
+ private:
+  uint64_t now_ns{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_VIRTUAL_CLOCK_H_
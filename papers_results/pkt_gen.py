@@ -50,7 +50,7 @@ def main():
         # Send the packet
         sendp(packet, iface="s1-eth1", inter=0.001)
         if i == 19:
-            subprocess.run(["nc", "localhost", "41200"], stdin=open("conf_swap_node.json", "r"))
+            subprocess.run(["nc", "-N", "localhost", "41200"], stdin=open("conf_swap_node.json", "r"))
         # sendp(packet, iface="veth0", inter=0.001)
 
 if __name__ == "__main__":
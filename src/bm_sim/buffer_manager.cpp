@@ -0,0 +1,175 @@
+#include <bm/bm_sim/buffer_manager.h>
+
+bm::BufferManager::BufferManager(size_t nb_ports)
+    : nb_ports(nb_ports),
+      ports(new Account[nb_ports]),
+      nodes(new Account[BUFFER_MAX_NODES]) {}
+
+/**
+ * @brief Replace the capacity of the shared buffer and the limits of the
+ * ports. Must be serialized with check() and admit() by the caller.
+ */
+void bm::BufferManager::configure(const BufferConfig &new_config) {
+  config = new_config;
+}
+
+/**
+ * @brief Tell whether a packet can enter the buffer. The shared buffer is
+ * checked first, then the egress port and the leaf. Nothing is accounted,
+ * see admit().
+ *
+ * @param port Egress port of the packet.
+ * @param node_id Leaf the packet is classified to.
+ * @param node_limits Limits of the leaf.
+ * @param bytes Size of the packet.
+ */
+bm::AdmitVerdict bm::BufferManager::check(uint32_t port, int node_id,
+                                          const BufferLimits &node_limits,
+                                          size_t bytes) const {
+  const uint64_t shared_packets =
+      shared.packets.load(std::memory_order_relaxed);
+  const uint64_t shared_bytes = shared.bytes.load(std::memory_order_relaxed);
+  if ((config.max_packets > 0 && shared_packets + 1 > config.max_packets) ||
+      (config.max_bytes > 0 && shared_bytes + bytes > config.max_bytes)) {
+    return AdmitVerdict::DropShared;
+  }
+  const Account *port_acc = port_account(port);
+  if (port_acc != nullptr && exceeds(*port_acc, config.port, bytes))
+    return AdmitVerdict::DropPort;
+  const Account *node_acc = node_account(node_id);
+  if (node_acc != nullptr && exceeds(*node_acc, node_limits, bytes))
+    return AdmitVerdict::DropNode;
+  return AdmitVerdict::Admit;
+}
+
+// Static limits first, then the dynamic thresholds on the free shared buffer
+bool bm::BufferManager::exceeds(const Account &account,
+                                const BufferLimits &limits,
+                                size_t bytes) const {
+  const uint64_t packets = account.packets.load(std::memory_order_relaxed);
+  const uint64_t used_bytes = account.bytes.load(std::memory_order_relaxed);
+  if (limits.max_packets > 0 && packets + 1 > limits.max_packets) return true;
+  if (limits.max_bytes > 0 && used_bytes + bytes > limits.max_bytes)
+    return true;
+  if (limits.alpha <= 0.0) return false;
+  // The capacity may have been lowered below the occupancy
+  auto free_space = [](uint64_t capacity, uint64_t used) {
+    return used < capacity ? capacity - used : 0;
+  };
+  if (config.max_packets > 0) {
+    uint64_t free_packets = free_space(
+        config.max_packets, shared.packets.load(std::memory_order_relaxed));
+    if (packets >= limits.alpha * free_packets) return true;
+  }
+  if (config.max_bytes > 0) {
+    uint64_t free_bytes = free_space(
+        config.max_bytes, shared.bytes.load(std::memory_order_relaxed));
+    if (used_bytes >= limits.alpha * free_bytes) return true;
+  }
+  return false;
+}
+
+void bm::BufferManager::admit(uint32_t port, int node_id, size_t bytes) {
+  shared.add(bytes);
+  if (Account *port_acc = port_account(port)) port_acc->add(bytes);
+  if (Account *node_acc = node_account(node_id)) node_acc->add(bytes);
+  nb_verdicts[static_cast<size_t>(AdmitVerdict::Admit)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Give back the buffer of a packet leaving the TM, transmitted or
+ * dropped after its admission.
+ */
+void bm::BufferManager::release(uint32_t port, int node_id, size_t bytes) {
+  if (Account *node_acc = node_account(node_id)) node_acc->remove(bytes);
+  if (Account *port_acc = port_account(port)) port_acc->remove(bytes);
+  shared.remove(bytes);
+}
+
+void bm::BufferManager::count_drop(uint32_t port, int node_id,
+                                   AdmitVerdict verdict) {
+  shared.nb_drops.fetch_add(1, std::memory_order_relaxed);
+  if (Account *port_acc = port_account(port))
+    port_acc->nb_drops.fetch_add(1, std::memory_order_relaxed);
+  if (Account *node_acc = node_account(node_id))
+    node_acc->nb_drops.fetch_add(1, std::memory_order_relaxed);
+  nb_verdicts[static_cast<size_t>(verdict)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Occupancy of the leaf, the egress port and the shared buffer, as
+ * seen by the admit action of a scheduler. Levels without account are 0.
+ */
+bm::BufferOccupancies bm::BufferManager::get_occupancies(uint32_t port,
+                                                         int node_id) const {
+  auto occupancy = [](const Account *account) {
+    if (account == nullptr) return BufferOccupancy{0, 0};
+    return BufferOccupancy{account->packets.load(std::memory_order_relaxed),
+                           account->bytes.load(std::memory_order_relaxed)};
+  };
+  BufferOccupancies occupancies;
+  occupancies[static_cast<size_t>(BufferScope::Node)] =
+      occupancy(node_account(node_id));
+  occupancies[static_cast<size_t>(BufferScope::Port)] =
+      occupancy(port_account(port));
+  occupancies[static_cast<size_t>(BufferScope::Shared)] = occupancy(&shared);
+  return occupancies;
+}
+
+bm::BufferStats bm::BufferManager::get_port_stats(uint32_t port) const {
+  const Account *account = port_account(port);
+  return account == nullptr ? BufferStats{} : account->get_stats();
+}
+
+bm::BufferStats bm::BufferManager::get_node_stats(int node_id) const {
+  const Account *account = node_account(node_id);
+  return account == nullptr ? BufferStats{} : account->get_stats();
+}
+
+uint64_t bm::BufferManager::get_nb_drops(AdmitVerdict verdict) const {
+  if (verdict == AdmitVerdict::Admit || verdict >= AdmitVerdict::NbVerdicts)
+    return 0;
+  return nb_verdicts[static_cast<size_t>(verdict)].load(
+      std::memory_order_relaxed);
+}
+
+bm::BufferManager::Account *bm::BufferManager::port_account(
+    uint32_t port) const {
+  return port < nb_ports ? &ports[port] : nullptr;
+}
+
+bm::BufferManager::Account *bm::BufferManager::node_account(
+    int node_id) const {
+  if (node_id < 0 || static_cast<size_t>(node_id) >= BUFFER_MAX_NODES)
+    return nullptr;
+  return &nodes[node_id];
+}
+
+// Only the admitting thread adds, the peaks need no compare-and-swap
+void bm::BufferManager::Account::add(size_t nb_bytes) {
+  uint64_t new_packets =
+      packets.fetch_add(1, std::memory_order_relaxed) + 1;
+  uint64_t new_bytes =
+      bytes.fetch_add(nb_bytes, std::memory_order_relaxed) + nb_bytes;
+  if (new_packets > peak_packets.load(std::memory_order_relaxed))
+    peak_packets.store(new_packets, std::memory_order_relaxed);
+  if (new_bytes > peak_bytes.load(std::memory_order_relaxed))
+    peak_bytes.store(new_bytes, std::memory_order_relaxed);
+  nb_admitted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void bm::BufferManager::Account::remove(size_t nb_bytes) {
+  packets.fetch_sub(1, std::memory_order_relaxed);
+  bytes.fetch_sub(nb_bytes, std::memory_order_relaxed);
+}
+
+bm::BufferStats bm::BufferManager::Account::get_stats() const {
+  return {packets.load(std::memory_order_relaxed),
+          bytes.load(std::memory_order_relaxed),
+          peak_packets.load(std::memory_order_relaxed),
+          peak_bytes.load(std::memory_order_relaxed),
+          nb_admitted.load(std::memory_order_relaxed),
+          nb_drops.load(std::memory_order_relaxed)};
+}
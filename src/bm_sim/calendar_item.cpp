@@ -0,0 +1,134 @@
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/logger.h>
+
+namespace {
+
+constexpr size_t field_index(bm::CalendarItemField field) {
+  return static_cast<size_t>(field);
+}
+
+}  // namespace
+
+bm::CalendarItemFieldMap::CalendarItemFieldMap() {
+  set_field_name(CalendarItemField::EgressPort,
+                 "standard_metadata.egress_port");
+  set_field_name(CalendarItemField::PacketSize,
+                 "intrinsic_metadata.packet_length");
+  set_field_name(CalendarItemField::Priority, "intrinsic_metadata.priority");
+  set_field_name(CalendarItemField::Dscp, "ipv4.diffserv");
+  set_field_name(CalendarItemField::Color, "scalars.metadata.color");
+  set_field_name(CalendarItemField::VlanId, "vlan.vid");
+  set_field_name(CalendarItemField::Sport, "tcp.srcPort");
+  set_field_name(CalendarItemField::Dport, "tcp.dstPort");
+}
+
+bool bm::CalendarItemFieldMap::field_from_string(const std::string &name,
+                                                 CalendarItemField *field) {
+  static const std::pair<const char *, CalendarItemField> names[] = {
+      {"egress_port", CalendarItemField::EgressPort},
+      {"packet_size", CalendarItemField::PacketSize},
+      {"priority", CalendarItemField::Priority},
+      {"dscp", CalendarItemField::Dscp},
+      {"color", CalendarItemField::Color},
+      {"vlan_id", CalendarItemField::VlanId},
+      {"sport", CalendarItemField::Sport},
+      {"dport", CalendarItemField::Dport}};
+  for (const auto &entry : names) {
+    if (name == entry.first) {
+      *field = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+void bm::CalendarItemFieldMap::set_field_name(CalendarItemField field,
+                                              const std::string &name) {
+  bindings.at(field_index(field)) = Binding();
+  bindings.at(field_index(field)).name = name;
+  resolved = false;
+}
+
+const std::string &bm::CalendarItemFieldMap::get_field_name(
+    CalendarItemField field) const {
+  return bindings.at(field_index(field)).name;
+}
+
+/**
+ * @brief Resolve the field names to (header id, offset) pairs. Header ids and
+ * offsets only depend on the P4 program, any PHV of the program can be used.
+ *
+ * @param phv PHV giving the layout of the program
+ * @return the number of fields found
+ */
+size_t bm::CalendarItemFieldMap::resolve(const PHV &phv) {
+  size_t nb_found = 0;
+  for (auto &binding : bindings) {
+    binding.found = false;
+    if (binding.name.empty()) continue;
+    // "scalars.metadata.color" is field "metadata.color" of header "scalars"
+    auto dot = binding.name.find('.');
+    if (dot == std::string::npos) continue;
+    auto header_name = binding.name.substr(0, dot);
+    if (!phv.has_header(header_name)) {
+      BMLOG_DEBUG("TM field {} not in the P4 program", binding.name);
+      continue;
+    }
+    const Header &header = phv.get_header(header_name);
+    int offset =
+        header.get_header_type().get_field_offset(binding.name.substr(dot + 1));
+    if (offset < 0) {
+      BMLOG_DEBUG("TM field {} not in the P4 program", binding.name);
+      continue;
+    }
+    binding.header_id = header.get_id();
+    binding.offset = offset;
+    binding.found = true;
+    nb_found++;
+  }
+  resolved = true;
+  return nb_found;
+}
+
+/**
+ * @brief Fill the scheduler-visible fields of @p item from @p phv. Must only
+ * be called once resolved.
+ */
+void bm::CalendarItemFieldMap::extract(const PHV &phv,
+                                       CalendarItem *item) const {
+  for (size_t i = 0; i < bindings.size(); i++) {
+    const Binding &binding = bindings[i];
+    if (!binding.found) continue;
+    const Header &header = phv.get_header(binding.header_id);
+    if (!header.is_metadata() && !header.is_valid()) continue;
+    auto value = header.get_field(binding.offset).get_uint();
+    switch (static_cast<CalendarItemField>(i)) {
+      case CalendarItemField::EgressPort:
+        item->set_egress_port(value);
+        break;
+      case CalendarItemField::PacketSize:
+        item->set_packet_size(value);
+        break;
+      case CalendarItemField::Priority:
+        item->set_priority(value);
+        break;
+      case CalendarItemField::Dscp:
+        item->set_dscp(value);
+        break;
+      case CalendarItemField::Color:
+        item->set_color(value);
+        break;
+      case CalendarItemField::VlanId:
+        item->set_vlan_id(value);
+        break;
+      case CalendarItemField::Sport:
+        item->set_sport(value);
+        break;
+      case CalendarItemField::Dport:
+        item->set_dport(value);
+        break;
+      default:
+        break;
+    }
+  }
+}
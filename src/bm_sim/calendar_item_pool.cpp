@@ -0,0 +1,77 @@
+#include <bm/bm_sim/calendar_item_pool.h>
+
+namespace {
+
+size_t round_up_pow2(size_t n) {
+  size_t p = 2;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+}  // namespace
+
+bm::CalendarItemPool::CalendarItemPool(size_t capacity)
+    : capacity(capacity),
+      slab(new CalendarItem[capacity]),
+      released_items(capacity),
+      recycled_mask(round_up_pow2(capacity) - 1),
+      recycled_items(new CalendarItem *[recycled_mask + 1]) {
+  free_items.reserve(capacity);
+  for (size_t i = 0; i < capacity; i++) {
+    slab[i].pool = this;
+    free_items.push_back(&slab[i]);
+  }
+}
+
+/**
+ * @brief Take a free item from the slab and initialize it for @p pkt.
+ *
+ * @param pkt Packet described by the item, still owned by the caller.
+ * @param fields Where to read the scheduler-visible fields from.
+ */
+bm::CalendarItem *bm::CalendarItemPool::acquire(
+    bm::Packet *pkt, const CalendarItemFieldMap &fields) {
+  if (free_items.empty()) collect();
+  CalendarItem *item;
+  if (!free_items.empty()) {
+    item = free_items.back();
+    free_items.pop_back();
+  } else {
+    // Slab exhausted, more packets in flight than the pool was sized for
+    nb_overflows.fetch_add(1, std::memory_order_relaxed);
+    item = new CalendarItem();
+  }
+  item->reset(pkt, fields);
+  return item;
+}
+
+void bm::CalendarItemPool::collect() {
+  const size_t tail = recycled_tail.load(std::memory_order_acquire);
+  for (; recycled_head != tail; recycled_head++)
+    free_items.push_back(recycled_items[recycled_head & recycled_mask]);
+  CalendarItem *item;
+  while (released_items.pop_batch(&item, 1) == 1) free_items.push_back(item);
+}
+
+void bm::CalendarItemPool::release(CalendarItem *item) {
+  if (item->pool == nullptr) {
+    delete item;
+    return;
+  }
+  item->pool->released_items.push(std::move(item));
+}
+
+/**
+ * @brief Give @p item back without CAS. The ring cannot fill up: it holds
+ * at most the items of the slab which are not free.
+ */
+void bm::CalendarItemPool::recycle(CalendarItem *item) {
+  CalendarItemPool *pool = item->pool;
+  if (pool == nullptr) {
+    delete item;
+    return;
+  }
+  const size_t tail = pool->recycled_tail.load(std::memory_order_relaxed);
+  pool->recycled_items[tail & pool->recycled_mask] = item;
+  pool->recycled_tail.store(tail + 1, std::memory_order_release);
+}
@@ -1,122 +1,489 @@
 #include <bm/bm_sim/config_server.h>
 #include <bm/bm_sim/logger.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstring>    // std::strerror
+#include <exception>
 #include <iostream>
+#include <stdexcept>  // std::invalid_argument
+#include <vector>
 
 #include "jsoncpp/json.h"
 
-bm::ConfigServer::ConfigServer() {}
+/**
+ * @brief State of a client session, owned by the server thread.
+ */
+struct bm::ConfigServer::Session {
+  uint64_t id;
+  int fd;
+  // Received bytes, from the start of the message being received
+  std::string in{};
+  // Framing state of the bytes of `in` already scanned
+  size_t scanned{0};
+  int depth{0};
+  bool in_string{false};
+  bool escaped{false};
+  // Replies not sent yet
+  std::string out{};
+  // Framing error, sent after the replies of the messages before it
+  std::string error_reply{};
+  // Messages handed to the consumer and not answered yet
+  size_t nb_pending{0};
+  // The client closed its side (or broke the framing), nothing more is read
+  bool read_closed{false};
+  uint32_t events{0};
+};
 
-bm::ConfigServer::ConfigServer(int port) : port(port) {
-  ntw_socket = socket(AF_INET, SOCK_STREAM, 0);
-  if (ntw_socket == -1) {
-    BMLOG_ERROR("Failed to create socket");
-    exit(1);
-  }
-  // bind_and_listen(this->port);
+namespace {
+
+// epoll data of the two server descriptors, the sessions use their id
+constexpr uint64_t LISTEN_EVENT_ID = 0;
+constexpr uint64_t WAKE_EVENT_ID = UINT64_MAX;
+
+bool set_non_blocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
 }
 
-bm::ConfigServer::~ConfigServer() {
-  close(ntw_socket);
-  if (accept_and_read_thread.joinable()) {
-    accept_and_read_thread.join();
-  }
+bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
 }
 
-bool bm::ConfigServer::is_config_ready() const { return !config.empty(); }
+}  // namespace
 
-std::vector<std::unique_ptr<bm::Node>> bm::ConfigServer::get_hierarchy() {
-  return std::move(hierarchy);  // Moves ownership to caller
-}
+bm::ConfigServer::ConfigServer(int port) : port(port) {}
+
+bm::ConfigServer::~ConfigServer() { stop(); }
 
 /**
- * @brief Binds the server socket to the specified port and starts listening for
- * incoming connections.
+ * @brief Bind the server socket to the port and start serving the sessions
+ * in a background thread. The server does not take the process down on
+ * errors, the TrafficManager then runs without configuration service.
  *
- * @param port The port number to bind the server socket to.
+ * @return false if the socket cannot be set up.
  */
-void bm::ConfigServer::bind_and_listen() {
-  struct sockaddr_in server_address;
+bool bm::ConfigServer::start() {
+  listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_socket < 0) {
+    BMLOG_ERROR("[Configuration Server] Failed to create socket");
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in server_address {};
   server_address.sin_family = AF_INET;
   server_address.sin_port = htons(port);
   server_address.sin_addr.s_addr = INADDR_ANY;
-
-  if (bind(ntw_socket, (struct sockaddr *)&server_address,
-           sizeof(server_address)) < 0) {
-    BMLOG_ERROR("Failed to bind socket");
-    exit(1);
+  socklen_t address_len = sizeof(server_address);
+  if (bind(listen_socket, (struct sockaddr *)&server_address,
+           sizeof(server_address)) < 0 ||
+      listen(listen_socket, MAX_RECONFIGURATION_NUMBER) < 0 ||
+      !set_non_blocking(listen_socket) ||
+      getsockname(listen_socket, (struct sockaddr *)&server_address,
+                  &address_len) < 0) {
+    BMLOG_ERROR("[Configuration Server] Failed to listen on port {}: {}",
+                port, std::strerror(errno));
+    close(listen_socket);
+    listen_socket = -1;
+    return false;
   }
+  port = ntohs(server_address.sin_port);
 
-  if (listen(ntw_socket, MAX_RECONFIGURATION_NUMBER) < 0) {
-    BMLOG_ERROR("Failed to listen on socket");
-    exit(1);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event listen_event {};
+  listen_event.events = EPOLLIN;
+  listen_event.data.u64 = LISTEN_EVENT_ID;
+  struct epoll_event wake_event {};
+  wake_event.events = EPOLLIN;
+  wake_event.data.u64 = WAKE_EVENT_ID;
+  if (epoll_fd < 0 || event_fd < 0 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &listen_event) < 0 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &wake_event) < 0) {
+    BMLOG_ERROR("[Configuration Server] Failed to set up epoll: {}",
+                std::strerror(errno));
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (event_fd >= 0) close(event_fd);
+    close(listen_socket);
+    epoll_fd = event_fd = listen_socket = -1;
+    return false;
   }
 
   BMLOG_DEBUG("[Configuration Server] Listening on port {}", port);
   std::cout << "[Configuration Server] Listening on port " << port << std::endl;
-  start_accept_and_read_thread();
+  running = true;
+  server_thread = std::thread(&ConfigServer::serve, this);
+  return true;
+}
+
+void bm::ConfigServer::stop() {
+  {
+    // wait_message() checks running under the mutex
+    std::lock_guard<std::mutex> lock(messages_mutex);
+    running = false;
+  }
+  messages_cv.notify_all();
+  if (server_thread.joinable()) {
+    wake();
+    server_thread.join();
+  }
+  while (!sessions.empty()) close_session(sessions.begin()->second.get());
+  for (int *fd : {&listen_socket, &epoll_fd, &event_fd}) {
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+  }
 }
 
 /**
- * @brief Starts the thread to accept and read incoming connections.
+ * @brief Wait for the next message of any session. The messages of a session
+ * come in the order they were sent.
  *
- * Attempts to accept a connection on the network socket. Logs an error and
- * terminates the program if the connection fails.
- * Blocks until a connection is established.
+ * @return false if no message came within @p timeout, or if the server is
+ * stopped.
  */
-void bm::ConfigServer::start_accept_and_read_thread() {
-  accept_and_read_thread = std::thread(&ConfigServer::accept_and_read, this);
+bool bm::ConfigServer::wait_message(ConfigMessage *message,
+                                    std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(messages_mutex);
+  messages_cv.wait_for(lock, timeout,
+                       [this] { return !messages.empty() || !running; });
+  if (messages.empty() || !running) return false;
+  *message = std::move(messages.front());
+  messages.pop_front();
+  return true;
 }
 
-void bm::ConfigServer::accept_and_read() {
-  sockaddr_in client_address{};
-  socklen_t client_address_len = sizeof(client_address);
-  int client_socket = accept(ntw_socket, (struct sockaddr *)&client_address,
-                             &client_address_len);
-  if (client_socket < 0) {
-    BMLOG_ERROR("Failed to accept connection");
-    exit(1);
+/**
+ * @brief Answer a message with one line of JSON: {"status": "ok"}, or
+ * {"status": "error", "error": @p error} if @p error is not empty. Each
+ * message gets exactly one answer, in order.
+ */
+void bm::ConfigServer::reply(uint64_t session_id, const std::string &error) {
+  Json::Value answer;
+  answer["status"] = error.empty() ? "ok" : "error";
+  if (!error.empty()) answer["error"] = error;
+  {
+    std::lock_guard<std::mutex> lock(replies_mutex);
+    // FastWriter ends the line
+    replies.push_back({session_id, Json::FastWriter().write(answer)});
   }
+  wake();
+}
 
-  BMLOG_DEBUG("[Configuration Server] Connection accepted");
+size_t bm::ConfigServer::get_nb_sessions() const {
+  return nb_sessions.load(std::memory_order_relaxed);
+}
 
-  std::vector<char> buffer(32768);
-  int bytes_read = read(client_socket, buffer.data(), buffer.size());
-  if (bytes_read < 0) {
-    BMLOG_ERROR("Failed to read from socket");
-    exit(1);
+void bm::ConfigServer::wake() const {
+  uint64_t one = 1;
+  if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    BMLOG_ERROR("[Configuration Server] Failed to wake up the server");
+}
+
+/**
+ * @brief Server thread: waits for the events of all the sessions, the new
+ * connections and the replies of the consumer.
+ */
+void bm::ConfigServer::serve() {
+  std::vector<struct epoll_event> events(64);
+  while (running) {
+    int nb_events = epoll_wait(epoll_fd, events.data(),
+                               static_cast<int>(events.size()), -1);
+    if (nb_events < 0) {
+      if (errno == EINTR) continue;
+      BMLOG_ERROR("[Configuration Server] epoll_wait failed: {}",
+                  std::strerror(errno));
+      break;
+    }
+    for (int i = 0; i < nb_events && running; i++) {
+      const uint64_t id = events[i].data.u64;
+      if (id == LISTEN_EVENT_ID) {
+        accept_sessions();
+      } else if (id == WAKE_EVENT_ID) {
+        uint64_t count;
+        while (read(event_fd, &count, sizeof(count)) > 0) continue;
+        flush_replies();
+      } else {
+        // The session may have been closed by a previous event
+        auto it = sessions.find(id);
+        if (it == sessions.end()) continue;
+        Session *session = it->second.get();
+        const bool hung_up = events[i].events & (EPOLLHUP | EPOLLERR);
+        if (hung_up && session->read_closed) {
+          // Nowhere to send the replies still pending
+          close_session(session);
+          continue;
+        }
+        if (events[i].events & EPOLLIN || hung_up) read_session(session);
+        if (sessions.count(id) != 0 && (events[i].events & EPOLLOUT))
+          write_session(session);
+      }
+    }
   }
-  close(client_socket);
+}
 
-  BMLOG_DEBUG("[Configuration Server] Received {} bytes", bytes_read);
-  BMLOG_DEBUG("[Configuration Server] Message: {}", buffer.data());
-  std::cout << "[Configuration Server] Received " << bytes_read << " bytes"
-            << std::endl;
-  std::cout << "[Configuration Server] Message: " << buffer.data() << std::endl;
-  // parse_config(buffer.data());
-  config = std::string(buffer.data(), bytes_read);
+void bm::ConfigServer::accept_sessions() {
+  while (true) {
+    int fd = accept4(listen_socket, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        BMLOG_ERROR("[Configuration Server] Failed to accept connection: {}",
+                    std::strerror(errno));
+      return;
+    }
+    auto session = std::make_unique<Session>();
+    session->id = next_session_id++;
+    session->fd = fd;
+    session->events = EPOLLIN;
+    struct epoll_event event {};
+    event.events = session->events;
+    event.data.u64 = session->id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      BMLOG_ERROR("[Configuration Server] Failed to watch connection");
+      close(fd);
+      continue;
+    }
+    BMLOG_DEBUG("[Configuration Server] Session {} opened", session->id);
+    sessions.emplace(session->id, std::move(session));
+    nb_sessions++;
+  }
 }
 
-void bm::ConfigServer::parse_config(const std::string &config) {
-  // get hierarchy from config
-  // auto hierarchy = ConfigParser::parse(config);
-  hierarchy = std::move(ConfigParser::parse(config));
-  if (hierarchy.empty()) {
-    BMLOG_ERROR("[Configuration Server] Failed to parse configuration");
+/**
+ * @brief Read what the client sent and cut it into messages. A message ends
+ * with the brace closing its top-level JSON object, braces in strings do not
+ * count; only whitespace can separate two messages.
+ */
+void bm::ConfigServer::read_session(Session *session) {
+  char buffer[65536];
+  bool eof = false;
+  while (!session->read_closed) {
+    ssize_t bytes_read = read(session->fd, buffer, sizeof(buffer));
+    if (bytes_read == 0) {
+      eof = true;
+      break;
+    }
+    if (bytes_read < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      BMLOG_ERROR("[Configuration Server] Failed to read session {}: {}",
+                  session->id, std::strerror(errno));
+      close_session(session);
+      return;
+    }
+    session->in.append(buffer, bytes_read);
+  }
+
+  std::string error;
+  std::vector<std::string> received;
+  std::string &in = session->in;
+  size_t start = 0;  // Start of the message being framed
+  for (size_t i = session->scanned; i < in.size() && error.empty(); i++) {
+    const char c = in[i];
+    if (session->depth == 0) {
+      if (is_space(c)) {
+        start = i + 1;
+      } else if (c == '{') {
+        start = i;
+        session->depth = 1;
+      } else {
+        error = "Messages must be JSON objects";
+      }
+    } else if (session->in_string) {
+      if (session->escaped)
+        session->escaped = false;
+      else if (c == '\\')
+        session->escaped = true;
+      else if (c == '"')
+        session->in_string = false;
+    } else if (c == '"') {
+      session->in_string = true;
+    } else if (c == '{') {
+      session->depth++;
+    } else if (c == '}' && --session->depth == 0) {
+      received.emplace_back(in, start, i + 1 - start);
+      start = i + 1;
+    }
+  }
+  in.erase(0, error.empty() ? start : in.size());
+  session->scanned = in.size();
+  if (error.empty() && in.size() > CONFIG_SERVER_MAX_MESSAGE_SIZE)
+    error = "Message too large";
+
+  if (!received.empty()) {
+    BMLOG_DEBUG("[Configuration Server] {} messages from session {}",
+                received.size(), session->id);
+    session->nb_pending += received.size();
+    {
+      std::lock_guard<std::mutex> lock(messages_mutex);
+      for (auto &text : received)
+        messages.push_back({session->id, std::move(text)});
+    }
+    messages_cv.notify_one();
+  }
+
+  if (!error.empty()) {
+    // The framing is lost, the session is closed once the messages before
+    // the error are answered
+    BMLOG_ERROR("[Configuration Server] Session {}: {}", session->id, error);
+    Json::Value answer;
+    answer["status"] = "error";
+    answer["error"] = error;
+    session->error_reply = Json::FastWriter().write(answer);
+    session->read_closed = true;
+  } else if (eof) {
+    if (!in.empty()) {
+      BMLOG_ERROR("[Configuration Server] Session {} closed in the middle of "
+                  "a message", session->id);
+    }
+    session->read_closed = true;
+  }
+  write_session(session);
+}
+
+/**
+ * @brief Send the pending replies of @p session, and close it if it is done.
+ */
+void bm::ConfigServer::write_session(Session *session) {
+  if (session->nb_pending == 0 && !session->error_reply.empty()) {
+    session->out += session->error_reply;
+    session->error_reply.clear();
+  }
+  while (!session->out.empty()) {
+    ssize_t bytes_sent = send(session->fd, session->out.data(),
+                              session->out.size(), MSG_NOSIGNAL);
+    if (bytes_sent < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      // The client is gone, its replies with it
+      close_session(session);
+      return;
+    }
+    session->out.erase(0, bytes_sent);
+  }
+  if (session->read_closed && session->nb_pending == 0 &&
+      session->out.empty()) {
+    close_session(session);
     return;
   }
+  update_events(session);
+}
+
+void bm::ConfigServer::flush_replies() {
+  std::vector<ConfigMessage> new_replies;
+  {
+    std::lock_guard<std::mutex> lock(replies_mutex);
+    new_replies.swap(replies);
+  }
+  for (auto &reply : new_replies) {
+    auto it = sessions.find(reply.session_id);
+    if (it == sessions.end()) continue;
+    Session *session = it->second.get();
+    session->out += reply.text;
+    session->nb_pending--;
+    write_session(session);
+  }
+}
+
+void bm::ConfigServer::update_events(Session *session) {
+  uint32_t events = 0;
+  if (!session->read_closed) events |= EPOLLIN;
+  if (!session->out.empty()) events |= EPOLLOUT;
+  if (events == session->events) return;
+  session->events = events;
+  struct epoll_event event {};
+  event.events = events;
+  event.data.u64 = session->id;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+}
+
+void bm::ConfigServer::close_session(Session *session) {
+  BMLOG_DEBUG("[Configuration Server] Session {} closed", session->id);
+  if (epoll_fd >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, nullptr);
+  close(session->fd);
+  sessions.erase(session->id);
+  nb_sessions--;
+}
+
+namespace {
+
+// "tmnode" (or "id") of a node of the configuration
+int tmnode_id(const Json::Value &tmnode) {
+  return tmnode.isMember("tmnode") ? tmnode["tmnode"].asInt()
+                                   : tmnode["id"].asInt();
+}
+
+// "params": [{"param": <index>, "values": [...]}, ...]
+bm::SchedulerParams::Updates parse_param_list(const Json::Value &params) {
+  bm::SchedulerParams::Updates updates;
+  for (const auto &param : params) {
+    std::vector<uint64_t> values;
+    for (const auto &value : param["values"])
+      values.push_back(value.asUInt64());
+    updates.emplace_back(param["param"].asUInt(), std::move(values));
+  }
+  return updates;
+}
+
+// "buffer": {"packets": <max>, "bytes": <max>, "alpha": <dynamic threshold>}
+bm::BufferLimits parse_buffer_limits(const Json::Value &buffer) {
+  bm::BufferLimits limits;
+  limits.max_packets = buffer.get("packets", 0).asUInt64();
+  limits.max_bytes = buffer.get("bytes", 0).asUInt64();
+  limits.alpha = buffer.get("alpha", 0.0).asDouble();
+  if (limits.alpha < 0.0)
+    throw std::invalid_argument("Negative buffer alpha");
+  return limits;
+}
+
+// "shaping": {"bps": <rate>, "burst": <bytes>}
+void parse_node_shaping(const Json::Value &shaping, uint64_t *rate_bps,
+                        uint64_t *burst_bytes) {
+  if (!shaping.isObject() || !shaping["bps"].isConvertibleTo(Json::uintValue))
+    throw std::invalid_argument("Shaping needs a rate in bps");
+  *rate_bps = shaping["bps"].asUInt64();
+  *burst_bytes = shaping.get("burst", 0).asUInt64();
 }
 
+}  // namespace
+
 bm::ConfigParser::ConfigParser() {}
 
 bm::ConfigParser::~ConfigParser() {}
 
-// // std::vector<std::shared_ptr<bm::Node>> bm::ConfigParser::parse(
-std::vector<std::unique_ptr<bm::Node>> bm::ConfigParser::parse(
-    const std::string &config) {
+/**
+ * @brief Build the node tree described by a "tmconfig" JSON configuration.
+ *
+ * Each entry of "tmnodes" needs an id ("tmnode", or "id") and a "scheduler".
+ * Optional fields: "port" (egress port of a root), "parent" (id of the
+ * parent) or "children" (array of child ids), "match" ({"field": ...,
+ * "values": [...]}, classifier of a leaf), "window" (packets a node can have
+ * in flight in its parent), "calendar", "calendar_days", "timeout_ms"
+ * (interval of the periodic_timeout action, none by default), "impl" ("p4",
+ * the default, or "native" for the C++ implementation of the scheduler, see
+ * NativeScheduler, including the schedulers of loaded modules), "weights"
+ * (per-color weights of a native WRR, quanta in bytes of a native DRR, passed
+ * as is to the schedulers of modules), "params" (initial scheduler
+ * parameters, [{"param": <index>, "values": [...]}, ...], read by the P4
+ * actions with get_scheduler_parameter(); parameter 0 replaces the weights of
+ * a native scheduler), "buffer" (limits of the buffer taken by the
+ * packets of a leaf, {"packets": ..., "bytes": ..., "alpha": ...}, see
+ * BufferLimits) and "shaping" (output rate of the node, {"bps": ...,
+ * "burst": <bytes>}, see Node::set_shaping()).
+ *
+ * @param config JSON configuration
+ * @param owner TrafficManager the roots hand their packets to
+ * @return the hierarchy, empty if the configuration is invalid
+ */
+bm::Hierarchy bm::ConfigParser::parse(const std::string &config,
+                                      TrafficManager *owner) {
   std::cout << "[Configuration Parser] Parsing configuration" << std::endl;
   std::cout << "[Configuration Parser] Configuration: " << config << std::endl;
 
@@ -130,30 +497,413 @@ std::vector<std::unique_ptr<bm::Node>> bm::ConfigParser::parse(
   }
 
   // config loaded successfully
-  std::vector<std::unique_ptr<bm::Node>> hierarchy = {};
+  bm::Hierarchy hierarchy;
+
+  std::string error;
+  try {
+    const Json::Value &tmnodes = root["tmconfig"]["tmnodes"];
+    for (const auto &tmnode : tmnodes) {
+      // mandatory fields
+      int id = tmnode_id(tmnode);
+      std::string scheduler_type = tmnode["scheduler"].asString();
+
+      // optional fields (root nodes, etc...)
+      int egress_port;
+      if (tmnode.isMember("port")) {
+        egress_port = tmnode["port"].asInt();
+      } else {
+        egress_port = -1;
+      }
 
-  const Json::Value &tmconfig = root["tmconfig"];
-  const Json::Value &tmnodes = tmconfig["tmnodes"];
+      if (hierarchy.get_node(id) != nullptr) {
+        std::cout << "[Configuration Parser] Duplicate node " << id
+                  << std::endl;
+        return {};
+      }
 
-  for (const auto &tmnode : tmnodes) {
-    // mandatory fields
-    int id = tmnode["id"].asInt();
-    std::string scheduler_type = tmnode["scheduler"].asString();
+      auto node =
+          std::make_unique<bm::Node>(id, owner, scheduler_type, egress_port);
+      if (tmnode.isMember("calendar")) {
+        auto calendar_type =
+            calendar_store_type_from_string(tmnode["calendar"].asString());
+        if (tmnode.isMember("calendar_days")) {
+          node->set_calendar_store(calendar_type,
+                                   tmnode["calendar_days"].asUInt());
+        } else {
+          node->set_calendar_store(calendar_type);
+        }
+      }
+      if (tmnode.isMember("match")) {
+        const Json::Value &match = tmnode["match"];
+        NodeClassifier classifier;
+        classifier.field =
+            NodeClassifier::field_from_string(match["field"].asString());
+        for (const auto &value : match["values"])
+          classifier.values.push_back(value.asUInt());
+        node->set_classifier(std::move(classifier));
+      }
+      if (tmnode.isMember("window")) {
+        node->set_window(tmnode["window"].asInt());
+      }
+      const std::string impl = tmnode.get("impl", "p4").asString();
+      if (impl == "native") {
+        std::vector<uint32_t> weights;
+        for (const auto &weight : tmnode["weights"])
+          weights.push_back(weight.asUInt());
+        node->set_native_scheduler(
+            NativeScheduler::make(scheduler_type, weights));
+      } else if (impl != "p4") {
+        throw std::invalid_argument("Unknown scheduler implementation: " +
+                                    impl);
+      }
+      if (tmnode.isMember("params") &&
+          !node->set_scheduler_params(parse_param_list(tmnode["params"]))) {
+        throw std::invalid_argument("Scheduler parameter out of bounds");
+      }
+      if (tmnode.isMember("buffer")) {
+        node->set_buffer_limits(parse_buffer_limits(tmnode["buffer"]));
+      }
+      if (tmnode.isMember("shaping")) {
+        uint64_t rate_bps, burst_bytes;
+        parse_node_shaping(tmnode["shaping"], &rate_bps, &burst_bytes);
+        node->set_shaping(rate_bps, burst_bytes);
+      }
+      if (tmnode.isMember("timeout_ms")) {
+        std::chrono::milliseconds timeout(tmnode["timeout_ms"].asUInt64());
+        uint64_t ticks = timeout / NODE_TIMER_TICK;
+        if (timeout.count() > 0 && ticks == 0) ticks = 1;
+        node->set_timeout_interval(ticks);
+      }
+      hierarchy.add_node(std::move(node));
+    }
 
-    // optional fields (root nodes, etc...)
-    int egress_port;
-    if (tmnode.isMember("port")) {
-      egress_port = tmnode["port"].asInt();
-    } else {
-      egress_port = -1;
+    // Second pass, once all the nodes exist. "children" used to be a count
+    // (ignored), only arrays of ids describe links.
+    for (const auto &tmnode : tmnodes) {
+      int id = tmnode_id(tmnode);
+      bool ok = true;
+      if (tmnode.isMember("parent")) {
+        ok = hierarchy.link(tmnode["parent"].asInt(), id, &error);
+      }
+      if (ok && tmnode["children"].isArray()) {
+        for (const auto &child : tmnode["children"]) {
+          if (!(ok = hierarchy.link(id, child.asInt(), &error))) break;
+        }
+      }
+      if (!ok) {
+        std::cout << "[Configuration Parser] Invalid hierarchy: " << error
+                  << std::endl;
+        return {};
+      }
     }
+  } catch (const std::exception &e) {
+    std::cout << "[Configuration Parser] Invalid configuration: " << e.what()
+              << std::endl;
+    return {};
+  }
 
-    auto node =
-        // std::make_shared<bm::Node>(id, nullptr, scheduler_type, egress_port);
-        std::make_unique<bm::Node>(id, nullptr, scheduler_type, egress_port);
-    // hierarchy.push_back(node);
-    hierarchy.push_back(std::move(node));  // Moves ownership instead of copying
+  if (!hierarchy.empty() && !hierarchy.finalize(&error)) {
+    std::cout << "[Configuration Parser] Invalid hierarchy: " << error
+              << std::endl;
+    return {};
   }
 
   return hierarchy;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Read the optional "fields" object of tmconfig, mapping the
+ * scheduler-visible CalendarItem fields to P4 fields, e.g.
+ * {"sport": "udp.srcPort", "vlan_id": ""}. Fields not listed keep the
+ * names already in @p fields, an empty name disables a field.
+ *
+ * @return Invalid for an unknown field or a name that is not a string,
+ * @p fields is only changed if Valid
+ */
+bm::ConfigSection bm::ConfigParser::parse_fields(
+    const std::string &config, CalendarItemFieldMap *fields) {
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(config, root) || !root.isObject() ||
+      !root["tmconfig"].isObject()) {
+    return ConfigSection::Invalid;
+  }
+  if (!root["tmconfig"].isMember("fields")) return ConfigSection::Absent;
+  const Json::Value &cfg_fields = root["tmconfig"]["fields"];
+  if (!cfg_fields.isObject()) {
+    std::cout << "[Configuration Parser] TM fields must be an object"
+              << std::endl;
+    return ConfigSection::Invalid;
+  }
+
+  CalendarItemFieldMap new_fields = *fields;
+  for (const auto &name : cfg_fields.getMemberNames()) {
+    CalendarItemField field;
+    if (!CalendarItemFieldMap::field_from_string(name, &field) ||
+        !cfg_fields[name].isString()) {
+      std::cout << "[Configuration Parser] Invalid TM field: " << name
+                << std::endl;
+      return ConfigSection::Invalid;
+    }
+    new_fields.set_field_name(field, cfg_fields[name].asString());
+  }
+  *fields = new_fields;
+  return ConfigSection::Valid;
+}
+
+/**
+ * @brief Read the optional "buffer" object of tmconfig, the shared buffer of
+ * the TM: {"packets": <capacity>, "bytes": <capacity>, "port": {"packets":
+ * ..., "bytes": ..., "alpha": ...}}, the port limits apply to every egress
+ * port. Missing values are unlimited.
+ *
+ * @return Invalid if "buffer" is not an object or has invalid limits,
+ * @p buffer is only changed if Valid
+ */
+bm::ConfigSection bm::ConfigParser::parse_buffer(const std::string &config,
+                                                 BufferConfig *buffer) {
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(config, root) || !root.isObject() ||
+      !root["tmconfig"].isObject()) {
+    return ConfigSection::Invalid;
+  }
+  if (!root["tmconfig"].isMember("buffer")) return ConfigSection::Absent;
+  const Json::Value &cfg_buffer = root["tmconfig"]["buffer"];
+
+  BufferConfig new_buffer;
+  try {
+    if (!cfg_buffer.isObject())
+      throw std::invalid_argument("Buffer must be an object");
+    new_buffer.max_packets = cfg_buffer.get("packets", 0).asUInt64();
+    new_buffer.max_bytes = cfg_buffer.get("bytes", 0).asUInt64();
+    if (cfg_buffer.isMember("port"))
+      new_buffer.port = parse_buffer_limits(cfg_buffer["port"]);
+  } catch (const std::exception &e) {
+    std::cout << "[Configuration Parser] Invalid buffer: " << e.what()
+              << std::endl;
+    return ConfigSection::Invalid;
+  }
+  *buffer = new_buffer;
+  return ConfigSection::Valid;
+}
+
+/**
+ * @brief Read a scheduler parameters update, sent instead of a "tmconfig":
+ * {"tmparams": [{"tmnode": <id>, "params": [{"param": <index>, "values":
+ * [...]}, ...]}, ...]}. The parameters of a node are published together.
+ *
+ * @return false if the configuration is not a (valid) parameters update
+ */
+bool bm::ConfigParser::parse_params(const std::string &config,
+                                    std::vector<NodeParamsUpdate> *updates) {
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(config, root)) return false;
+  const Json::Value &tmparams = root["tmparams"];
+  if (!tmparams.isArray()) return false;
+
+  std::vector<NodeParamsUpdate> new_updates;
+  try {
+    for (const auto &tmnode : tmparams) {
+      new_updates.push_back(
+          {tmnode["tmnode"].asInt(), parse_param_list(tmnode["params"])});
+    }
+  } catch (const std::exception &e) {
+    std::cout << "[Configuration Parser] Invalid parameters: " << e.what()
+              << std::endl;
+    return false;
+  }
+  *updates = std::move(new_updates);
+  return true;
+}
+
+/**
+ * @brief Read a shaping update, sent instead of a "tmconfig": {"tmshaping":
+ * [{"tmnode": <id>, "bps": <rate>, "burst": <bytes>}, ...]}. A rate of 0
+ * removes the limit of the node.
+ *
+ * @return false if the configuration is not a (valid) shaping update
+ */
+bool bm::ConfigParser::parse_shaping(const std::string &config,
+                                     std::vector<NodeShaping> *updates) {
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(config, root) || !root.isObject()) return false;
+  const Json::Value &tmshaping = root["tmshaping"];
+  if (!tmshaping.isArray()) return false;
+
+  std::vector<NodeShaping> new_updates;
+  try {
+    for (const auto &tmnode : tmshaping) {
+      NodeShaping update;
+      update.node_id = tmnode["tmnode"].asInt();
+      parse_node_shaping(tmnode, &update.rate_bps, &update.burst_bytes);
+      new_updates.push_back(update);
+    }
+  } catch (const std::exception &e) {
+    std::cout << "[Configuration Parser] Invalid shaping: " << e.what()
+              << std::endl;
+    return false;
+  }
+  *updates = std::move(new_updates);
+  return true;
+}
+
+/**
+ * @brief Read a trace control message, sent instead of a "tmconfig":
+ * {"tmtrace": {"file": <path>}} starts the binary trace of the TM to the
+ * file, {"tmtrace": {}} stops it.
+ *
+ * @return false if the message is not a (valid) trace control message
+ */
+bool bm::ConfigParser::parse_trace(const std::string &message,
+                                   std::string *path) {
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(message, root) || !root.isObject()) return false;
+  const Json::Value &tmtrace = root["tmtrace"];
+  if (!tmtrace.isObject()) return false;
+  const Json::Value &file = tmtrace["file"];
+  if (!file.isNull() && !file.isString()) return false;
+  *path = file.isString() ? file.asString() : "";
+  return true;
+}
+
+bool bm::ConfigParser::is_edit(const std::string &message) {
+  Json::Reader reader;
+  Json::Value root;
+  return reader.parse(message, root) && root.isObject() &&
+         root.isMember("tmedit");
+}
+
+namespace {
+
+// Index of node @p id in @p tmnodes, -1 if there is none
+int find_tmnode(const Json::Value &tmnodes, int id) {
+  for (Json::ArrayIndex i = 0; i < tmnodes.size(); i++) {
+    if (tmnode_id(tmnodes[i]) == id) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+// Detach node @p id from the parents listing it in their "children"
+void unlink_child(Json::Value *tmnodes, int id) {
+  for (auto &tmnode : *tmnodes) {
+    if (!tmnode["children"].isArray()) continue;
+    Json::Value children(Json::arrayValue);
+    for (const auto &child : tmnode["children"])
+      if (child.asInt() != id) children.append(child);
+    tmnode["children"] = children;
+  }
+}
+
+}  // namespace
+
+/**
+ * @brief Apply an incremental edit to a "tmconfig" configuration:
+ * {"tmedit": [<operation>, ...]}, with the operations
+ * - {"op": "add_node", "tmnode": {<node, as in "tmnodes">}}
+ * - {"op": "remove_node", "tmnode": <id>}, the node is also removed from the
+ *   "children" of its parent; its own children must be removed or retargeted
+ *   by the same edit
+ * - {"op": "retarget_node", "tmnode": <id>, "parent": <id>}, the node (and
+ *   its subtree) moves under another parent, it loses its "port" if it was a
+ *   root
+ * - {"op": "set_scheduler", "tmnode": <id>, "scheduler": <type>}, with
+ *   optionally the "impl", "weights" and "params" of the new scheduler (the
+ *   ones of the previous scheduler are dropped)
+ * The operations are applied in order, the edit is applied as a whole or not
+ * at all. The resulting hierarchy is validated by parse().
+ *
+ * @param config Configuration to edit.
+ * @param edit "tmedit" message.
+ * @param new_config Edited configuration.
+ * @param error Set if the edit cannot be applied.
+ * @param edited If not null, set to the nodes removed or given a new
+ * scheduler by the edit.
+ * @return false if the edit is invalid, @p new_config is left as is then.
+ */
+bool bm::ConfigParser::apply_edit(const std::string &config,
+                                  const std::string &edit,
+                                  std::string *new_config, std::string *error,
+                                  EditedNodes *edited) {
+  Json::Reader reader;
+  Json::Value root;
+  Json::Value edit_root;
+  if (!reader.parse(config, root) || !root["tmconfig"].isObject()) {
+    *error = "Invalid configuration to edit";
+    return false;
+  }
+  if (!reader.parse(edit, edit_root) || !edit_root["tmedit"].isArray()) {
+    *error = "Not a tmedit message";
+    return false;
+  }
+
+  Json::Value tmnodes = root["tmconfig"]["tmnodes"];
+  if (!tmnodes.isArray()) tmnodes = Json::Value(Json::arrayValue);
+  EditedNodes new_edited;
+  try {
+    for (const auto &operation : edit_root["tmedit"]) {
+      const std::string op = operation["op"].asString();
+      if (op == "add_node") {
+        const Json::Value &tmnode = operation["tmnode"];
+        if (!tmnode.isObject() || !tmnode.isMember("scheduler")) {
+          *error = "add_node needs a node with a scheduler";
+          return false;
+        }
+        if (find_tmnode(tmnodes, tmnode_id(tmnode)) >= 0) {
+          *error = "Node " + std::to_string(tmnode_id(tmnode)) + " exists";
+          return false;
+        }
+        tmnodes.append(tmnode);
+        continue;
+      }
+
+      const int id = operation["tmnode"].asInt();
+      const int index = find_tmnode(tmnodes, id);
+      if (index < 0) {
+        *error = "Unknown node " + std::to_string(id) + " in " + op;
+        return false;
+      }
+      Json::Value &tmnode = tmnodes[index];
+      if (op == "remove_node") {
+        Json::Value removed;
+        tmnodes.removeIndex(index, &removed);
+        unlink_child(&tmnodes, id);
+        new_edited.removed.push_back(id);
+      } else if (op == "retarget_node") {
+        const int parent = operation["parent"].asInt();
+        if (!operation.isMember("parent") ||
+            find_tmnode(tmnodes, parent) < 0) {
+          *error = "retarget_node needs an existing parent";
+          return false;
+        }
+        tmnode.removeMember("port");
+        tmnode["parent"] = parent;
+        unlink_child(&tmnodes, id);
+      } else if (op == "set_scheduler") {
+        if (!operation.isMember("scheduler")) {
+          *error = "set_scheduler needs a scheduler";
+          return false;
+        }
+        for (const char *key : {"scheduler", "impl", "weights", "params"}) {
+          tmnode.removeMember(key);
+          if (operation.isMember(key)) tmnode[key] = operation[key];
+        }
+        new_edited.rescheduled.push_back(id);
+      } else {
+        *error = "Unknown edit operation: " + op;
+        return false;
+      }
+    }
+  } catch (const std::exception &e) {
+    *error = std::string("Invalid edit: ") + e.what();
+    return false;
+  }
+
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  *new_config = Json::FastWriter().write(root);
+  if (edited != nullptr) *edited = std::move(new_edited);
+  return true;
+}
@@ -0,0 +1,134 @@
+#include <bm/bm_sim/hierarchy.h>
+#include <bm/bm_sim/logger.h>
+
+#include <algorithm>  // std::max
+#include <utility>  // std::move
+
+bm::Hierarchy::~Hierarchy() { stop_nodes(); }
+
+bm::Hierarchy &bm::Hierarchy::operator=(Hierarchy &&other) {
+  if (this == &other) return *this;
+  stop_nodes();
+  nodes = std::move(other.nodes);
+  nodes_by_id = std::move(other.nodes_by_id);
+  roots = std::move(other.roots);
+  leaves = std::move(other.leaves);
+  leaves_by_port = std::move(other.leaves_by_port);
+  portless_leaves = std::move(other.portless_leaves);
+  depth = other.depth;
+  return *this;
+}
+
+void bm::Hierarchy::stop_nodes() {
+  for (auto &node : nodes) node->stop();
+}
+
+/**
+ * @brief Add a node to the hierarchy. The hierarchy takes ownership.
+ */
+void bm::Hierarchy::add_node(std::unique_ptr<Node> node) {
+  nodes_by_id[node->get_id()] = node.get();
+  nodes.push_back(std::move(node));
+}
+
+bm::Node *bm::Hierarchy::get_node(int id) const {
+  auto it = nodes_by_id.find(id);
+  return it == nodes_by_id.end() ? nullptr : it->second;
+}
+
+/**
+ * @brief Make @p child_id a child of @p parent_id.
+ *
+ * @return false (and set @p error) if a node is unknown or the child
+ * already has another parent.
+ */
+bool bm::Hierarchy::link(int parent_id, int child_id, std::string *error) {
+  Node *parent = get_node(parent_id);
+  Node *child = get_node(child_id);
+  if (parent == nullptr || child == nullptr) {
+    *error = "unknown node in link " + std::to_string(parent_id) + " -> " +
+             std::to_string(child_id);
+    return false;
+  }
+  if (parent == child) {
+    *error = "node " + std::to_string(child_id) + " is its own parent";
+    return false;
+  }
+  if (child->get_parent() != nullptr && child->get_parent() != parent) {
+    *error = "node " + std::to_string(child_id) + " has several parents";
+    return false;
+  }
+  parent->add_child(child);
+  return true;
+}
+
+/**
+ * @brief Check the tree and index its leaves. Must be called once all the
+ * nodes are added and linked, before the first packet is enqueued.
+ *
+ * @return false (and set @p error) if the tree has no root or a cycle.
+ */
+bool bm::Hierarchy::finalize(std::string *error) {
+  roots.clear();
+  leaves.clear();
+  leaves_by_port.clear();
+  portless_leaves.clear();
+  depth = 0;
+
+  for (auto &node : nodes) {
+    // Walk up to the root, a path longer than the tree size is a cycle
+    Node *root = node.get();
+    size_t level = 1;
+    int port = node->get_egress_port();
+    while (root->get_parent() != nullptr) {
+      root = root->get_parent();
+      if (port < 0) port = root->get_egress_port();
+      if (++level > nodes.size()) {
+        *error = "cycle through node " + std::to_string(node->get_id());
+        return false;
+      }
+    }
+    depth = std::max(depth, level);
+    // The nodes of a port share the worker of the port
+    node->set_affinity(port);
+
+    if (node->get_parent() == nullptr) roots.push_back(node.get());
+    if (!node->is_leaf()) continue;
+    leaves.push_back(node.get());
+    if (port >= 0)
+      leaves_by_port[port].push_back(node.get());
+    else
+      portless_leaves.push_back(node.get());
+  }
+
+  if (roots.empty()) {
+    *error = "no root node";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Select the leaf a packet is enqueued to: the first leaf of its
+ * egress port whose classifier accepts it, then the first accepting leaf
+ * without port. A packet no classifier accepts goes to the first leaf of its
+ * port, or to the first leaf without port.
+ *
+ * @return nullptr if no leaf serves the egress port of the packet, which is
+ * then dropped: the leaves of the other ports never send to it
+ */
+bm::Node *bm::Hierarchy::find_leaf(const CalendarItem &item) const {
+  Node *fallback = nullptr;
+  auto it = leaves_by_port.find(static_cast<int>(item.get_egress_port()));
+  if (it != leaves_by_port.end()) {
+    for (auto *leaf : it->second) {
+      if (leaf->accepts(item)) return leaf;
+    }
+    fallback = it->second.front();
+  }
+  for (auto *leaf : portless_leaves) {
+    if (leaf->accepts(item)) return leaf;
+  }
+  if (fallback != nullptr) return fallback;
+  return portless_leaves.empty() ? nullptr : portless_leaves.front();
+}
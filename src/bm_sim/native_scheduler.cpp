@@ -0,0 +1,184 @@
+#include <bm/bm_sim/native_scheduler.h>
+
+#include <algorithm>  // std::max, std::min
+#include <limits>
+#include <stdexcept>  // std::invalid_argument
+#include <string>  // std::to_string
+
+constexpr int bm::StrictPriorityScheduler::NB_PRIORITIES;
+constexpr uint32_t bm::DrrScheduler::DEFAULT_QUANTUM;
+
+std::unique_ptr<bm::NativeScheduler> bm::NativeScheduler::make(
+    const std::string &type, const std::vector<uint32_t> &weights) {
+  const NativeSchedulerMap *schedulers = NativeSchedulerMap::get_instance();
+  auto scheduler = schedulers->get_scheduler(type, weights);
+  if (scheduler != nullptr) return scheduler;
+  auto rejected = schedulers->rejected_.find(type);
+  if (rejected != schedulers->rejected_.end()) {
+    throw std::invalid_argument(
+        "Native scheduler " + type + " was built against scheduler ABI " +
+        std::to_string(rejected->second) + ", expected " +
+        std::to_string(BM_NATIVE_SCHEDULER_ABI_VERSION));
+  }
+  throw std::invalid_argument("No native implementation of scheduler " +
+                              type);
+}
+
+int bm::NativeScheduler::next_time(uint32_t *last_time) {
+  constexpr uint32_t max_time = std::numeric_limits<int>::max();
+  *last_time = *last_time >= max_time ? 1 : *last_time + 1;
+  return static_cast<int>(*last_time);
+}
+
+bm::NativeSchedulerMap::NativeSchedulerMap() {
+  // Same number of colors as SP when no weight is given
+  const size_t nb_colors = StrictPriorityScheduler::NB_PRIORITIES;
+  register_scheduler("FIFO", BM_NATIVE_SCHEDULER_ABI_VERSION,
+                     [](const std::vector<uint32_t> &) {
+                       return std::make_unique<FifoScheduler>();
+                     });
+  register_scheduler("SP", BM_NATIVE_SCHEDULER_ABI_VERSION,
+                     [](const std::vector<uint32_t> &) {
+                       return std::make_unique<StrictPriorityScheduler>();
+                     });
+  register_scheduler("WRR", BM_NATIVE_SCHEDULER_ABI_VERSION,
+                     [nb_colors](const std::vector<uint32_t> &weights) {
+                       return std::make_unique<WrrScheduler>(
+                           weights.empty() ? std::vector<uint32_t>(nb_colors, 1)
+                                           : weights);
+                     });
+  register_scheduler("DRR", BM_NATIVE_SCHEDULER_ABI_VERSION,
+                     [nb_colors](const std::vector<uint32_t> &weights) {
+                       return std::make_unique<DrrScheduler>(
+                           weights.empty()
+                               ? std::vector<uint32_t>(
+                                     nb_colors, DrrScheduler::DEFAULT_QUANTUM)
+                               : weights);
+                     });
+}
+
+bm::NativeSchedulerMap *bm::NativeSchedulerMap::get_instance() {
+  static NativeSchedulerMap instance;
+  return &instance;
+}
+
+bool bm::NativeSchedulerMap::register_scheduler(const char *name,
+                                                int abi_version,
+                                                FactoryFn fn) {
+  const std::string str_name(name);
+  if (map_.find(str_name) != map_.end()) return false;
+  if (abi_version != BM_NATIVE_SCHEDULER_ABI_VERSION) {
+    rejected_[str_name] = abi_version;
+    return false;
+  }
+  map_[str_name] = std::move(fn);
+  names_.push_back(str_name);
+  return true;
+}
+
+std::unique_ptr<bm::NativeScheduler> bm::NativeSchedulerMap::get_scheduler(
+    const std::string &name, const std::vector<uint32_t> &weights) const {
+  auto it = map_.find(name);
+  if (it == map_.end()) return nullptr;
+  return it->second(weights);
+}
+
+std::vector<std::string> bm::NativeSchedulerMap::get_names() const {
+  return names_;
+}
+
+bm::CalendarKey bm::FifoScheduler::calculate_rank(const CalendarItem &item) {
+  (void) item;
+  return {0, next_time(&last_time)};
+}
+
+bm::CalendarKey bm::FifoScheduler::evaluate_predicate(
+    const NodeCalendar &calendar) {
+  CalendarKey key;
+  if (calendar.lowest_for_day(0, 1, &key) == nullptr) return {0, 0};
+  return key;
+}
+
+bm::CalendarKey bm::StrictPriorityScheduler::calculate_rank(
+    const CalendarItem &item) {
+  int day = std::min<int>(item.get_color(), NB_PRIORITIES - 1);
+  return {day, next_time(&last_time[day])};
+}
+
+/**
+ * @brief Head of the first non-empty priority, like find_non_empty_day(0,
+ * MAX_DAY) followed by get_lowest_priority_for_day() in SP_evaluate_predicate.
+ */
+bm::CalendarKey bm::StrictPriorityScheduler::evaluate_predicate(
+    const NodeCalendar &calendar) {
+  CalendarKey key;
+  for (int day = 0; day < NB_PRIORITIES; day++) {
+    if (calendar.lowest_for_day(day, 1, &key) != nullptr) return key;
+  }
+  return {0, 0};
+}
+
+bm::RoundScheduler::RoundScheduler(std::vector<uint32_t> weights) {
+  set_weights(std::move(weights));
+}
+
+void bm::RoundScheduler::set_weights(std::vector<uint32_t> new_weights) {
+  weights = std::move(new_weights);
+  if (weights.empty()) weights.push_back(1);
+  // A null weight would never let its color through
+  for (auto &weight : weights) weight = std::max<uint32_t>(weight, 1);
+  flows.resize(weights.size());
+}
+
+void bm::RoundScheduler::set_params(const SchedulerParams::Snapshot &params) {
+  const size_t nb_weights = params.sizes[0];
+  if (nb_weights == 0) return;
+  std::vector<uint32_t> new_weights(nb_weights);
+  for (size_t i = 0; i < nb_weights; i++)
+    new_weights[i] = static_cast<uint32_t>(params.values[0][i]);
+  set_weights(std::move(new_weights));
+}
+
+/**
+ * @brief The packet goes in the first round of its color with enough budget
+ * left, each round adding the weight of the color to the budget.
+ */
+bm::CalendarKey bm::RoundScheduler::calculate_rank(const CalendarItem &item) {
+  size_t color = std::min<size_t>(item.get_color(), flows.size() - 1);
+  Flow &flow = flows[color];
+  const uint64_t weight = weights[color];
+  if (!flow.active || flow.round < current_round) {
+    // New or idle color: starts over in the round being served, the budget
+    // left from its past rounds is lost
+    flow.active = true;
+    flow.round = current_round;
+    flow.budget = weight;
+  }
+  const uint64_t item_cost = cost(item);
+  while (flow.budget < item_cost) {
+    flow.round++;
+    flow.budget += weight;
+  }
+  flow.budget -= item_cost;
+  return {flow.round, next_time(&last_time)};
+}
+
+bm::CalendarKey bm::RoundScheduler::evaluate_predicate(
+    const NodeCalendar &calendar) {
+  CalendarKey key;
+  if (calendar.lowest(&key) == nullptr) return {0, 0};
+  return key;
+}
+
+void bm::RoundScheduler::dequeued(const CalendarItem &item) {
+  current_round = std::max(current_round, item.get_rank().first);
+}
+
+uint32_t bm::WrrScheduler::cost(const CalendarItem &item) const {
+  (void) item;
+  return 1;
+}
+
+uint32_t bm::DrrScheduler::cost(const CalendarItem &item) const {
+  return static_cast<uint32_t>(item.get_packet_size());
+}
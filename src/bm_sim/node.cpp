@@ -1,76 +1,91 @@
+#include <bm/bm_sim/calendar_item_pool.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/node.h>
+#include <bm/bm_sim/tm_trace.h>
 #include <bm/bm_sim/traffic_manager.h>
 
+#include <algorithm>  // std::find
 #include <chrono>
 #include <iomanip>
 #include <iostream>
-
-bm::Node::Node() : predicate_rank(0, 0) {
-  BMLOG_DEBUG("Node created");
-
-  node_p4_interface = std::make_unique<TrafficManagerInterface>();
-  node_p4_interface->init();
-  node_p4_interface->set_owner(this);
-
-  run_thread = std::thread(&Node::run, this);
-
-  predicate_callback = [this]() {
-    {
-      std::lock_guard<std::mutex> lock(predicate_mutex);
-      predicate_tasks.push([this]() { eval_predicate(); });
-    }
-    predicate_cv.notify_one();
-  };
-
-  predicate_thread = std::thread(&Node::predicate_worker, this);
-  predicate_thread.detach();
+#include <stdexcept>  // std::invalid_argument
+
+bm::NodeClassifier::Field bm::NodeClassifier::field_from_string(
+    const std::string& name) {
+  if (name.empty() || name == "none") return Field::None;
+  if (name == "egress_port") return Field::EgressPort;
+  if (name == "priority") return Field::Priority;
+  if (name == "dscp") return Field::Dscp;
+  if (name == "color") return Field::Color;
+  if (name == "vlan_id") return Field::VlanId;
+  if (name == "sport") return Field::Sport;
+  if (name == "dport") return Field::Dport;
+  throw std::invalid_argument("Unknown classifier field: " + name);
 }
 
-bm::Node::Node(int new_id) : Node() {
-  if (id >= 0) this->id = new_id;
-  predicate_rank = std::make_pair(0, 0);
-  scheduler_type = "SP";  // default configuration
-
-#ifdef BM_ENABLE_TM_DEBUG
-  if (node_p4_interface) {
-    BMLOG_DEBUG("Node {} created with P4 interface", this->id);
-    std::cout << "Node " << this->id << " created with P4 interface"
-              << std::endl;
+bool bm::NodeClassifier::matches(const bm::CalendarItem& item) const {
+  uint32_t value;
+  switch (field) {
+    case Field::None:
+      return true;
+    case Field::EgressPort:
+      value = item.get_egress_port();
+      break;
+    case Field::Priority:
+      value = item.get_priority();
+      break;
+    case Field::Dscp:
+      value = item.get_dscp();
+      break;
+    case Field::Color:
+      value = item.get_color();
+      break;
+    case Field::VlanId:
+      value = item.get_vlan_id();
+      break;
+    case Field::Sport:
+      value = item.get_sport();
+      break;
+    case Field::Dport:
+      value = item.get_dport();
+      break;
+    default:
+      return false;
   }
-
-  // Open CSV file and write header
-  csv_tm_dump_in.open("packet_log_in" + std::to_string(id) + ".csv",
-                      std::ios::out | std::ios::trunc);
-  csv_tm_dump_out.open("packet_log_out" + std::to_string(id) + ".csv",
-                       std::ios::out | std::ios::trunc);
-  if (!csv_tm_dump_in.is_open() || !csv_tm_dump_out.is_open()) {
-    BMLOG_DEBUG("Failed to open CSV file");
-  }
-  std::string header =
-      "Timestamp,PacketID,EgressPort,PacketSize,Priority,DSCP,Color,VLANID,"
-      "Sport,Dport\n";
-  csv_tm_dump_in << header;
-  csv_tm_dump_out << header;
-  csv_tm_dump_in.flush();
-  csv_tm_dump_out.flush();
-#endif
+  return std::find(values.begin(), values.end(), value) != values.end();
 }
 
-bm::Node::Node(int id, TrafficManager* tm) : Node(id) { owner = tm; }
+// The other constructors delegate to the full one, the executor is bound
+// once the owner is known
+bm::Node::Node() : Node(-1, nullptr, "") {}
+
+bm::Node::Node(int new_id) : Node(new_id, nullptr, "SP") {}
+
+bm::Node::Node(int id, TrafficManager* tm) : Node(id, tm, "SP") {}
 
 bm::Node::Node(int new_id, TrafficManager* tm, std::string scheduler_type,
                int egress_port)
-    : Node() {
-  if (id >= 0) this->id = new_id;
+    : calendar_store(make_calendar_store<bm::CalendarItem *>(
+          CalendarStoreType::Bucket)),
+      task_batch(TASK_BATCH_SIZE),
+      predicate_rank(0, 0) {
+  BMLOG_DEBUG("Node created");
+
+  node_p4_interface = std::make_unique<TrafficManagerInterface>();
+  node_p4_interface->init();
+  node_p4_interface->set_owner(this);
+
+  if (new_id >= 0) this->id = new_id;
   if (egress_port >= 0) {
     this->egress_port = egress_port;
     this->root = true;
-    if (tm) {
-      this->owner = tm;
-    }
+  }
+  // Only used by the roots, which hand their packets over to the TM
+  if (tm) {
+    this->owner = tm;
   }
   this->scheduler_type = scheduler_type;
+  bind_executor();
 
 #ifdef BM_ENABLE_TM_DEBUG
   if (node_p4_interface) {
@@ -78,56 +93,111 @@ bm::Node::Node(int new_id, TrafficManager* tm, std::string scheduler_type,
     std::cout << "Node " << this->id << " created with P4 interface"
               << std::endl;
   }
-
-  // Open CSV file and write header
-  csv_tm_dump_in.open("packet_log_in" + std::to_string(id) + ".csv",
-                      std::ios::out | std::ios::trunc);
-  csv_tm_dump_out.open("packet_log_out" + std::to_string(id) + ".csv",
-                       std::ios::out | std::ios::trunc);
-  if (!csv_tm_dump_in.is_open() || !csv_tm_dump_out.is_open()) {
-    BMLOG_DEBUG("Failed to open CSV file");
-  }
-  std::string header =
-      "Timestamp,PacketID,EgressPort,PacketSize,Priority,DSCP,Color,VLANID,"
-      "Sport,Dport\n";
-  csv_tm_dump_in << header;
-  csv_tm_dump_out << header;
-  csv_tm_dump_in.flush();
-  csv_tm_dump_out.flush();
 #endif
-};
+}
 
 bm::Node::~Node() {
+  // No timeout can be pushed once the timer is removed
+  if (timer_wheel != nullptr) timer_wheel->remove(timer_id);
+  stop();
+  // Not running any more, the egress sink must forget the root
+  if (owner != nullptr) owner->cancel_tx_wait(this);
 #ifdef BM_ENABLE_TM_DEBUG
   BMLOG_DEBUG("Node {} destroyed", id);
-  if (csv_tm_dump_in.is_open()) csv_tm_dump_in.close();
-  if (csv_tm_dump_out.is_open()) csv_tm_dump_out.close();
 #endif
 }
 
+void bm::Node::bind_executor() {
+  // The default executor (and its threads) is only created for the nodes
+  // without TM
+  executor = owner != nullptr ? owner->get_node_executor()
+                              : NodeExecutor::get_default();
+  worker = executor->get_worker(egress_port, id);
+}
+
+void bm::Node::set_affinity(int port) {
+  worker = executor->get_worker(port, id);
+}
+
+void bm::Node::stop() { executor->stop(this); }
+
 /**
- * @brief Set the actions map of the Node.
+ * @brief Resolve the scheduler hooks of the Node from the actions map. Hooks
+ * the scheduler does not implement are skipped when called, except
+ * calculate_rank and evaluate_predicate: without them the packets of a P4
+ * scheduler never leave the Node.
  *
- * @param actions Actions map to set.
+ * @param actions Actions map, indexed by "<scheduler>_<hook>".
+ * @param action_mutexes Mutex of each action, shared with the other nodes.
+ * @return false if the scheduler is not native and lacks one of the
+ * mandatory hooks.
  */
-void bm::Node::set_actions(
-    std::unordered_map<std::string, bm::ActionFn*>* actions) {
-  this->actionsfn_map = *actions;
-  auto* extern_ptr = node_p4_interface.get();
-
-  // Inject extern to the P4 action
-  for (auto& action : actionsfn_map) {
-    bm::ActionFn* action_fn = action.second;
-    // action_fn->parameter_push_back_extern_instance(extern_ptr);
-    action_fn->update_extern_instance(extern_ptr);
+bool bm::Node::set_actions(
+    std::unordered_map<std::string, bm::ActionFn*>* actions,
+    ActionMutexMap* action_mutexes) {
+  static const char* const hook_names[] = {
+      "_calculate_rank", "_evaluate_predicate", "_dequeued",
+      "_periodic_timeout", "_admit"};
+  static_assert(sizeof(hook_names) / sizeof(hook_names[0]) ==
+                    static_cast<size_t>(SchedulerHook::NbHooks),
+                "one name per scheduler hook");
+
+  // The extern of the Node is injected in the P4 action at execution time,
+  // see execute_action()
+  for (size_t i = 0; i < hooks.size(); i++) {
+    auto it = actions->find(scheduler_type + hook_names[i]);
+    if (it == actions->end() || it->second == nullptr) {
+      hooks[i] = HookEntry();
+      continue;
+    }
+    hooks[i].action_fn = it->second;
+    hooks[i].entry = std::make_unique<bm::ActionFnEntry>(it->second);
+    hooks[i].mutex = &(*action_mutexes)[it->second];
   }
+  if (native_scheduler) return true;
+  return hooks[static_cast<size_t>(SchedulerHook::CalculateRank)].entry &&
+         hooks[static_cast<size_t>(SchedulerHook::EvaluatePredicate)].entry;
+}
+
+/**
+ * @brief Schedule with a native implementation of the scheduler type instead
+ * of its P4 actions: no interpreter nor extern register on the packet path.
+ * Must be called before any packet is enqueued to the Node.
+ *
+ * @param scheduler Native scheduler, owned by the Node.
+ */
+void bm::Node::set_native_scheduler(
+    std::unique_ptr<NativeScheduler> scheduler) {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  native_scheduler = std::move(scheduler);
+  native_params_version = 0;
+}
+
+/**
+ * @brief Update some of the scheduler parameters, e.g. the weights of a
+ * WRR. The update is published atomically: the hooks running meanwhile keep
+ * the previous version, the next ones see all of the new values. Neither the
+ * calendar nor the packet flow is stopped.
+ *
+ * @param updates Parameters to replace, by index.
+ * @return false if a parameter is out of bounds, nothing is updated then.
+ */
+bool bm::Node::set_scheduler_params(const SchedulerParams::Updates& updates) {
+  return node_p4_interface->get_scheduler_params().set(updates);
+}
 
-  // Populate actions_map with ActionFnEntry
-  for (auto& action : actionsfn_map) {
-    bm::ActionFn* action_fn = action.second;
-    bm::ActionFnEntry* entry = new bm::ActionFnEntry(action_fn);
-    actions_map[action.first] = entry;
+/**
+ * @brief The native scheduler, after handing it the scheduler parameters if
+ * they changed since its last hook. The caller must hold calendar_mutex.
+ */
+bm::NativeScheduler* bm::Node::get_native_scheduler() {
+  const SchedulerParams& params = node_p4_interface->get_scheduler_params();
+  if (params.get_version() != native_params_version) {
+    SchedulerParams::Pin pin(params);
+    native_scheduler->set_params(*pin);
+    native_params_version = pin.get_version();
   }
+  return native_scheduler.get();
 }
 
 /**
@@ -142,129 +212,279 @@ void bm::Node::set_parent(Node* parent) { this->parent = parent; }
  *
  * @param children Children to set.
  */
-void bm::Node::set_children(
-    const std::vector<std::shared_ptr<Node>>& children) {
-  for (const auto& child : children) {
-    this->children.push_back(
-        child);  // copies the shared_ptr, original vector remains intact
+void bm::Node::set_children(const std::vector<Node*>& children) {
+  for (auto* child : children) add_child(child);
+}
+
+/**
+ * @brief Add a child to the Node and make the Node its parent.
+ *
+ * @param child Child to add.
+ */
+void bm::Node::add_child(Node* child) {
+  if (std::find(children.begin(), children.end(), child) != children.end())
+    return;
+  children.push_back(child);
+  child->set_parent(this);
+}
+
+/**
+ * @brief Set the classifier selecting the packets enqueued to this (leaf)
+ * Node.
+ *
+ * @param classifier Classifier to set.
+ */
+void bm::Node::set_classifier(NodeClassifier classifier) {
+  this->classifier = std::move(classifier);
+}
+
+/**
+ * @brief Set the number of packets the Node can have in flight towards its
+ * parent. With a window of 1, the parent only ever sees the head packet of
+ * each child, which gives HPFQ-like hierarchical scheduling.
+ *
+ * @param window Number of packets, at least 1.
+ */
+void bm::Node::set_window(int window) {
+  upstream_credits = window > 0 ? window : 1;
+}
+
+/**
+ * @brief Limit the rate of the packets the Node hands to its parent (or to
+ * its egress port for a root) to @p rate_bps bits per second, counted on
+ * CalendarItem::get_packet_size(). The winner of the predicate waits in the
+ * calendar until the token bucket lets it go, the Node polls meanwhile. Can
+ * be changed while packets flow.
+ *
+ * @param rate_bps Rate in bits per second, 0 for no limit.
+ * @param burst_bytes Bytes the Node can send at once after an idle period.
+ */
+void bm::Node::set_shaping(uint64_t rate_bps, uint64_t burst_bytes) {
+  {
+    std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+    shaper.set_rate(rate_bps, burst_bytes);
+  }
+  if (!calendar_empty()) request_predicate();
+}
+
+/**
+ * @brief Called by the parent when it forwarded a packet coming from this
+ * Node: a new predicate winner can be pushed upward.
+ */
+void bm::Node::release_credit() {
+  upstream_credits++;
+  request_predicate();
+}
+
+/**
+ * @brief Register the periodic_timeout hook of the Node in @p wheel, if the
+ * Node has a timeout interval. The timer only queues a Timeout task, the P4
+ * action runs on the Node thread. Must be called once, the timer is removed
+ * when the Node is destroyed.
+ *
+ * @param wheel Timer wheel of the TM, must outlive the Node.
+ */
+void bm::Node::start_periodic_timeout(TimerWheel* wheel) {
+  if (timeout_interval == 0 || timer_wheel != nullptr) return;
+  timer_wheel = wheel;
+  timer_id = wheel->add(timeout_interval, [this]() {
+    if (timeout_pending.exchange(true, std::memory_order_acq_rel)) return;
+    push_task(Task(TaskType::Timeout, nullptr, id));
+  });
+}
+
+/**
+ * @brief Run the periodic_timeout P4 action of the scheduler, e.g. to refill
+ * token buckets or advance the calendar day, then re-evaluate the predicate
+ * since the action may have released packets.
+ */
+void bm::Node::periodic_timeout() {
+  timeout_pending.store(false, std::memory_order_release);
+  nb_timeouts.fetch_add(1, std::memory_order_relaxed);
+  // P4 actions need a packet, even without one to schedule
+  bm::Packet* pkt = owner != nullptr ? owner->get_timer_packet() : nullptr;
+  if (native_scheduler) {
+    std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+    get_native_scheduler()->periodic_timeout();
+  } else if (pkt != nullptr) {
+    std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+    // The packet is shared by the nodes of the TM
+    std::lock_guard<std::mutex> packet_lock(*owner->get_timer_packet_mutex());
+    execute_action(SchedulerHook::PeriodicTimeout, pkt);
   }
+  if (!calendar_empty()) request_predicate();
 }
 
-std::shared_ptr<bm::CalendarItem> bm::Node::get_lowest_for_day(int day) const {
-  // Keys are ordered lexicographically (day, time), so lower_bound with (day,
-  // 0)
-  // returns the first CalendarItem for that day (if it exists).
+/**
+ * @brief Select the data structure backing the calendar of the Node.
+ * Must be called before any packet is enqueued to the Node.
+ *
+ * @param type Calendar store type (map or bucketed calendar queue).
+ * @param nb_days Number of day buckets of the calendar queue.
+ */
+void bm::Node::set_calendar_store(CalendarStoreType type, size_t nb_days) {
+  calendar_store =
+      make_calendar_store<bm::CalendarItem *>(type, nb_days);
+}
 
-  // FIRST TRY (using std libs)
-  auto it = calendar_store.lower_bound(std::make_pair(day, 1));
-  if (it == calendar_store.end() || it->first.first != day) {
+bm::CalendarItem* bm::Node::get_lowest_for_day(int day) const {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  // Time 0 is reserved for the null predicate, start looking at (day, 1)
+  auto *item = calendar_store->lowest_for_day(day, 1);
+  if (item == nullptr) {
     return nullptr;  // No entries for the given day.
   }
 
-  return it->second;
+  return *item;
 }
 
 /**
  * @brief Get the lowest-ranked CalendarItem in the Node.
  * Is get_lowest for the lowest day
  */
-std::shared_ptr<bm::CalendarItem> bm::Node::get_lowest() const {
-  if (calendar_store.empty()) {
+bm::CalendarItem* bm::Node::get_lowest() const {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  auto *item = calendar_store->lowest();
+  if (item == nullptr) {
     return nullptr;  // No items exist
   }
-  return calendar_store.begin()
-      ->second;  // The first element is the lowest-ranked
+  return *item;  // The first element is the lowest-ranked
 }
 
 bool bm::Node::has_packets_for_day(int day) const {
-  // calendar_store is keyed by a pair (day, time)
-  auto it = calendar_store.lower_bound(std::make_pair(day, 0));
-  // If found and the day component matches, there is at least one packet.
-  return (it != calendar_store.end() && it->first.first == day);
-}
-
-void bm::Node::run() {
-  while (true) {
-    //! Task scheduler part
-    std::unique_lock<std::mutex> lock(mtx);
-    cv.wait(lock,
-            [this] { return !task_queue.empty() || !calendar_store.empty(); });
-    if (!task_queue.empty()) {
-      bm::Task task = std::move(task_queue.front());
-      task_queue.erase(task_queue.begin());
-      lock.unlock();
-
-      switch (task.type) {
-        case bm::TaskType::Enqueue: {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  return calendar_store->has_day(day);
+}
+
+/**
+ * @brief Process the tasks pushed to the Node (up to a batch, the Node is
+ * queued again if more are left), then evaluate the predicate if it was
+ * requested or if the poll timer expired. Runs on the worker of the Node,
+ * never concurrently with itself.
+ */
+void bm::Node::execute() {
+  auto start = std::chrono::steady_clock::now();
+  size_t nb_tasks =
+      task_queue.pop_batch(task_batch.data(), task_batch.size());
+  for (size_t i = 0; i < nb_tasks; i++) {
+    bm::Task &task = task_batch[i];
+    switch (task.type) {
+      case bm::TaskType::Enqueue:
 #ifdef BM_ENABLE_TM_DEBUG
-          BMLOG_DEBUG("Task is enqueue");
+        BMLOG_DEBUG("Task is enqueue");
 #endif
-          enqueue(std::move(task));
-          break;
-
-          case bm::TaskType::Dequeue:
+        enqueue(std::move(task));
+        break;
+      case bm::TaskType::Dequeue:
 #ifdef BM_ENABLE_TM_DEBUG
-            BMLOG_DEBUG("Task is dequeue");
+        BMLOG_DEBUG("Task is dequeue");
 #endif
-            break;
-          default:
-            std::cout << "Unknown task type in the Node" << std::endl;
-        }
-      }
-    } else {
-      if (!calendar_store.empty()) {
-        // size_t wait_threasold = 20;
-        // if (calendar_store.size() > wait_threasold) {
-        //   flag = true;
-        // }
-        // if (flag) {
-        //   std::cout << "FLAG IS TRUE : EVAL PREDICATE" << std::endl;
-        //   predicate_callback();
-        // }
-        predicate_callback();
-      }
+        break;
+      case bm::TaskType::Timeout:
+        periodic_timeout();
+        break;
+      default:
+        std::cout << "Unknown task type in the Node" << std::endl;
     }
-  }  // end main loop
+  }
+
+  // Requests arriving from now on trigger a new evaluation
+  bool requested =
+      predicate_requested.exchange(false, std::memory_order_acq_rel);
+  bool timer = timer_fired;
+  timer_fired = false;
+  if (requested || timer) {
+    waiting_tx_credit = false;
+    nb_predicate_evaluations.fetch_add(1, std::memory_order_relaxed);
+    if (!requested)
+      nb_timer_evaluations.fetch_add(1, std::memory_order_relaxed);
+    eval_predicate();
+  }
+
+  if (!task_queue.empty()) {
+    // Back of the run queue, the other nodes of the worker get their turn
+    executor->schedule(this);
+  } else if (can_send() &&
+             !predicate_requested.load(std::memory_order_acquire)) {
+    // The scheduler holds back packets it could send, poll it. A change
+    // making can_send() true comes with a request.
+    executor->schedule_after(this, NODE_IDLE_POLL_INTERVAL);
+  }
+  busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count(),
+                    std::memory_order_relaxed);
+}
+
+/**
+ * @brief Hand a task over to the Node and schedule it. Lock-free, can be
+ * called concurrently by the TM and by other nodes. The windows of the
+ * children bound what they push, the task ring of a Node never fills up
+ * with packets of its children.
+ *
+ * @param task Task to push.
+ */
+void bm::Node::push_task(Task&& task) {
+  if (task.type == TaskType::Enqueue) pending_packets++;
+  task_queue.push(std::move(task));
+  executor->schedule(this);
+}
+
+/**
+ * @brief Hand several tasks over to the Node, e.g. the packets of a batch
+ * enqueued to the TM, and schedule it once. The tasks are moved from.
+ *
+ * @param tasks Tasks to push, in order.
+ * @param nb_tasks Number of tasks.
+ */
+void bm::Node::push_tasks(Task *tasks, size_t nb_tasks) {
+  for (size_t i = 0; i < nb_tasks; i++) {
+    if (tasks[i].type == TaskType::Enqueue) pending_packets++;
+    if (!task_queue.try_push(std::move(tasks[i]))) {
+      // The Node has to run to make room for the rest of the batch
+      executor->schedule(this);
+      task_queue.push(std::move(tasks[i]));
+    }
+  }
+  if (nb_tasks > 0) executor->schedule(this);
 }
 
 void bm::Node::enqueue(Task&& task) {
 #ifdef BM_ENABLE_TM_DEBUG
   // BMLOG_DEBUG("Enqueued packet in the Node {}", this->id);
 #endif
-  std::shared_ptr<bm::CalendarItem> cal_item;
-  cal_item = std::move(task.cal_item);
+  bm::CalendarItem* cal_item = task.cal_item;
+  task.cal_item = nullptr;
 
-// Log packet details to CSV file
-#ifdef BM_ENABLE_TM_DEBUG
-  dump_packet_info(csv_tm_dump_in, cal_item.get());
-  dump_packet_info_vector(this->accumulated_logs_in, cal_item.get());
-#endif
   auto rank = this->calculate_rank(cal_item);
   cal_item->set_rank(rank);
+  TMTrace::record(TraceEvent::Enqueue, id, *cal_item);
 #ifdef BM_ENABLE_TM_DEBUG
   BMLOG_DEBUG("Rank is {}", rank.second);
 #endif
-  this->calendar_store.emplace(rank, std::move(cal_item));
+  Node* source = cal_item->get_source_node();
+  bool inserted;
+  {
+    std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+    inserted = this->calendar_store->insert(rank, cal_item);
 #ifdef BM_ENABLE_TM_DEBUG
-  // Display the content of the pkt store
-  std::cout << calendar_store_to_string() << std::endl;
+    // Display the content of the pkt store
+    std::cout << calendar_store_to_string() << std::endl;
 #endif
-
-  // size_t wait_threasold = 20;
-  // if (calendar_store.size() > wait_threasold) {
-  //   flag = true;
-  // }
-  // if (flag) {
-  //   std::cout << "FLAG IS TRUE : EVAL PREDICATE" << std::endl;
-  //   predicate_callback();
-  // }
-
-  if (predicate_callback) {
-#ifdef BM_ENABLE_TM_DEBUG
-    // BMLOG_DEBUG("Enqueue callback");
-#endif
-    predicate_callback();
   }
+  if (!inserted) {
+    // Rank already used in the calendar, the packet is lost
+    if (owner != nullptr)
+      owner->drop(cal_item);
+    else
+      CalendarItemPool::release(cal_item);
+    pending_packets--;
+    if (source != nullptr) source->release_credit();
+    return;
+  }
+  nb_enqueued.fetch_add(1, std::memory_order_relaxed);
+
+  request_predicate();
 }
 
 void bm::Node::dequeue(std::pair<int, int> pred_to_dq) {
@@ -273,29 +493,72 @@ void bm::Node::dequeue(std::pair<int, int> pred_to_dq) {
   pred_to_dq.first,
               pred_to_dq.second);
 #endif
-  // Get the packet from the map
-  auto it = calendar_store.find(pred_to_dq);
-  if (it != calendar_store.end()) {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  // The parent still holds as many packets of this Node as it can take
+  if (parent != nullptr && upstream_credits.load() <= 0) return;
+
+  // Get the packet from the calendar
+  bm::CalendarItem* cal_item = nullptr;
+  if (calendar_store->take(pred_to_dq, &cal_item)) {
 #ifdef BM_ENABLE_TM_DEBUG
     BMLOG_DEBUG("DQ - Packet found in the Node");
 #endif
-    std::shared_ptr<bm::CalendarItem> cal_item = std::move(it->second);
-
-    Task task(TaskType::Dequeue, cal_item, this->id);
+    // A shaped Node only releases its winner once the token bucket allows
+    // it. The packet goes back to its slot until then, polled no later than
+    // usual so that stop() is not delayed by slow rates.
+    const uint64_t now_ns = executor->now_ns();
+    if (shaper.is_limited()) {
+      uint64_t wait_ns = shaper.conform_time(now_ns) - now_ns;
+      if (wait_ns > 0) {
+        calendar_store->insert(pred_to_dq, cal_item);
+        executor->schedule_after(
+            this, std::min<std::chrono::nanoseconds>(
+                      std::chrono::nanoseconds(wait_ns),
+                      NODE_IDLE_POLL_INTERVAL));
+        return;
+      }
+    }
+    // A root only releases its winner when the egress port can take it. The
+    // packet goes back to its slot, the egress sink wakes the root up when
+    // the target frees a slot.
+    if (parent == nullptr && owner != nullptr &&
+        !owner->acquire_tx_credit(cal_item->get_egress_port(),
+                                  cal_item->get_egress_priority(), this)) {
+      calendar_store->insert(pred_to_dq, cal_item);
+      waiting_tx_credit = true;
+      return;
+    }
+    shaper.consume(now_ns, cal_item->get_packet_size());
+    Node* source = cal_item->get_source_node();
+
+    TMTrace::record(TraceEvent::Dequeue, id, *cal_item);
+    // P4 action called dequeued, before the packet can leave the TM
+    if (native_scheduler)
+      get_native_scheduler()->dequeued(*cal_item);
+    else
+      execute_action(SchedulerHook::Dequeued, cal_item->get_packet_ptr());
 #ifdef BM_ENABLE_TM_DEBUG
-    dump_packet_info(csv_tm_dump_out, cal_item.get());
-    BMLOG_DEBUG("Task created for dequeue");
+    BMLOG_DEBUG("Dequeued action called from the Node");
 #endif
-    owner->push_task(std::move(task));
-    calendar_store.erase(it);  // Cause issues with the predicate
 
-    // P4 action called dequeued
-    std::string action = scheduler_type + "_dequeued";
-    actions_map[action]->execute(cal_item->get_packet_ptr());
+    if (parent != nullptr) {
+      // Inner node or leaf: the packet competes in the parent's calendar
+      upstream_credits--;
+      cal_item->set_source_node(this);
+      parent->push_task(Task(TaskType::Enqueue, cal_item, this->id));
+    } else {
+      Task task(TaskType::Dequeue, cal_item, this->id);
 #ifdef BM_ENABLE_TM_DEBUG
-    BMLOG_DEBUG("Dequeued action called from the Node");
+      BMLOG_DEBUG("Task created for dequeue");
 #endif
-    if (calendar_store.empty()) {
+      owner->push_task(std::move(task));
+    }
+    pending_packets--;
+    nb_dequeued.fetch_add(1, std::memory_order_relaxed);
+    // The child the packet came from can push its next winner
+    if (source != nullptr) source->release_credit();
+
+    if (calendar_store->empty()) {
 #ifdef BM_ENABLE_TM_DEBUG
       BMLOG_DEBUG("Calendar store is empty after dequeue");
 #endif
@@ -306,8 +569,7 @@ void bm::Node::dequeue(std::pair<int, int> pred_to_dq) {
 #ifdef BM_ENABLE_TM_DEBUG
       BMLOG_DEBUG("Evaluating predicate after dequeue");
 #endif
-      // eval_predicate();
-      predicate_callback();
+      request_predicate();
     }
   }
 #ifdef BM_ENABLE_TM_DEBUG
@@ -321,14 +583,15 @@ void bm::Node::dequeue(std::pair<int, int> pred_to_dq) {
 /**
  * @brief Calculate the rank of the CalendarItem.
  */
-std::pair<int, int> bm::Node::calculate_rank(
-    std::shared_ptr<bm::CalendarItem> cal_item) {
+std::pair<int, int> bm::Node::calculate_rank(bm::CalendarItem* cal_item) {
 #ifdef BM_ENABLE_TM_DEBUG
   BMLOG_DEBUG("Calculating rank in the Node");
 #endif
   bm::Packet* pkt = cal_item->get_packet_ptr();
-  std::string action = scheduler_type + "_calculate_rank";
-  actions_map[action]->execute(pkt);
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  if (native_scheduler)
+    return get_native_scheduler()->calculate_rank(*cal_item);
+  execute_action(SchedulerHook::CalculateRank, pkt);
   auto rank = node_p4_interface->get_rank();
 #ifdef BM_ENABLE_TM_DEBUG
   BMLOG_DEBUG("Rank calculated");
@@ -336,20 +599,75 @@ std::pair<int, int> bm::Node::calculate_rank(
   return std::make_pair(rank.first, rank.second);
 }
 
-void bm::Node::predicate_worker() {
-  while (predicate_running) {
-    std::function<void()> task;
-    {
-      std::unique_lock<std::mutex> lock(predicate_mutex);
-      predicate_cv.wait(lock, [this] {
-        return !predicate_tasks.empty() || !predicate_running;
-      });
-      if (!predicate_running) return;
-      task = std::move(predicate_tasks.front());
-      predicate_tasks.pop();
-    }
-    task();
-  }
+/**
+ * @brief Run the admit action of the scheduler on a packet classified to this
+ * leaf, before it enters the buffer. The action reads the occupancy of the
+ * buffer with get_buffer_occupancy(), it can mark the packet (e.g. ECN) or
+ * drop it with drop_packet(). Called by TrafficManager::enqueue().
+ *
+ * @param cal_item Item of the packet, not in the calendar yet.
+ * @param occupancies Buffer occupancy before the packet.
+ * @return false if the action dropped the packet, true if the scheduler has
+ * no admit action.
+ */
+bool bm::Node::admit(bm::CalendarItem* cal_item,
+                     const BufferOccupancies& occupancies) {
+  if (!hooks[static_cast<size_t>(SchedulerHook::Admit)].entry) return true;
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  node_p4_interface->begin_admission(occupancies);
+  execute_action(SchedulerHook::Admit, cal_item->get_packet_ptr());
+  return node_p4_interface->is_admitted();
+}
+
+/**
+ * @brief Execute one of the scheduler P4 actions with the extern of this Node.
+ * The caller must hold calendar_mutex, the P4 action may query the calendar.
+ * Only the nodes running the same action wait for each other, the registers
+ * of the action are locked like in the pipelines.
+ *
+ * @param hook Scheduler hook to execute.
+ * @param pkt Packet the action runs on.
+ */
+void bm::Node::execute_action(SchedulerHook hook, bm::Packet* pkt) {
+  const HookEntry& hook_entry = hooks[static_cast<size_t>(hook)];
+  if (!hook_entry.entry) return;  // Not implemented by the scheduler
+  std::lock_guard<std::mutex> lock(*hook_entry.mutex);
+  hook_entry.action_fn->update_extern_instance(node_p4_interface.get());
+  // The scheduler parameters stay the same for the whole action
+  node_p4_interface->begin_action();
+  (*hook_entry.entry)(pkt);
+  node_p4_interface->end_action();
+}
+
+/**
+ * @brief Ask for an evaluation of the predicate, after a change of state of
+ * the Node (enqueue, dequeue, credit from the parent). Requests made before
+ * the Node is executed are coalesced into a single evaluation. Safe from any
+ * thread.
+ */
+void bm::Node::request_predicate() {
+  nb_predicate_requests.fetch_add(1, std::memory_order_relaxed);
+  if (predicate_requested.exchange(true, std::memory_order_acq_rel)) return;
+  executor->schedule(this);
+}
+
+/**
+ * @brief Activity counters of the Node. An idle Node does not evaluate its
+ * predicate and its CPU time stays constant.
+ */
+bm::NodeStats bm::Node::get_stats() const {
+  NodeStats stats;
+  stats.nb_enqueued = nb_enqueued.load(std::memory_order_relaxed);
+  stats.nb_dequeued = nb_dequeued.load(std::memory_order_relaxed);
+  stats.nb_predicate_requests =
+      nb_predicate_requests.load(std::memory_order_relaxed);
+  stats.nb_predicate_evaluations =
+      nb_predicate_evaluations.load(std::memory_order_relaxed);
+  stats.nb_timer_evaluations =
+      nb_timer_evaluations.load(std::memory_order_relaxed);
+  stats.nb_timeouts = nb_timeouts.load(std::memory_order_relaxed);
+  stats.cpu_time_ns = busy_ns.load(std::memory_order_relaxed);
+  return stats;
 }
 
 /**
@@ -360,9 +678,11 @@ void bm::Node::eval_predicate() {
   BMLOG_DEBUG("Evaluating predicate in the Node");
 #endif
 
-  // Safeguard, if the map is empty, return immediately
-  auto it = calendar_store.begin();
-  if (it == calendar_store.end()) {
+  std::lock_guard<std::recursive_mutex> lock(calendar_mutex);
+  // Safeguard, if the calendar is empty, return immediately
+  CalendarKey lowest_key;
+  auto *lowest_item = calendar_store->lowest(&lowest_key);
+  if (lowest_item == nullptr) {
 #ifdef BM_ENABLE_TM_DEBUG
     BMLOG_DEBUG("Calendar store is empty, returning");
 #endif
@@ -374,23 +694,28 @@ void bm::Node::eval_predicate() {
 #ifdef BM_ENABLE_TM_DEBUG
   BMLOG_DEBUG("Calendar store is not empty, continuing");
 #endif
-  std::shared_ptr<bm::CalendarItem> cal_item = it->second;
+  bm::CalendarItem* cal_item = *lowest_item;
   // Second safeguard, if the packet is empty, suppress return immediately
   // Really useful ? To check
   if (cal_item == nullptr) {
     predicate_rank = std::make_pair(0, 0);
-    calendar_store.erase(it);
+    if (calendar_store->take(lowest_key, nullptr)) pending_packets--;
     // predicate_set = false;
     predicate_set.store(false, std::memory_order_relaxed);
     return;
   }
 
-  // P4 action call
-  std::string action = scheduler_type + "_evaluate_predicate";
-  actions_map[action]->execute(cal_item->get_packet_ptr());
-  // New predicate is determined
-  // Fetch the predicate
-  auto new_pred = node_p4_interface->get_predicate();
+  std::pair<int, int> new_pred;
+  if (native_scheduler) {
+    new_pred = get_native_scheduler()->evaluate_predicate(*calendar_store);
+  } else {
+    // P4 action call
+    execute_action(SchedulerHook::EvaluatePredicate,
+                   cal_item->get_packet_ptr());
+    // New predicate is determined
+    // Fetch the predicate
+    new_pred = node_p4_interface->get_predicate();
+  }
 #ifdef BM_ENABLE_TM_DEBUG
   // BMLOG_DEBUG("After P4 call * New predicate is {}, {}", new_pred.first,
   //             new_pred.second);
@@ -408,34 +733,18 @@ void bm::Node::eval_predicate() {
   }
 
   // Here, the current predicate cant be empty (returned earlier if its the
-  // case) If new pred is different from the current one
+  // case). A previous predicate packet that could not be sent upward yet (no
+  // credit left) stays in the calendar and competes again.
   if (new_pred != predicate_rank) {
-    /// If current pred is not empty and node is not root
-    /// Dequeue current predicate packet
-    if (predicate_rank.second != 0) {
-      if (parent != nullptr) {
-        // Dequeue the current predicate packet to parent
-
-        // TEMPORARY IMPLEMENTATION, replace with dequeue to parent
-        auto it = calendar_store.find(predicate_rank);
-        if (it != calendar_store.end()) {
-          calendar_store.erase(it);
-        }
-      }
-    } else {
-#ifdef BM_ENABLE_TM_DEBUG
-      BMLOG_DEBUG("Predicate is null");
-#endif
-    }
     // Set the new predicate
     predicate_rank = new_pred;
     // predicate_set = true;
     predicate_set.store(true, std::memory_order_relaxed);
+  }
 
-    /// Enqueue packet to parent node or TM
-    if (this->ready()) {
-      dequeue(predicate_rank);
-    }
+  /// Enqueue packet to parent node or TM
+  if (this->ready()) {
+    dequeue(predicate_rank);
   }
 
 #ifdef BM_ENABLE_TM_DEBUG
@@ -443,58 +752,3 @@ void bm::Node::eval_predicate() {
               predicate_rank.second);
 #endif
 }
-
-#ifdef BM_ENABLE_TM_DEBUG
-
-/**
- * @brief Get the string representation of the calendar store.
- * Used for debugging purposes.
- *
- * @return std::string String representation of the timestamp
- */
-std::string bm::Node::current_time() {
-  // auto now = std::chrono::system_clock::now();
-  auto now = std::chrono::system_clock::now();
-  auto in_time_t = std::chrono::high_resolution_clock::to_time_t(now);
-  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now.time_since_epoch()) %
-            1000;
-  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                now.time_since_epoch()) %
-            1000000;
-
-  std::stringstream ss;
-  ss << std::put_time(std::localtime(&in_time_t), "%H:%M:%S");
-  ss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-  ss << '.' << std::setfill('0') << std::setw(6) << ns.count();
-  return ss.str();
-}
-
-/**
- * @brief Log packet details to CSV file.
- *
- * @param csv CSV file to write to.
- * @param cal_item CalendarItem to log.
- */
-void bm::Node::dump_packet_info(std::ofstream& csv,
-                                bm::CalendarItem* cal_item) {
-  std::string timestamp = current_time();
-
-  // Log packet details to CSV file
-  csv << timestamp << "," << cal_item->get_packet_id() << ","
-      << cal_item->get_egress_port() << "," << cal_item->get_packet_size()
-      << "," << static_cast<int>(cal_item->get_priority()) << ","
-      << static_cast<int>(cal_item->get_dscp()) << ","
-      << static_cast<int>(cal_item->get_color()) << ","
-      << static_cast<int>(cal_item->get_vlan_id()) << ","
-      << static_cast<int>(cal_item->get_sport()) << ","
-      << static_cast<int>(cal_item->get_dport()) << "\n";
-  csv.flush();
-}
-
-void bm::Node::dump_packet_info_vector(std::vector<std::string>& vec,
-                                       bm::CalendarItem* cal_item) {
-  std::string timestamp = current_time();
-  vec.push_back(timestamp + "," + std::to_string(cal_item->get_packet_id()));
-}
-#endif
\ No newline at end of file
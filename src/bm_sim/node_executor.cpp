@@ -0,0 +1,240 @@
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/node.h>
+#include <bm/bm_sim/node_executor.h>
+#include <bm/bm_sim/virtual_clock.h>
+
+#include <algorithm>  // std::max
+#include <cassert>
+#include <deque>
+#include <functional>  // std::greater
+#include <map>
+#include <queue>
+#include <utility>  // std::pair
+
+namespace {
+
+// Node::exec_state bits
+constexpr uint32_t SCHEDULED = 1;  // Queued on its worker
+constexpr uint32_t RUNNING = 2;    // Being executed
+constexpr uint32_t TIMER = 4;      // Poll timer pending
+constexpr uint32_t STOPPED = 8;    // Never executed again
+
+}  // namespace
+
+struct bm::NodeExecutor::Worker {
+  using Timer = std::pair<std::chrono::steady_clock::time_point, Node *>;
+
+  MPSCRing<Node *> run_queue{NODE_EXECUTOR_QUEUE_CAPACITY};
+  // Nodes scheduled while run_queue was full
+  std::mutex overflow_mutex;
+  std::vector<Node *> overflow;
+  std::atomic<bool> has_overflow{false};
+  // Poll timers of the nodes of the worker, only used by its thread
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+  std::thread thread;
+
+  // Virtual time only: the nodes to execute in scheduling order, and the
+  // poll timers by expiry then arming order (no tie broken by address)
+  std::deque<Node *> ready;
+  std::map<std::pair<uint64_t, uint64_t>, Node *> virtual_timers;
+  uint64_t nb_timers_armed{0};
+};
+
+namespace {
+
+// Worker of the calling thread, nullptr outside of the executors
+thread_local void *current_worker = nullptr;
+
+}  // namespace
+
+bm::NodeExecutor::NodeExecutor(size_t nb_workers) {
+  nb_workers = std::max<size_t>(nb_workers, 1);
+  for (size_t i = 0; i < nb_workers; i++)
+    workers.push_back(std::make_unique<Worker>());
+  for (auto &worker : workers)
+    worker->thread = std::thread(&NodeExecutor::run_worker, this, worker.get());
+  BMLOG_DEBUG("Node executor created with {} workers", nb_workers);
+}
+
+bm::NodeExecutor::NodeExecutor(const VirtualClock &clock) : clock(&clock) {
+  workers.push_back(std::make_unique<Worker>());
+  BMLOG_DEBUG("Node executor created in virtual time");
+}
+
+/**
+ * @brief Stop the workers. All the nodes of the executor must be destroyed
+ * (or stopped) before.
+ */
+bm::NodeExecutor::~NodeExecutor() {
+  running = false;
+  for (auto &worker : workers) {
+    worker->run_queue.wake();
+    if (worker->thread.joinable()) worker->thread.join();
+  }
+}
+
+bm::NodeExecutor *bm::NodeExecutor::get_default() {
+  // Leaked on purpose, nodes may be destroyed by static destructors
+  static NodeExecutor *executor = new NodeExecutor();
+  return executor;
+}
+
+size_t bm::NodeExecutor::get_worker(int port, int node_id) const {
+  const int key = port >= 0 ? port : node_id;
+  return static_cast<size_t>(key < 0 ? -key : key) % workers.size();
+}
+
+uint64_t bm::NodeExecutor::now_ns() const {
+  if (clock != nullptr) return clock->now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void bm::NodeExecutor::schedule(Node *node) {
+  uint32_t state = node->exec_state.load(std::memory_order_acquire);
+  do {
+    if (state & (SCHEDULED | STOPPED)) return;
+  } while (!node->exec_state.compare_exchange_weak(
+      state, state | SCHEDULED, std::memory_order_acq_rel));
+
+  Worker &worker = *workers[node->worker];
+  if (clock != nullptr) {
+    worker.ready.push_back(node);
+    return;
+  }
+  Node *queued = node;
+  if (worker.run_queue.try_push(std::move(queued))) return;
+  {
+    std::lock_guard<std::mutex> lock(worker.overflow_mutex);
+    worker.overflow.push_back(node);
+    worker.has_overflow.store(true, std::memory_order_release);
+  }
+  worker.run_queue.wake();
+}
+
+void bm::NodeExecutor::schedule_after(Node *node,
+                                      std::chrono::nanoseconds delay) {
+  Worker *worker = workers[node->worker].get();
+  assert(current_worker == worker);
+  if (node->exec_state.fetch_or(TIMER, std::memory_order_acq_rel) & TIMER)
+    return;
+  if (clock != nullptr) {
+    uint64_t expiry = clock->now() + delay.count();
+    worker->virtual_timers.emplace(
+        std::make_pair(expiry, worker->nb_timers_armed++), node);
+    return;
+  }
+  worker->timers.emplace(std::chrono::steady_clock::now() + delay, node);
+}
+
+void bm::NodeExecutor::stop(Node *node) {
+  node->exec_state.fetch_or(STOPPED, std::memory_order_acq_rel);
+  if (clock != nullptr) {
+    // Nothing runs concurrently, forget the queued executions and the timer
+    Worker &worker = *workers[node->worker];
+    worker.ready.erase(
+        std::remove(worker.ready.begin(), worker.ready.end(), node),
+        worker.ready.end());
+    for (auto it = worker.virtual_timers.begin();
+         it != worker.virtual_timers.end();) {
+      it = it->second == node ? worker.virtual_timers.erase(it) : ++it;
+    }
+    node->exec_state.fetch_and(~(SCHEDULED | TIMER),
+                               std::memory_order_acq_rel);
+  }
+  // Queued executions are skipped by the worker, timers expire within
+  // NODE_IDLE_POLL_INTERVAL
+  while (node->exec_state.load(std::memory_order_acquire) &
+         (SCHEDULED | RUNNING | TIMER)) {
+    std::this_thread::yield();
+  }
+}
+
+void bm::NodeExecutor::run_worker(Worker *worker) {
+  current_worker = worker;
+  std::vector<Node *> batch(TASK_BATCH_SIZE);
+  std::vector<Node *> overflow;
+  while (running) {
+    size_t nb_nodes;
+    if (worker->timers.empty()) {
+      nb_nodes = worker->run_queue.wait_pop_batch(batch.data(), batch.size());
+    } else {
+      auto delay =
+          worker->timers.top().first - std::chrono::steady_clock::now();
+      nb_nodes = worker->run_queue.wait_pop_batch_for(
+          batch.data(), batch.size(),
+          std::max(delay, std::chrono::steady_clock::duration::zero()));
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    while (!worker->timers.empty() && worker->timers.top().first <= now) {
+      Node *node = worker->timers.top().second;
+      worker->timers.pop();
+      fire_timer(node);
+    }
+    for (size_t i = 0; i < nb_nodes; i++) execute(batch[i]);
+
+    if (worker->has_overflow.load(std::memory_order_acquire)) {
+      {
+        std::lock_guard<std::mutex> lock(worker->overflow_mutex);
+        overflow.swap(worker->overflow);
+        worker->has_overflow.store(false, std::memory_order_relaxed);
+      }
+      for (Node *node : overflow) execute(node);
+      overflow.clear();
+    }
+  }
+  current_worker = nullptr;
+}
+
+size_t bm::NodeExecutor::run_pending() {
+  assert(clock != nullptr);
+  Worker *worker = workers.front().get();
+  current_worker = worker;
+  const uint64_t now = clock->now();
+  // Timers armed from now on expire later, a single pass fires them all
+  auto &timers = worker->virtual_timers;
+  while (!timers.empty() && timers.begin()->first.first <= now) {
+    Node *node = timers.begin()->second;
+    timers.erase(timers.begin());
+    fire_timer(node);
+  }
+  size_t nb_executions = 0;
+  while (!worker->ready.empty()) {
+    Node *node = worker->ready.front();
+    worker->ready.pop_front();
+    execute(node);
+    nb_executions++;
+  }
+  current_worker = nullptr;
+  return nb_executions;
+}
+
+bool bm::NodeExecutor::get_next_timer(uint64_t *time_ns) const {
+  assert(clock != nullptr);
+  const auto &timers = workers.front()->virtual_timers;
+  if (timers.empty()) return false;
+  *time_ns = timers.begin()->first.first;
+  return true;
+}
+
+void bm::NodeExecutor::execute(Node *node) {
+  // New work arriving from now on queues the node again
+  uint32_t state = node->exec_state.load(std::memory_order_acquire);
+  while (!node->exec_state.compare_exchange_weak(
+      state, (state & ~SCHEDULED) | RUNNING, std::memory_order_acq_rel)) {
+  }
+  if (!(state & STOPPED)) node->execute();
+  // The node may be destroyed as soon as the bit is cleared
+  node->exec_state.fetch_and(~RUNNING, std::memory_order_acq_rel);
+}
+
+void bm::NodeExecutor::fire_timer(Node *node) {
+  if (!(node->exec_state.load(std::memory_order_acquire) & STOPPED)) {
+    node->timer_fired = true;
+    schedule(node);
+  }
+  // The node may be destroyed as soon as the bit is cleared
+  node->exec_state.fetch_and(~TIMER, std::memory_order_acq_rel);
+}
@@ -0,0 +1,95 @@
+#include <bm/bm_sim/packet_store.h>
+
+#include <cassert>
+#include <utility>
+
+bm::PacketStore::PacketStore(size_t capacity) : slots(capacity) {
+  assert(capacity > 0);
+  free_slots.reserve(capacity);
+  for (size_t i = capacity; i > 0; i--)
+    free_slots.push_back(static_cast<uint32_t>(i - 1));
+}
+
+/**
+ * @brief File @p packet in a free slot.
+ *
+ * @param packet Packet to store, must not be null.
+ * @return Handle of the packet, valid until it is taken.
+ */
+bm::PacketHandle bm::PacketStore::insert(std::unique_ptr<Packet> &&packet) {
+  assert(packet != nullptr);
+  std::unique_lock<std::mutex> lock(mutex);
+  not_full.wait(lock, [this]() { return !free_slots.empty(); });
+  uint32_t index = free_slots.back();
+  free_slots.pop_back();
+
+  Slot &slot = slots[index];
+  // Generation 0 is skipped when wrapping around, so that no handle is 0
+  if (++slot.generation == 0) slot.generation = 1;
+  slot.packet = std::move(packet);
+  return (static_cast<PacketHandle>(slot.generation) << 32) | index;
+}
+
+/**
+ * @brief File the first packets of @p packets, as many as the store has free
+ * slots for. Only the first packet waits for a slot, so that the caller can
+ * hand the packets already filed over before waiting for more.
+ *
+ * @param packets Packets to store, must not be null, moved from when filed.
+ * @param nb_packets Number of packets, at least 1.
+ * @param handles Handles of the packets filed, in the same order.
+ * @return Number of packets filed, from the start of @p packets.
+ */
+size_t bm::PacketStore::insert_batch(std::unique_ptr<Packet> *packets,
+                                     size_t nb_packets,
+                                     PacketHandle *handles) {
+  assert(nb_packets > 0);
+  std::unique_lock<std::mutex> lock(mutex);
+  not_full.wait(lock, [this]() { return !free_slots.empty(); });
+  size_t nb_filed = 0;
+  for (; nb_filed < nb_packets && !free_slots.empty(); nb_filed++) {
+    assert(packets[nb_filed] != nullptr);
+    uint32_t index = free_slots.back();
+    free_slots.pop_back();
+
+    Slot &slot = slots[index];
+    if (++slot.generation == 0) slot.generation = 1;
+    slot.packet = std::move(packets[nb_filed]);
+    handles[nb_filed] = (static_cast<PacketHandle>(slot.generation) << 32) |
+                        index;
+  }
+  return nb_filed;
+}
+
+std::unique_ptr<bm::Packet> bm::PacketStore::take(PacketHandle handle) {
+  std::unique_ptr<Packet> packet;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (find(handle) == nullptr) return nullptr;
+    uint32_t index = static_cast<uint32_t>(handle);
+    packet = std::move(slots[index].packet);
+    free_slots.push_back(index);
+  }
+  not_full.notify_one();
+  return packet;
+}
+
+bm::Packet *bm::PacketStore::get(PacketHandle handle) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const Slot *slot = find(handle);
+  return (slot == nullptr) ? nullptr : slot->packet.get();
+}
+
+size_t bm::PacketStore::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return slots.size() - free_slots.size();
+}
+
+const bm::PacketStore::Slot *bm::PacketStore::find(PacketHandle handle) const {
+  uint32_t index = static_cast<uint32_t>(handle);
+  uint32_t generation = static_cast<uint32_t>(handle >> 32);
+  if (index >= slots.size()) return nullptr;
+  const Slot &slot = slots[index];
+  if (slot.packet == nullptr || slot.generation != generation) return nullptr;
+  return &slot;
+}
@@ -154,6 +154,9 @@ PeriodicTaskList::loop() {
 
 PeriodicTaskList&
 PeriodicTaskList::get_instance() {
+    // The destructor may log: the logger has to be created first, so that it
+    // is destroyed after the instance
+    Logger::get();
     static PeriodicTaskList instance;
     return instance;
 }
@@ -0,0 +1,84 @@
+#include <bm/bm_sim/scheduler_params.h>
+
+#include <algorithm>  // std::copy
+#include <cstring>    // std::memcpy
+#include <thread>
+
+constexpr size_t bm::SchedulerParams::MAX_PARAMS;
+constexpr size_t bm::SchedulerParams::MAX_VALUES;
+
+/**
+ * @brief Pin the front buffer. A writer may publish a new version between
+ * the read of the version and the pin, the pin is then retried: once pinned,
+ * the buffer is never the back buffer of an update.
+ */
+bm::SchedulerParams::Pin::Pin(const SchedulerParams &params)
+    : params(params) {
+  while (true) {
+    version = params.version.load(std::memory_order_seq_cst);
+    auto &readers = params.readers[version & 1];
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (params.version.load(std::memory_order_seq_cst) == version) break;
+    readers.fetch_sub(1, std::memory_order_release);
+  }
+  snapshot = &params.buffers[version & 1];
+}
+
+bm::SchedulerParams::Pin::~Pin() {
+  params.readers[version & 1].fetch_sub(1, std::memory_order_release);
+}
+
+bm::SchedulerParams::SchedulerParams() {
+  readers[0] = 0;
+  readers[1] = 0;
+  std::memset(buffers, 0, sizeof(buffers));
+}
+
+template <typename Fn>
+void bm::SchedulerParams::publish(Fn apply) {
+  const uint64_t current = version.load(std::memory_order_relaxed);
+  const Snapshot &front = buffers[current & 1];
+  Snapshot &back = buffers[(current + 1) & 1];
+  // Hooks still running on the previous version
+  while (readers[(current + 1) & 1].load(std::memory_order_seq_cst) != 0)
+    std::this_thread::yield();
+  std::memcpy(&back, &front, sizeof(Snapshot));
+  apply(&back);
+  version.store(current + 1, std::memory_order_seq_cst);
+}
+
+bool bm::SchedulerParams::set(size_t param,
+                              const std::vector<uint64_t> &values) {
+  Updates updates;
+  updates.emplace_back(param, values);
+  return set(updates);
+}
+
+bool bm::SchedulerParams::set(const Updates &updates) {
+  if (!in_bounds(updates)) return false;
+  std::lock_guard<std::mutex> lock(write_mutex);
+  publish([&updates](Snapshot *snapshot) {
+    for (const auto &update : updates) {
+      auto &values = snapshot->values[update.first];
+      std::fill(std::begin(values), std::end(values), 0);
+      std::copy(update.second.begin(), update.second.end(), values);
+      snapshot->sizes[update.first] = update.second.size();
+    }
+  });
+  return true;
+}
+
+bool bm::SchedulerParams::in_bounds(const Updates &updates) {
+  for (const auto &update : updates) {
+    if (update.first >= MAX_PARAMS || update.second.size() > MAX_VALUES)
+      return false;
+  }
+  return true;
+}
+
+void bm::SchedulerParams::clear() {
+  std::lock_guard<std::mutex> lock(write_mutex);
+  publish([](Snapshot *snapshot) {
+    std::memset(snapshot, 0, sizeof(Snapshot));
+  });
+}
@@ -0,0 +1,121 @@
+#include <bm/bm_sim/timer_wheel.h>
+
+#include <algorithm>  // std::max
+#include <utility>    // std::move
+
+constexpr size_t bm::TimerWheel::TIMER_WHEEL_BITS;
+constexpr size_t bm::TimerWheel::TIMER_WHEEL_SLOTS;
+constexpr size_t bm::TimerWheel::TIMER_WHEEL_LEVELS;
+
+bm::TimerWheel::TimerId bm::TimerWheel::add(uint64_t interval,
+                                            Callback callback) {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint32_t index;
+  if (free_indexes.empty()) {
+    index = static_cast<uint32_t>(timers.size());
+    timers.emplace_back();
+  } else {
+    index = free_indexes.back();
+    free_indexes.pop_back();
+  }
+  Timer &timer = timers[index];
+  timer.interval = std::max<uint64_t>(interval, 1);
+  timer.expiry = now + timer.interval;
+  timer.callback = std::move(callback);
+  timer.active = true;
+  nb_active++;
+  file(index);
+  return (static_cast<uint64_t>(timer.generation) << 32) | index;
+}
+
+bool bm::TimerWheel::remove(TimerId id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto index = static_cast<uint32_t>(id);
+  auto generation = static_cast<uint32_t>(id >> 32);
+  if (index >= timers.size()) return false;
+  Timer &timer = timers[index];
+  if (!timer.active || timer.generation != generation) return false;
+  timer.active = false;
+  timer.callback = nullptr;
+  timer.generation++;
+  nb_active--;
+  free_indexes.push_back(index);
+  return true;
+}
+
+/**
+ * @brief File a timer in the lowest level covering its expiry.
+ */
+void bm::TimerWheel::file(uint32_t index) {
+  const Timer &timer = timers[index];
+  uint64_t delta = timer.expiry - now;
+  size_t level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         (delta >> (TIMER_WHEEL_BITS * (level + 1))) != 0)
+    level++;
+  size_t slot =
+      (timer.expiry >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  levels[level][slot].push_back({index, timer.generation});
+}
+
+/**
+ * @brief Move one tick forward: cascade the levels which wrapped around,
+ * highest first, and collect the timers expiring now.
+ */
+void bm::TimerWheel::tick(std::vector<uint32_t> *expired) {
+  now++;
+  for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+    uint64_t period = uint64_t(1) << (TIMER_WHEEL_BITS * level);
+    if ((now & (period - 1)) != 0) continue;
+    size_t slot =
+        (now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    std::vector<Entry> entries;
+    entries.swap(levels[level][slot]);
+    for (const auto &entry : entries) {
+      const Timer &timer = timers[entry.index];
+      if (!timer.active || timer.generation != entry.generation) continue;
+      if (timer.expiry <= now)
+        expired->push_back(entry.index);
+      else
+        file(entry.index);
+    }
+  }
+
+  auto &slot = levels[0][now & (TIMER_WHEEL_SLOTS - 1)];
+  for (const auto &entry : slot) {
+    const Timer &timer = timers[entry.index];
+    if (timer.active && timer.generation == entry.generation)
+      expired->push_back(entry.index);
+  }
+  slot.clear();
+}
+
+void bm::TimerWheel::advance(uint64_t nb_ticks) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (nb_active == 0) {
+    // Only stale entries left in the slots, nothing to cascade or fire
+    now += nb_ticks;
+    return;
+  }
+  std::vector<uint32_t> expired;
+  for (uint64_t i = 0; i < nb_ticks; i++) {
+    tick(&expired);
+    for (auto index : expired) {
+      Timer &timer = timers[index];
+      timer.callback();
+      timer.expiry = now + timer.interval;
+      file(index);
+    }
+    expired.clear();
+  }
+}
+
+uint64_t bm::TimerWheel::get_now() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return now;
+}
+
+size_t bm::TimerWheel::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return nb_active;
+}
@@ -0,0 +1,73 @@
+#include <bm/bm_sim/P4Objects.h>
+#include <bm/bm_sim/node.h>
+#include <bm/bm_sim/tm_adapter.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+void bm::TMEgressSink::slot_freed(uint32_t egress_port) {
+  wake(false, egress_port);
+}
+
+void bm::TMEgressSink::slot_freed() { wake(true, 0); }
+
+/**
+ * @brief Register @p root, held back by the lack of a free slot of
+ * @p egress_port. The count is published before the caller checks the free
+ * slots again: a slot freed in between either shows up in that check or
+ * finds the root registered.
+ */
+void bm::TMEgressSink::wait_for_slot(uint32_t egress_port, Node *root) {
+  std::lock_guard<std::mutex> lock(waiters_mutex);
+  const auto waiter = std::make_pair(egress_port, root);
+  if (std::find(waiters.begin(), waiters.end(), waiter) != waiters.end())
+    return;
+  waiters.push_back(waiter);
+  nb_waiters.store(waiters.size());
+}
+
+void bm::TMEgressSink::cancel_wait(Node *root) {
+  // Always locked: a wake() holding the lock may still be requesting the
+  // predicate of @p root
+  std::lock_guard<std::mutex> lock(waiters_mutex);
+  waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                               [root](const std::pair<uint32_t, Node *> &w) {
+                                 return w.second == root;
+                               }),
+                waiters.end());
+  nb_waiters.store(waiters.size());
+}
+
+/**
+ * @brief Request the predicate of the roots waiting for a slot of
+ * @p egress_port (of any port if @p all_ports), under the lock so that
+ * cancel_wait() cannot let a root go away meanwhile.
+ */
+void bm::TMEgressSink::wake(bool all_ports, uint32_t egress_port) {
+  if (nb_waiters.load() == 0) return;
+  std::lock_guard<std::mutex> lock(waiters_mutex);
+  auto woken = std::partition(waiters.begin(), waiters.end(),
+                              [all_ports, egress_port](
+                                  const std::pair<uint32_t, Node *> &w) {
+                                return !all_ports && w.first != egress_port;
+                              });
+  for (auto it = woken; it != waiters.end(); ++it)
+    it->second->request_predicate();
+  waiters.erase(woken, waiters.end());
+  nb_waiters.store(waiters.size());
+}
+
+bm::P4ActionSource::P4ActionSource(const P4Objects *objects,
+                                   std::vector<std::string> controls)
+    : objects(objects), controls(std::move(controls)) {}
+
+bm::ActionFn *bm::P4ActionSource::get_action(const std::string &name) const {
+  for (const auto &control : controls) {
+    ActionFn *action_fn =
+        objects->get_one_action_with_name(control + "." + name);
+    if (action_fn != nullptr) return action_fn;
+  }
+  return nullptr;
+}
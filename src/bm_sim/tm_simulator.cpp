@@ -0,0 +1,435 @@
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/node.h>
+#include <bm/bm_sim/node_executor.h>
+#include <bm/bm_sim/pcap_file.h>
+#include <bm/bm_sim/tm_simulator.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <algorithm>  // std::min, std::stable_sort
+#include <cctype>     // std::isdigit
+#include <chrono>
+#include <cstdio>  // std::sscanf
+#include <fstream>
+#include <iterator>  // std::distance
+#include <limits>
+#include <sstream>
+#include <stdexcept>  // std::exception
+
+namespace {
+
+constexpr uint64_t ns_per_s = 1000000000;
+
+uint16_t read_u16(const unsigned char *data) {
+  return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+// Fields of an Ethernet frame: VLAN tag, IPv4 / IPv6 traffic class, TCP /
+// UDP ports. Stops at the first header it does not know
+void parse_headers(const unsigned char *data, size_t size,
+                   bm::SimPacket *packet) {
+  if (size < 14) return;
+  uint16_t ether_type = read_u16(data + 12);
+  size_t offset = 14;
+  if ((ether_type == 0x8100 || ether_type == 0x88a8) && size >= offset + 4) {
+    uint16_t tci = read_u16(data + offset);
+    packet->priority = static_cast<uint8_t>(tci >> 13);
+    packet->vlan_id = tci & 0x0fff;
+    ether_type = read_u16(data + offset + 2);
+    offset += 4;
+  }
+  uint8_t protocol;
+  if (ether_type == 0x0800 && size >= offset + 20) {
+    packet->dscp = data[offset + 1];
+    protocol = data[offset + 9];
+    offset += (data[offset] & 0x0f) * 4;
+  } else if (ether_type == 0x86dd && size >= offset + 40) {
+    packet->dscp = static_cast<uint8_t>((read_u16(data + offset) >> 4) & 0xff);
+    protocol = data[offset + 6];
+    offset += 40;
+  } else {
+    return;
+  }
+  if ((protocol == 6 || protocol == 17) && size >= offset + 4) {
+    packet->sport = read_u16(data + offset);
+    packet->dport = read_u16(data + offset + 2);
+  }
+}
+
+// Whole token as an unsigned integer, no sign and nothing after the digits
+bool parse_uint(const std::string &token, uint64_t *value) {
+  if (token.empty() || !std::isdigit(static_cast<unsigned char>(token[0])))
+    return false;
+  size_t pos = 0;
+  try {
+    *value = std::stoull(token, &pos);
+  } catch (const std::exception &) {
+    return false;
+  }
+  return pos == token.size();
+}
+
+// Timestamp of a CSV trace: ns, or the HH:MM:SS.mmm.nnnnnn local time of the
+// packet logs (milliseconds, then nanoseconds within the millisecond)
+bool parse_time(const std::string &token, uint64_t *time_ns) {
+  if (parse_uint(token, time_ns)) return true;
+  static const std::string format = "00:00:00.000.000000";
+  if (token.size() != format.size()) return false;
+  for (size_t i = 0; i < format.size(); i++) {
+    const bool digit = std::isdigit(static_cast<unsigned char>(token[i]));
+    if (format[i] == '0' ? !digit : token[i] != format[i]) return false;
+  }
+  unsigned hours, minutes, seconds, ms, ns;
+  std::sscanf(token.c_str(), "%2u:%2u:%2u.%3u.%6u", &hours, &minutes,
+              &seconds, &ms, &ns);
+  if (hours > 23 || minutes > 59 || seconds > 60) return false;
+  *time_ns = ((hours * 3600ull + minutes * 60 + seconds) * 1000 + ms) *
+                 1000000 +
+             ns;
+  return true;
+}
+
+}  // namespace
+
+bm::TMSimulator::TMSimulator()
+    : tm(std::make_unique<TrafficManager>(this)) {}
+
+// The TM goes first, it may still call transmit() while its nodes stop
+bm::TMSimulator::~TMSimulator() { tm.reset(); }
+
+/**
+ * @brief Configure the TM of the simulation with a "tmconfig" message, like
+ * the configuration server of the switch. The first configuration also gives
+ * the PHV fields the TM reads, from its "fields" object.
+ */
+bool bm::TMSimulator::configure(const std::string &config,
+                                std::string *error) {
+  if (ran) {
+    *error = "The simulation already ran";
+    return false;
+  }
+  if (!configured) {
+    try {
+      CalendarItemFieldMap fields;
+      if (ConfigParser::parse_fields(config, &fields) ==
+          ConfigSection::Invalid) {
+        *error = "Invalid TM fields";
+        return false;
+      }
+      build_phv(fields);
+    } catch (const std::exception &e) {
+      *error = std::string("Invalid configuration: ") + e.what();
+      return false;
+    }
+    tm->set_phv_factory(&phv_factory);
+    configured = true;
+  }
+  return tm->apply_config_message(config, error);
+}
+
+void bm::TMSimulator::set_default_port(const SimPortConfig &config) {
+  default_port = config;
+  default_port.capacity = std::max<size_t>(default_port.capacity, 1);
+}
+
+void bm::TMSimulator::set_port(uint32_t egress_port,
+                               const SimPortConfig &config) {
+  Port &port = get_port(egress_port);
+  port.config = config;
+  port.config.capacity = std::max<size_t>(port.config.capacity, 1);
+}
+
+bm::TMSimulator::Port &bm::TMSimulator::get_port(uint32_t egress_port) {
+  auto it = ports.find(egress_port);
+  if (it == ports.end())
+    it = ports.emplace(egress_port, Port{default_port}).first;
+  return it->second;
+}
+
+/**
+ * @brief One metadata header per header of the field map, with all its
+ * fields 32-bit wide. The headers are in name order, the layout only depends
+ * on the field map.
+ */
+void bm::TMSimulator::build_phv(const CalendarItemFieldMap &fields) {
+  auto split = [](const std::string &name, std::string *header,
+                  std::string *field) {
+    auto dot = name.find('.');
+    if (dot == std::string::npos) return false;
+    *header = name.substr(0, dot);
+    *field = name.substr(dot + 1);
+    return true;
+  };
+
+  std::map<std::string, std::vector<std::string>> layout;
+  std::string header, field;
+  for (size_t i = 0; i < field_locations.size(); i++) {
+    const auto &name =
+        fields.get_field_name(static_cast<CalendarItemField>(i));
+    if (!split(name, &header, &field)) continue;
+    auto &names = layout[header];
+    if (std::find(names.begin(), names.end(), field) == names.end())
+      names.push_back(field);
+  }
+
+  header_id_t header_id = 0;
+  for (const auto &entry : layout) {
+    header_types.push_back(
+        std::make_unique<HeaderType>(entry.first + "_t", header_id));
+    for (const auto &name : entry.second)
+      header_types.back()->push_back_field(name, 32);
+    phv_factory.push_back_header(entry.first, header_id,
+                                 *header_types.back(), true);
+    header_id++;
+  }
+
+  for (size_t i = 0; i < field_locations.size(); i++) {
+    const auto &name =
+        fields.get_field_name(static_cast<CalendarItemField>(i));
+    if (!split(name, &header, &field)) continue;
+    auto index = std::distance(layout.begin(), layout.find(header));
+    field_locations[i].header_id = static_cast<header_id_t>(index);
+    field_locations[i].offset =
+        header_types[index]->get_field_offset(field);
+    field_locations[i].found = true;
+  }
+
+  phv_source = PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+}
+
+// The id of the bm::Packet is the index of the SimPacket in the input
+std::unique_ptr<bm::Packet> bm::TMSimulator::make_packet(
+    const SimPacket &packet, uint64_t index) {
+  auto new_packet = std::make_unique<Packet>(Packet::make_new(
+      0, 0, index, 0, static_cast<int>(packet.packet_size),
+      PacketBuffer(packet.packet_size), phv_source.get()));
+  new_packet->set_egress_port(packet.egress_port);
+  // Same order as CalendarItemField
+  const uint32_t values[] = {packet.egress_port, packet.packet_size,
+                             packet.priority,    packet.dscp,
+                             packet.color,       packet.vlan_id,
+                             packet.sport,       packet.dport};
+  static_assert(sizeof(values) / sizeof(values[0]) ==
+                    static_cast<size_t>(CalendarItemField::NbFields),
+                "one value per CalendarItemField");
+  PHV *phv = new_packet->get_phv();
+  for (size_t i = 0; i < field_locations.size(); i++) {
+    const FieldLocation &location = field_locations[i];
+    if (location.found)
+      phv->get_field(location.header_id, location.offset).set(values[i]);
+  }
+  return new_packet;
+}
+
+size_t bm::TMSimulator::get_free_slots(uint32_t egress_port,
+                                       size_t /* priority */) {
+  const Port &port = get_port(egress_port);
+  return port.config.capacity - std::min(port.queue.size(),
+                                         port.config.capacity);
+}
+
+/**
+ * @brief The packet is transmitted on the link of the port as soon as the
+ * packets before it are, at the rate of the port. The departure is reported
+ * by run() once the transmission ended.
+ */
+bool bm::TMSimulator::transmit(uint32_t egress_port, size_t /* priority */,
+                               std::unique_ptr<Packet> &&packet,
+                               size_t /* bytes */) {
+  Port &port = get_port(egress_port);
+  if (port.queue.size() >= port.config.capacity) return false;
+  const uint64_t index = packet->get_packet_id();
+  uint64_t start = std::max(clock.now(), port.busy_until);
+  uint64_t duration = 0;
+  if (port.config.rate_bps > 0) {
+    uint64_t bits_ns =
+        uint64_t((*packets)[index].packet_size) * 8 * ns_per_s +
+        port.remainder;
+    duration = bits_ns / port.config.rate_bps;
+    port.remainder = bits_ns % port.config.rate_bps;
+  }
+  port.busy_until = start + duration;
+  port.queue.emplace_back(port.busy_until, index);
+  return true;
+}
+
+/**
+ * @brief Event loop of the simulation. At each step the clock jumps to the
+ * earliest event, then, in this order: the transmissions ending at that time
+ * are reported, the timer wheel ticks, the nodes whose poll timer expired run,
+ * and the packets arriving at that time are enqueued one by one, each
+ * followed by the executions it triggers.
+ */
+bm::SimStats bm::TMSimulator::run(const std::vector<SimPacket> &packets,
+                                  const DepartureFn &on_departure) {
+  SimStats stats{};
+  if (ran) return stats;
+  ran = true;
+  if (!configured) {
+    build_phv(CalendarItemFieldMap());
+    configured = true;
+  }
+  this->packets = &packets;
+  NodeExecutor *executor = tm->get_node_executor();
+  const uint64_t tick_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(NODE_TIMER_TICK)
+          .count();
+  constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+  size_t next = 0;
+  // Last arrival or departure, to detect the packets stuck in the TM
+  uint64_t last_progress = 0;
+  while (true) {
+    uint64_t time = never;
+    if (next < packets.size()) time = packets[next].time_ns;
+    uint64_t timer;
+    if (executor->get_next_timer(&timer)) time = std::min(time, timer);
+    if (tm->timer_wheel.size() > 0)
+      time = std::min(time, (tm->timer_wheel.get_now() + 1) * tick_ns);
+    bool ports_busy = false;
+    for (const auto &entry : ports) {
+      if (entry.second.queue.empty()) continue;
+      ports_busy = true;
+      time = std::min(time, entry.second.queue.front().first);
+    }
+
+    if (next == packets.size() && !ports_busy) {
+      bool tm_empty = tm->buffer_manager.get_shared_stats().packets == 0;
+      if (tm_empty || time == never ||
+          time > last_progress + TM_SIM_STALL_TIMEOUT_NS)
+        break;
+    }
+    clock.advance_to(time);
+
+    for (auto &entry : ports) {
+      Port &port = entry.second;
+      bool departed = false;
+      while (!port.queue.empty() && port.queue.front().first <= time) {
+        on_departure(packets[port.queue.front().second],
+                     port.queue.front().first);
+        port.queue.pop_front();
+        stats.nb_departures++;
+        departed = true;
+      }
+      if (!departed) continue;
+      last_progress = time;
+      // The roots of the port waiting for a slot may release their packet
+      slot_freed(entry.first);
+    }
+    if (tm->timer_wheel.size() > 0 &&
+        time >= (tm->timer_wheel.get_now() + 1) * tick_ns)
+      tm->timer_tick();
+    stats.nb_executions += executor->run_pending();
+
+    while (next < packets.size() && packets[next].time_ns <= time) {
+      tm->enqueue(packets[next].egress_port,
+                  make_packet(packets[next], next));
+      next++;
+      stats.nb_arrivals++;
+      last_progress = time;
+      stats.nb_executions += executor->run_pending();
+    }
+  }
+
+  stats.end_time_ns = clock.now();
+  stats.nb_left = tm->buffer_manager.get_shared_stats().packets;
+  stats.nb_drops = stats.nb_arrivals - stats.nb_departures - stats.nb_left;
+  if (stats.nb_left > 0) {
+    Logger::get()->warn(
+        "TM simulation: {} packets still in the TM after {} ns without "
+        "progress",
+        stats.nb_left, TM_SIM_STALL_TIMEOUT_NS);
+  }
+  return stats;
+}
+
+bool bm::TMSimulator::read_csv(const std::string &path,
+                               std::vector<SimPacket> *packets,
+                               std::string *error) {
+  std::ifstream file(path);
+  if (!file) {
+    *error = "Cannot open " + path;
+    return false;
+  }
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    // Header, comments and blank lines
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || !std::isdigit(static_cast<unsigned char>(line[0])))
+      continue;
+    std::vector<uint64_t> values;
+    std::istringstream stream(line);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+      uint64_t value;
+      const bool valid = values.empty() ? parse_time(token, &value)
+                                        : parse_uint(token, &value);
+      if (!valid) {
+        *error = path + ":" + std::to_string(line_number) +
+                 ": invalid value " + token;
+        return false;
+      }
+      values.push_back(value);
+    }
+    if (values.size() < 4) {
+      *error = path + ":" + std::to_string(line_number) +
+               ": expected at least Timestamp, PacketID, EgressPort and "
+               "PacketSize";
+      return false;
+    }
+    values.resize(10, 0);
+    SimPacket packet;
+    packet.time_ns = values[0];
+    packet.packet_id = values[1];
+    packet.egress_port = static_cast<uint32_t>(values[2]);
+    packet.packet_size = static_cast<uint32_t>(values[3]);
+    packet.priority = static_cast<uint8_t>(values[4]);
+    packet.dscp = static_cast<uint8_t>(values[5]);
+    packet.color = static_cast<uint8_t>(values[6]);
+    packet.vlan_id = static_cast<uint16_t>(values[7]);
+    packet.sport = static_cast<uint16_t>(values[8]);
+    packet.dport = static_cast<uint16_t>(values[9]);
+    packets->push_back(packet);
+  }
+  return true;
+}
+
+bool bm::TMSimulator::read_pcap(const std::string &path, uint32_t egress_port,
+                                std::vector<SimPacket> *packets,
+                                std::string *error) {
+  // PcapFileIn exits on the files it cannot open
+  if (!std::ifstream(path)) {
+    *error = "Cannot open " + path;
+    return false;
+  }
+  PcapFileIn file(egress_port, path);
+  uint64_t packet_id = 0;
+  while (file.moveNext()) {
+    auto pcap_packet = file.current();
+    const struct timeval *tv = pcap_packet->getTime();
+    SimPacket packet{};
+    packet.time_ns = static_cast<uint64_t>(tv->tv_sec) * ns_per_s +
+                     static_cast<uint64_t>(tv->tv_usec) * 1000;
+    packet.packet_id = packet_id++;
+    packet.egress_port = egress_port;
+    packet.packet_size = pcap_packet->getLength();
+    parse_headers(reinterpret_cast<const unsigned char *>(
+                      pcap_packet->getData()),
+                  pcap_packet->getLength(), &packet);
+    packets->push_back(packet);
+  }
+  return true;
+}
+
+void bm::TMSimulator::normalize(std::vector<SimPacket> *packets) {
+  if (packets->empty()) return;
+  std::stable_sort(packets->begin(), packets->end(),
+                   [](const SimPacket &a, const SimPacket &b) {
+                     return a.time_ns < b.time_ns;
+                   });
+  const uint64_t start = packets->front().time_ns;
+  for (auto &packet : *packets) packet.time_ns -= start;
+}
@@ -0,0 +1,235 @@
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/tm_trace.h>
+
+#include <algorithm>  // std::copy
+#include <chrono>
+#include <cstdlib>  // std::atexit
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+constexpr auto drain_period = std::chrono::milliseconds(1);
+// Clock records, for the offline conversion of the timestamps
+constexpr auto clock_period = std::chrono::seconds(1);
+
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+}  // namespace
+
+/**
+ * @brief Records of one thread. Only that thread pushes, only the writer
+ * pops: head and tail are each written by a single thread and live on their
+ * own cache line.
+ */
+struct bm::TMTrace::Ring {
+  static constexpr size_t mask = TM_TRACE_RING_SIZE - 1;
+  static_assert((TM_TRACE_RING_SIZE & mask) == 0,
+                "TM_TRACE_RING_SIZE must be a power of two");
+
+  alignas(64) std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> nb_lost{0};
+  alignas(64) std::atomic<uint64_t> tail{0};
+  // The thread exited, the writer forgets the ring once drained
+  std::atomic<bool> orphaned{false};
+  std::unique_ptr<TraceRecord[]> records{new TraceRecord[TM_TRACE_RING_SIZE]};
+
+  void push(const TraceRecord &record) {
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    if (pos - tail.load(std::memory_order_acquire) == TM_TRACE_RING_SIZE) {
+      nb_lost.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    records[pos & mask] = record;
+    head.store(pos + 1, std::memory_order_release);
+  }
+
+  // Append the pending records to @p out
+  void pop_all(std::vector<TraceRecord> *out) {
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    const uint64_t end = head.load(std::memory_order_acquire);
+    for (; pos != end; pos++) out->push_back(records[pos & mask]);
+    tail.store(pos, std::memory_order_release);
+  }
+};
+
+namespace {
+
+// Ring of the calling thread, orphaned when the thread exits
+struct ThreadRing {
+  std::shared_ptr<bm::TMTrace::Ring> ring;
+
+  ~ThreadRing() {
+    if (ring != nullptr) ring->orphaned.store(true, std::memory_order_release);
+  }
+};
+
+thread_local ThreadRing thread_ring;
+
+}  // namespace
+
+bm::TMTrace *bm::TMTrace::get() {
+  // Leaked on purpose, see the declaration
+  static TMTrace *trace = [] {
+    auto *new_trace = new TMTrace();
+    std::atexit([] { TMTrace::get()->stop(); });
+    return new_trace;
+  }();
+  return trace;
+}
+
+uint64_t bm::TMTrace::now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+bool bm::TMTrace::start(const std::string &path) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+  stop_writer();
+  file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    BMLOG_ERROR("Cannot create TM trace file {}", path);
+    return false;
+  }
+  TraceFileHeader header;
+  std::copy(TM_TRACE_MAGIC, TM_TRACE_MAGIC + sizeof(header.magic),
+            header.magic);
+  header.version = 1;
+  header.record_size = sizeof(TraceRecord);
+  std::fwrite(&header, sizeof(header), 1, file);
+  {
+    // Records pushed while the previous trace was stopping
+    std::lock_guard<std::mutex> rings_lock(rings_mutex);
+    for (auto &ring : rings) {
+      ring->pop_all(&write_buffer);
+      ring->nb_lost.store(0);
+    }
+    write_buffer.clear();
+  }
+  nb_records = 0;
+  write_clock();
+  writer_stop = false;
+  writer = std::thread(&TMTrace::run_writer, this);
+  enabled = true;
+  BMLOG_DEBUG("TM trace started to {}", path);
+  return true;
+}
+
+void bm::TMTrace::stop() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+  stop_writer();
+}
+
+// Records pushed while the writer stops stay in the rings, they are dropped
+// by the next start()
+void bm::TMTrace::stop_writer() {
+  if (!writer.joinable()) return;
+  enabled = false;
+  {
+    std::lock_guard<std::mutex> writer_lock(writer_mutex);
+    writer_stop = true;
+  }
+  writer_cv.notify_one();
+  writer.join();
+  drain();
+  write_clock();
+  std::fclose(file);
+  file = nullptr;
+  BMLOG_DEBUG("TM trace stopped, {} records, {} lost", get_nb_records(),
+              get_nb_lost());
+}
+
+uint64_t bm::TMTrace::get_nb_records() const {
+  return nb_records.load(std::memory_order_relaxed);
+}
+
+uint64_t bm::TMTrace::get_nb_lost() const {
+  std::lock_guard<std::mutex> lock(rings_mutex);
+  uint64_t nb_lost = 0;
+  for (const auto &ring : rings)
+    nb_lost += ring->nb_lost.load(std::memory_order_relaxed);
+  return nb_lost;
+}
+
+void bm::TMTrace::push(TraceEvent event, int node_id,
+                       const CalendarItem &item) {
+  TraceRecord record;
+  record.timestamp = now();
+  record.packet_id = item.get_packet_id();
+  record.node_id = node_id;
+  record.rank_day = item.get_rank().first;
+  record.rank_time = item.get_rank().second;
+  record.packet_size = static_cast<uint32_t>(item.get_packet_size());
+  record.egress_port = static_cast<uint16_t>(item.get_egress_port());
+  record.vlan_id = item.get_vlan_id();
+  record.sport = item.get_sport();
+  record.dport = item.get_dport();
+  record.event = static_cast<uint8_t>(event);
+  record.priority = item.get_priority();
+  record.dscp = item.get_dscp();
+  record.color = item.get_color();
+  record.reserved = 0;
+  get_ring()->push(record);
+}
+
+bm::TMTrace::Ring *bm::TMTrace::get_ring() {
+  if (thread_ring.ring == nullptr) {
+    thread_ring.ring = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(thread_ring.ring);
+  }
+  return thread_ring.ring.get();
+}
+
+void bm::TMTrace::run_writer() {
+  auto next_clock = std::chrono::steady_clock::now() + clock_period;
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  while (!writer_stop) {
+    writer_cv.wait_for(lock, drain_period);
+    drain();
+    if (std::chrono::steady_clock::now() >= next_clock) {
+      write_clock();
+      next_clock += clock_period;
+    }
+  }
+}
+
+void bm::TMTrace::drain() {
+  write_buffer.clear();
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto it = rings.begin(); it != rings.end();) {
+      // Read before the last pop: the last record of the thread is in it
+      bool orphaned = (*it)->orphaned.load(std::memory_order_acquire);
+      (*it)->pop_all(&write_buffer);
+      it = orphaned ? rings.erase(it) : it + 1;
+    }
+  }
+  if (write_buffer.empty()) return;
+  std::fwrite(write_buffer.data(), sizeof(TraceRecord), write_buffer.size(),
+              file);
+  nb_records.fetch_add(write_buffer.size(), std::memory_order_relaxed);
+}
+
+void bm::TMTrace::write_clock() {
+  TraceRecord record{};
+  record.event = static_cast<uint8_t>(TraceEvent::Clock);
+  record.node_id = -1;
+  record.timestamp = now();
+  record.packet_id = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+  std::fwrite(&record, sizeof(record), 1, file);
+}
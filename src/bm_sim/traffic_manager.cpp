@@ -1,34 +1,109 @@
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/native_scheduler.h>
 #include <bm/bm_sim/task.h>  // Task
+#include <bm/bm_sim/tm_simulator.h>
+#include <bm/bm_sim/tm_trace.h>
 #include <bm/bm_sim/traffic_manager.h>
 
+#include <algorithm>  // std::all_of, std::find_if, std::min
+#include <cassert>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
-#include "jsoncpp/json.h"
+bm::TrafficManager::TrafficManager(std::unique_ptr<NodeExecutor> executor)
+    : node_executor(std::move(executor)) {
+  for (size_t i = 0; i < EGRESS_PORT_NUMBER; i++) {
+    task_queues.push_back(std::make_unique<TaskQueue>(TASK_QUEUE_CAPACITY));
+    packet_stores.push_back(
+        std::make_unique<PacketStore>(TM_PACKET_STORE_CAPACITY));
+    // Room for a full packet store plus the items in transit on each side of
+    // it (batch waiting for the store, dequeue worker)
+    calendar_item_pools.push_back(std::make_unique<CalendarItemPool>(
+        TM_PACKET_STORE_CAPACITY + 2 * TASK_BATCH_SIZE));
+    shard_batches.emplace_back();
+  }
 
-bm::TrafficManager::TrafficManager()
-    : pkt_store(EGRESS_PORT_NUMBER, 1024,
-                TrafficManagerEgressThreadMapper(EGRESS_PORT_NUMBER)) {
   // Node creation
-  std::unique_ptr<bm::Node> node = std::make_unique<bm::Node>(0, this);
-  nodes_hierarchy.push_back(std::move(node));
+  active_hierarchy_owner = std::make_unique<Hierarchy>();
+  active_hierarchy_owner->add_node(std::make_unique<bm::Node>(0, this));
+  std::string error;
+  active_hierarchy_owner->finalize(&error);
+  active_hierarchy.store(active_hierarchy_owner.get(),
+                         std::memory_order_release);
+}
+
+bm::TrafficManager::TrafficManager(size_t nb_node_workers)
+    : TrafficManager(std::make_unique<NodeExecutor>(nb_node_workers)) {
+  timer_start = std::chrono::steady_clock::now();
+  timer_task = std::make_unique<PeriodicTask>(
+      "tm_timer_wheel", [this]() { timer_tick(); },
+      std::chrono::duration_cast<std::chrono::milliseconds>(NODE_TIMER_TICK));
 
   BMLOG_DEBUG("TrafficManager (default) created");
 }
 
+/**
+ * @brief Traffic Manager in the virtual time of @p simulator. It has no
+ * thread at all: the nodes run in the event loop of the simulator, the
+ * timer wheel follows its clock and the roots transmit to its egress ports.
+ *
+ * @param simulator Simulator owning the TM
+ */
+bm::TrafficManager::TrafficManager(TMSimulator *simulator)
+    : TrafficManager(std::make_unique<NodeExecutor>(simulator->get_clock())) {
+  this->simulator = simulator;
+  egress_sink = simulator;
+  BMLOG_DEBUG("TrafficManager created in virtual time");
+}
+
+/**
+ * @brief Traffic Manager of a target: the packets scheduled by the roots go
+ * to the egress sink of @p adapter, the scheduler-visible fields are read
+ * from its fields until a tmconfig names others.
+ *
+ * @param adapter Egress sink and fields of the target
+ * @param config_port Port of the configuration server, negative for none
+ * @param nb_node_workers Threads executing the nodes
+ */
+bm::TrafficManager::TrafficManager(const TMAdapter &adapter, int config_port,
+                                   size_t nb_node_workers)
+    : TrafficManager(nb_node_workers) {
+  calendar_fields = adapter.fields;
+  configured_fields = adapter.fields;
+  // The default root runs the P4 SP actions, which PSA and PNA programs
+  // usually lack, see bind_program()
+  pass_through = true;
+  start(adapter.egress_sink, config_port);
+}
+
 bm::TrafficManager::TrafficManager(
     bm::QueueingLogicPriRL<std::unique_ptr<Packet>, EgressThreadMapper>
-        *egress_buffers)
-    : TrafficManager() {
-  egress_buf = egress_buffers;
-  task_queue.reserve(1024);
-  dequeue_thread = std::thread(&TrafficManager::dequeue_, this);
+        *egress_buffers,
+    int config_port, size_t nb_node_workers)
+    : TrafficManager(nb_node_workers) {
+  owned_egress_sink =
+      std::make_unique<PriQueueingEgressSink<EgressThreadMapper>>(
+          egress_buffers);
+  start(owned_egress_sink.get(), config_port);
+}
 
-  config_server = std::make_unique<bm::ConfigServer>(41200);
-  config_server_thread =
-      std::thread([this]() { config_server->bind_and_listen(); });
-  reconfiguration_thread = std::thread([this]() { run(); });
+void bm::TrafficManager::start(TMEgressSink *sink, int config_port) {
+  egress_sink = sink;
+  for (size_t i = 0; i < EGRESS_PORT_NUMBER; i++)
+    dequeue_threads.emplace_back(&TrafficManager::dequeue_, this, i);
+
+  if (config_port >= 0) {
+    config_server = std::make_unique<bm::ConfigServer>(config_port);
+    if (config_server->start()) {
+      reconfiguration_thread = std::thread([this]() { run(); });
+    } else {
+      bm::Logger::get()->error(
+          "Traffic Manager configuration server disabled, port {}",
+          config_port);
+    }
+  }
 
   BMLOG_DEBUG("TrafficManager (advanced task version) created");
   std::cout << "TrafficManager (advanced task version) created" << std::endl;
@@ -36,166 +111,275 @@ bm::TrafficManager::TrafficManager(
 
 bm::TrafficManager::~TrafficManager() {
   BMLOG_DEBUG("TrafficManager destroyed");
+  // Unregistering waits for a running tick
+  timer_task.reset();
+  stop_server = true;
+  // Wakes up the reconfiguration thread
+  if (config_server) config_server->stop();
+  if (reconfiguration_thread.joinable()) reconfiguration_thread.join();
+
+  // The roots push to the task rings, destroy the nodes while they are still
+  // drained
+  {
+    std::lock_guard<std::mutex> lock(reconfiguration_mutex);
+    active_hierarchy.store(nullptr, std::memory_order_release);
+    retired_hierarchies.clear();
+    active_hierarchy_owner.reset();
+  }
+
   // Signal the TM run loop to stop and join the thread.
   stop_dequeue_thread = true;
+  for (auto &queue : task_queues) queue->wake();
 
-  if (dequeue_thread.joinable()) {
-    dequeue_thread.join();
+  for (auto &thread : dequeue_threads) {
+    if (thread.joinable()) thread.join();
   }
 }
 
+/**
+ * @brief Reconfiguration thread: applies the messages of the configuration
+ * server, in order, and answers each of them. Sleeps while no message comes
+ * in, waking up every TM_CONFIG_POLL_INTERVAL_MS to free the drained
+ * hierarchies.
+ */
 void bm::TrafficManager::run() {
-  // Wait for config
-  while (true) {
-    if (config_server->is_config_ready()) {
-      // Call the static parser
-      auto config = config_server->get_config();
+  ConfigMessage message;
+  while (!stop_server) {
+    // Old hierarchies drain in the background, free them once idle
+    reap_retired_hierarchies();
+
+    if (!config_server->wait_message(
+            &message,
+            std::chrono::milliseconds(TM_CONFIG_POLL_INTERVAL_MS))) {
+      continue;
+    }
 #ifdef BM_ENABLE_TM_DEBUG
-      BMLOG_DEBUG("Config is ready for THE TM !");
-      std::cout << config << std::endl;
-      // Create the hierarchy and swap here (avoid destroyed node during swaps)
-      std::cout << "[Configuration Parser] Parsing configuration" << std::endl;
+    BMLOG_DEBUG("Config is ready for THE TM !");
+    std::cout << message.text << std::endl;
 #endif
+    std::string error;
+    if (!apply_config_message(message.text, &error)) {
+      std::cout << "[Configuration Parser] " << error << std::endl;
+    }
+    config_server->reply(message.session_id, error);
+  }
+}
 
-      // parse the JSON config
-      Json::Reader reader;
-      Json::Value root;
-      if (!reader.parse(config, root)) {
-        std::cout << "[Configuration Parser] Failed to parse configuration"
-                  << std::endl;
-        continue;
-      }
-
-      // config loaded successfully
-      std::vector<std::unique_ptr<bm::Node>> hierarchy = {};
-      // std::vector<std::shared_ptr<bm::Node>> hierarchy = {};
-
-      const Json::Value &tmconfig = root["tmconfig"];
-      const Json::Value &tmnodes = tmconfig["tmnodes"];
-
-      for (const auto &tmnode : tmnodes) {
-        // mandatory fields
-        int id = tmnode["tmnode"].asInt();
-        std::string scheduler_type = tmnode["scheduler"].asString();
+/**
+ * @brief Apply one message of the configuration server: a "tmparams"
+ * scheduler parameters update, a "tmshaping" node rate update, a "tmtrace"
+ * trace control message, a "tmedit" incremental edit of the last
+ * configuration, or a whole "tmconfig" configuration. Configurations and
+ * edits go through reconfigure(), the packets keep flowing.
+ */
+bool bm::TrafficManager::apply_config_message(const std::string &message,
+                                              std::string *error) {
+  // A message of any client must not end the server thread: jsoncpp throws
+  // on type errors, e.g. a string where a number is expected
+  try {
+    // Parameter updates leave the hierarchy as it is
+    std::vector<NodeParamsUpdate> params_updates;
+    if (ConfigParser::parse_params(message, &params_updates))
+      return set_scheduler_params(params_updates, error);
 
-        // optional fields (root nodes, etc...)
-        int egress_port;
-        if (tmnode.isMember("port")) {
-          egress_port = tmnode["port"].asInt();
-        } else {
-          egress_port = -1;
-        }
+    std::vector<NodeShaping> shaping_updates;
+    if (ConfigParser::parse_shaping(message, &shaping_updates))
+      return set_node_shaping(shaping_updates, error);
 
-        // auto node =
-        //     // std::make_shared<bm::Node>(id, nullptr, scheduler_type,
-        //     // egress_port);
-        //     std::make_unique<bm::Node>(id, nullptr, scheduler_type,
-        //                                egress_port);
-        // // hierarchy.push_back(node);
-        // hierarchy.push_back(
-        //     std::move(node));  // Moves ownership instead of copying
-        reconf_hierarchy.emplace_back(
-            std::make_unique<bm::Node>(id, this, scheduler_type, egress_port));
+    std::string trace_path;
+    if (ConfigParser::parse_trace(message, &trace_path)) {
+      if (trace_path.empty()) {
+        TMTrace::get()->stop();
+      } else if (!TMTrace::get()->start(trace_path)) {
+        *error = "Cannot create trace file " + trace_path;
+        return false;
       }
+      return true;
+    }
 
-      // Lock to pause enqueuing
-      {
-        std::lock_guard<std::mutex> lock(enqueue_mutex);
-        ready_to_enqueue = false;
+    std::string config = message;
+    const bool is_edit = ConfigParser::is_edit(message);
+    EditedNodes edited;
+    if (is_edit) {
+      if (active_config.empty()) {
+        *error = "No configuration to edit";
+        return false;
       }
-
-      // Wait for the packet store to be empty (avoid potential deadlocks)
-      {
-        std::unique_lock<std::mutex> lock(pkt_store_mutex);
-        pkt_store_empty_cv.wait(lock, [this] { return pkt_store.empty(); });
+      if (!ConfigParser::apply_edit(active_config, message, &config, error,
+                                    &edited)) {
+        return false;
       }
-      // Dump logs
-      // this->nodes_hierarchy[0]->write_accumulated_logs();
-#ifdef BM_ENABLE_TM_DEBUG
-      auto now = std::chrono::high_resolution_clock::now();
-      auto now_c = std::chrono::system_clock::to_time_t(
-          std::chrono::system_clock::now());
-      auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                        now.time_since_epoch()) %
-                    1000000000;
-      std::cout << "Reconfiguration started at "
-                << std::put_time(std::localtime(&now_c), "%F %T") << "."
-                << std::setfill('0') << std::setw(9) << now_ns.count()
-                << std::endl;
-
-      // Update the nodes hierarchy
-      // nodes_hierarchy.clear();
-      // BMLOG_DEBUG("Hierarchy cleared");
-      // for (auto &node : new_hier) {
-      //   nodes_hierarchy.push_back(std::move(node));
-      // }
-      // nodes_hierarchy = std::move(hierarchy);
-      // reconf_hierarchy = std::move(hierarchy);
-      BMLOG_DEBUG("Hierarchy swapped");
-#endif
-      swapped = true;
-      // this->set_actions();
-      this->set_actions(swapped);
-
-      // Resume enqueuing
-      {
-        std::lock_guard<std::mutex> lock(enqueue_mutex);
-        ready_to_enqueue = true;
+    }
+
+    // Everything is parsed before anything is applied, a rejected
+    // configuration leaves the TM as it is. The roots of the node tree hand
+    // their packets to this TM
+    Hierarchy hierarchy = ConfigParser::parse(config, this);
+    if (hierarchy.empty()) {
+      *error = "No valid node in configuration";
+      return false;
+    }
+    // Before the program is bound its actions are not known yet, a node
+    // lacking them is only reported by reconfigure()
+    if (program_bound) {
+      for (auto &node : hierarchy) {
+        if (!node->set_actions(&actionsfn_map, &action_mutexes)) {
+          const std::string scheduler = node->get_scheduler_type();
+          *error = "Node " + std::to_string(node->get_id()) + ": no " +
+                   scheduler + "_calculate_rank or " + scheduler +
+                   "_evaluate_predicate action in the P4 program";
+          return false;
+        }
       }
-      enqueue_cv.notify_all();
-#ifdef BM_ENABLE_TM_DEBUG
-      BMLOG_DEBUG("Traffic Manager reconfigured");
-#endif
+    }
+    CalendarItemFieldMap fields;
+    {
+      std::lock_guard<std::mutex> lock(pending_config_mutex);
+      fields = configured_fields;
+    }
+    const ConfigSection fields_section =
+        ConfigParser::parse_fields(config, &fields);
+    BufferConfig buffer_config;
+    const ConfigSection buffer_section =
+        ConfigParser::parse_buffer(config, &buffer_config);
+    if (fields_section == ConfigSection::Invalid) {
+      *error = "Invalid TM fields";
+      return false;
+    }
+    if (buffer_section == ConfigSection::Invalid) {
+      *error = "Invalid TM buffer";
+      return false;
+    }
 
-      // Clear the config for the next iteration
-      config_server->clear_config();
+    if (fields_section == ConfigSection::Valid) set_calendar_fields(fields);
+    if (buffer_section == ConfigSection::Valid)
+      set_buffer_config(buffer_config);
+    {
+      // The nodes an edit builds again keep their runtime updates, a new
+      // configuration replaces them. No update can fall between the nodes
+      // getting them and the publication of the hierarchy
+      std::lock_guard<std::mutex> updates_lock(node_updates_mutex);
+      if (!is_edit) node_updates.clear();
+      for (int id : edited.removed) node_updates.erase(id);
+      for (int id : edited.rescheduled) {
+        auto it = node_updates.find(id);
+        if (it != node_updates.end()) it->second.params.clear();
+      }
+      apply_node_updates(hierarchy);
+      // New packets go to the new hierarchy right away, the old one keeps
+      // draining its calendars in the background
+      reconfigure(std::move(hierarchy));
     }
+    active_config = std::move(config);
+    return true;
+  } catch (const std::exception &e) {
+    *error = std::string("Invalid configuration: ") + e.what();
+    return false;
   }
 }
 
-void bm::TrafficManager::dequeue_() {
+/**
+ * @brief Dequeue worker of one egress shard: moves the packets scheduled by
+ * the root nodes of the shard from the packet store to the egress buffers,
+ * see transmit(). The workers share no lock: each one has its own packet
+ * store, the egress sink is internally synchronized.
+ *
+ * @param shard Shard of the worker, see get_shard()
+ */
+void bm::TrafficManager::dequeue_(size_t shard) {
+  TaskQueue &task_queue = *task_queues[shard];
+  std::vector<bm::Task> batch(TASK_BATCH_SIZE);
   while (!stop_dequeue_thread) {
     //! Task scheduler part
-    std::unique_lock<std::mutex> lock(tq_mutex);
-    cv.wait(lock, [this] {
-      return !task_queue.empty();
-    });  // Wait until task_queue is not empty
-    bm::Task task = std::move(task_queue.front());
-    task_queue.erase(task_queue.begin());
-    lock.unlock();
-
-    // Extract the cal_item from Task
-    std::shared_ptr<bm::CalendarItem> cal_item;
-    cal_item = std::move(task.cal_item);
+    // Wait until task_queue is not empty, then drain a batch of tasks
+    size_t nb_tasks = task_queue.wait_pop_batch(batch.data(), batch.size());
+
+    for (size_t i = 0; i < nb_tasks; i++) {
+      // Extract the cal_item from Task
+      bm::CalendarItem *cal_item = batch[i].cal_item;
+      batch[i].cal_item = nullptr;
+
+      // Check if non-null cal_item
+      if (cal_item) {
+        transmit(cal_item);
+      } else {
+        BMLOG_DEBUG("Cal_item is null");
+      }
+    }
 #ifdef BM_ENABLE_TM_DEBUG
-    BMLOG_DEBUG("Dequeued packet from the Node, packet ID {}",
-                cal_item->get_packet_id());
+    if (nb_tasks > 0 && packet_stores[shard]->empty()) {
+      BMLOG_DEBUG("Packet store is empty");
+    }
 #endif
+  }
+}
 
-    // Check if non-null cal_item
-    if (cal_item) {
-      std::unique_ptr<Packet> packet;
-      size_t queue_id;
-      auto worker_id = TrafficManagerEgressThreadMapper(EGRESS_PORT_NUMBER)(
-          cal_item->get_egress_port());
-      std::unique_lock<std::mutex> lock(tm_mutex);  // Prevent
-      pkt_store.pop_back(worker_id, &queue_id, &packet);
+/**
+ * @brief Move the packet of @p cal_item from the packet store to the egress
+ * sink: the egress buffer of its port in the target, or the egress port of
+ * the simulator in virtual time. The packet is taken by the handle of its
+ * calendar item, so the egress order is the order of the schedulers. The
+ * transmit credit the root took for the packet is given back once it is in
+ * the egress buffer.
+ */
+void bm::TrafficManager::transmit(bm::CalendarItem *cal_item) {
 #ifdef BM_ENABLE_TM_DEBUG
-      BMLOG_DEBUG("[THREAD {}] Dequeued packet from the TM, PacketID : {}",
-                  std::this_thread::get_id(), packet->get_packet_id());
+  BMLOG_DEBUG("Dequeued packet from the Node, packet ID {}",
+              cal_item->get_packet_id());
 #endif
-      egress_buf->push_front(queue_id, std::move(packet));
-      // pkt_in_store--;
-      // if (pkt_in_store >= 30) reconf_hierarchy[0]->write_accumulated_logs();
-    } else {
-      BMLOG_DEBUG("Cal_item is null");
-    }
-    if (pkt_store.empty()) {
-      pkt_store_empty_cv.notify_one();
+  uint32_t egress_port = cal_item->get_egress_port();
+  std::unique_ptr<Packet> packet =
+      packet_stores[get_shard(egress_port)]->take(
+          cal_item->get_packet_handle());
+  assert(packet != nullptr);
 #ifdef BM_ENABLE_TM_DEBUG
-      BMLOG_DEBUG("Packet store is empty");
+  BMLOG_DEBUG("[THREAD {}] Dequeued packet from the TM, PacketID : {}",
+              std::this_thread::get_id(), packet->get_packet_id());
 #endif
-    }
+  // The root took a credit, the push only fails if the capacity of the
+  // egress buffer was lowered in the meantime
+  bool transmitted = egress_sink->transmit(
+      egress_port, cal_item->get_egress_priority(), std::move(packet),
+      cal_item->get_packet_size());
+  if (egress_port < TM_MAX_EGRESS_PORTS) {
+    TxPort &tx_port = tx_ports[egress_port];
+    if (transmitted)
+      tx_port.nb_transmitted.fetch_add(1, std::memory_order_relaxed);
+    else
+      tx_port.nb_drops.fetch_add(1, std::memory_order_relaxed);
+    tx_port.in_flight.fetch_sub(1, std::memory_order_release);
+    // The credit is given back: the root may have run out of credits while
+    // its packets were in flight, or the packet was dropped
+    egress_sink->slot_freed(egress_port);
+  }
+  if (!transmitted)
+    BMLOG_DEBUG("Egress buffer of port {} full, packet dropped", egress_port);
+  release_buffer(*cal_item);
+  // The item left the hierarchy, recycle it for a new packet. Only the
+  // dequeue worker of the shard (or the simulator thread) transmits its
+  // packets
+  CalendarItemPool::recycle(cal_item);
+}
+
+/**
+ * @brief Hand packets to the egress sink without scheduling them, while no
+ * hierarchy can (see pass_through). The sink either drops the packets its
+ * queues cannot take, as the egress buffers of simple_switch and psa_switch
+ * do, or blocks until they can (BlockingQueueEgressSink, pna_nic).
+ */
+void bm::TrafficManager::transmit_batch(TMPacket *packets, size_t nb_packets) {
+  for (size_t i = 0; i < nb_packets; i++) {
+    const uint32_t egress_port = packets[i].egress_port;
+    const size_t bytes = packets[i].packet->get_data_size();
+    bool transmitted = egress_sink->transmit(
+        egress_port, packets[i].egress_priority, std::move(packets[i].packet),
+        bytes);
+    if (egress_port >= TM_MAX_EGRESS_PORTS) continue;
+    TxPort &tx_port = tx_ports[egress_port];
+    if (transmitted)
+      tx_port.nb_transmitted.fetch_add(1, std::memory_order_relaxed);
+    else
+      tx_port.nb_drops.fetch_add(1, std::memory_order_relaxed);
   }
 }
 
@@ -205,123 +389,676 @@ void bm::TrafficManager::dequeue_() {
 void bm::TrafficManager::add_action(const std::string &type,
                                     ActionFn *action_fn) {
   actionsfn_map[type] = action_fn;
+  action_mutexes[action_fn];
 }
 
 /**
  * @brief Set the actions to the node based on the scheduler type
  */
 void bm::TrafficManager::set_actions() {
-  for (auto &node : nodes_hierarchy) {
-    node->set_actions(&actionsfn_map);
+  std::lock_guard<std::mutex> lock(reconfiguration_mutex);
+  for (auto &node : *active_hierarchy_owner) {
+    // The default root of a program without SP actions passes through
+    if (!node->set_actions(&actionsfn_map, &action_mutexes) && !pass_through)
+      warn_missing_actions(*node);
   }
 }
 
-void bm::TrafficManager::set_actions(bool swapped) {
-  if (swapped) {
-    for (auto &node : reconf_hierarchy) {
-      node->set_actions(&actionsfn_map);
-    }
-  } else {
-    for (auto &node : nodes_hierarchy) {
-      node->set_actions(&actionsfn_map);
+void bm::TrafficManager::warn_missing_actions(Node &node) {
+  const std::string scheduler = node.get_scheduler_type();
+  bm::Logger::get()->warn(
+      "Node {}: no {}_calculate_rank or {}_evaluate_predicate action in the "
+      "P4 program, its packets are never scheduled",
+      node.get_id(), scheduler, scheduler);
+}
+
+/**
+ * @brief Bind the TM to the P4 program the target loaded: the actions of the
+ * hooks of every scheduler type (built-in or loaded with --load-modules) come
+ * from @p actions, the scheduler-visible fields are resolved against the
+ * layout of the program and the periodic_timeout actions run on its PHVs.
+ *
+ * @param actions Actions of the program, by "<scheduler>_<hook>" name
+ * @param factory PHV factory of the program, must outlive the TM
+ */
+void bm::TrafficManager::bind_program(const TMActionSource &actions,
+                                      const PHVFactory &factory) {
+  static const char *const hook_names[] = {
+      "calculate_rank", "evaluate_predicate", "dequeued", "periodic_timeout",
+      "admit"};
+  const std::vector<std::string> scheduler_types =
+      NativeSchedulerMap::get_instance()->get_names();
+  for (const auto &scheduler : scheduler_types) {
+    for (const char *hook : hook_names) {
+      const std::string name = scheduler + "_" + hook;
+      ActionFn *action_fn = actions.get_action(name);
+      if (action_fn == nullptr) continue;
+      bm::Logger::get()->info("Traffic Manager action found: {}",
+                              action_fn->get_name());
+      add_action(name, action_fn);
     }
   }
+  program_bound = true;
+  set_actions();
+  // The default hierarchy can schedule with the SP actions of the program
+  if (actionsfn_map.count("SP_calculate_rank") != 0 &&
+      actionsfn_map.count("SP_evaluate_predicate") != 0) {
+    pass_through = false;
+  }
+
+  resolve_calendar_fields(*factory.create());
+  set_phv_factory(&factory);
 }
 
+/**
+ * @brief Push a task to the dequeue worker of the packet's egress shard.
+ * Lock-free, called concurrently by all the root nodes of the hierarchy. In
+ * virtual time, the packet is transmitted by the calling root.
+ */
 void bm::TrafficManager::push_task(Task &&task) {
-  // std::lock_guard<std::mutex> lock(tm_mutex);  // Lock the mutex
-  task_queue.push_back(std::move(task));
-  cv.notify_one();
+  // No dequeue worker in virtual time, the packet goes out right away
+  if (simulator != nullptr) {
+    transmit(task.cal_item);
+    return;
+  }
+  size_t shard = get_shard(task.cal_item->get_egress_port());
+  task_queues[shard]->push(std::move(task));
+}
+
+/**
+ * @brief Free the packet of @p cal_item and the item itself, e.g. when a node
+ * could not file the item in its calendar.
+ */
+void bm::TrafficManager::drop(bm::CalendarItem *cal_item) {
+  TMTrace::record(TraceEvent::Drop, cal_item->get_leaf_id(), *cal_item);
+  size_t shard = get_shard(cal_item->get_egress_port());
+  packet_stores[shard]->take(cal_item->get_packet_handle());
+  release_buffer(*cal_item);
+  CalendarItemPool::release(cal_item);
+}
+
+void bm::TrafficManager::release_buffer(const CalendarItem &cal_item) {
+  // Only the admitted packets have a leaf
+  if (cal_item.get_leaf_id() < 0) return;
+  buffer_manager.release(cal_item.get_egress_port(), cal_item.get_leaf_id(),
+                         cal_item.get_packet_size());
 }
 
 /**
- * @brief Enqueue a packet to the Traffic Manager stage.
+ * @brief Reserve a slot of the egress buffer of @p egress_port for a packet a
+ * root is about to release. Without credit, the root keeps its predicate
+ * winner in the calendar and retries on its next predicate evaluation, the
+ * scheduler can still reorder it with the packets arriving meanwhile. The
+ * egress sink requests that evaluation when the target frees a slot of the
+ * port, the root does not poll.
+ *
+ * @param egress_port Egress port of the packet.
+ * @param egress_priority Priority queue of the packet in the egress buffer.
+ * @param root Node to wake up once a slot is freed, if there is no credit.
+ * @return true if the packet can be released, the credit is given back by
+ * the dequeue worker.
+ */
+bool bm::TrafficManager::acquire_tx_credit(uint32_t egress_port,
+                                          size_t egress_priority,
+                                          Node *root) {
+  if (egress_port >= TM_MAX_EGRESS_PORTS) return true;
+  if (egress_sink == nullptr) return true;
+  TxPort &tx_port = tx_ports[egress_port];
+  auto try_acquire = [this, &tx_port, egress_port, egress_priority]() {
+    // Only the egress threads free slots concurrently, and the credits in
+    // flight are those of every priority of the port: this is conservative
+    size_t free_slots =
+        egress_sink->get_free_slots(egress_port, egress_priority);
+    size_t in_flight = tx_port.in_flight.load(std::memory_order_acquire);
+    do {
+      if (in_flight >= free_slots) return false;
+    } while (!tx_port.in_flight.compare_exchange_weak(
+        in_flight, in_flight + 1, std::memory_order_acq_rel));
+    return true;
+  };
+  if (try_acquire()) return true;
+  if (root != nullptr) {
+    // Checked again once registered, a slot freed meanwhile would not wake
+    // the root up. A root that gets its credit now is woken up for nothing
+    egress_sink->wait_for_slot(egress_port, root);
+    if (try_acquire()) return true;
+  }
+  tx_port.nb_credit_stalls.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void bm::TrafficManager::cancel_tx_wait(Node *root) {
+  if (egress_sink != nullptr) egress_sink->cancel_wait(root);
+}
+
+void bm::TrafficManager::egress_slot_freed(uint32_t egress_port) {
+  if (egress_sink != nullptr) egress_sink->slot_freed(egress_port);
+}
+
+void bm::TrafficManager::egress_slot_freed() {
+  if (egress_sink != nullptr) egress_sink->slot_freed();
+}
+
+/**
+ * @brief Enqueue a packet to the Traffic Manager stage. The packet is
+ * dropped if the buffer is over one of its limits (shared buffer, egress
+ * port, leaf), or by the admit action of the scheduler of its leaf.
  *
  * @param egress_port of the packet to be enqueued
  * @param packet to be enqueued
+ * @param egress_priority Priority queue of the egress buffer of the port the
+ * packet goes to once scheduled, see TMEgressSink
  */
 void bm::TrafficManager::enqueue(uint32_t egress_port,
-                                 std::unique_ptr<Packet> &&packet) {
-  std::unique_lock<std::mutex> lock(enqueue_mutex);
-  enqueue_cv.wait(lock, [this] { return ready_to_enqueue; });
-  /** Mandatory workaround : If using only a raw pointer for the calendar
-   * item, the packet will be deleted when the calendar item is deleted.
-   * ie, Packet destructor will be called. This is not the desired behavior as
-   * it removes the PHV. To avoid this, we use a shared_ptr with a no-op
-   * deleter, specific to the packet.
-   * This workaround is necessary because the packet is owned by the calendar
-   * item, and the calendar item is owned by nodes.
-   *
-   * Before :
-   * Destruction of CalendarItem -> Packet destructor called -> PHV reset
-   *
-   * After :
-   * Destruction of CalendarItem -> Packet destructor not called -> PHV kept
-   */
-
-  auto no_op_deleter = [](bm::Packet *) { /* do nothing */ };
-  std::shared_ptr<bm::Packet> non_owning_packet(packet.get(), no_op_deleter);
-  std::shared_ptr<bm::CalendarItem> cal_item =
-      std::make_shared<bm::CalendarItem>(non_owning_packet);
-  cal_item->set_egress_port(egress_port);
+                                 std::unique_ptr<Packet> &&packet,
+                                 size_t egress_priority) {
+  TMPacket item{egress_port, std::move(packet), egress_priority};
+  enqueue_batch(&item, 1);
+}
+
+/**
+ * @brief Enqueue several packets to the Traffic Manager stage, e.g. the
+ * copies of a multicast packet or a burst of the ingress pipeline. Same as
+ * enqueue() for each packet in turn, but the TM lock is taken once for the
+ * batch, the packet store of a shard once per TASK_BATCH_SIZE packets, and a
+ * leaf is scheduled once for its consecutive packets. The packets of a leaf
+ * keep their order in the batch.
+ *
+ * @param packets Packets to enqueue, moved from
+ * @param nb_packets Number of packets
+ */
+void bm::TrafficManager::enqueue_batch(TMPacket *packets, size_t nb_packets) {
+  if (nb_packets == 0) return;
+  if (pass_through.load(std::memory_order_acquire)) {
+    transmit_batch(packets, nb_packets);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(enqueue_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    // Only a contended lock is timed
+    const uint64_t epoch = nb_reconfigurations.load(std::memory_order_acquire);
+    const auto start = std::chrono::steady_clock::now();
+    lock.lock();
+    record_enqueue_wait(epoch, start);
+  }
+  if (has_pending_config.load(std::memory_order_acquire))
+    apply_pending_config();
+  // Never blocks on reconfigurations: the hierarchy is read once per batch
+  Hierarchy *hierarchy = active_hierarchy.load(std::memory_order_acquire);
+  // Field names are only resolved once per configuration, not per packet
+  if (!calendar_fields.is_resolved())
+    calendar_fields.resolve(*packets[0].packet->get_phv());
+  for (size_t i = 0; i < nb_packets; i++) {
+    const uint32_t egress_port = packets[i].egress_port;
+    std::unique_ptr<Packet> packet = std::move(packets[i].packet);
+    // The packet stays owned by the packet store, the calendar item only
+    // refers to it and comes from the pool of the shard (no allocation per
+    // packet)
+    size_t shard = get_shard(egress_port);
+    ShardBatch &batch = shard_batches[shard];
+    bm::CalendarItem *cal_item =
+        calendar_item_pools[shard]->acquire(packet.get(), calendar_fields);
+    cal_item->set_egress_port(egress_port);
+    cal_item->set_egress_priority(packets[i].egress_priority);
 #ifdef BM_ENABLE_TM_DEBUG
-  BMLOG_DEBUG("Enqueued packet in the TM");
-  BMLOG_DEBUG("Packet ID: {}", cal_item->get_packet_id());
-  BMLOG_DEBUG("Egress port: {}", cal_item->get_egress_port());
+    BMLOG_DEBUG("Enqueued packet in the TM");
+    BMLOG_DEBUG("Packet ID: {}", cal_item->get_packet_id());
+    BMLOG_DEBUG("Egress port: {}", cal_item->get_egress_port());
 #endif
 
-  pkt_store.push_front(cal_item->get_egress_port(), std::move(packet));
-  pkt_in_store++;
-  if (pkt_in_store > 0) has_packet = true;
-  cv.notify_one();
-
-  // Send to first node
-  // First create the enqueue task
-  if (swapped) {
-    Task task(TaskType::Enqueue, cal_item, this->reconf_hierarchy[0]->get_id());
-    // Push it to the first node
-    reconf_hierarchy[0]->enqueue(std::move(task));
-  } else {
-    Task task(TaskType::Enqueue, cal_item, this->nodes_hierarchy[0]->get_id());
-    // Push it to the first node
-    nodes_hierarchy[0]->enqueue(std::move(task));
-  }
-  // Task task(TaskType::Enqueue, cal_item, this->nodes_hierarchy[0]->get_id());
-  // Push it to the first node
-  // nodes_hierarchy[0]->enqueue(std::move(task));
+    // Leaf selected by the classifiers, the packet is accounted in it
+    Node *leaf = hierarchy->find_leaf(*cal_item);
+    if (leaf == nullptr) {
+      buffer_manager.count_drop(egress_port, -1, AdmitVerdict::DropNoLeaf);
+      BMLOG_DEBUG("Packet {} dropped by the TM, no leaf for port {}",
+                  cal_item->get_packet_id(), egress_port);
+      CalendarItemPool::release(cal_item);
+      continue;
+    }
+    const int leaf_id = leaf->get_id();
+    const size_t bytes = cal_item->get_packet_size();
+    AdmitVerdict verdict = buffer_manager.check(
+        egress_port, leaf_id, leaf->get_buffer_limits(), bytes);
+    // In virtual time a full packet store cannot block the only thread, the
+    // packet is dropped as if the shared buffer was full
+    if (verdict == AdmitVerdict::Admit && simulator != nullptr &&
+        packet_stores[shard]->size() + batch.packets.size() >=
+            packet_stores[shard]->get_capacity()) {
+      verdict = AdmitVerdict::DropShared;
+    }
+    if (verdict == AdmitVerdict::Admit &&
+        !leaf->admit(cal_item,
+                     buffer_manager.get_occupancies(egress_port, leaf_id))) {
+      verdict = AdmitVerdict::DropAqm;
+    }
+    if (verdict != AdmitVerdict::Admit) {
+      buffer_manager.count_drop(egress_port, leaf_id, verdict);
+      TMTrace::record(TraceEvent::Drop, leaf_id, *cal_item);
+      BMLOG_DEBUG("Packet {} not admitted by the TM, verdict {}",
+                  cal_item->get_packet_id(), static_cast<size_t>(verdict));
+      CalendarItemPool::release(cal_item);
+      continue;
+    }
+    buffer_manager.admit(egress_port, leaf_id, bytes);
+    cal_item->set_leaf_id(leaf_id);
+
+    batch.packets.push_back(std::move(packet));
+    batch.cal_items.push_back(cal_item);
+    batch.leaves.push_back(leaf);
+    // Bounds the calendar items waiting for the store, see the pool capacity
+    if (batch.packets.size() == TASK_BATCH_SIZE) push_shard_batch(shard);
+  }
+  for (size_t shard = 0; shard < shard_batches.size(); shard++)
+    push_shard_batch(shard);
+}
+
+void bm::TrafficManager::record_enqueue_wait(
+    uint64_t epoch, std::chrono::steady_clock::time_point start) {
+  if (epoch == nb_reconfigurations.load(std::memory_order_acquire) &&
+      !reconfiguring.load(std::memory_order_acquire)) {
+    return;
+  }
+  const uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  // Only the enqueue() holding the TM lock raises them, reconfigure() resets
+  // the last one
+  if (wait > last_stall_ns.load(std::memory_order_relaxed))
+    last_stall_ns.store(wait, std::memory_order_relaxed);
+  if (wait > max_stall_ns.load(std::memory_order_relaxed))
+    max_stall_ns.store(wait, std::memory_order_relaxed);
+}
+
+void bm::TrafficManager::push_shard_batch(size_t shard) {
+  ShardBatch &batch = shard_batches[shard];
+  const size_t nb_packets = batch.packets.size();
+  batch.handles.resize(nb_packets);
+  size_t next = 0;
+  while (next < nb_packets) {
+    // The packets filed are pushed to their leaves before waiting for more
+    // slots, the dequeue worker has to be able to free them
+    size_t end = next + packet_stores[shard]->insert_batch(
+                            &batch.packets[next], nb_packets - next,
+                            &batch.handles[next]);
+    while (next < end) {
+      // Send to the leaf the run of its consecutive packets, each task climbs
+      // up the tree to the root of its port
+      Node *leaf = batch.leaves[next];
+      batch.tasks.clear();
+      for (; next < end && batch.leaves[next] == leaf; next++) {
+        bm::CalendarItem *cal_item = batch.cal_items[next];
+        cal_item->set_packet_handle(batch.handles[next]);
+        batch.tasks.emplace_back(TaskType::Enqueue, cal_item, leaf->get_id());
+      }
+      leaf->push_tasks(batch.tasks.data(), batch.tasks.size());
+    }
+  }
 #ifdef BM_ENABLE_TM_DEBUG
-  // Display the content of the pkt store
-  std::cout << pkt_store.to_string() << std::endl;
+  BMLOG_DEBUG("Packets in the store of shard {}: {}", shard,
+              packet_stores[shard]->size());
 #endif
+  batch.packets.clear();
+  batch.cal_items.clear();
+  batch.leaves.clear();
 }
 
+/**
+ * @brief Replace the active hierarchy without draining the packet store.
+ * The new hierarchy is published with a single pointer swap, without the
+ * lock of enqueue(): a reconfiguration never waits for the packets being
+ * enqueued, even when a full packet store holds them. In-flight calendar
+ * items of the previous hierarchy keep being scheduled by its nodes until
+ * they are drained, then the hierarchy is destroyed by
+ * reap_retired_hierarchies().
+ *
+ * @param new_hier hierarchy to activate, must not be empty
+ */
 void bm::TrafficManager::reconfigure(Hierarchy new_hier) {
-  // Lock to pause enqueuing
+  auto new_owner = std::make_unique<Hierarchy>(std::move(new_hier));
+  for (auto &node : *new_owner) {
+    if (!node->set_actions(&actionsfn_map, &action_mutexes))
+      warn_missing_actions(*node);
+    node->start_periodic_timeout(&timer_wheel);
+  }
+
+  std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+  // enqueue_mutex is not taken: an enqueue() waiting for room in a full
+  // packet store would hold the swap back for as long. The enqueue() calls
+  // still using the previous hierarchy are waited for by
+  // reap_retired_hierarchies()
+  active_hierarchy.store(new_owner.get(), std::memory_order_release);
+
+  pass_through = false;
+  retired_hierarchies.push_back(
+      {std::move(active_hierarchy_owner), std::chrono::steady_clock::now()});
+  active_hierarchy_owner = std::move(new_owner);
+  // A new stall window, the enqueue() calls waiting across the swap see the
+  // new count
+  last_stall_ns.store(0, std::memory_order_relaxed);
+  reconfiguring.store(true, std::memory_order_release);
+  nb_reconfigurations++;
+
+  bm::Logger::get()->info("Traffic Manager reconfigured, {} hierarchies draining",
+                          retired_hierarchies.size());
+}
+
+/**
+ * @brief Update the scheduler parameters of a node of the active hierarchy,
+ * see Node::set_scheduler_params(). The packets keep flowing, the hierarchy
+ * is only kept from being replaced during the update.
+ *
+ * @param node_id Id of the node in the active hierarchy.
+ * @param updates Parameters to replace, by index.
+ * @return false if the node does not exist or a parameter is out of bounds.
+ */
+bool bm::TrafficManager::set_scheduler_params(
+    int node_id, const SchedulerParams::Updates &updates) {
+  std::string error;
+  return set_scheduler_params({{node_id, updates}}, &error);
+}
+
+/**
+ * @brief Update the scheduler parameters of several nodes of the active
+ * hierarchy, e.g. from a "tmparams" message. The whole update is checked
+ * before any node changes: a message naming an unknown node or with a
+ * parameter out of bounds leaves all the nodes as they were.
+ *
+ * @param updates Parameters to replace, by node.
+ * @param error Set to the reason of a failure.
+ * @return false if nothing was updated.
+ */
+bool bm::TrafficManager::set_scheduler_params(
+    const std::vector<NodeParamsUpdate> &updates, std::string *error) {
+  std::lock_guard<std::mutex> updates_lock(node_updates_mutex);
+  {
+    std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+    for (const auto &update : updates) {
+      const std::string node_id = std::to_string(update.node_id);
+      if (active_hierarchy_owner->get_node(update.node_id) == nullptr) {
+        *error = "Cannot update the parameters of unknown node " + node_id;
+        return false;
+      }
+      if (!SchedulerParams::in_bounds(update.updates)) {
+        *error = "Parameters of node " + node_id + " out of bounds";
+        return false;
+      }
+    }
+    for (const auto &update : updates) {
+      active_hierarchy_owner->get_node(update.node_id)
+          ->set_scheduler_params(update.updates);
+    }
+  }
+  // The node a tmedit builds again keeps the update
+  for (const auto &node_update : updates) {
+    auto &params = node_updates[node_update.node_id].params;
+    for (const auto &update : node_update.updates) {
+      auto it = std::find_if(params.begin(), params.end(),
+                             [&update](const auto &param) {
+                               return param.first == update.first;
+                             });
+      if (it == params.end()) {
+        params.push_back(update);
+      } else {
+        it->second = update.second;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Limit the output rate of a node of the active hierarchy, e.g. a
+ * root to the rate of its link. Like the scheduler parameters, the shaping
+ * is kept by the "tmedit" edits but not by a new configuration, the
+ * "shaping" of the new configuration applies.
+ *
+ * @param node_id Id of the node in the active hierarchy.
+ * @param rate_bps Rate in bits per second, 0 for no limit.
+ * @param burst_bytes Burst of the token bucket.
+ * @return false if the node does not exist.
+ */
+bool bm::TrafficManager::set_node_shaping(int node_id, uint64_t rate_bps,
+                                          uint64_t burst_bytes) {
+  std::string error;
+  return set_node_shaping({{node_id, rate_bps, burst_bytes}}, &error);
+}
+
+/**
+ * @brief Limit the output rate of several nodes of the active hierarchy,
+ * e.g. from a "tmshaping" message. The nodes are all looked up before any
+ * is shaped: a message naming an unknown node changes nothing.
+ *
+ * @param updates Rate and burst, by node.
+ * @param error Set to the reason of a failure.
+ * @return false if nothing was shaped.
+ */
+bool bm::TrafficManager::set_node_shaping(
+    const std::vector<NodeShaping> &updates, std::string *error) {
+  std::lock_guard<std::mutex> updates_lock(node_updates_mutex);
+  {
+    std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+    for (const auto &update : updates) {
+      if (active_hierarchy_owner->get_node(update.node_id) == nullptr) {
+        *error = "Cannot shape unknown node " + std::to_string(update.node_id);
+        return false;
+      }
+    }
+    for (const auto &update : updates) {
+      active_hierarchy_owner->get_node(update.node_id)
+          ->set_shaping(update.rate_bps, update.burst_bytes);
+    }
+  }
+  for (const auto &update : updates) {
+    NodeRuntimeUpdates &node_update = node_updates[update.node_id];
+    node_update.shaped = true;
+    node_update.rate_bps = update.rate_bps;
+    node_update.burst_bytes = update.burst_bytes;
+  }
+  return true;
+}
+
+/**
+ * @brief Apply the runtime parameters and shaping updates to the nodes of a
+ * hierarchy built again by a "tmedit". The updates of the nodes it does not
+ * have are dropped.
+ */
+void bm::TrafficManager::apply_node_updates(const Hierarchy &hierarchy) {
+  for (auto it = node_updates.begin(); it != node_updates.end();) {
+    Node *node = hierarchy.get_node(it->first);
+    if (node == nullptr) {
+      it = node_updates.erase(it);
+      continue;
+    }
+    const NodeRuntimeUpdates &node_update = it->second;
+    if (!node_update.params.empty() &&
+        !node->set_scheduler_params(node_update.params)) {
+      BMLOG_DEBUG("Runtime parameters of node {} out of bounds, dropped",
+                  it->first);
+    }
+    if (node_update.shaped)
+      node->set_shaping(node_update.rate_bps, node_update.burst_bytes);
+    ++it;
+  }
+}
+
+/**
+ * @brief Change the PHV fields the scheduler-visible CalendarItem fields are
+ * read from. The names are resolved on the next enqueued packet.
+ */
+void bm::TrafficManager::set_calendar_fields(
+    const CalendarItemFieldMap &fields) {
   {
-    std::lock_guard<std::mutex> lock(enqueue_mutex);
-    ready_to_enqueue = false;
+    std::lock_guard<std::mutex> lock(pending_config_mutex);
+    configured_fields = fields;
+    pending_config.fields = std::make_unique<CalendarItemFieldMap>(fields);
+    has_pending_config.store(true, std::memory_order_release);
   }
+  try_apply_pending_config();
+}
+
+/**
+ * @brief Change the capacity of the shared buffer and the limits of the
+ * egress ports. The packets already admitted stay in the buffer, they only
+ * make room for new ones when they leave.
+ */
+void bm::TrafficManager::set_buffer_config(const BufferConfig &config) {
+  {
+    std::lock_guard<std::mutex> lock(pending_config_mutex);
+    pending_config.buffer = std::make_unique<BufferConfig>(config);
+    has_pending_config.store(true, std::memory_order_release);
+  }
+  try_apply_pending_config();
+}
+
+/**
+ * @brief Resolve the CalendarItem fields against the layout of the P4
+ * program, so that no name lookup happens on the packet path.
+ *
+ * @param phv Any PHV of the P4 program
+ */
+void bm::TrafficManager::resolve_calendar_fields(const PHV &phv) {
+  {
+    std::lock_guard<std::mutex> lock(pending_config_mutex);
+    size_t nb_found = configured_fields.resolve(phv);
+    BMLOG_DEBUG("Traffic Manager: {} scheduler fields resolved", nb_found);
+    (void) nb_found;
+    pending_config.fields =
+        std::make_unique<CalendarItemFieldMap>(configured_fields);
+    has_pending_config.store(true, std::memory_order_release);
+  }
+  try_apply_pending_config();
+}
 
-  // Wait for the packet store to be empty (avoid potential deadlocks)
+void bm::TrafficManager::apply_pending_config() {
+  PendingConfig config;
   {
-    std::unique_lock<std::mutex> lock(pkt_store_mutex);
-    pkt_store_empty_cv.wait(lock, [this] { return pkt_store.empty(); });
+    std::lock_guard<std::mutex> lock(pending_config_mutex);
+    config = std::move(pending_config);
+    pending_config = PendingConfig();
+    has_pending_config.store(false, std::memory_order_relaxed);
   }
+  if (config.fields) calendar_fields = std::move(*config.fields);
+  if (config.buffer) buffer_manager.configure(*config.buffer);
+}
+
+/**
+ * @brief Apply the pending configuration if no enqueue() holds the TM lock,
+ * otherwise leave it to the next batch. Like the grace period of
+ * reap_retired_hierarchies(), only tried: the configuration thread must not
+ * wait for an enqueue() blocked on a full packet store.
+ */
+void bm::TrafficManager::try_apply_pending_config() {
+  std::unique_lock<std::mutex> lock(enqueue_mutex, std::try_to_lock);
+  if (lock.owns_lock() && has_pending_config.load(std::memory_order_acquire))
+    apply_pending_config();
+}
+
+/**
+ * @brief Give the TM the PHV layout of the P4 program. The periodic_timeout
+ * actions, which have no packet to schedule, run on a packet of the TM.
+ * Must be called before the hierarchy is configured.
+ *
+ * @param factory PHV factory of the P4 program, must outlive the TM
+ */
+void bm::TrafficManager::set_phv_factory(const PHVFactory *factory) {
+  // The PHV of the previous packet goes back to its source
+  timer_packet.reset();
+  timer_phv_source = PHVSourceIface::make_phv_source();
+  timer_phv_source->set_phv_factory(0, factory);
+  timer_packet = std::make_unique<Packet>(
+      Packet::make_new(timer_phv_source.get()));
+}
 
-  // Update the nodes hierarchy
-  nodes_hierarchy.clear();
-  // for (auto &node : new_hier) {
-  //   nodes_hierarchy.push_back(std::move(node));
-  // }
-  nodes_hierarchy = std::move(new_hier);
-  this->set_actions();
+/**
+ * @brief Advance the timer wheel to the current time. Called by the
+ * PeriodicTask of the TM; late ticks are caught up, the timeouts do not
+ * drift with the scheduling delay of the periodic thread. In virtual time,
+ * called by the simulator at every tick of its clock.
+ */
+void bm::TrafficManager::timer_tick() {
+  std::chrono::nanoseconds elapsed;
+  if (simulator != nullptr)
+    elapsed = std::chrono::nanoseconds(simulator->get_clock().now());
+  else
+    elapsed = std::chrono::steady_clock::now() - timer_start;
+  uint64_t target = elapsed / NODE_TIMER_TICK;
+  uint64_t current = timer_wheel.get_now();
+  if (target > current) timer_wheel.advance(target - current);
+}
 
-  // Resume enqueuing
+/**
+ * @brief Destroy the retired hierarchies whose nodes are all drained.
+ */
+void bm::TrafficManager::reap_retired_hierarchies() {
+  size_t nb_retired;
+  {
+    std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+    nb_retired = retired_hierarchies.size();
+    if (nb_retired == 0) return;
+  }
   {
-    std::lock_guard<std::mutex> lock(enqueue_mutex);
-    ready_to_enqueue = true;
+    // Grace period: the enqueue() calls that read one of these hierarchies
+    // hold enqueue_mutex until their packets are pushed to its leaves, the
+    // next ones read the active hierarchy. Only tried, an enqueue() waiting
+    // for a full store must not hold back the config messages; the next
+    // poll tries again
+    std::unique_lock<std::mutex> lock(enqueue_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return;
   }
-  enqueue_cv.notify_all();
 
-  BMLOG_DEBUG("Traffic Manager reconfigured");
+  std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+  // Only the hierarchies retired before the grace period are known to get
+  // no more packets, the later ones are reaped on the next call
+  auto it = retired_hierarchies.begin();
+  auto end = it + std::min(nb_retired, retired_hierarchies.size());
+  while (it != end) {
+    const auto &nodes = *it->hierarchy;
+    bool drained =
+        std::all_of(nodes.begin(), nodes.end(),
+                    [](const std::unique_ptr<Node> &n) { return n->is_idle(); });
+    if (!drained) {
+      ++it;
+      continue;
+    }
+    last_drain_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - it->retired_at)
+                        .count();
+    BMLOG_DEBUG("Retired hierarchy drained in {} ns, enqueue stall {} ns",
+                last_drain_ns.load(), last_stall_ns.load());
+    it = retired_hierarchies.erase(it);
+    --end;
+  }
+  if (retired_hierarchies.empty())
+    reconfiguring.store(false, std::memory_order_release);
+}
+
+bm::ReconfigurationStats bm::TrafficManager::get_reconfiguration_stats()
+    const {
+  return {nb_reconfigurations.load(), last_stall_ns.load(),
+          max_stall_ns.load(), last_drain_ns.load()};
+}
+
+uint64_t bm::TrafficManager::get_nb_calendar_item_overflows() const {
+  uint64_t nb_overflows = 0;
+  for (const auto &pool : calendar_item_pools)
+    nb_overflows += pool->get_nb_overflows();
+  return nb_overflows;
+}
+
+std::vector<std::pair<int, bm::NodeStats>>
+bm::TrafficManager::get_node_stats() {
+  std::lock_guard<std::mutex> reconf_lock(reconfiguration_mutex);
+  std::vector<std::pair<int, NodeStats>> stats;
+  if (!active_hierarchy_owner) return stats;
+  for (const auto &node : *active_hierarchy_owner)
+    stats.emplace_back(node->get_id(), node->get_stats());
+  return stats;
+}
+
+bm::TxPortStats bm::TrafficManager::get_port_stats(uint32_t egress_port) const {
+  if (egress_port >= TM_MAX_EGRESS_PORTS) return {0, 0, 0};
+  const TxPort &tx_port = tx_ports[egress_port];
+  return {tx_port.nb_transmitted.load(std::memory_order_relaxed),
+          tx_port.nb_drops.load(std::memory_order_relaxed),
+          tx_port.nb_credit_stalls.load(std::memory_order_relaxed)};
 }
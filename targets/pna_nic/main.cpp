@@ -22,6 +22,7 @@
 
 #include <bm/PnaNic.h>
 #include <bm/bm_runtime/bm_runtime.h>
+#include <bm/bm_sim/options_parse.h>
 #include <bm/bm_sim/target_parser.h>
 
 #include "pna_nic.h"
@@ -38,19 +39,34 @@ shared_ptr<PnaNicIf> get_handler(bm::pna::PnaNic *nic);
 int
 main(int argc, char* argv[]) {
   using bm::pna::PnaNic;
-  pna_nic = new PnaNic();
   pna_nic_parser = new bm::TargetParserBasic();
   pna_nic_parser->add_flag_option("enable-swap",
                                         "enable JSON swapping at runtime");
-  int status = pna_nic->init_from_command_line_options(
-      argc, argv, pna_nic_parser);
-  if (status != 0) std::exit(status);
+  pna_nic_parser->add_int_option(
+      "tm-config-port",
+      "Port of the Traffic Manager configuration server, which is disabled "
+      "unless a port is given");
+
+  bm::OptionsParser parser;
+  parser.parse(argc, argv, pna_nic_parser);
 
   bool enable_swap_flag = false;
   if (pna_nic_parser->get_flag_option("enable-swap", &enable_swap_flag)
       != bm::TargetParserBasic::ReturnCode::SUCCESS)
     std::exit(1);
-  if (enable_swap_flag) pna_nic->enable_config_swap();
+
+  int tm_config_port = -1;
+  {
+    auto rc =
+        pna_nic_parser->get_int_option("tm-config-port", &tm_config_port);
+    if (rc != bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED &&
+        rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+
+  pna_nic = new PnaNic(enable_swap_flag, tm_config_port);
+  int status = pna_nic->init_from_options_parser(parser);
+  if (status != 0) std::exit(status);
 
   int thrift_port = pna_nic->get_runtime_port();
   bm_runtime::start_server(pna_nic, thrift_port);
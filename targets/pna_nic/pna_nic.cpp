@@ -43,11 +43,17 @@ namespace pna {
 
 packet_id_t PnaNic::packet_id = 0;
 
+namespace {
 
-PnaNic::PnaNic(bool enable_swap)
+constexpr size_t output_buffer_capacity = 128;
+
+}  // namespace
+
+
+PnaNic::PnaNic(bool enable_swap, int tm_config_port)
   : Switch(enable_swap),
     input_buffer(1024),
-    output_buffer(128),
+    output_buffer(output_buffer_capacity),
     // cannot use std::bind because of a clang bug
     // https://stackoverflow.com/questions/32030141/is-this-incorrect-use-of-stdbind-or-a-compiler-bug
     my_transmit_fn([this](port_t port_num, packet_id_t pkt_id,
@@ -72,6 +78,18 @@ PnaNic::PnaNic(bool enable_swap)
   force_arith_header("pna_main_input_metadata");
   force_arith_header("pna_main_output_metadata");
 
+  // The class of service is the priority of the schedulers, the egress port
+  // is the one of send_to_port() and the size the one of the deparsed packet
+  TMAdapter tm_adapter;
+  tm_egress_sink.reset(
+      new BlockingQueueEgressSink(&output_buffer, output_buffer_capacity));
+  tm_adapter.egress_sink = tm_egress_sink.get();
+  tm_adapter.fields.set_field_name(CalendarItemField::EgressPort, "");
+  tm_adapter.fields.set_field_name(CalendarItemField::PacketSize, "");
+  tm_adapter.fields.set_field_name(
+      CalendarItemField::Priority, "pna_main_output_metadata.class_of_service");
+  traffic_manager.reset(new TrafficManager(tm_adapter, tm_config_port));
+
   import_primitives();
   import_counters();
   import_meters();
@@ -112,15 +130,27 @@ PnaNic::receive_(port_t port_num, const char *buffer, int len) {
 
 void
 PnaNic::start_and_return_() {
+  // The program is loaded, the scheduler actions of the TM can be bound
+  auto p4objects = get_context(0)->get_p4objects();
+  if (p4objects) {
+    traffic_manager->bind_program(
+        P4ActionSource(p4objects.get(), {"MainControlImpl", "main_control"}),
+        p4objects->get_phv_factory());
+  }
   threads_.push_back(std::thread(&PnaNic::main_thread, this));
   threads_.push_back(std::thread(&PnaNic::transmit_thread, this));
 }
 
 PnaNic::~PnaNic() {
   input_buffer.push_front(nullptr);
+  // main_thread() is the first thread, it feeds the TM
+  if (!threads_.empty()) threads_.front().join();
+  // The dequeue workers of the TM may wait for room in the output buffer,
+  // the TM stops while transmit_thread() still drains it
+  traffic_manager.reset();
   output_buffer.push_front(nullptr);
   for (auto& thread_ : threads_) {
-    thread_.join();
+    if (thread_.joinable()) thread_.join();
   }
 }
 
@@ -153,6 +183,9 @@ PnaNic::transmit_thread() {
     output_buffer.pop_back(&packet);
 
     if (packet == nullptr) break;
+    // The buffer is shared by the ports, all their roots may send again. The
+    // sink outlives the TM, which is destroyed while this thread drains
+    tm_egress_sink->slot_freed();
     BMELOG(packet_out, *packet);
     BMLOG_DEBUG_PKT(*packet, "Transmitting packet of size {} out of port {}",
                     packet->get_data_size(), packet->get_egress_port());
@@ -204,7 +237,8 @@ PnaNic::main_thread() {
 
     Deparser *deparser = this->get_deparser("main_deparser");
     deparser->deparse(packet.get());
-    output_buffer.push_front(std::move(packet));
+    auto egress_port = packet->get_egress_port();
+    traffic_manager->enqueue(egress_port, std::move(packet));
   }
 }
 
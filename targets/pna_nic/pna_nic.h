@@ -27,6 +27,7 @@
 #include <bm/bm_sim/switch.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/simple_pre_lag.h>
+#include <bm/bm_sim/traffic_manager.h>
 
 #include <memory>
 #include <chrono>
@@ -53,8 +54,9 @@ class PnaNic : public Switch {
   using clock = std::chrono::high_resolution_clock;
 
  public:
-  // by default, swapping is off
-  explicit PnaNic(bool enable_swap = false);
+  // by default, swapping is off and the configuration server of the Traffic
+  // Manager is disabled (negative tm_config_port)
+  explicit PnaNic(bool enable_swap = false, int tm_config_port = -1);
 
   ~PnaNic();
 
@@ -103,7 +105,10 @@ class PnaNic : public Switch {
  private:
   std::vector<std::thread> threads_;
   Queue<std::unique_ptr<Packet> > input_buffer;
+  // Filled by the TM, blocking when full, and drained by transmit_thread()
   Queue<std::unique_ptr<Packet> > output_buffer;
+  std::unique_ptr<TMEgressSink> tm_egress_sink;
+  std::unique_ptr<TrafficManager> traffic_manager;
   TransmitFn my_transmit_fn;
   clock::time_point start;
 };
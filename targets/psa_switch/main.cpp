@@ -22,6 +22,7 @@
 
 #include <bm/PsaSwitch.h>
 #include <bm/bm_runtime/bm_runtime.h>
+#include <bm/bm_sim/options_parse.h>
 #include <bm/bm_sim/target_parser.h>
 
 #include "psa_switch.h"
@@ -38,19 +39,34 @@ shared_ptr<PsaSwitchIf> get_handler(bm::psa::PsaSwitch *sw);
 int
 main(int argc, char* argv[]) {
   using bm::psa::PsaSwitch;
-  psa_switch = new PsaSwitch();
   psa_switch_parser = new bm::TargetParserBasic();
   psa_switch_parser->add_flag_option("enable-swap",
                                         "enable JSON swapping at runtime");
-  int status = psa_switch->init_from_command_line_options(
-      argc, argv, psa_switch_parser);
-  if (status != 0) std::exit(status);
+  psa_switch_parser->add_int_option(
+      "tm-config-port",
+      "Port of the Traffic Manager configuration server, which is disabled "
+      "unless a port is given");
+
+  bm::OptionsParser parser;
+  parser.parse(argc, argv, psa_switch_parser);
 
   bool enable_swap_flag = false;
   if (psa_switch_parser->get_flag_option("enable-swap", &enable_swap_flag)
       != bm::TargetParserBasic::ReturnCode::SUCCESS)
     std::exit(1);
-  if (enable_swap_flag) psa_switch->enable_config_swap();
+
+  int tm_config_port = -1;
+  {
+    auto rc =
+        psa_switch_parser->get_int_option("tm-config-port", &tm_config_port);
+    if (rc != bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED &&
+        rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+
+  psa_switch = new PsaSwitch(enable_swap_flag, tm_config_port);
+  int status = psa_switch->init_from_options_parser(parser);
+  if (status != 0) std::exit(status);
 
   int thrift_port = psa_switch->get_runtime_port();
   bm_runtime::start_server(psa_switch, thrift_port);
@@ -117,7 +117,7 @@ class PsaSwitch::MirroringSessions {
   std::unordered_map<mirror_id_t, MirroringSessionConfig> sessions_map;
 };
 
-PsaSwitch::PsaSwitch(bool enable_swap)
+PsaSwitch::PsaSwitch(bool enable_swap, int tm_config_port)
   : Switch(enable_swap),
     input_buffer(1024),
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
@@ -181,6 +181,25 @@ PsaSwitch::PsaSwitch(bool enable_swap)
   force_arith_header("psa_egress_output_metadata");
   force_arith_header("psa_egress_deparser_input_metadata");
 
+  // The scheduler-visible fields of the PSA programs: the class of service is
+  // the priority, the packet size is the one of the deparsed packet
+  TMAdapter tm_adapter;
+#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+  tm_egress_sink.reset(
+      new PriQueueingEgressSink<EgressThreadMapper>(&egress_buffers));
+#else
+  tm_egress_sink.reset(
+      new QueueingEgressSink<EgressThreadMapper>(&egress_buffers));
+#endif
+  tm_adapter.egress_sink = tm_egress_sink.get();
+  tm_adapter.fields.set_field_name(CalendarItemField::EgressPort,
+                                   "psa_ingress_output_metadata.egress_port");
+  tm_adapter.fields.set_field_name(CalendarItemField::PacketSize, "");
+  tm_adapter.fields.set_field_name(
+      CalendarItemField::Priority,
+      "psa_ingress_output_metadata.class_of_service");
+  traffic_manager.reset(new TrafficManager(tm_adapter, tm_config_port));
+
   import_primitives();
   import_counters();
   import_meters();
@@ -221,6 +240,13 @@ PsaSwitch::receive_(port_t port_num, const char *buffer, int len) {
 
 void
 PsaSwitch::start_and_return_() {
+  // The program is loaded, the scheduler actions of the TM can be bound
+  auto p4objects = get_context(0)->get_p4objects();
+  if (p4objects) {
+    traffic_manager->bind_program(
+        P4ActionSource(p4objects.get(), {"ingress", "MyIngress"}),
+        p4objects->get_phv_factory());
+  }
   threads_.push_back(std::thread(&PsaSwitch::ingress_thread, this));
   for (size_t i = 0; i < nb_egress_threads; i++) {
     threads_.push_back(std::thread(&PsaSwitch::egress_thread, this, i));
@@ -231,10 +257,12 @@ PsaSwitch::start_and_return_() {
 PsaSwitch::~PsaSwitch() {
   input_buffer.push_front(nullptr);
   for (size_t i = 0; i < nb_egress_threads; i++) {
+    // The TM may still fill the egress buffers, retry until the sentinel is
+    // in, as in simple_switch
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
-    egress_buffers.push_front(i, 0, nullptr);
+    while (egress_buffers.push_front(i, 0, nullptr) == 0) continue;
 #else
-    egress_buffers.push_front(i, nullptr);
+    while (egress_buffers.push_front(i, nullptr) == 0) continue;
 #endif
   }
   output_buffer.push_front(nullptr);
@@ -269,12 +297,15 @@ PsaSwitch::mirroring_get_session(mirror_id_t mirror_id,
 int
 PsaSwitch::set_egress_queue_depth(size_t port, const size_t depth_pkts) {
   egress_buffers.set_capacity(port, depth_pkts);
+  // A deeper queue gives credits to the roots of the port
+  tm_egress_sink->slot_freed(port);
   return 0;
 }
 
 int
 PsaSwitch::set_all_egress_queue_depths(const size_t depth_pkts) {
   egress_buffers.set_capacity_for_all(depth_pkts);
+  tm_egress_sink->slot_freed();
   return 0;
 }
 
@@ -332,17 +363,21 @@ PsaSwitch::enqueue(port_t egress_port, std::unique_ptr<Packet> &&packet) {
     packet->set_egress_port(egress_port);
 
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
+    auto phv = packet->get_phv();
     auto priority = phv->has_field(SSWITCH_PRIORITY_QUEUEING_SRC) ?
         phv->get_field(SSWITCH_PRIORITY_QUEUEING_SRC).get<size_t>() : 0u;
     if (priority >= SSWITCH_PRIORITY_QUEUEING_NB_QUEUES) {
       bm::Logger::get()->error("Priority out of range, dropping packet");
       return;
     }
-    egress_buffers.push_front(
-        egress_port, SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority,
-        std::move(packet));
+    // Scheduled by the hierarchy of the TM into the priority queue of
+    // egress_buffers the packet would have gone to without it
+    traffic_manager->enqueue(
+        egress_port, std::move(packet),
+        SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority);
 #else
-    egress_buffers.push_front(egress_port, std::move(packet));
+    // Scheduled into egress_buffers by the hierarchy of the TM
+    traffic_manager->enqueue(egress_port, std::move(packet));
 #endif
 }
 
@@ -533,6 +568,8 @@ PsaSwitch::egress_thread(size_t worker_id) {
 #endif
 
     if (packet == nullptr) break;
+    // Wakes up the roots of the port waiting for a transmit credit
+    tm_egress_sink->slot_freed(port);
     phv = packet->get_phv();
 
     // this reset() marks all headers as invalid - this is important since PSA
@@ -27,6 +27,7 @@
 #include <bm/bm_sim/switch.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/simple_pre_lag.h>
+#include <bm/bm_sim/traffic_manager.h>
 
 #include <memory>
 #include <chrono>
@@ -79,8 +80,9 @@ class PsaSwitch : public Switch {
   using clock = std::chrono::high_resolution_clock;
 
  public:
-  // by default, swapping is off
-  explicit PsaSwitch(bool enable_swap = false);
+  // by default, swapping is off and the configuration server of the Traffic
+  // Manager is disabled (negative tm_config_port)
+  explicit PsaSwitch(bool enable_swap = false, int tm_config_port = -1);
 
   ~PsaSwitch();
 
@@ -274,6 +276,9 @@ class PsaSwitch : public Switch {
   bm::QueueingLogicRL<std::unique_ptr<Packet>, EgressThreadMapper>
 #endif
   egress_buffers;
+  // The TM schedules the packets of the ingress into egress_buffers
+  std::unique_ptr<TMEgressSink> tm_egress_sink;
+  std::unique_ptr<TrafficManager> traffic_manager;
   Queue<std::unique_ptr<Packet> > output_buffer;
   TransmitFn my_transmit_fn;
   std::shared_ptr<McSimplePreLAG> pre;
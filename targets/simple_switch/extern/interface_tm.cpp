@@ -48,6 +48,11 @@ BM_REGISTER_EXTERN_METHOD(TrafficManagerInterface, find_next_non_empty_day,
 BM_REGISTER_EXTERN_METHOD(TrafficManagerInterface, find_non_empty_day,
                           const Data &, const Data &, Data &);
 
+BM_REGISTER_EXTERN_METHOD(TrafficManagerInterface, drop_packet);
+
+BM_REGISTER_EXTERN_METHOD(TrafficManagerInterface, get_buffer_occupancy,
+                          const Data &, Data &, Data &);
+
 /// @brief Get a scheduler parameter
 /// @param param_index index of the parameter
 /// @param value value to set (output of the function)
@@ -55,15 +60,22 @@ BM_REGISTER_EXTERN_METHOD(TrafficManagerInterface, find_non_empty_day,
 void TrafficManagerInterface::get_scheduler_parameter(const Data &param_index,
                                                       const Data &reg_index,
                                                       Data &value) {
-  // Check if the parameter exists
-  if (param_index.get<size_t>() >= scheduler_params.size()) {
-    bm::Logger::get()->error("Scheduler parameter index {} out of bounds",
-                             param_index.get<size_t>());
-    return;
+  const size_t param = param_index.get<size_t>();
+  const size_t idx = reg_index.get<size_t>();
+  auto read = [&](const SchedulerParams::Snapshot &params) {
+    // Check if the parameter exists
+    if (param >= MAX_NB_SCHED_PARAM || idx >= params.sizes[param]) {
+      bm::Logger::get()->error("Scheduler parameter {} index {} out of bounds",
+                               param, idx);
+      return;
+    }
+    value.set(params.values[param][idx]);
+  };
+  if (action_params) {
+    read(**action_params);
+  } else {
+    read(*SchedulerParams::Pin(scheduler_params));
   }
-  auto it = scheduler_params.begin();
-  std::advance(it, param_index.get<size_t>());
-  value.set(it->second->at(reg_index.get<size_t>()).get<size_t>());
 }
 
 /// @brief Return the size of a scheduler parameter
@@ -71,15 +83,21 @@ void TrafficManagerInterface::get_scheduler_parameter(const Data &param_index,
 /// @param value value to set (output of the function)
 void TrafficManagerInterface::get_size_of_parameter(const Data &param_index,
                                                     Data &value) {
-  if (this->scheduler_params.find(param_index.get<size_t>()) ==
-      scheduler_params.end()) {
-    bm::Logger::get()->error("Scheduler parameter {} does not exist",
-                             param_index);
-    return;
+  const size_t param = param_index.get<size_t>();
+  auto read = [&](const SchedulerParams::Snapshot &params) {
+    if (param >= MAX_NB_SCHED_PARAM || params.sizes[param] == 0) {
+      bm::Logger::get()->error("Scheduler parameter {} does not exist", param);
+      return;
+    }
+    value.set(params.sizes[param]);
+    BMLOG_DEBUG("Size of scheduler parameter {} is {}", param,
+                params.sizes[param]);
+  };
+  if (action_params) {
+    read(**action_params);
+  } else {
+    read(*SchedulerParams::Pin(scheduler_params));
   }
-  value.set(Data{this->scheduler_params[param_index.get<size_t>()]->size()});
-  BMLOG_DEBUG("Size of scheduler parameter {} is {}", param_index.get<size_t>(),
-              value.get<size_t>());
 }
 
 /// @brief Write to a general purpose register
@@ -88,18 +106,17 @@ void TrafficManagerInterface::get_size_of_parameter(const Data &param_index,
 /// @param idx index of the RegisterArray
 void TrafficManagerInterface::write_to_reg(const Data &reg_number,
                                            const Data &idx, const Data &value) {
-  // Check if the parameter exists
-  if (gen_purpose_reg.find(reg_number.get<size_t>()) == gen_purpose_reg.end()) {
-    bm::Logger::get()->error("Register index {} out of bounds",
-                             reg_number.get<size_t>());
+  const size_t reg = reg_number.get<size_t>();
+  const size_t i = idx.get<size_t>();
+  // Check if the register exists
+  if (reg >= MAX_NB_GP_REG || i >= MAX_SIZE_GP_REG_ARRAY) {
+    bm::Logger::get()->error("Register {} index {} out of bounds", reg, i);
     return;
   }
-  gen_purpose_reg[reg_number.get<size_t>()]
-      ->at(idx.get<size_t>())
-      .set(value.get<size_t>());
+  regs.gen_purpose_reg[reg][i] = value.get<uint64_t>();
 
-  BMLOG_DEBUG("Wrote {} to register {} at index {}", value.get<size_t>(),
-              reg_number.get<size_t>(), idx.get<size_t>());
+  BMLOG_DEBUG("Wrote {} to register {} at index {}",
+              regs.gen_purpose_reg[reg][i], reg, i);
 }
 
 /// @brief Read from a general purpose register
@@ -108,26 +125,24 @@ void TrafficManagerInterface::write_to_reg(const Data &reg_number,
 /// @param value value to set (output of the function)
 void TrafficManagerInterface::read_from_reg(const Data &reg_number,
                                             const Data &idx, Data &value) {
-  // Check if the parameter exists
-  if (gen_purpose_reg.find(reg_number.get<size_t>()) == gen_purpose_reg.end()) {
-    bm::Logger::get()->error("Register index {} out of bounds",
-                             reg_number.get<size_t>());
+  const size_t reg = reg_number.get<size_t>();
+  const size_t i = idx.get<size_t>();
+  // Check if the register exists
+  if (reg >= MAX_NB_GP_REG || i >= MAX_SIZE_GP_REG_ARRAY) {
+    bm::Logger::get()->error("Register {} index {} out of bounds", reg, i);
     return;
   }
-  value.set(gen_purpose_reg[reg_number.get<size_t>()]
-                ->at(idx.get<size_t>())
-                .get<size_t>());
+  value.set(regs.gen_purpose_reg[reg][i]);
 
-  BMLOG_DEBUG("Read {} from register {} at index {}", value.get<size_t>(),
-              reg_number.get<size_t>(), idx.get<size_t>());
+  BMLOG_DEBUG("Read {} from register {} at index {}",
+              regs.gen_purpose_reg[reg][i], reg, i);
 }
 
 /// @brief Thread safe modifier to the rank register
 /// @param value
 void TrafficManagerInterface::set_rank(const Data &day, const Data &time) {
-  rank->at(0).set(day.get<size_t>());
-  rank->at(1).set(time.get<size_t>());
-  // BMLOG_DEBUG("Set rank {}", rank->at(1).get<size_t>());
+  regs.rank[0] = day.get<int>();
+  regs.rank[1] = time.get<int>();
 }
 
 void TrafficManagerInterface::get_rank(const Data &, Data &value) {
@@ -140,8 +155,8 @@ void TrafficManagerInterface::get_rank(const Data &, Data &value) {
 void TrafficManagerInterface::set_predicate(const Data &day, const Data &time) {
   BMLOG_DEBUG("Setting predicate to day {} and time {}", day.get<size_t>(),
               time.get<size_t>());
-  predicate->at(0).set(day.get<size_t>());
-  predicate->at(1).set(time.get<size_t>());
+  regs.predicate[0] = day.get<int>();
+  regs.predicate[1] = time.get<int>();
 }
 
 /**
@@ -150,7 +165,7 @@ void TrafficManagerInterface::set_predicate(const Data &day, const Data &time) {
  */
 void TrafficManagerInterface::get_lowest_priority(Data &day, Data &value) {
   // Locks to be done ?
-  std::shared_ptr<CalendarItem> cal_item = owner->get_lowest();
+  CalendarItem *cal_item = owner->get_lowest();
 
   if (cal_item == nullptr) {
 #ifdef BM_ENABLE_TM_DEBUG
@@ -172,8 +187,7 @@ void TrafficManagerInterface::get_lowest_priority(Data &day, Data &value) {
 void TrafficManagerInterface::get_lowest_priority_for_day(const Data &day,
                                                           Data &value) {
   // Locks to be done ?
-  std::shared_ptr<CalendarItem> cal_item =
-      owner->get_lowest_for_day(day.get<int>());
+  CalendarItem *cal_item = owner->get_lowest_for_day(day.get<int>());
 
   // TODO opti via returning a null value for the predicate ? letting P4 code
   // handling it
@@ -197,17 +211,23 @@ void TrafficManagerInterface::get_lowest_priority_for_day(const Data &day,
   // }
 }
 
-// Safe access to the packet fields for these 2 ?
 void TrafficManagerInterface::set_field(const Data &field_index,
                                         const Data &value) {
-  this->packet_informations[field_index.get<size_t>()]->at(0).set(
-      value.get<size_t>());
+  const size_t field = field_index.get<size_t>();
+  if (field >= MAX_NB_SCHED_PARAM) {
+    bm::Logger::get()->error("Packet field {} out of bounds", field);
+    return;
+  }
+  regs.packet_informations[field] = value.get<uint64_t>();
 }
 
 void TrafficManagerInterface::get_field(const Data &field_index, Data &value) {
-  value.set(this->packet_informations[field_index.get<size_t>()]
-                ->at(0)
-                .get<size_t>());
+  const size_t field = field_index.get<size_t>();
+  if (field >= MAX_NB_SCHED_PARAM) {
+    bm::Logger::get()->error("Packet field {} out of bounds", field);
+    return;
+  }
+  value.set(regs.packet_informations[field]);
 }
 
 // ----------------- END OF REGISTERED FUNCTIONS -----------------
@@ -217,36 +237,44 @@ void TrafficManagerInterface::get_field(const Data &field_index, Data &value) {
  */
 
 size_t TrafficManagerInterface::get_field(int field_index) {
-  // Packets info is 2D array, all values in stored in the first row
-  return packet_informations[field_index]->at(0).get<size_t>();
+  return regs.packet_informations[field_index];
 }
 
 /// @brief Add a scheduler parameter
 /// @param name Name of the parameter
-/// @param value vector of values to initialize the RegisterArray
-/// @param id id of the RegisterArray (not meaningful as of now)
-/// @param size number of registers in the RegisterArray
-/// @param bitwidth size of each register in bits
+/// @param value vector of values to initialize the parameter
+/// @param id id of the parameter (not meaningful as of now)
+/// @param size number of values of the parameter, at most
+/// MAX_SIZE_SCHED_PARAM_ARRAY
+/// @param bitwidth size of each value in bits, the initial values are
+/// truncated to it
 void TrafficManagerInterface::add_scheduler_parameter(const int &param_index,
                                                       std::vector<int> value,
                                                       p4object_id_t id,
                                                       size_t size,
                                                       int bitwidth) {
-  if (scheduler_params.find(param_index) != scheduler_params.end()) {
-    bm::Logger::get()->error("Scheduler parameter {} already exists",
+  (void) id;
+  if (param_index < 0 || param_index >= MAX_NB_SCHED_PARAM ||
+      size > MAX_SIZE_SCHED_PARAM_ARRAY || value.size() > size) {
+    bm::Logger::get()->error("Scheduler parameter {} out of bounds",
                              param_index);
     return;
   }
-  scheduler_params[param_index] = std::make_unique<bm::RegisterArray>(
-      "scheduler_param_" + std::to_string(param_index), id, size, bitwidth);
-
-  for (size_t i = 0; i < value.size(); i++) {
-    scheduler_params[param_index]->at(i).set(value[i]);
+  if (SchedulerParams::Pin(scheduler_params)->sizes[param_index] != 0) {
+    bm::Logger::get()->error("Scheduler parameter {} already exists",
+                             param_index);
+    return;
   }
+  const uint64_t mask =
+      bitwidth >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << bitwidth) - 1;
+  std::vector<uint64_t> values(size, 0);
+  for (size_t i = 0; i < value.size(); i++)
+    values[i] = static_cast<uint64_t>(value[i]) & mask;
+  scheduler_params.set(param_index, values);
 }
 
 int TrafficManagerInterface::get_content_reg(int reg_index, int idx) {
-  return gen_purpose_reg[reg_index]->at(idx).get<int>();
+  return static_cast<int>(regs.gen_purpose_reg[reg_index][idx]);
 }
 
 void TrafficManagerInterface::has_packets(const Data &day, Data &is_empty) {
@@ -304,4 +332,18 @@ void TrafficManagerInterface::find_non_empty_day(const Data &day_start,
   }
 }
 
+void TrafficManagerInterface::drop_packet() { admitted = false; }
+
+void TrafficManagerInterface::get_buffer_occupancy(const Data &scope,
+                                                   Data &packets,
+                                                   Data &bytes) {
+  const size_t level = scope.get<size_t>();
+  if (level >= admission.size()) {
+    bm::Logger::get()->error("Buffer scope {} out of bounds", level);
+    return;
+  }
+  packets.set(admission[level].packets);
+  bytes.set(admission[level].bytes);
+}
+
 }  // namespace bm
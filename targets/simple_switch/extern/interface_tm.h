@@ -1,16 +1,18 @@
 #ifndef SIMPLE_SWITCH_EXTERN_INTERFACE_TM_H_
 #define SIMPLE_SWITCH_EXTERN_INTERFACE_TM_H_
 
+#include <bm/bm_sim/buffer_manager.h>  // bm::BufferOccupancies
 #include <bm/bm_sim/data.h>    // bm::Data
 #include <bm/bm_sim/extern.h>  // bm::ExternType
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/node.h>
-#include <bm/bm_sim/stateful.h>  // bm::RegisterArray
+#include <bm/bm_sim/scheduler_params.h>
 #include <bm/config.h>
 
+#include <cstdint>
 #include <iostream>
-#include <memory>
-#include <unordered_map>
+#include <optional>
+#include <utility>  // std::pair
 #include <vector>
 
 #define MAX_NB_GP_REG 32
@@ -19,6 +21,10 @@
 #define MAX_SIZE_GP_REG_ARRAY 16
 #define BITWIDTH 32
 
+static_assert(MAX_NB_SCHED_PARAM <= bm::SchedulerParams::MAX_PARAMS &&
+                  MAX_SIZE_SCHED_PARAM_ARRAY <= bm::SchedulerParams::MAX_VALUES,
+              "Scheduler parameters do not fit in SchedulerParams");
+
 namespace bm {
 class Node;
 
@@ -35,31 +41,12 @@ class TrafficManagerInterface : public bm::ExternType {
     // This registration is only for the P4 constructor call
   }
 
-  void init() override {  // Attributes
-    // Single register arrays
-    this->rank = std::make_unique<bm::RegisterArray>("rank", 0, 2, BITWIDTH);
-    this->predicate =
-        std::make_unique<bm::RegisterArray>("predicate", 0, 2, BITWIDTH);
-
-    this->reset();
-  }
+  void init() override { this->reset(); }
 
+  //! Clears all the registers and removes the scheduler parameters
   void reset() {
-    this->scheduler_params.clear();
-
-    // Allocation of the general purpose registers
-    for (size_t i = 0; i < MAX_NB_GP_REG; i++) {
-      gen_purpose_reg[i] = std::make_unique<bm::RegisterArray>(
-          "gen_purpose_reg_" + std::to_string(i), 0, MAX_SIZE_GP_REG_ARRAY,
-          BITWIDTH);
-    }
-
-    // Initialization of the packet fields, needed for predicate
-    for (size_t i = 0; i < MAX_NB_SCHED_PARAM; i++) {
-      // 1 register for each field (MAX_NB_SCHED_PARAM fields per packet)
-      packet_informations[i] = std::make_unique<bm::RegisterArray>(
-          "packet_field_" + std::to_string(i), 0, 1, BITWIDTH);
-    }
+    regs = RegisterFile{};
+    scheduler_params.clear();
   }
 
   /*
@@ -114,6 +101,18 @@ class TrafficManagerInterface : public bm::ExternType {
 
   void get_field(const bm::Data &field_index, bm::Data &value);
 
+  /// @brief Drop the packet being admitted, from the admit action only
+  void drop_packet();
+
+  /// @brief Occupancy of the buffer when the packet is admitted, from the
+  /// admit action only
+  /// @param scope 0 for the leaf, 1 for the egress port, 2 for the shared
+  /// buffer
+  /// @param packets number of packets (output of the function)
+  /// @param bytes number of bytes (output of the function)
+  void get_buffer_occupancy(const bm::Data &scope, bm::Data &packets,
+                            bm::Data &bytes);
+
   // ----------------- END OF REGISTERED FUNCTIONS -----------------
 
   /*
@@ -122,25 +121,39 @@ class TrafficManagerInterface : public bm::ExternType {
 
   void set_owner(bm::Node *p) { this->owner = p; }
 
+  //! Parameters read by get_scheduler_parameter(), updated at runtime
+  SchedulerParams &get_scheduler_params() { return scheduler_params; }
+
+  //! Called around each scheduler action: all the parameters the action
+  //! reads come from the same version, whatever the updates in the meantime
+  void begin_action() { action_params.emplace(scheduler_params); }
+  void end_action() { action_params.reset(); }
+
+  //! Called by the Node before the admit action, see drop_packet()
+  void begin_admission(const BufferOccupancies &occupancies) {
+    admission = occupancies;
+    admitted = true;
+  }
+  bool is_admitted() const { return admitted; }
+
   /// @brief Return the rank register. Thread safe access
   /// @return the value of the rank register
   std::pair<int, int> get_rank() const {
-    // auto lock = rank->unique_lock();
-    int day = rank->at(0).get<int>();
-    int time = rank->at(1).get<int>();
-    // rank->unlock(lock);
 #ifdef BM_ENABLE_TM_DEBUG
-    BMLOG_DEBUG("Read day:{}, time:{} from rank register", day, time);
+    BMLOG_DEBUG("Read day:{}, time:{} from rank register", regs.rank[0],
+                regs.rank[1]);
 #endif
-    return std::make_pair(day, time);
+    return std::make_pair(regs.rank[0], regs.rank[1]);
   }
 
   /// @brief Add a scheduler parameter
   /// @param name Name of the parameter
-  /// @param value vector of values to initialize the RegisterArray
-  /// @param id id of the RegisterArray (not meaningful as of now)
-  /// @param size number of registers in the RegisterArray
-  /// @param bitwidth size of each register in bits
+  /// @param value vector of values to initialize the parameter
+  /// @param id id of the parameter (not meaningful as of now)
+  /// @param size number of values of the parameter, at most
+  /// MAX_SIZE_SCHED_PARAM_ARRAY
+  /// @param bitwidth size of each value in bits, the initial values are
+  /// truncated to it
   void add_scheduler_parameter(const int &param_index, std::vector<int> value,
                                bm::p4object_id_t id,
                                size_t size = MAX_SIZE_SCHED_PARAM_ARRAY,
@@ -152,11 +165,7 @@ class TrafficManagerInterface : public bm::ExternType {
   /// @return the rank of the predicate packet to be set as predicate in the
   /// node
   std::pair<int, int> get_predicate() const {
-    // auto lock = predicate->unique_lock();
-    int day = predicate->at(0).get<int>();
-    int time = predicate->at(1).get<int>();
-    // BMLOG_DEBUG("Read day:{}, time:{} from predicate register", day, time);
-    return std::make_pair(day, time);
+    return std::make_pair(regs.predicate[0], regs.predicate[1]);
   }
 
   void find_next_non_empty_day(const Data &day, const Data &max_search_limit,
@@ -171,19 +180,34 @@ class TrafficManagerInterface : public bm::ExternType {
   size_t get_field(int field_index);
 
  private:
-  using Registers = std::unordered_map<int, std::unique_ptr<bm::RegisterArray>>;
-
-  // Scheduler parameters set at P4Runtime
+  /**
+   * @brief All the registers of the Node, in one block indexed directly.
+   * Values are 64-bit wide. The registers are only accessed by the scheduler
+   * actions of the Node and by the Node right after them, both under its
+   * calendar lock, they need no lock of their own. The registers used by
+   * every action come first, they share the first cache line. The scheduler
+   * parameters, written by the control plane, are kept apart.
+   */
+  struct alignas(64) RegisterFile {
+    int rank[2]{};
+    int predicate[2]{};
+    // Packet fields, needed for predicate
+    uint64_t packet_informations[MAX_NB_SCHED_PARAM]{};
+    // General purpose registers. To be used by the P4 user
+    uint64_t gen_purpose_reg[MAX_NB_GP_REG][MAX_SIZE_GP_REG_ARRAY]{};
+  };
+
+  RegisterFile regs;
+
+  // Scheduler parameters set by the control plane
   // Should be read-only for the P4 user
-  Registers scheduler_params;
-
-  Registers packet_informations;
-
-  // General purpose registers. To be used by the P4 user
-  Registers gen_purpose_reg;
+  SchedulerParams scheduler_params;
+  // Version pinned by the running action, if any
+  std::optional<SchedulerParams::Pin> action_params;
 
-  std::unique_ptr<bm::RegisterArray> rank;
-  std::unique_ptr<bm::RegisterArray> predicate;
+  // Buffer state and verdict of the admit action
+  BufferOccupancies admission{};
+  bool admitted{true};
 
   Node *owner;
 };
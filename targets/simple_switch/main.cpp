@@ -24,6 +24,7 @@
 #include <bm/bm_runtime/bm_runtime.h>
 #include <bm/bm_sim/options_parse.h>
 #include <bm/bm_sim/target_parser.h>
+#include <bm/bm_sim/tm_trace.h>
 #include <bm/config.h>
 
 #include "simple_switch.h"
@@ -44,6 +45,17 @@ int main(int argc, char *argv[]) {
       "drop-port", "Choose drop port number (default is 511)");
   simple_switch_parser.add_uint_option(
       "priority-queues", "Number of priority queues (default is 1)");
+  simple_switch_parser.add_uint_option(
+      "tm-workers",
+      "Number of threads executing the Traffic Manager nodes (default is 4)");
+  simple_switch_parser.add_int_option(
+      "tm-config-port",
+      "Port of the Traffic Manager configuration server, negative to disable "
+      "it (default is 41200)");
+  simple_switch_parser.add_string_option(
+      "tm-trace",
+      "Trace the Traffic Manager events to this file (binary, see "
+      "tools/tm_trace_to_csv.py)");
 
   bm::OptionsParser parser;
   parser.parse(argc, argv, &simple_switch_parser);
@@ -73,8 +85,37 @@ int main(int argc, char *argv[]) {
       std::exit(1);
   }
 
-  simple_switch =
-      new SimpleSwitch(enable_swap_flag, drop_port, priority_queues);
+  uint32_t tm_workers = 0xffffffff;
+  {
+    auto rc = simple_switch_parser.get_uint_option("tm-workers", &tm_workers);
+    if (rc == bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED)
+      tm_workers = SimpleSwitch::default_nb_tm_workers;
+    else if (rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+
+  int tm_config_port = TM_CONFIG_SERVER_PORT;
+  {
+    auto rc = simple_switch_parser.get_int_option("tm-config-port",
+                                                  &tm_config_port);
+    if (rc != bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED &&
+        rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+
+  std::string tm_trace;
+  {
+    auto rc = simple_switch_parser.get_string_option("tm-trace", &tm_trace);
+    if (rc != bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED &&
+        rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+  if (!tm_trace.empty() && !bm::TMTrace::get()->start(tm_trace))
+    std::exit(1);
+
+  simple_switch = new SimpleSwitch(enable_swap_flag, drop_port,
+                                   priority_queues, tm_workers,
+                                   tm_config_port);
 
   int status = simple_switch->init_from_options_parser(parser);
   if (status != 0) std::exit(status);
@@ -151,6 +151,29 @@ class SimpleSwitch::InputBuffer {
     return 0;
   }
 
+  // Same as pop_back() for the packets already queued, up to max_items of
+  // them, in the same order. Waits for the first one
+  void pop_back_burst(std::vector<std::unique_ptr<Packet> > *items,
+                      size_t max_items) {
+    Lock lock(mutex);
+    cvar_can_pop.wait(
+        lock, [this] { return (queue_hi.size() + queue_lo.size()) > 0; });
+    bool popped_hi = false, popped_lo = false;
+    while (items->size() < max_items && queue_hi.size() > 0) {
+      items->push_back(std::move(queue_hi.back()));
+      queue_hi.pop_back();
+      popped_hi = true;
+    }
+    while (items->size() < max_items && queue_lo.size() > 0) {
+      items->push_back(std::move(queue_lo.back()));
+      queue_lo.pop_back();
+      popped_lo = true;
+    }
+    lock.unlock();
+    if (popped_hi) cvar_can_push_hi.notify_all();
+    if (popped_lo) cvar_can_push_lo.notify_all();
+  }
+
   void pop_back(std::unique_ptr<Packet> *pItem) {
     Lock lock(mutex);
     cvar_can_pop.wait(
@@ -199,7 +222,8 @@ class SimpleSwitch::InputBuffer {
 };
 
 SimpleSwitch::SimpleSwitch(bool enable_swap, port_t drop_port,
-                           size_t nb_queues_per_port)
+                           size_t nb_queues_per_port, size_t nb_tm_workers,
+                           int tm_config_port)
     : Switch(enable_swap),
       drop_port(drop_port),
       input_buffer(new InputBuffer(1024 /* normal capacity */,
@@ -232,7 +256,8 @@ SimpleSwitch::SimpleSwitch(bool enable_swap, port_t drop_port,
 
   // Create a TrafficManager instance
   this->traffic_manager = std::unique_ptr<bm::TrafficManager>(
-      new bm::TrafficManager(&egress_buffers));
+      new bm::TrafficManager(&egress_buffers, tm_config_port,
+                             nb_tm_workers));
 
   import_primitives(this);
 }
@@ -249,37 +274,10 @@ void SimpleSwitch::init_tm() {
     std::shared_ptr<bm::P4Objects> p4objects = cxt->get_p4objects();
     if (p4objects) {
       BMLOG_DEBUG("Got P4Objects instance");
-
-      // Loop around scheduler specific functions
-      // TODO Find a way to not hardcode the scheduler types.
-
-      // First select type between a selection of scheduler
-      std::vector<std::string> scheduler_types = {"FIFO", "DRR", "WRR", "SP"};
-
-      // Then, create the action_names
-      std::vector<std::string> action_names = {"calculate_rank",
-                                               "evaluate_predicate", "dequeued",
-                                               "periodic_timeout"};
-
-      // Finally, concatenate the scheduler types with the actions names
-      std::vector<std::string> action_entries_name;
-      for (const auto &scheduler : scheduler_types) {
-        for (const auto &action : action_names) {
-          action_entries_name.push_back(scheduler + "_" + action);
-        }
-      }
-
-      // Loop around the action_entries_name to check the action names
-      for (const auto &action_entry_name : action_entries_name) {
-        bm::ActionFn *action_fn = p4objects->get_one_action_with_name(
-            "MyIngress." + action_entry_name);
-        if (action_fn) {
-          std::cout << "Action function found: " << action_fn->get_name()
-                    << std::endl;
-          traffic_manager->add_action(action_entry_name, action_fn);
-        }
-      }
-      traffic_manager->set_actions();
+      // The scheduler actions of the v1model programs are in MyIngress
+      traffic_manager->bind_program(
+          bm::P4ActionSource(p4objects.get(), {"MyIngress"}),
+          p4objects->get_phv_factory());
     } else {
       BMLOG_DEBUG("Failed to get P4Objects instance");
     }
@@ -375,16 +373,20 @@ bool SimpleSwitch::mirroring_get_session(mirror_id_t mirror_id,
 int SimpleSwitch::set_egress_priority_queue_depth(size_t port, size_t priority,
                                                   const size_t depth_pkts) {
   egress_buffers.set_capacity(port, priority, depth_pkts);
+  // A deeper queue gives credits to the roots of the port
+  traffic_manager->egress_slot_freed(port);
   return 0;
 }
 
 int SimpleSwitch::set_egress_queue_depth(size_t port, const size_t depth_pkts) {
   egress_buffers.set_capacity(port, depth_pkts);
+  traffic_manager->egress_slot_freed(port);
   return 0;
 }
 
 int SimpleSwitch::set_all_egress_queue_depths(const size_t depth_pkts) {
   egress_buffers.set_capacity_for_all(depth_pkts);
+  traffic_manager->egress_slot_freed();
   return 0;
 }
 
@@ -404,6 +406,37 @@ int SimpleSwitch::set_all_egress_queue_rates(const uint64_t rate_pps) {
   return 0;
 }
 
+int SimpleSwitch::set_egress_priority_queue_rate_bps(size_t port,
+                                                     size_t priority,
+                                                     const uint64_t rate_bps) {
+  egress_buffers.set_rate_bps(port, priority, rate_bps);
+  return 0;
+}
+
+int SimpleSwitch::set_egress_queue_rate_bps(size_t port,
+                                            const uint64_t rate_bps) {
+  egress_buffers.set_rate_bps(port, rate_bps);
+  return 0;
+}
+
+int SimpleSwitch::set_all_egress_queue_rates_bps(const uint64_t rate_bps) {
+  egress_buffers.set_rate_bps_for_all(rate_bps);
+  return 0;
+}
+
+int SimpleSwitch::set_tm_scheduler_param(int node_id, size_t param,
+                                         const std::vector<uint64_t> &values) {
+  bm::SchedulerParams::Updates updates;
+  updates.emplace_back(param, values);
+  return traffic_manager->set_scheduler_params(node_id, updates) ? 0 : 1;
+}
+
+int SimpleSwitch::set_tm_node_shaping(int node_id, uint64_t rate_bps,
+                                      uint64_t burst_bytes) {
+  return traffic_manager->set_node_shaping(node_id, rate_bps, burst_bytes)
+      ? 0 : 1;
+}
+
 uint64_t SimpleSwitch::get_time_elapsed_us() const { return get_ts().count(); }
 
 uint64_t SimpleSwitch::get_time_since_epoch_us() const {
@@ -432,8 +465,7 @@ ts_res SimpleSwitch::get_ts() const {
   return duration_cast<ts_res>(clock::now() - start);
 }
 
-void SimpleSwitch::enqueue(port_t egress_port,
-                           std::unique_ptr<Packet> &&packet) {
+bool SimpleSwitch::prepare_enqueue(port_t egress_port, Packet *packet) {
   packet->set_egress_port(egress_port);
 
   PHV *phv = packet->get_phv();
@@ -444,7 +476,7 @@ void SimpleSwitch::enqueue(port_t egress_port,
           : 0u;
   if (priority >= nb_queues_per_port) {
     bm::Logger::get()->error("Priority out of range, dropping packet");
-    return;
+    return false;
   }
 
   if (with_queueing_metadata) {
@@ -452,6 +484,24 @@ void SimpleSwitch::enqueue(port_t egress_port,
     phv->get_field("queueing_metadata.enq_qdepth")
         .set(egress_buffers.size(egress_port, priority));
   }
+  return true;
+}
+
+void SimpleSwitch::enqueue(port_t egress_port,
+                           std::unique_ptr<Packet> &&packet,
+                           TMBatch *tm_batch) {
+  if (!prepare_enqueue(egress_port, packet.get())) return;
+  tm_batch->push_back({static_cast<uint32_t>(egress_port), std::move(packet)});
+}
+
+void SimpleSwitch::flush_tm_batch(TMBatch *tm_batch) {
+  traffic_manager->enqueue_batch(tm_batch->data(), tm_batch->size());
+  tm_batch->clear();
+}
+
+void SimpleSwitch::enqueue(port_t egress_port,
+                           std::unique_ptr<Packet> &&packet) {
+  if (!prepare_enqueue(egress_port, packet.get())) return;
 
   // TrafficManager addition
   this->traffic_manager->enqueue(egress_port, std::move(packet));
@@ -499,6 +549,14 @@ void SimpleSwitch::check_queueing_metadata() {
 }
 
 void SimpleSwitch::multicast(Packet *packet, unsigned int mgid) {
+  TMBatch tm_batch;
+  multicast(packet, mgid, &tm_batch);
+  flush_tm_batch(&tm_batch);
+}
+
+// The copies are only added to @p tm_batch, the TM takes them all at once
+void SimpleSwitch::multicast(Packet *packet, unsigned int mgid,
+                             TMBatch *tm_batch) {
   auto *phv = packet->get_phv();
   auto &f_rid = phv->get_field("intrinsic_metadata.egress_rid");
   const auto pre_out = pre->replicate({mgid});
@@ -512,172 +570,188 @@ void SimpleSwitch::multicast(Packet *packet, unsigned int mgid) {
     RegisterAccess::clear_all(packet_copy.get());
     packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
                               packet_size);
-    enqueue(egress_port, std::move(packet_copy));
+    enqueue(egress_port, std::move(packet_copy), tm_batch);
   }
 }
 
 void SimpleSwitch::ingress_thread() {
-  PHV *phv;
+  std::vector<std::unique_ptr<Packet> > burst;
+  TMBatch tm_batch;
 
   while (1) {
-    std::unique_ptr<Packet> packet;
-    input_buffer->pop_back(&packet);
-    if (packet == nullptr) break;
+    input_buffer->pop_back_burst(&burst, ingress_burst_size);
+    bool stop = false;
+    for (auto &packet : burst) {
+      if (packet == nullptr) {
+        stop = true;
+        break;
+      }
+      ingress_packet(std::move(packet), &tm_batch);
+    }
+    // The whole burst, multicast copies included, goes to the TM at once
+    flush_tm_batch(&tm_batch);
+    burst.clear();
+    if (stop) break;
+  }
+}
 
-    // TODO(antonin): only update these if swapping actually happened?
-    Parser *parser = this->get_parser("parser");
-    Pipeline *ingress_mau = this->get_pipeline("ingress");
+void SimpleSwitch::ingress_packet(std::unique_ptr<Packet> &&packet,
+                                  TMBatch *tm_batch) {
+  PHV *phv;
 
-    phv = packet->get_phv();
+  // TODO(antonin): only update these if swapping actually happened?
+  Parser *parser = this->get_parser("parser");
+  Pipeline *ingress_mau = this->get_pipeline("ingress");
 
-    port_t ingress_port = packet->get_ingress_port();
-    (void)ingress_port;
-    BMLOG_DEBUG_PKT(*packet, "Processing packet received on port {}",
-                    ingress_port);
-
-    auto ingress_packet_size =
-        packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX);
-
-    /* This looks like it comes out of the blue. However this is needed for
-       ingress cloning. The parser updates the buffer state (pops the parsed
-       headers) to make the deparser's job easier (the same buffer is
-       re-used). But for ingress cloning, the original packet is needed. This
-       kind of looks hacky though. Maybe a better solution would be to have the
-       parser leave the buffer unchanged, and move the pop logic to the
-       deparser. TODO? */
-    const Packet::buffer_state_t packet_in_state = packet->save_buffer_state();
-    parser->parse(packet.get());
-
-    if (phv->has_field("standard_metadata.parser_error")) {
-      phv->get_field("standard_metadata.parser_error")
-          .set(packet->get_error_code().get());
-    }
+  phv = packet->get_phv();
 
-    if (phv->has_field("standard_metadata.checksum_error")) {
-      phv->get_field("standard_metadata.checksum_error")
-          .set(packet->get_checksum_error() ? 1 : 0);
-    }
+  port_t ingress_port = packet->get_ingress_port();
+  (void)ingress_port;
+  BMLOG_DEBUG_PKT(*packet, "Processing packet received on port {}",
+                  ingress_port);
+
+  auto ingress_packet_size =
+      packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX);
 
-    ingress_mau->apply(packet.get());
+  /* This looks like it comes out of the blue. However this is needed for
+     ingress cloning. The parser updates the buffer state (pops the parsed
+     headers) to make the deparser's job easier (the same buffer is
+     re-used). But for ingress cloning, the original packet is needed. This
+     kind of looks hacky though. Maybe a better solution would be to have the
+     parser leave the buffer unchanged, and move the pop logic to the
+     deparser. TODO? */
+  const Packet::buffer_state_t packet_in_state = packet->save_buffer_state();
+  parser->parse(packet.get());
+
+  if (phv->has_field("standard_metadata.parser_error")) {
+    phv->get_field("standard_metadata.parser_error")
+        .set(packet->get_error_code().get());
+  }
 
-    packet->reset_exit();
+  if (phv->has_field("standard_metadata.checksum_error")) {
+    phv->get_field("standard_metadata.checksum_error")
+        .set(packet->get_checksum_error() ? 1 : 0);
+  }
 
-    Field &f_egress_spec = phv->get_field("standard_metadata.egress_spec");
-    port_t egress_spec = f_egress_spec.get_uint();
+  ingress_mau->apply(packet.get());
 
-    auto clone_mirror_session_id =
-        RegisterAccess::get_clone_mirror_session_id(packet.get());
-    auto clone_field_list = RegisterAccess::get_clone_field_list(packet.get());
+  packet->reset_exit();
 
-    int learn_id = RegisterAccess::get_lf_field_list(packet.get());
-    unsigned int mgid = 0u;
+  Field &f_egress_spec = phv->get_field("standard_metadata.egress_spec");
+  port_t egress_spec = f_egress_spec.get_uint();
 
-    // detect mcast support, if this is true we assume that other fields needed
-    // for mcast are also defined
-    if (phv->has_field("intrinsic_metadata.mcast_grp")) {
-      Field &f_mgid = phv->get_field("intrinsic_metadata.mcast_grp");
-      mgid = f_mgid.get_uint();
-    }
+  auto clone_mirror_session_id =
+      RegisterAccess::get_clone_mirror_session_id(packet.get());
+  auto clone_field_list = RegisterAccess::get_clone_field_list(packet.get());
 
-    // INGRESS CLONING
-    if (clone_mirror_session_id) {
-      BMLOG_DEBUG_PKT(*packet, "Cloning packet at ingress");
-      RegisterAccess::set_clone_mirror_session_id(packet.get(), 0);
-      RegisterAccess::set_clone_field_list(packet.get(), 0);
-      MirroringSessionConfig config;
-      // Extract the part of clone_mirror_session_id that contains the
-      // actual session id.
-      clone_mirror_session_id &= RegisterAccess::MIRROR_SESSION_ID_MASK;
-      bool is_session_configured = mirroring_get_session(
-          static_cast<mirror_id_t>(clone_mirror_session_id), &config);
-      if (is_session_configured) {
-        const Packet::buffer_state_t packet_out_state =
-            packet->save_buffer_state();
-        packet->restore_buffer_state(packet_in_state);
-        p4object_id_t field_list_id = clone_field_list;
-        std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
-        RegisterAccess::clear_all(packet_copy.get());
-        packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
-                                  ingress_packet_size);
-        // We need to parse again.
-        // The alternative would be to pay the (huge) price of PHV copy for
-        // every ingress packet.
-        // Since parsers can branch on the ingress port, we need to preserve it
-        // to ensure re-parsing gives the same result as the original parse.
-        // TODO(https://github.com/p4lang/behavioral-model/issues/795): other
-        // standard metadata should be preserved as well.
-        packet_copy->get_phv()
-            ->get_field("standard_metadata.ingress_port")
-            .set(ingress_port);
-        parser->parse(packet_copy.get());
-        copy_field_list_and_set_type(packet, packet_copy,
-                                     PKT_INSTANCE_TYPE_INGRESS_CLONE,
-                                     field_list_id);
-        if (config.mgid_valid) {
-          BMLOG_DEBUG_PKT(*packet, "Cloning packet to MGID {}", config.mgid);
-          multicast(packet_copy.get(), config.mgid);
-        }
-        if (config.egress_port_valid) {
-          BMLOG_DEBUG_PKT(*packet, "Cloning packet to egress port {}",
-                          config.egress_port);
-          enqueue(config.egress_port, std::move(packet_copy));
-        }
-        packet->restore_buffer_state(packet_out_state);
-      }
-    }
+  int learn_id = RegisterAccess::get_lf_field_list(packet.get());
+  unsigned int mgid = 0u;
 
-    // LEARNING
-    if (learn_id > 0) {
-      get_learn_engine()->learn(learn_id, *packet.get());
-    }
+  // detect mcast support, if this is true we assume that other fields needed
+  // for mcast are also defined
+  if (phv->has_field("intrinsic_metadata.mcast_grp")) {
+    Field &f_mgid = phv->get_field("intrinsic_metadata.mcast_grp");
+    mgid = f_mgid.get_uint();
+  }
 
-    // RESUBMIT
-    auto resubmit_flag = RegisterAccess::get_resubmit_flag(packet.get());
-    if (resubmit_flag) {
-      BMLOG_DEBUG_PKT(*packet, "Resubmitting packet");
-      // get the packet ready for being parsed again at the beginning of
-      // ingress
+  // INGRESS CLONING
+  if (clone_mirror_session_id) {
+    BMLOG_DEBUG_PKT(*packet, "Cloning packet at ingress");
+    RegisterAccess::set_clone_mirror_session_id(packet.get(), 0);
+    RegisterAccess::set_clone_field_list(packet.get(), 0);
+    MirroringSessionConfig config;
+    // Extract the part of clone_mirror_session_id that contains the
+    // actual session id.
+    clone_mirror_session_id &= RegisterAccess::MIRROR_SESSION_ID_MASK;
+    bool is_session_configured = mirroring_get_session(
+        static_cast<mirror_id_t>(clone_mirror_session_id), &config);
+    if (is_session_configured) {
+      const Packet::buffer_state_t packet_out_state =
+          packet->save_buffer_state();
       packet->restore_buffer_state(packet_in_state);
-      p4object_id_t field_list_id = resubmit_flag;
-      RegisterAccess::set_resubmit_flag(packet.get(), 0);
-      // TODO(antonin): a copy is not needed here, but I don't yet have an
-      // optimized way of doing this
+      p4object_id_t field_list_id = clone_field_list;
       std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
-      PHV *phv_copy = packet_copy->get_phv();
-      copy_field_list_and_set_type(packet, packet_copy,
-                                   PKT_INSTANCE_TYPE_RESUBMIT, field_list_id);
       RegisterAccess::clear_all(packet_copy.get());
       packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
                                 ingress_packet_size);
-      phv_copy->get_field("standard_metadata.packet_length")
-          .set(ingress_packet_size);
-      input_buffer->push_front(InputBuffer::PacketType::RESUBMIT,
-                               std::move(packet_copy));
-      continue;
+      // We need to parse again.
+      // The alternative would be to pay the (huge) price of PHV copy for
+      // every ingress packet.
+      // Since parsers can branch on the ingress port, we need to preserve it
+      // to ensure re-parsing gives the same result as the original parse.
+      // TODO(https://github.com/p4lang/behavioral-model/issues/795): other
+      // standard metadata should be preserved as well.
+      packet_copy->get_phv()
+          ->get_field("standard_metadata.ingress_port")
+          .set(ingress_port);
+      parser->parse(packet_copy.get());
+      copy_field_list_and_set_type(packet, packet_copy,
+                                   PKT_INSTANCE_TYPE_INGRESS_CLONE,
+                                   field_list_id);
+      if (config.mgid_valid) {
+        BMLOG_DEBUG_PKT(*packet, "Cloning packet to MGID {}", config.mgid);
+        multicast(packet_copy.get(), config.mgid, tm_batch);
+      }
+      if (config.egress_port_valid) {
+        BMLOG_DEBUG_PKT(*packet, "Cloning packet to egress port {}",
+                        config.egress_port);
+        enqueue(config.egress_port, std::move(packet_copy), tm_batch);
+      }
+      packet->restore_buffer_state(packet_out_state);
     }
+  }
 
-    // MULTICAST
-    if (mgid != 0) {
-      BMLOG_DEBUG_PKT(*packet, "Multicast requested for packet");
-      auto &f_instance_type = phv->get_field("standard_metadata.instance_type");
-      f_instance_type.set(PKT_INSTANCE_TYPE_REPLICATION);
-      multicast(packet.get(), mgid);
-      // when doing multicast, we discard the original packet
-      continue;
-    }
+  // LEARNING
+  if (learn_id > 0) {
+    get_learn_engine()->learn(learn_id, *packet.get());
+  }
 
-    port_t egress_port = egress_spec;
-    BMLOG_DEBUG_PKT(*packet, "Egress port is {}", egress_port);
+  // RESUBMIT
+  auto resubmit_flag = RegisterAccess::get_resubmit_flag(packet.get());
+  if (resubmit_flag) {
+    BMLOG_DEBUG_PKT(*packet, "Resubmitting packet");
+    // get the packet ready for being parsed again at the beginning of
+    // ingress
+    packet->restore_buffer_state(packet_in_state);
+    p4object_id_t field_list_id = resubmit_flag;
+    RegisterAccess::set_resubmit_flag(packet.get(), 0);
+    // TODO(antonin): a copy is not needed here, but I don't yet have an
+    // optimized way of doing this
+    std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
+    PHV *phv_copy = packet_copy->get_phv();
+    copy_field_list_and_set_type(packet, packet_copy,
+                                 PKT_INSTANCE_TYPE_RESUBMIT, field_list_id);
+    RegisterAccess::clear_all(packet_copy.get());
+    packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
+                              ingress_packet_size);
+    phv_copy->get_field("standard_metadata.packet_length")
+        .set(ingress_packet_size);
+    input_buffer->push_front(InputBuffer::PacketType::RESUBMIT,
+                             std::move(packet_copy));
+    return;
+  }
 
-    if (egress_port == drop_port) {  // drop packet
-      BMLOG_DEBUG_PKT(*packet, "Dropping packet at the end of ingress");
-      continue;
-    }
+  // MULTICAST
+  if (mgid != 0) {
+    BMLOG_DEBUG_PKT(*packet, "Multicast requested for packet");
     auto &f_instance_type = phv->get_field("standard_metadata.instance_type");
-    f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
+    f_instance_type.set(PKT_INSTANCE_TYPE_REPLICATION);
+    multicast(packet.get(), mgid, tm_batch);
+    // when doing multicast, we discard the original packet
+    return;
+  }
+
+  port_t egress_port = egress_spec;
+  BMLOG_DEBUG_PKT(*packet, "Egress port is {}", egress_port);
 
-    enqueue(egress_port, std::move(packet));
+  if (egress_port == drop_port) {  // drop packet
+    BMLOG_DEBUG_PKT(*packet, "Dropping packet at the end of ingress");
+    return;
   }
+  auto &f_instance_type = phv->get_field("standard_metadata.instance_type");
+  f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
+
+  enqueue(egress_port, std::move(packet), tm_batch);
 }
 
 void SimpleSwitch::egress_thread(size_t worker_id) {
@@ -692,6 +766,8 @@ void SimpleSwitch::egress_thread(size_t worker_id) {
     // packet = std::move(this->traffic_manager->dequeue());
 
     if (packet == nullptr) break;
+    // Wakes up the roots of the port waiting for a transmit credit
+    traffic_manager->egress_slot_freed(port);
     port = packet->get_egress_port();
 
     Deparser *deparser = this->get_deparser("deparser");
@@ -77,6 +77,7 @@ class SimpleSwitch : public Switch {
 
   static constexpr port_t default_drop_port = 511;
   static constexpr size_t default_nb_queues_per_port = 1;
+  static constexpr size_t default_nb_tm_workers = TM_NODE_WORKER_NUMBER;
 
  private:
   using clock = std::chrono::high_resolution_clock;
@@ -85,7 +86,9 @@ class SimpleSwitch : public Switch {
   // by default, swapping is off
   explicit SimpleSwitch(bool enable_swap = false,
                         port_t drop_port = default_drop_port,
-                        size_t nb_queues_per_port = default_nb_queues_per_port);
+                        size_t nb_queues_per_port = default_nb_queues_per_port,
+                        size_t nb_tm_workers = default_nb_tm_workers,
+                        int tm_config_port = TM_CONFIG_SERVER_PORT);
 
   ~SimpleSwitch();
 
@@ -117,6 +120,21 @@ class SimpleSwitch : public Switch {
   int set_egress_queue_rate(size_t port, const uint64_t rate_pps);
   int set_all_egress_queue_rates(const uint64_t rate_pps);
 
+  // rates in bits per second, counted on the packet sizes
+  int set_egress_priority_queue_rate_bps(size_t port, size_t priority,
+                                         const uint64_t rate_bps);
+  int set_egress_queue_rate_bps(size_t port, const uint64_t rate_bps);
+  int set_all_egress_queue_rates_bps(const uint64_t rate_bps);
+
+  // updates a scheduler parameter of a node of the TM hierarchy, returns 0 on
+  // success
+  int set_tm_scheduler_param(int node_id, size_t param,
+                             const std::vector<uint64_t> &values);
+  // shapes the output of a node of the TM hierarchy to rate_bps (0 for no
+  // limit), returns 0 on success
+  int set_tm_node_shaping(int node_id, uint64_t rate_bps,
+                          uint64_t burst_bytes);
+
   // returns the number of microseconds elapsed since the switch started
   uint64_t get_time_elapsed_us() const;
 
@@ -141,6 +159,9 @@ class SimpleSwitch : public Switch {
 
  private:
   static constexpr size_t nb_egress_threads = 4u;
+  // Packets the ingress thread takes from the input buffer at once, their
+  // output is handed to the TM as a single batch
+  static constexpr size_t ingress_burst_size = 32u;
   static packet_id_t packet_id;
 
   class MirroringSessions;
@@ -158,7 +179,11 @@ class SimpleSwitch : public Switch {
   };
 
  private:
+  // Packets handed to the TM at once, see TrafficManager::enqueue_batch()
+  using TMBatch = std::vector<bm::TMPacket>;
+
   void ingress_thread();
+  void ingress_packet(std::unique_ptr<Packet> &&packet, TMBatch *tm_batch);
   void egress_thread(size_t worker_id);
   void transmit_thread();
 
@@ -166,6 +191,12 @@ class SimpleSwitch : public Switch {
 
   // TODO(antonin): switch to pass by value?
   void enqueue(port_t egress_port, std::unique_ptr<Packet> &&packet);
+  // Same, but the packet is only added to @p tm_batch, see flush_tm_batch()
+  void enqueue(port_t egress_port, std::unique_ptr<Packet> &&packet,
+               TMBatch *tm_batch);
+  // False if the packet is dropped before the TM
+  bool prepare_enqueue(port_t egress_port, Packet *packet);
+  void flush_tm_batch(TMBatch *tm_batch);
 
   void copy_field_list_and_set_type(
       const std::unique_ptr<Packet> &packet,
@@ -175,6 +206,7 @@ class SimpleSwitch : public Switch {
   void check_queueing_metadata();
 
   void multicast(Packet *packet, unsigned int mgid);
+  void multicast(Packet *packet, unsigned int mgid, TMBatch *tm_batch);
 
  private:
   port_t drop_port;
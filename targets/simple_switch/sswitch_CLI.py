@@ -82,6 +82,45 @@ class SimpleSwitchAPI(runtime_CLI.RuntimeAPI):
         else:
             self.sswitch_client.set_all_egress_queue_rates(rate)
 
+    @handle_bad_input
+    def do_set_queue_rate_bps(self, line):
+        "Set rate in bits per second of one / all egress queue(s): set_queue_rate_bps <rate_bps> [<egress_port> [<priority>]]"
+        args = line.split()
+        self.at_least_n_args(args, 1)
+        rate = self.parse_int(args[0], "rate_bps")
+        if len(args) > 2:
+            port = self.parse_int(args[1], "egress_port")
+            priority = self.parse_int(args[2], "priority")
+            self.sswitch_client.set_egress_priority_queue_rate_bps(port, priority, rate)
+        elif len(args) == 2:
+            port = self.parse_int(args[1], "egress_port")
+            self.sswitch_client.set_egress_queue_rate_bps(port, rate)
+        else:
+            self.sswitch_client.set_all_egress_queue_rates_bps(rate)
+
+    @handle_bad_input
+    def do_tm_set_param(self, line):
+        "Update a scheduler parameter of a TM node: tm_set_param <node_id> <param_index> <value> [<value> ...]"
+        args = line.split()
+        self.at_least_n_args(args, 3)
+        node_id = self.parse_int(args[0], "node_id")
+        param_index = self.parse_int(args[1], "param_index")
+        values = [self.parse_int(v, "value") for v in args[2:]]
+        if self.sswitch_client.set_tm_scheduler_param(node_id, param_index, values) != 0:
+            print("Cannot update parameter {} of TM node {}".format(
+                param_index, node_id))
+
+    @handle_bad_input
+    def do_tm_set_shaping(self, line):
+        "Shape the output of a TM node, 0 removes the limit: tm_set_shaping <node_id> <rate_bps> [<burst_bytes>]"
+        args = line.split()
+        self.at_least_n_args(args, 2)
+        node_id = self.parse_int(args[0], "node_id")
+        rate = self.parse_int(args[1], "rate_bps")
+        burst = self.parse_int(args[2], "burst_bytes") if len(args) > 2 else 0
+        if self.sswitch_client.set_tm_node_shaping(node_id, rate, burst) != 0:
+            print("Cannot shape TM node {}".format(node_id))
+
     @handle_bad_input
     def do_mirroring_add(self, line):
         "Add mirroring session to unicast port: mirroring_add <mirror_id> <egress_port>"
@@ -54,6 +54,16 @@ service SimpleSwitch {
   i32 set_egress_priority_queue_rate(1:i32 port_num, 2:i32 priority, 3:i64 rate_pps);
   i32 set_egress_queue_rate(1:i32 port_num, 2:i64 rate_pps);
   i32 set_all_egress_queue_rates(1:i64 rate_pps);
+  // same as above, in bits per second
+  i32 set_egress_priority_queue_rate_bps(1:i32 port_num, 2:i32 priority, 3:i64 rate_bps);
+  i32 set_egress_queue_rate_bps(1:i32 port_num, 2:i64 rate_bps);
+  i32 set_all_egress_queue_rates_bps(1:i64 rate_bps);
+
+  // updates a scheduler parameter of a node of the Traffic Manager, without
+  // reconfiguring the hierarchy
+  i32 set_tm_scheduler_param(1:i32 node_id, 2:i32 param_index, 3:list<i64> values);
+  // shapes the output of a node of the Traffic Manager, 0 removes the limit
+  i32 set_tm_node_shaping(1:i32 node_id, 2:i64 rate_bps, 3:i64 burst_bytes);
 
   // these methods are here as an experiment, prefer get_time_elapsed_us() when
   // possible
@@ -145,6 +145,47 @@ class SimpleSwitchHandler : virtual public SimpleSwitchIf {
     return switch_->set_all_egress_queue_rates(static_cast<uint64_t>(rate_pps));
   }
 
+  int32_t set_egress_priority_queue_rate_bps(const int32_t port_num,
+                                             const int32_t priority,
+                                             const int64_t rate_bps) {
+    bm::Logger::get()->trace("set_egress_priority_queue_rate_bps");
+    return switch_->set_egress_priority_queue_rate_bps(
+        port_num, priority, static_cast<uint64_t>(rate_bps));
+  }
+
+  int32_t set_egress_queue_rate_bps(const int32_t port_num,
+                                    const int64_t rate_bps) {
+    bm::Logger::get()->trace("set_egress_queue_rate_bps");
+    return switch_->set_egress_queue_rate_bps(port_num,
+                                              static_cast<uint64_t>(rate_bps));
+  }
+
+  int32_t set_all_egress_queue_rates_bps(const int64_t rate_bps) {
+    bm::Logger::get()->trace("set_all_egress_queue_rates_bps");
+    return switch_->set_all_egress_queue_rates_bps(
+        static_cast<uint64_t>(rate_bps));
+  }
+
+  int32_t set_tm_scheduler_param(const int32_t node_id,
+                                 const int32_t param_index,
+                                 const std::vector<int64_t> &values) {
+    bm::Logger::get()->trace("set_tm_scheduler_param");
+    if (param_index < 0) return 1;
+    // cast from signed to unsigned
+    std::vector<uint64_t> values_(values.begin(), values.end());
+    return switch_->set_tm_scheduler_param(
+        node_id, static_cast<size_t>(param_index), values_);
+  }
+
+  int32_t set_tm_node_shaping(const int32_t node_id, const int64_t rate_bps,
+                              const int64_t burst_bytes) {
+    bm::Logger::get()->trace("set_tm_node_shaping");
+    if (rate_bps < 0 || burst_bytes < 0) return 1;
+    return switch_->set_tm_node_shaping(node_id,
+                                        static_cast<uint64_t>(rate_bps),
+                                        static_cast<uint64_t>(burst_bytes));
+  }
+
   int64_t get_time_elapsed_us() {
     bm::Logger::get()->trace("get_time_elapsed_us");
     // cast from unsigned to signed
@@ -0,0 +1,218 @@
+#include <bm/config.h>
+#include <bm/bm_sim/actions.h>
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/stateful.h>
+#include <bm/bm_sim/tm_adapter.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+
+#include "jsoncpp/json.h"
+#include "stress_utils.h"
+
+using ::stress_tests_utils::SwitchTest;
+using ::stress_tests_utils::TestChrono;
+
+namespace fs = boost::filesystem;
+
+// Heap allocations made while counting is enabled, by any thread
+namespace {
+
+std::atomic<bool> count_allocations{false};
+std::atomic<size_t> nb_allocations{0};
+
+}  // namespace
+
+void *operator new(size_t size) {
+  if (count_allocations.load(std::memory_order_relaxed))
+    nb_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// simple_switch primitives used by the P4 program, the scheduler actions only
+// need the register ones
+
+class mark_to_drop : public bm::ActionPrimitive<bm::Header &> {
+  void operator ()(bm::Header &std_hdr) {
+    (void) std_hdr;
+  }
+};
+
+REGISTER_PRIMITIVE(mark_to_drop);
+
+class register_read : public bm::ActionPrimitive<bm::Field &,
+                                                 const bm::RegisterArray &,
+                                                 const bm::Data &> {
+  void operator ()(bm::Field &dst, const bm::RegisterArray &src,
+                   const bm::Data &idx) {
+    dst.set(src[idx.get_uint()]);
+  }
+};
+
+REGISTER_PRIMITIVE(register_read);
+
+class register_write : public bm::ActionPrimitive<bm::RegisterArray &,
+                                                  const bm::Data &,
+                                                  const bm::Data &> {
+  void operator ()(bm::RegisterArray &dst, const bm::Data &idx,
+                   const bm::Data &src) {
+    dst[idx.get_uint()].set(src);
+  }
+};
+
+REGISTER_PRIMITIVE(register_write);
+
+namespace {
+
+// Egress side of the benchmark: the packets go to a vector sized for the
+// whole run, so that only the allocations of the TM are counted (the egress
+// buffers of the targets allocate as their queues grow)
+class PreallocatedSink : public bm::TMEgressSink {
+ public:
+  explicit PreallocatedSink(size_t nb_packets) : packets(nb_packets) {}
+
+  size_t get_free_slots(uint32_t, size_t) override { return 1024; }
+
+  bool transmit(uint32_t, size_t, std::unique_ptr<bm::Packet> &&packet,
+                size_t) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    packets[nb_transmitted++] = std::move(packet);
+    if (nb_transmitted == packets.size()) cvar.notify_one();
+    return true;
+  }
+
+  void wait_all() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cvar.wait(lock, [this]() { return nb_transmitted == packets.size(); });
+  }
+
+  // Hands the packets back, the sink can then receive them again
+  void take_all(std::vector<std::unique_ptr<bm::Packet>> *transmitted) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < packets.size(); i++)
+      (*transmitted)[i] = std::move(packets[i]);
+    nb_transmitted = 0;
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable cvar;
+  std::vector<std::unique_ptr<bm::Packet>> packets;
+  size_t nb_transmitted{0};
+};
+
+// A chain of nb_levels FIFO nodes on egress port 0
+std::string make_config(int nb_levels) {
+  Json::Value tmnodes(Json::arrayValue);
+  for (int id = 0; id < nb_levels; id++) {
+    Json::Value tmnode;
+    tmnode["tmnode"] = id;
+    tmnode["scheduler"] = "FIFO";
+    if (id == 0)
+      tmnode["port"] = 0;
+    else
+      tmnode["parent"] = id - 1;
+    tmnodes.append(tmnode);
+  }
+  Json::Value root;
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  return Json::FastWriter().write(root);
+}
+
+// Returns the steady-state number of allocations per packet
+double run_one(SwitchTest *sw, int nb_levels, size_t nb_packets) {
+  PreallocatedSink sink(nb_packets);
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  bm::TrafficManager tm(adapter, -1);
+  auto p4objects = sw->get_context(0)->get_p4objects();
+  for (const std::string action : {"calculate_rank", "evaluate_predicate",
+                                   "dequeued", "periodic_timeout"}) {
+    auto *action_fn =
+        p4objects->get_one_action_with_name("MyIngress.FIFO_" + action);
+    assert(action_fn != nullptr);
+    tm.add_action("FIFO_" + action, action_fn);
+  }
+  tm.reconfigure(bm::ConfigParser::parse(make_config(nb_levels), &tm));
+
+  // Packets are created up front, only the TM path is measured
+  std::vector<std::unique_ptr<bm::Packet>> packets;
+  packets.reserve(nb_packets);
+  for (size_t i = 0; i < nb_packets; i++) {
+    auto packet = sw->new_packet_ptr(0, i, 64, bm::PacketBuffer(128));
+    packet->set_egress_port(0);
+    packet->get_phv()->get_field("standard_metadata.egress_port").set(0);
+    packets.push_back(std::move(packet));
+  }
+
+  // Warm-up, lets the queues and calendars of the nodes reach their size
+  for (auto &packet : packets) tm.enqueue(0, std::move(packet));
+  sink.wait_all();
+  sink.take_all(&packets);
+
+  std::cout << nb_levels << "-level hierarchy\n";
+  TestChrono chrono(nb_packets);
+  nb_allocations = 0;
+  count_allocations = true;
+  chrono.start();
+  for (auto &packet : packets) tm.enqueue(0, std::move(packet));
+  sink.wait_all();
+  chrono.end();
+  count_allocations = false;
+  chrono.print_summary();
+  sink.take_all(&packets);
+
+  const double per_packet = static_cast<double>(nb_allocations) / nb_packets;
+  std::cout << "Heap allocations per packet: " << per_packet << "\n";
+  std::cout << "Calendar items allocated outside of the pools: "
+            << tm.get_nb_calendar_item_overflows() << "\n";
+  return per_packet;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t nb_packets = 50000;
+  if (argc > 1) nb_packets = std::stoul(argv[1]);
+
+  SwitchTest sw;
+  fs::path config_path =
+      fs::path(TESTDATADIR) / fs::path("tm_hierarchy_1.json");
+  sw.init_objects(config_path.string());
+
+  bool allocates = false;
+  for (int nb_levels : {1, 3})
+    allocates |= run_one(&sw, nb_levels, nb_packets) > 0.0;
+
+#if defined(BM_LOG_DEBUG_ON) || defined(BM_LOG_TRACE_ON)
+  // The P4 actions format their trace logs, the count is only checked when
+  // bmv2 is configured with --disable-logging-macros
+  std::cout << "Logging macros enabled, allocations not checked\n";
+  return 0;
+#else
+  if (allocates) {
+    std::cerr << "The TM allocates in steady state\n";
+    return 1;
+  }
+  return 0;
+#endif
+}
@@ -0,0 +1,469 @@
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/tm_trace.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+#include <sys/resource.h>
+
+#include <boost/program_options.hpp>
+
+#include "jsoncpp/json.h"
+
+// Standalone benchmark of the TrafficManager: a generated (or given) tmconfig
+// hierarchy with native schedulers, synthetic packets from a mix of flows,
+// optionally paced, and one egress thread standing for the egress pipelines.
+// Reports the sustained rate, the enqueue-to-egress latency percentiles and
+// the CPU time per packet for every scheduler x hierarchy depth. The defaults
+// are small enough for "make check".
+
+namespace po = boost::program_options;
+
+namespace {
+
+using EgressBuffers =
+    bm::QueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>;
+using Clock = std::chrono::steady_clock;
+
+// Pushed by the main thread once every packet is accounted for
+constexpr bm::packet_id_t end_of_run = ~bm::packet_id_t(0);
+
+struct BenchOptions {
+  size_t nb_packets;
+  int nb_ports;
+  int fanout;
+  int nb_classes;
+  int nb_flows;
+  std::vector<int> sizes;
+  double rate;
+  size_t egress_capacity;
+  size_t nb_workers;
+  unsigned int seed;
+  std::string config_path;
+  std::string csv_path;
+  std::string trace_path;
+};
+
+struct Flow {
+  uint32_t port;
+  int color;
+  int size;
+};
+
+struct BenchResult {
+  std::string scheduler;
+  int nb_levels;
+  size_t nb_nodes;
+  size_t nb_sent;
+  size_t nb_received;
+  uint64_t nb_drops;
+  double pps;
+  // Enqueue-to-egress latency, in microseconds
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+  // Process CPU time (sender, TM and egress threads) and time the TM workers
+  // spent in the nodes, per sent packet
+  double cpu_ns;
+  double node_ns;
+};
+
+template <typename T>
+std::vector<T> split_list(const std::string &list) {
+  std::vector<T> values;
+  std::istringstream stream(list);
+  std::string token;
+  while (std::getline(stream, token, ',')) {
+    if (token.empty()) continue;
+    std::istringstream value_stream(token);
+    T value;
+    value_stream >> value;
+    values.push_back(value);
+  }
+  return values;
+}
+
+// Per-port trees of nb_levels levels, every inner node has fanout children,
+// all running the same native scheduler. The classes (colors) are spread over
+// the leaves of each port; WRR weights the class c by c + 1, DRR gives every
+// class a 1500-byte quantum.
+std::string make_config(const std::string &scheduler, int nb_levels,
+                        const BenchOptions &options, size_t *nb_nodes) {
+  Json::Value weights(Json::arrayValue);
+  for (int c = 0; c < options.nb_classes; c++)
+    weights.append(scheduler == "DRR" ? 1500 : c + 1);
+
+  Json::Value tmnodes(Json::arrayValue);
+  int next_id = 0;
+  for (int port = 0; port < options.nb_ports; port++) {
+    std::vector<int> level{next_id};
+    std::vector<Json::Value> nodes;
+    Json::Value root;
+    root["tmnode"] = next_id++;
+    root["port"] = port;
+    nodes.push_back(root);
+    for (int depth = 1; depth < nb_levels; depth++) {
+      std::vector<int> children;
+      for (int parent : level) {
+        for (int i = 0; i < options.fanout; i++) {
+          Json::Value child;
+          child["tmnode"] = next_id;
+          child["parent"] = parent;
+          nodes.push_back(child);
+          children.push_back(next_id++);
+        }
+      }
+      level = std::move(children);
+    }
+    // level holds the leaves, the first ids of the last level
+    const size_t first_leaf = nodes.size() - level.size();
+    for (size_t leaf = 0; leaf < level.size(); leaf++) {
+      Json::Value values(Json::arrayValue);
+      for (int c = 0; c < options.nb_classes; c++)
+        if (static_cast<size_t>(c) % level.size() == leaf) values.append(c);
+      // A leaf without class has no classifier, but the leaves before it
+      // already match every class
+      if (values.empty()) continue;
+      nodes[first_leaf + leaf]["match"]["field"] = "color";
+      nodes[first_leaf + leaf]["match"]["values"] = values;
+    }
+    for (auto &node : nodes) {
+      node["scheduler"] = scheduler;
+      node["impl"] = "native";
+      if (scheduler == "WRR" || scheduler == "DRR") node["weights"] = weights;
+      tmnodes.append(node);
+    }
+  }
+  *nb_nodes = next_id;
+  Json::Value root;
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  return Json::FastWriter().write(root);
+}
+
+// The fields the TM reads from the PHV: egress port, color and length
+class BenchPHV {
+ public:
+  BenchPHV() {
+    std_meta_t.push_back_field("egress_port", 16);
+    intrinsic_meta_t.push_back_field("packet_length", 32);
+    scalars_t.push_back_field("metadata.color", 8);
+    phv_factory.push_back_header("standard_metadata", 0, std_meta_t, true);
+    phv_factory.push_back_header("intrinsic_metadata", 1, intrinsic_meta_t,
+                                 true);
+    phv_factory.push_back_header("scalars", 2, scalars_t, true);
+    phv_source->set_phv_factory(0, &phv_factory);
+  }
+
+  std::unique_ptr<bm::Packet> make_packet(bm::packet_id_t id,
+                                          const Flow &flow) {
+    auto packet = std::make_unique<bm::Packet>(bm::Packet::make_new(
+        0, 0, id, 0, flow.size, bm::PacketBuffer(flow.size),
+        phv_source.get()));
+    packet->set_egress_port(flow.port);
+    auto *phv = packet->get_phv();
+    phv->get_field("standard_metadata.egress_port").set(flow.port);
+    phv->get_field("intrinsic_metadata.packet_length").set(flow.size);
+    phv->get_field("scalars.metadata.color").set(flow.color);
+    return packet;
+  }
+
+ private:
+  bm::HeaderType std_meta_t{"standard_metadata_t", 0};
+  bm::HeaderType intrinsic_meta_t{"intrinsic_metadata_t", 1};
+  bm::HeaderType scalars_t{"scalars_0", 2};
+  bm::PHVFactory phv_factory;
+  std::unique_ptr<bm::PHVSourceIface> phv_source{
+      bm::PHVSourceIface::make_phv_source()};
+};
+
+uint64_t cpu_time_ns() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  auto to_ns = [](const struct timeval &tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000000u +
+           static_cast<uint64_t>(tv.tv_usec) * 1000u;
+  };
+  return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+double percentile(const std::vector<int64_t> &sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[rank] / 1000.0;
+}
+
+BenchResult run_one(const std::string &scheduler, int nb_levels,
+                    const std::string &config, size_t nb_nodes,
+                    const std::vector<Flow> &flows,
+                    const BenchOptions &options) {
+  BenchPHV phv;
+  EgressBuffers egress_buffers(1, options.egress_capacity,
+                               EgressThreadMapper(1));
+  bm::TrafficManager tm(&egress_buffers, -1, options.nb_workers);
+  bm::BufferConfig buffer_config;
+  if (bm::ConfigParser::parse_buffer(config, &buffer_config) ==
+      bm::ConfigSection::Valid)
+    tm.set_buffer_config(buffer_config);
+  tm.reconfigure(bm::ConfigParser::parse(config, &tm));
+
+  // Written by the sender before the enqueue, read by the egress thread after
+  // the packet went through the (locked) TM and egress buffer
+  std::vector<Clock::time_point> sent_at(options.nb_packets);
+  std::vector<int64_t> latency_ns(options.nb_packets, -1);
+  std::atomic<size_t> nb_received{0};
+  Clock::time_point last_egress;
+
+  std::thread egress([&]() {
+    while (true) {
+      size_t port;
+      std::unique_ptr<bm::Packet> packet;
+      egress_buffers.pop_back(0, &port, &packet);
+      tm.egress_slot_freed(port);
+      bm::packet_id_t id = packet->get_packet_id();
+      if (id == end_of_run) break;
+      last_egress = Clock::now();
+      latency_ns[id] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          last_egress - sent_at[id]).count();
+      nb_received.fetch_add(1, std::memory_order_release);
+    }
+  });
+
+  std::mt19937 rng(options.seed);
+  std::uniform_int_distribution<size_t> pick_flow(0, flows.size() - 1);
+  const auto period = options.rate > 0 ?
+      std::chrono::nanoseconds(static_cast<int64_t>(1e9 / options.rate)) :
+      std::chrono::nanoseconds(0);
+
+  const uint64_t cpu_start = cpu_time_ns();
+  const Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < options.nb_packets; i++) {
+    const Flow &flow = flows[pick_flow(rng)];
+    auto packet = phv.make_packet(i, flow);
+    if (options.rate > 0) std::this_thread::sleep_until(start + i * period);
+    sent_at[i] = Clock::now();
+    tm.enqueue(flow.port, std::move(packet));
+  }
+
+  // Admission drops are final once enqueue() returned, egress drops once the
+  // roots released everything
+  auto nb_drops = [&tm, &options]() {
+    const auto &buffer = tm.get_buffer_manager();
+    uint64_t drops = 0;
+    for (size_t v = 1; v < static_cast<size_t>(bm::AdmitVerdict::NbVerdicts);
+         v++)
+      drops += buffer.get_nb_drops(static_cast<bm::AdmitVerdict>(v));
+    for (int port = 0; port < options.nb_ports; port++)
+      drops += tm.get_port_stats(port).nb_drops;
+    return drops;
+  };
+  while (nb_received.load(std::memory_order_acquire) + nb_drops() <
+         options.nb_packets) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  egress_buffers.push_front(0, phv.make_packet(end_of_run, flows.front()));
+  egress.join();
+  const uint64_t cpu_ns = cpu_time_ns() - cpu_start;
+
+  BenchResult result;
+  result.scheduler = scheduler;
+  result.nb_levels = nb_levels;
+  result.nb_nodes = nb_nodes;
+  result.nb_sent = options.nb_packets;
+  result.nb_received = nb_received.load();
+  result.nb_drops = nb_drops();
+  std::chrono::duration<double> elapsed =
+      (result.nb_received > 0 ? last_egress : Clock::now()) - start;
+  result.pps = result.nb_received / elapsed.count();
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(result.nb_received);
+  for (int64_t latency : latency_ns)
+    if (latency >= 0) latencies.push_back(latency);
+  std::sort(latencies.begin(), latencies.end());
+  result.p50 = percentile(latencies, 0.5);
+  result.p90 = percentile(latencies, 0.9);
+  result.p99 = percentile(latencies, 0.99);
+  result.p999 = percentile(latencies, 0.999);
+  result.max = percentile(latencies, 1.0);
+
+  uint64_t node_ns = 0;
+  for (const auto &stats : tm.get_node_stats())
+    node_ns += stats.second.cpu_time_ns;
+  result.cpu_ns = static_cast<double>(cpu_ns) / options.nb_packets;
+  result.node_ns = static_cast<double>(node_ns) / options.nb_packets;
+  return result;
+}
+
+void print_header(std::ostream *out) {
+  *out << std::left << std::setw(10) << "scheduler" << std::right
+       << std::setw(7) << "levels" << std::setw(7) << "nodes"
+       << std::setw(10) << "kpps" << std::setw(9) << "p50_us"
+       << std::setw(9) << "p90_us" << std::setw(9) << "p99_us"
+       << std::setw(10) << "p99.9_us" << std::setw(10) << "max_us"
+       << std::setw(12) << "cpu_ns/pkt" << std::setw(13) << "node_ns/pkt"
+       << std::setw(8) << "drops" << "\n";
+}
+
+void print_result(std::ostream *out, const BenchResult &r) {
+  *out << std::left << std::setw(10) << r.scheduler << std::right
+       << std::setw(7) << r.nb_levels << std::setw(7) << r.nb_nodes
+       << std::fixed << std::setprecision(1) << std::setw(10)
+       << r.pps / 1000.0 << std::setw(9) << r.p50 << std::setw(9) << r.p90
+       << std::setw(9) << r.p99 << std::setw(10) << r.p999 << std::setw(10)
+       << r.max << std::setprecision(0) << std::setw(12) << r.cpu_ns
+       << std::setw(13) << r.node_ns << std::setw(8) << r.nb_drops << "\n";
+}
+
+void write_csv(const std::string &path, const std::vector<BenchResult> &rs) {
+  std::ofstream out(path);
+  out << "scheduler,levels,nodes,sent,received,drops,pps,p50_us,p90_us,"
+         "p99_us,p999_us,max_us,cpu_ns_per_pkt,node_ns_per_pkt\n";
+  for (const auto &r : rs) {
+    out << r.scheduler << "," << r.nb_levels << "," << r.nb_nodes << ","
+        << r.nb_sent << "," << r.nb_received << "," << r.nb_drops << ","
+        << r.pps << "," << r.p50 << "," << r.p90 << "," << r.p99 << ","
+        << r.p999 << "," << r.max << "," << r.cpu_ns << "," << r.node_ns
+        << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  std::string schedulers_list, levels_list, sizes_list;
+  po::options_description description("TrafficManager benchmark options");
+  description.add_options()
+      ("help", "Display this help message")
+      ("packets", po::value<size_t>(&options.nb_packets)->default_value(20000),
+       "Packets sent per run")
+      ("schedulers",
+       po::value<std::string>(&schedulers_list)->default_value(
+           "FIFO,SP,WRR,DRR"),
+       "Native schedulers to run, comma-separated")
+      ("levels", po::value<std::string>(&levels_list)->default_value("1,3"),
+       "Hierarchy depths to run, comma-separated")
+      ("fanout", po::value<int>(&options.fanout)->default_value(2),
+       "Children of every inner node")
+      ("ports", po::value<int>(&options.nb_ports)->default_value(2),
+       "Egress ports, one tree each")
+      ("classes", po::value<int>(&options.nb_classes)->default_value(4),
+       "Traffic classes (colors), spread over the leaves")
+      ("flows", po::value<int>(&options.nb_flows)->default_value(16),
+       "Flows, each with its own port, class and packet size")
+      ("sizes", po::value<std::string>(&sizes_list)->default_value(
+           "64,576,1500"),
+       "Packet sizes of the flows, comma-separated, in bytes")
+      ("rate", po::value<double>(&options.rate)->default_value(0),
+       "Offered load in pps, 0 sends as fast as possible")
+      ("egress-capacity",
+       po::value<size_t>(&options.egress_capacity)->default_value(64),
+       "Capacity of the egress buffer of each port")
+      ("workers",
+       po::value<size_t>(&options.nb_workers)->default_value(
+           TM_NODE_WORKER_NUMBER),
+       "Worker threads of the TM nodes")
+      ("seed", po::value<unsigned int>(&options.seed)->default_value(1),
+       "Seed of the flow generator")
+      ("config", po::value<std::string>(&options.config_path),
+       "tmconfig file to run instead of the generated hierarchies, native "
+       "schedulers only")
+      ("csv", po::value<std::string>(&options.csv_path),
+       "Also write the results to this CSV file")
+      ("trace", po::value<std::string>(&options.trace_path),
+       "Trace the TM events of all the runs to this file");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << "\n" << description;
+    return 1;
+  }
+  if (vm.count("help")) {
+    std::cout << description;
+    return 0;
+  }
+
+  options.sizes = split_list<int>(sizes_list);
+  if (options.nb_packets == 0 || options.nb_ports <= 0 ||
+      options.fanout <= 0 || options.nb_classes <= 0 ||
+      options.nb_flows <= 0 || options.sizes.empty()) {
+    std::cerr << "Invalid options\n" << description;
+    return 1;
+  }
+
+  // Round-robin over the ports and sizes, the classes shifted so that every
+  // port sees every class
+  std::vector<Flow> flows;
+  for (int f = 0; f < options.nb_flows; f++) {
+    Flow flow;
+    flow.port = f % options.nb_ports;
+    flow.color = (f + f / options.nb_ports) % options.nb_classes;
+    flow.size = options.sizes[f % options.sizes.size()];
+    flows.push_back(flow);
+  }
+
+  if (!options.trace_path.empty() &&
+      !bm::TMTrace::get()->start(options.trace_path)) {
+    std::cerr << "Cannot create " << options.trace_path << "\n";
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  if (!options.config_path.empty()) {
+    std::ifstream file(options.config_path);
+    std::stringstream config;
+    config << file.rdbuf();
+    if (!file) {
+      std::cerr << "Cannot read " << options.config_path << "\n";
+      return 1;
+    }
+    size_t nb_nodes = bm::ConfigParser::parse(config.str()).size();
+    results.push_back(
+        run_one("config", 0, config.str(), nb_nodes, flows, options));
+  } else {
+    for (const auto &scheduler : split_list<std::string>(schedulers_list)) {
+      for (int nb_levels : split_list<int>(levels_list)) {
+        size_t nb_nodes;
+        auto config = make_config(scheduler, nb_levels, options, &nb_nodes);
+        results.push_back(
+            run_one(scheduler, nb_levels, config, nb_nodes, flows, options));
+      }
+    }
+  }
+  // After the runs, the configuration parser logs to stdout
+  print_header(&std::cout);
+  for (const auto &result : results) print_result(&std::cout, result);
+  if (!options.csv_path.empty()) write_csv(options.csv_path, results);
+  if (!options.trace_path.empty()) {
+    bm::TMTrace::get()->stop();
+    std::cout << "Trace: " << bm::TMTrace::get()->get_nb_records()
+              << " records, " << bm::TMTrace::get()->get_nb_lost()
+              << " lost\n";
+  }
+
+  // Every packet leaves the TM, transmitted or dropped
+  for (const auto &result : results) {
+    assert(result.nb_received + result.nb_drops == result.nb_sent);
+    (void) result;
+  }
+}
@@ -0,0 +1,94 @@
+#include <bm/bm_sim/calendar_queue.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stress_utils.h"
+
+using ::stress_tests_utils::RandomGen;
+using ::stress_tests_utils::TestChrono;
+
+namespace {
+
+// Days ahead of the current round a new item can land on. Wider than the
+// default ring of BucketCalendarStore, so that the window slides as the
+// rounds advance and the farthest days go through the overflow map
+constexpr int nb_spread_days = 96;
+
+// Payload with the same footprint as the Node's calendar items
+using Item = std::shared_ptr<int>;
+
+// Keep the store at a constant depth: every iteration removes the lowest
+// item (as the node predicate does), which sets the current round, and
+// enqueues a new one a random number of rounds ahead of it (as the WRR / DRR
+// rank actions do). Times only increase, so the items leave in key order.
+bool run_one(bm::CalendarStoreType type, const std::string &name,
+             size_t depth, size_t num_repeats) {
+  auto store = bm::make_calendar_store<Item>(type);
+  RandomGen rgen;
+  int next_time = 1;
+  auto item = std::make_shared<int>(0);
+
+  for (size_t i = 0; i < depth; i++) {
+    int day = rgen.get_int(0, nb_spread_days - 1);
+    if (!store->insert(std::make_pair(day, next_time++), item)) {
+      std::cerr << name << ": initial insert rejected\n";
+      return false;
+    }
+  }
+
+  std::cout << name << " calendar, " << depth << " queued packets\n";
+  bm::CalendarKey previous(0, 0);
+  size_t nb_far = 0;
+  TestChrono chrono(num_repeats);
+  chrono.start();
+  for (size_t iter = 0; iter < num_repeats; iter++) {
+    bm::CalendarKey key;
+    if (store->lowest(&key) == nullptr || key < previous ||
+        !store->take(key, nullptr)) {
+      std::cerr << name << ": lowest item out of order at iteration " << iter
+                << "\n";
+      return false;
+    }
+    previous = key;
+    int ahead = rgen.get_int(0, nb_spread_days - 1);
+    if (ahead >= static_cast<int>(
+            bm::BucketCalendarStore<Item>::default_nb_days))
+      nb_far++;
+    store->insert(std::make_pair(key.first + ahead, next_time++), item);
+  }
+  chrono.end();
+  chrono.print_summary();
+  std::cout << "  " << previous.first << " rounds, " << nb_far
+            << " items enqueued beyond the ring\n";
+  auto *bucket_store =
+      dynamic_cast<bm::BucketCalendarStore<Item> *>(store.get());
+  if (bucket_store) {
+    std::cout << "  " << bucket_store->overflow_size() << " of " << depth
+              << " items left in the overflow map\n";
+  }
+  if (store->size() != depth) {
+    std::cerr << name << ": " << store->size() << " items left, expected "
+              << depth << "\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t num_repeats = 1000000;
+  if (argc > 1) num_repeats = std::stoul(argv[1]);
+
+  for (size_t depth : {1000u, 10000u, 100000u}) {
+    if (!run_one(bm::CalendarStoreType::Map, "map", depth, num_repeats) ||
+        !run_one(bm::CalendarStoreType::Bucket, "bucket", depth,
+                 num_repeats)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include <bm/bm_sim/actions.h>
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/stateful.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+#include <boost/filesystem.hpp>
+
+#include "jsoncpp/json.h"
+#include "stress_utils.h"
+
+using ::stress_tests_utils::SwitchTest;
+using ::stress_tests_utils::TestChrono;
+
+namespace fs = boost::filesystem;
+
+// simple_switch primitives used by the P4 program, the scheduler actions only
+// need the register ones
+
+class mark_to_drop : public bm::ActionPrimitive<bm::Header &> {
+  void operator ()(bm::Header &std_hdr) {
+    (void) std_hdr;
+  }
+};
+
+REGISTER_PRIMITIVE(mark_to_drop);
+
+class register_read : public bm::ActionPrimitive<bm::Field &,
+                                                 const bm::RegisterArray &,
+                                                 const bm::Data &> {
+  void operator ()(bm::Field &dst, const bm::RegisterArray &src,
+                   const bm::Data &idx) {
+    dst.set(src[idx.get_uint()]);
+  }
+};
+
+REGISTER_PRIMITIVE(register_read);
+
+class register_write : public bm::ActionPrimitive<bm::RegisterArray &,
+                                                  const bm::Data &,
+                                                  const bm::Data &> {
+  void operator ()(bm::RegisterArray &dst, const bm::Data &idx,
+                   const bm::Data &src) {
+    dst[idx.get_uint()].set(src);
+  }
+};
+
+REGISTER_PRIMITIVE(register_write);
+
+namespace {
+
+using EgressBuffers =
+    bm::QueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>;
+
+// One tree per egress port (0 to nb_ports - 1), FIFO at every level with a
+// binary fan-out, the leaves split the traffic on the packet color. In each
+// tree, node i has children 2i + 1 and 2i + 2.
+std::string make_config(int nb_levels, int nb_ports) {
+  Json::Value tmnodes(Json::arrayValue);
+  int nb_nodes = (1 << nb_levels) - 1;
+  int first_leaf = (1 << (nb_levels - 1)) - 1;
+  for (int port = 0; port < nb_ports; port++) {
+    int base = port * nb_nodes;
+    for (int id = 0; id < nb_nodes; id++) {
+      Json::Value tmnode;
+      tmnode["tmnode"] = base + id;
+      tmnode["scheduler"] = "FIFO";
+      if (id == 0)
+        tmnode["port"] = port;
+      else
+        tmnode["parent"] = base + (id - 1) / 2;
+      if (id >= first_leaf) {
+        tmnode["match"]["field"] = "color";
+        tmnode["match"]["values"].append(id - first_leaf);
+      }
+      tmnodes.append(tmnode);
+    }
+  }
+  Json::Value root;
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  return Json::FastWriter().write(root);
+}
+
+void run_one(SwitchTest *sw, int nb_levels, int nb_ports, size_t nb_packets) {
+  // Same depth as simple_switch, the backlog stays in the calendars
+  EgressBuffers egress_buffers(1, 64, EgressThreadMapper(1));
+  std::vector<std::unique_ptr<bm::Packet>> transmitted;
+  transmitted.reserve(nb_packets);
+
+  {
+    bm::TrafficManager tm(&egress_buffers, -1);
+    auto p4objects = sw->get_context(0)->get_p4objects();
+    for (const std::string action : {"calculate_rank", "evaluate_predicate",
+                                     "dequeued", "periodic_timeout"}) {
+      auto *action_fn =
+          p4objects->get_one_action_with_name("MyIngress.FIFO_" + action);
+      assert(action_fn != nullptr);
+      tm.add_action("FIFO_" + action, action_fn);
+    }
+    auto hierarchy =
+        bm::ConfigParser::parse(make_config(nb_levels, nb_ports), &tm);
+    assert(hierarchy.get_depth() == static_cast<size_t>(nb_levels));
+    tm.reconfigure(std::move(hierarchy));
+
+    std::thread egress([&egress_buffers, &tm, &transmitted, nb_packets]() {
+      for (size_t i = 0; i < nb_packets; i++) {
+        size_t port;
+        std::unique_ptr<bm::Packet> packet;
+        egress_buffers.pop_back(0, &port, &packet);
+        tm.egress_slot_freed(port);
+        transmitted.push_back(std::move(packet));
+      }
+    });
+
+    int nb_leaves = 1 << (nb_levels - 1);
+    std::cout << nb_levels << "-level hierarchy, " << nb_leaves
+              << " leaves, " << nb_ports << " egress ports\n";
+    TestChrono chrono(nb_packets);
+    chrono.start();
+    for (size_t i = 0; i < nb_packets; i++) {
+      auto packet = sw->new_packet_ptr(0, i, 64, bm::PacketBuffer(128));
+      int egress_port = static_cast<int>(i % nb_ports);
+      packet->set_egress_port(egress_port);
+      auto *phv = packet->get_phv();
+      phv->get_field("standard_metadata.egress_port").set(egress_port);
+      phv->get_field("scalars.metadata.color").set((i / nb_ports) % nb_leaves);
+      tm.enqueue(egress_port, std::move(packet));
+    }
+    egress.join();
+    chrono.end();
+    chrono.print_summary();
+
+    // Predicate evaluations are event-driven and coalesced
+    uint64_t nb_evaluations = 0, cpu_time_ns = 0;
+    auto node_stats = tm.get_node_stats();
+    for (const auto &stats : node_stats) {
+      nb_evaluations += stats.second.nb_predicate_evaluations;
+      cpu_time_ns += stats.second.cpu_time_ns;
+    }
+    std::cout << "Predicate evaluations per packet and per level: "
+              << static_cast<double>(nb_evaluations) /
+                     (nb_packets * nb_levels)
+              << "\nCPU time per node: "
+              << cpu_time_ns / node_stats.size() / 1000 << " us\n";
+
+    // Roots only release packets the egress buffers can take
+    uint64_t nb_credit_stalls = 0;
+    for (int port = 0; port < nb_ports; port++) {
+      auto port_stats = tm.get_port_stats(port);
+      assert(port_stats.nb_drops == 0);
+      nb_credit_stalls += port_stats.nb_credit_stalls;
+    }
+    std::cout << "Transmit credit stalls: " << nb_credit_stalls << "\n";
+  }
+  assert(transmitted.size() == nb_packets);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t nb_packets = 100000;
+  if (argc > 1) nb_packets = std::stoul(argv[1]);
+
+  SwitchTest sw;
+  fs::path config_path =
+      fs::path(TESTDATADIR) / fs::path("tm_hierarchy_1.json");
+  sw.init_objects(config_path.string());
+
+  // Cost of each scheduling level
+  for (int nb_levels : {1, 2, 3}) run_one(&sw, nb_levels, 1, nb_packets);
+  // Scaling with the number of egress ports (one dequeue worker per shard)
+  for (int nb_ports : {2, 4}) run_one(&sw, 1, nb_ports, nb_packets);
+}
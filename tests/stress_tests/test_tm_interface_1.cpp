@@ -0,0 +1,78 @@
+#include <bm/bm_sim/data.h>
+#include <bm/bm_sim/node.h>  // TrafficManagerInterface
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <cassert>
+
+// Cost of the TrafficManagerInterface extern methods the scheduler actions
+// call the most, without the interpreter around them
+
+namespace {
+
+using bm::Data;
+using bm::TrafficManagerInterface;
+
+template <typename Fn>
+void time_calls(const std::string &name, size_t nb_calls, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nb_calls; i++) fn(i);
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": " << elapsed.count() / nb_calls
+            << " ns/call\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t nb_calls = 1000000;
+  if (argc > 1) nb_calls = std::stoul(argv[1]);
+
+  TrafficManagerInterface tm_interface;
+  tm_interface.init();
+  for (int param = 0; param < MAX_NB_SCHED_PARAM; param++)
+    tm_interface.add_scheduler_parameter(param, {1, 2, 3, 4}, 0);
+
+  // The P4 action arguments, built once like the interpreter does
+  Data reg(MAX_NB_GP_REG - 1), idx(3), param(MAX_NB_SCHED_PARAM - 1);
+  Data field(7), day(2), time(12345), value(42), out;
+
+  std::cout << "TrafficManagerInterface extern calls (" << nb_calls
+            << " each)\n";
+  time_calls("write_to_reg", nb_calls, [&](size_t) {
+    tm_interface.write_to_reg(reg, idx, value);
+  });
+  time_calls("read_from_reg", nb_calls, [&](size_t) {
+    tm_interface.read_from_reg(reg, idx, out);
+  });
+  time_calls("get_scheduler_parameter", nb_calls, [&](size_t) {
+    tm_interface.get_scheduler_parameter(param, idx, out);
+  });
+  // The Node pins the parameters once per action
+  tm_interface.begin_action();
+  time_calls("get_scheduler_parameter, pinned", nb_calls, [&](size_t) {
+    tm_interface.get_scheduler_parameter(param, idx, out);
+  });
+  tm_interface.end_action();
+  time_calls("set_field", nb_calls, [&](size_t) {
+    tm_interface.set_field(field, value);
+  });
+  time_calls("get_field", nb_calls, [&](size_t) {
+    tm_interface.get_field(field, out);
+  });
+  time_calls("set_rank + get_rank", nb_calls, [&](size_t) {
+    tm_interface.set_rank(day, time);
+    (void) tm_interface.get_rank();
+  });
+
+  // Values made it through
+  tm_interface.read_from_reg(reg, idx, out);
+  assert(out.get<int>() == 42);
+  tm_interface.get_scheduler_parameter(param, idx, out);
+  assert(out.get<int>() == 4);
+  assert(tm_interface.get_rank() == std::make_pair(2, 12345));
+  (void) out;
+}
@@ -0,0 +1,304 @@
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+#include <sys/resource.h>
+
+#include <boost/program_options.hpp>
+
+#include "jsoncpp/json.h"
+
+// Benchmark of the multicast replication into the TrafficManager: every
+// packet is cloned to N egress ports, as SimpleSwitch::multicast() does, and
+// the copies are handed to the TM either one enqueue() at a time or as a
+// single enqueue_batch(). One FIFO root per port, one egress thread standing
+// for the egress pipelines. Reports, for every fan-out, the rate of copies
+// out of the TM, the time the replicating thread spends in the TM and the CPU
+// time per copy. The defaults are small enough for "make check".
+
+namespace po = boost::program_options;
+
+namespace {
+
+using EgressBuffers =
+    bm::QueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>;
+using Clock = std::chrono::steady_clock;
+
+// Pushed by the main thread once every copy is accounted for
+constexpr bm::packet_id_t end_of_run = ~bm::packet_id_t(0);
+
+struct BenchOptions {
+  size_t nb_copies;
+  int size;
+  size_t egress_capacity;
+  size_t nb_workers;
+  std::string csv_path;
+};
+
+struct BenchResult {
+  int nb_ways;
+  bool batched;
+  size_t nb_sent;
+  size_t nb_received;
+  uint64_t nb_drops;
+  double pps;
+  // Replicating thread in enqueue() / enqueue_batch(), per copy
+  double enqueue_ns;
+  // Process CPU time (replicating, TM and egress threads), per copy
+  double cpu_ns;
+};
+
+template <typename T>
+std::vector<T> split_list(const std::string &list) {
+  std::vector<T> values;
+  std::istringstream stream(list);
+  std::string token;
+  while (std::getline(stream, token, ',')) {
+    if (token.empty()) continue;
+    std::istringstream value_stream(token);
+    T value;
+    value_stream >> value;
+    values.push_back(value);
+  }
+  return values;
+}
+
+// One FIFO root per egress port of the multicast group
+std::string make_config(int nb_ports) {
+  Json::Value tmnodes(Json::arrayValue);
+  for (int port = 0; port < nb_ports; port++) {
+    Json::Value node;
+    node["tmnode"] = port;
+    node["port"] = port;
+    node["scheduler"] = "FIFO";
+    node["impl"] = "native";
+    tmnodes.append(node);
+  }
+  Json::Value root;
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  return Json::FastWriter().write(root);
+}
+
+// The fields the TM reads from the PHV: egress port and length
+class BenchPHV {
+ public:
+  BenchPHV() {
+    std_meta_t.push_back_field("egress_port", 16);
+    intrinsic_meta_t.push_back_field("packet_length", 32);
+    phv_factory.push_back_header("standard_metadata", 0, std_meta_t, true);
+    phv_factory.push_back_header("intrinsic_metadata", 1, intrinsic_meta_t,
+                                 true);
+    phv_source->set_phv_factory(0, &phv_factory);
+  }
+
+  std::unique_ptr<bm::Packet> make_packet(bm::packet_id_t id, int size) {
+    auto packet = std::make_unique<bm::Packet>(bm::Packet::make_new(
+        0, 0, id, 0, size, bm::PacketBuffer(size), phv_source.get()));
+    packet->get_phv()->get_field("intrinsic_metadata.packet_length").set(size);
+    return packet;
+  }
+
+ private:
+  bm::HeaderType std_meta_t{"standard_metadata_t", 0};
+  bm::HeaderType intrinsic_meta_t{"intrinsic_metadata_t", 1};
+  bm::PHVFactory phv_factory;
+  std::unique_ptr<bm::PHVSourceIface> phv_source{
+      bm::PHVSourceIface::make_phv_source()};
+};
+
+uint64_t cpu_time_ns() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  auto to_ns = [](const struct timeval &tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000000u +
+           static_cast<uint64_t>(tv.tv_usec) * 1000u;
+  };
+  return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+BenchResult run_one(int nb_ways, bool batched, const BenchOptions &options) {
+  BenchPHV phv;
+  EgressBuffers egress_buffers(1, options.egress_capacity,
+                               EgressThreadMapper(1));
+  bm::TrafficManager tm(&egress_buffers, -1, options.nb_workers);
+  tm.reconfigure(bm::ConfigParser::parse(make_config(nb_ways), &tm));
+
+  std::atomic<size_t> nb_received{0};
+  Clock::time_point last_egress;
+  std::thread egress([&]() {
+    while (true) {
+      size_t port;
+      std::unique_ptr<bm::Packet> packet;
+      egress_buffers.pop_back(0, &port, &packet);
+      tm.egress_slot_freed(port);
+      if (packet->get_packet_id() == end_of_run) break;
+      last_egress = Clock::now();
+      nb_received.fetch_add(1, std::memory_order_release);
+    }
+  });
+
+  const size_t nb_packets = options.nb_copies / nb_ways;
+  std::vector<bm::TMPacket> copies(nb_ways);
+  Clock::duration enqueue_time{0};
+  const uint64_t cpu_start = cpu_time_ns();
+  const Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < nb_packets; i++) {
+    auto packet = phv.make_packet(i, options.size);
+    auto &f_egress_port =
+        packet->get_phv()->get_field("standard_metadata.egress_port");
+    // Replication as in SimpleSwitch::multicast(), then the TM
+    for (int port = 0; port < nb_ways; port++) {
+      f_egress_port.set(port);
+      copies[port].egress_port = port;
+      copies[port].packet = packet->clone_with_phv_ptr();
+      copies[port].packet->set_egress_port(port);
+    }
+    const Clock::time_point enqueue_start = Clock::now();
+    if (batched) {
+      tm.enqueue_batch(copies.data(), copies.size());
+    } else {
+      for (auto &copy : copies)
+        tm.enqueue(copy.egress_port, std::move(copy.packet));
+    }
+    enqueue_time += Clock::now() - enqueue_start;
+  }
+  const size_t nb_sent = nb_packets * nb_ways;
+
+  // Admission drops are final once enqueue() returned, egress drops once the
+  // roots released everything
+  auto nb_drops = [&tm, nb_ways]() {
+    const auto &buffer = tm.get_buffer_manager();
+    uint64_t drops = 0;
+    for (size_t v = 1; v < static_cast<size_t>(bm::AdmitVerdict::NbVerdicts);
+         v++)
+      drops += buffer.get_nb_drops(static_cast<bm::AdmitVerdict>(v));
+    for (int port = 0; port < nb_ways; port++)
+      drops += tm.get_port_stats(port).nb_drops;
+    return drops;
+  };
+  while (nb_received.load(std::memory_order_acquire) + nb_drops() < nb_sent)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  egress_buffers.push_front(0, phv.make_packet(end_of_run, options.size));
+  egress.join();
+  const uint64_t cpu_ns = cpu_time_ns() - cpu_start;
+
+  BenchResult result;
+  result.nb_ways = nb_ways;
+  result.batched = batched;
+  result.nb_sent = nb_sent;
+  result.nb_received = nb_received.load();
+  result.nb_drops = nb_drops();
+  std::chrono::duration<double> elapsed =
+      (result.nb_received > 0 ? last_egress : Clock::now()) - start;
+  result.pps = result.nb_received / elapsed.count();
+  result.enqueue_ns =
+      static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(enqueue_time)
+              .count()) / nb_sent;
+  result.cpu_ns = static_cast<double>(cpu_ns) / nb_sent;
+  return result;
+}
+
+void print_header(std::ostream *out) {
+  *out << std::right << std::setw(5) << "ways" << std::setw(9) << "enqueue"
+       << std::setw(10) << "kpps" << std::setw(15) << "enqueue_ns/pkt"
+       << std::setw(12) << "cpu_ns/pkt" << std::setw(8) << "drops" << "\n";
+}
+
+void print_result(std::ostream *out, const BenchResult &r) {
+  *out << std::right << std::setw(5) << r.nb_ways << std::setw(9)
+       << (r.batched ? "batch" : "single") << std::fixed
+       << std::setprecision(1) << std::setw(10) << r.pps / 1000.0
+       << std::setprecision(0) << std::setw(15) << r.enqueue_ns
+       << std::setw(12) << r.cpu_ns << std::setw(8) << r.nb_drops << "\n";
+}
+
+void write_csv(const std::string &path, const std::vector<BenchResult> &rs) {
+  std::ofstream out(path);
+  out << "ways,enqueue,sent,received,drops,pps,enqueue_ns_per_pkt,"
+         "cpu_ns_per_pkt\n";
+  for (const auto &r : rs) {
+    out << r.nb_ways << "," << (r.batched ? "batch" : "single") << ","
+        << r.nb_sent << "," << r.nb_received << "," << r.nb_drops << ","
+        << r.pps << "," << r.enqueue_ns << "," << r.cpu_ns << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  std::string ways_list;
+  po::options_description description(
+      "TrafficManager multicast benchmark options");
+  description.add_options()
+      ("help", "Display this help message")
+      ("copies", po::value<size_t>(&options.nb_copies)->default_value(16384),
+       "Copies sent per run, the packets are this divided by the fan-out")
+      ("ways", po::value<std::string>(&ways_list)->default_value("1,8,64"),
+       "Fan-outs to run, comma-separated, one egress port per copy")
+      ("size", po::value<int>(&options.size)->default_value(64),
+       "Packet size in bytes")
+      ("egress-capacity",
+       po::value<size_t>(&options.egress_capacity)->default_value(64),
+       "Capacity of the egress buffer of each port")
+      ("workers",
+       po::value<size_t>(&options.nb_workers)->default_value(
+           TM_NODE_WORKER_NUMBER),
+       "Worker threads of the TM nodes")
+      ("csv", po::value<std::string>(&options.csv_path),
+       "Also write the results to this CSV file");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << "\n" << description;
+    return 1;
+  }
+  if (vm.count("help")) {
+    std::cout << description;
+    return 0;
+  }
+
+  auto ways = split_list<int>(ways_list);
+  bool valid = options.nb_copies > 0 && options.size > 0 && !ways.empty();
+  for (int nb_ways : ways) {
+    valid = valid && nb_ways > 0 && nb_ways <= TM_MAX_EGRESS_PORTS &&
+            static_cast<size_t>(nb_ways) <= options.nb_copies;
+  }
+  if (!valid) {
+    std::cerr << "Invalid options\n" << description;
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  for (int nb_ways : ways) {
+    for (bool batched : {false, true})
+      results.push_back(run_one(nb_ways, batched, options));
+  }
+  // After the runs, the configuration parser logs to stdout
+  print_header(&std::cout);
+  for (const auto &result : results) print_result(&std::cout, result);
+  if (!options.csv_path.empty()) write_csv(options.csv_path, results);
+
+  // Every copy leaves the TM, transmitted or dropped
+  for (const auto &result : results) {
+    assert(result.nb_received + result.nb_drops == result.nb_sent);
+    (void) result;
+  }
+}
@@ -0,0 +1,209 @@
+#include <bm/bm_sim/actions.h>
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/stateful.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+#include <boost/filesystem.hpp>
+
+#include "jsoncpp/json.h"
+#include "stress_utils.h"
+
+using ::stress_tests_utils::SwitchTest;
+
+namespace fs = boost::filesystem;
+
+// simple_switch primitives used by the P4 program, the scheduler actions only
+// need the register ones
+
+class mark_to_drop : public bm::ActionPrimitive<bm::Header &> {
+  void operator ()(bm::Header &std_hdr) {
+    (void) std_hdr;
+  }
+};
+
+REGISTER_PRIMITIVE(mark_to_drop);
+
+class register_read : public bm::ActionPrimitive<bm::Field &,
+                                                 const bm::RegisterArray &,
+                                                 const bm::Data &> {
+  void operator ()(bm::Field &dst, const bm::RegisterArray &src,
+                   const bm::Data &idx) {
+    dst.set(src[idx.get_uint()]);
+  }
+};
+
+REGISTER_PRIMITIVE(register_read);
+
+class register_write : public bm::ActionPrimitive<bm::RegisterArray &,
+                                                  const bm::Data &,
+                                                  const bm::Data &> {
+  void operator ()(bm::RegisterArray &dst, const bm::Data &idx,
+                   const bm::Data &src) {
+    dst[idx.get_uint()].set(src);
+  }
+};
+
+REGISTER_PRIMITIVE(register_write);
+
+namespace {
+
+using EgressBuffers =
+    bm::QueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>;
+
+// (port, color) of each packet, in the order of each port
+using PortOrder = std::map<size_t, std::vector<int>>;
+
+constexpr int nb_ports = 2;
+constexpr int nb_colors = 3;
+
+// One root per egress port, the scheduler runs its P4 actions or its native
+// implementation
+std::string make_config(const std::string &scheduler, bool native) {
+  Json::Value tmnodes(Json::arrayValue);
+  for (int port = 0; port < nb_ports; port++) {
+    Json::Value tmnode;
+    tmnode["tmnode"] = port;
+    tmnode["port"] = port;
+    tmnode["scheduler"] = scheduler;
+    tmnode["impl"] = native ? "native" : "p4";
+    tmnodes.append(tmnode);
+  }
+  Json::Value root;
+  root["tmconfig"]["tmnodes"] = tmnodes;
+  return Json::FastWriter().write(root);
+}
+
+class TMRun {
+ public:
+  TMRun(SwitchTest *sw, const std::string &scheduler, bool native,
+        size_t egress_capacity)
+      : sw(sw), egress_buffers(1, egress_capacity, EgressThreadMapper(1)),
+        tm(&egress_buffers, -1) {
+    auto p4objects = sw->get_context(0)->get_p4objects();
+    for (const std::string action : {"calculate_rank", "evaluate_predicate",
+                                     "dequeued", "periodic_timeout"}) {
+      auto *action_fn = p4objects->get_one_action_with_name(
+          "MyIngress." + scheduler + "_" + action);
+      if (action_fn != nullptr) tm.add_action(scheduler + "_" + action,
+                                               action_fn);
+    }
+    auto hierarchy =
+        bm::ConfigParser::parse(make_config(scheduler, native), &tm);
+    assert(hierarchy.size() == static_cast<size_t>(nb_ports));
+    tm.reconfigure(std::move(hierarchy));
+  }
+
+  // Mixed-port traffic, the colors change every few packets
+  void send(size_t nb_packets) {
+    for (size_t i = 0; i < nb_packets; i++) {
+      auto packet = sw->new_packet_ptr(0, i, 64, bm::PacketBuffer(128));
+      int egress_port = static_cast<int>(i % nb_ports);
+      packet->set_egress_port(egress_port);
+      auto *phv = packet->get_phv();
+      phv->get_field("standard_metadata.egress_port").set(egress_port);
+      phv->get_field("scalars.metadata.color").set((i / 5 + i) % nb_colors);
+      tm.enqueue(egress_port, std::move(packet));
+    }
+  }
+
+  // Wait for all the packets to be in the calendars of the roots
+  void wait_enqueued(size_t nb_packets) {
+    while (true) {
+      uint64_t nb_enqueued = 0;
+      for (const auto &stats : tm.get_node_stats())
+        nb_enqueued += stats.second.nb_enqueued;
+      if (nb_enqueued == nb_packets) return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  PortOrder receive(size_t nb_packets) {
+    PortOrder order;
+    for (size_t i = 0; i < nb_packets; i++) {
+      size_t port;
+      std::unique_ptr<bm::Packet> packet;
+      egress_buffers.pop_back(0, &port, &packet);
+      tm.egress_slot_freed(port);
+      order[port].push_back(
+          packet->get_phv()->get_field("scalars.metadata.color").get_int());
+    }
+    return order;
+  }
+
+  // As a target changing the depth of its egress queues
+  void set_egress_capacity(size_t capacity) {
+    egress_buffers.set_capacity_for_all(capacity);
+    tm.egress_slot_freed();
+  }
+
+ private:
+  SwitchTest *sw;
+  EgressBuffers egress_buffers;
+  bm::TrafficManager tm;
+};
+
+// The egress buffers are closed while the packets are enqueued, then let one
+// packet per port through at a time: each root releases its predicate winner
+// over the full backlog, the order only depends on the scheduler.
+PortOrder backlog_order(SwitchTest *sw, const std::string &scheduler,
+                        bool native, size_t nb_packets) {
+  TMRun run(sw, scheduler, native, 0);
+  run.send(nb_packets);
+  run.wait_enqueued(nb_packets);
+  run.set_egress_capacity(1);
+  return run.receive(nb_packets);
+}
+
+double throughput(SwitchTest *sw, const std::string &scheduler, bool native,
+                  size_t nb_packets) {
+  TMRun run(sw, scheduler, native, 64);
+  std::thread egress([&run, nb_packets]() { run.receive(nb_packets); });
+  auto start = std::chrono::steady_clock::now();
+  run.send(nb_packets);
+  egress.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return nb_packets / elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t nb_packets = 100000;
+  if (argc > 1) nb_packets = std::stoul(argv[1]);
+
+  SwitchTest sw;
+  fs::path config_path =
+      fs::path(TESTDATADIR) / fs::path("tm_hierarchy_1.json");
+  sw.init_objects(config_path.string());
+
+  // The schedulers of the P4 program, WRR and DRR have no reference P4
+  // implementation
+  for (const std::string scheduler : {"FIFO", "SP"}) {
+    // Differential check: same output order on the same backlog, the backlog
+    // fits in the packet stores
+    auto p4_order = backlog_order(&sw, scheduler, false, 600);
+    auto native_order = backlog_order(&sw, scheduler, true, 600);
+    assert(p4_order.size() == static_cast<size_t>(nb_ports));
+    assert(p4_order == native_order);
+    (void) native_order;
+
+    double p4_pps = throughput(&sw, scheduler, false, nb_packets);
+    double native_pps = throughput(&sw, scheduler, true, nb_packets);
+    std::cout << scheduler << ": same order on a backlog of 600 packets\n"
+              << "  P4:     " << static_cast<uint64_t>(p4_pps) << " pps\n"
+              << "  native: " << static_cast<uint64_t>(native_pps)
+              << " pps (x" << native_pps / p4_pps << ")\n";
+  }
+}
@@ -0,0 +1,251 @@
+#include <bm/bm_sim/tm_simulator.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+// Virtual-time simulation of the TrafficManager: runs a tmconfig on a packet
+// trace (CSV or pcap, see bm::TMSimulator) with the egress ports drained at
+// their line rate, as fast as the CPU allows. Without a trace, a seeded
+// synthetic one is generated. Every trace is run twice and the departures
+// must match exactly, so the defaults double as a determinism check for
+// "make check". The departures can be written to a CSV file to compare
+// scheduler parameters.
+
+namespace po = boost::program_options;
+
+namespace {
+
+using Departures = std::vector<std::pair<uint64_t, uint64_t>>;
+
+// SP over the 4 colors on each of the 2 ports of the synthetic trace
+const char *const default_config = R"({"tmconfig": {
+    "buffer": {"packets": 1024},
+    "tmnodes": [
+    {"tmnode": 0, "port": 0, "scheduler": "SP", "impl": "native"},
+    {"tmnode": 1, "port": 1, "scheduler": "SP", "impl": "native"}
+    ]}})";
+
+struct SimOptions {
+  size_t nb_packets;
+  int nb_ports;
+  double load;
+  unsigned int seed;
+  uint64_t rate_bps;
+  size_t capacity;
+  std::string config_path;
+  std::string csv_path;
+  std::vector<std::string> pcaps;
+  std::vector<std::string> port_rates;
+  std::string out_path;
+};
+
+// Poisson arrivals of uniform sizes and colors, spread evenly over the ports,
+// each port offered @p load times its rate
+std::vector<bm::SimPacket> make_trace(const SimOptions &options) {
+  std::mt19937 rng(options.seed);
+  std::uniform_int_distribution<uint32_t> size(64, 1500);
+  std::uniform_int_distribution<int> color(0, 3);
+  const double mean_bits = (64 + 1500) / 2.0 * 8;
+  const double mean_gap_ns = mean_bits * 1e9 / options.rate_bps /
+                             options.load / options.nb_ports;
+  std::exponential_distribution<double> gap(1.0 / mean_gap_ns);
+  std::vector<bm::SimPacket> packets(options.nb_packets);
+  double time = 0;
+  for (size_t i = 0; i < packets.size(); i++) {
+    time += gap(rng);
+    bm::SimPacket &packet = packets[i];
+    packet = {};
+    packet.time_ns = static_cast<uint64_t>(time);
+    packet.packet_id = i;
+    packet.egress_port = i % options.nb_ports;
+    packet.packet_size = size(rng);
+    packet.color = static_cast<uint8_t>(color(rng));
+  }
+  return packets;
+}
+
+bool parse_port_rate(const std::string &arg, uint32_t *port, uint64_t *bps) {
+  size_t colon = arg.find(':');
+  if (colon == std::string::npos) return false;
+  try {
+    *port = static_cast<uint32_t>(std::stoul(arg.substr(0, colon)));
+    *bps = std::stoull(arg.substr(colon + 1));
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+bool run_once(const std::string &config, const SimOptions &options,
+              const std::vector<bm::SimPacket> &packets,
+              Departures *departures, bm::SimStats *stats,
+              std::ostream *out) {
+  bm::TMSimulator simulator;
+  std::string error;
+  if (!simulator.configure(config, &error)) {
+    std::cerr << "Invalid configuration: " << error << "\n";
+    return false;
+  }
+  simulator.set_default_port({options.rate_bps, options.capacity});
+  for (const auto &arg : options.port_rates) {
+    uint32_t port;
+    uint64_t bps;
+    if (!parse_port_rate(arg, &port, &bps)) {
+      std::cerr << "Invalid --port-rate " << arg << ", expected PORT:BPS\n";
+      return false;
+    }
+    simulator.set_port(port, {bps, options.capacity});
+  }
+  *stats = simulator.run(packets, [departures, out](
+      const bm::SimPacket &packet, uint64_t departure_ns) {
+    departures->emplace_back(packet.packet_id, departure_ns);
+    if (out == nullptr) return;
+    *out << packet.time_ns << "," << departure_ns << "," << packet.packet_id
+         << "," << packet.egress_port << "," << packet.packet_size << ","
+         << static_cast<int>(packet.priority) << ","
+         << static_cast<int>(packet.dscp) << ","
+         << static_cast<int>(packet.color) << "," << packet.vlan_id << ","
+         << packet.sport << "," << packet.dport << "\n";
+  });
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  SimOptions options;
+  po::options_description description("TrafficManager simulation options");
+  description.add_options()
+      ("help", "Display this help message")
+      ("packets",
+       po::value<size_t>(&options.nb_packets)->default_value(200000),
+       "Packets of the synthetic trace")
+      ("ports", po::value<int>(&options.nb_ports)->default_value(2),
+       "Egress ports of the synthetic trace")
+      ("load", po::value<double>(&options.load)->default_value(1.2),
+       "Offered load of the synthetic trace, relative to the port rate")
+      ("seed", po::value<unsigned int>(&options.seed)->default_value(1),
+       "Seed of the synthetic trace")
+      ("csv", po::value<std::string>(&options.csv_path),
+       "Trace to run, a CSV file with the columns of the packet logs")
+      ("pcap", po::value<std::vector<std::string>>(&options.pcaps),
+       "Trace to run, PORT@FILE, all the packets of FILE going to PORT; "
+       "can be repeated")
+      ("config", po::value<std::string>(&options.config_path),
+       "tmconfig file to run, native schedulers only")
+      ("rate", po::value<uint64_t>(&options.rate_bps)->default_value(
+           10000000000),
+       "Rate of the egress ports in bps, 0 for infinitely fast ports")
+      ("port-rate", po::value<std::vector<std::string>>(&options.port_rates),
+       "Rate of one egress port, PORT:BPS; can be repeated")
+      ("capacity", po::value<size_t>(&options.capacity)->default_value(2),
+       "Packets each egress port takes from the TM")
+      ("out", po::value<std::string>(&options.out_path),
+       "Write the departures to this CSV file");
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << "\n" << description;
+    return 1;
+  }
+  if (vm.count("help")) {
+    std::cout << description;
+    return 0;
+  }
+  if (options.nb_packets == 0 || options.nb_ports <= 0 ||
+      options.load <= 0 || options.capacity == 0) {
+    std::cerr << "Invalid options\n" << description;
+    return 1;
+  }
+
+  std::vector<bm::SimPacket> packets;
+  std::string error;
+  if (!options.csv_path.empty() &&
+      !bm::TMSimulator::read_csv(options.csv_path, &packets, &error)) {
+    std::cerr << error << "\n";
+    return 1;
+  }
+  for (const auto &arg : options.pcaps) {
+    size_t at = arg.find('@');
+    uint32_t port;
+    try {
+      if (at == std::string::npos) throw std::invalid_argument(arg);
+      port = static_cast<uint32_t>(std::stoul(arg.substr(0, at)));
+    } catch (const std::exception &) {
+      std::cerr << "Invalid --pcap " << arg << ", expected PORT@FILE\n";
+      return 1;
+    }
+    if (!bm::TMSimulator::read_pcap(arg.substr(at + 1), port, &packets,
+                                    &error)) {
+      std::cerr << error << "\n";
+      return 1;
+    }
+  }
+  if (options.csv_path.empty() && options.pcaps.empty()) {
+    if (options.rate_bps == 0) {
+      std::cerr << "The synthetic trace needs a port rate\n";
+      return 1;
+    }
+    packets = make_trace(options);
+  }
+  bm::TMSimulator::normalize(&packets);
+
+  std::string config = default_config;
+  if (!options.config_path.empty()) {
+    std::ifstream file(options.config_path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    if (!file) {
+      std::cerr << "Cannot read " << options.config_path << "\n";
+      return 1;
+    }
+    config = buffer.str();
+  }
+
+  std::ofstream out;
+  if (!options.out_path.empty()) {
+    out.open(options.out_path);
+    if (!out) {
+      std::cerr << "Cannot create " << options.out_path << "\n";
+      return 1;
+    }
+    out << "Arrival,Departure,PacketID,EgressPort,PacketSize,Priority,DSCP,"
+           "Color,VLANID,Sport,Dport\n";
+  }
+
+  Departures first, second;
+  bm::SimStats stats, second_stats;
+  auto start = std::chrono::steady_clock::now();
+  if (!run_once(config, options, packets, &first, &stats,
+                out.is_open() ? &out : nullptr)) {
+    return 1;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (!run_once(config, options, packets, &second, &second_stats, nullptr))
+    return 1;
+
+  std::cout << "arrivals " << stats.nb_arrivals << ", departures "
+            << stats.nb_departures << ", drops " << stats.nb_drops
+            << ", left " << stats.nb_left << "\n"
+            << "simulated " << stats.end_time_ns / 1e6 << " ms in "
+            << elapsed.count() * 1e3 << " ms, "
+            << stats.nb_arrivals / elapsed.count() / 1e6 << " Mpps, "
+            << stats.nb_executions << " node executions\n";
+  if (first != second || stats.end_time_ns != second_stats.end_time_ns) {
+    std::cerr << "The two runs of the trace differ\n";
+    return 1;
+  }
+  return 0;
+}
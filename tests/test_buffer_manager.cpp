@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/buffer_manager.h>
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <memory>
+#include <string>
+
+using bm::AdmitVerdict;
+using bm::BufferConfig;
+using bm::BufferLimits;
+using bm::BufferManager;
+using bm::BufferScope;
+using bm::ConfigSection;
+
+namespace {
+
+constexpr size_t nb_ports = 4;
+
+// Admit if possible, like the TM does
+AdmitVerdict offer(BufferManager *buffer, uint32_t port, int node_id,
+                   size_t bytes, const BufferLimits &node_limits = {}) {
+  AdmitVerdict verdict = buffer->check(port, node_id, node_limits, bytes);
+  if (verdict == AdmitVerdict::Admit)
+    buffer->admit(port, node_id, bytes);
+  else
+    buffer->count_drop(port, node_id, verdict);
+  return verdict;
+}
+
+}  // namespace
+
+TEST(BufferManager, Unlimited) {
+  BufferManager buffer(nb_ports);
+  for (int i = 0; i < 1000; i++)
+    ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, i % nb_ports, 1, 1500));
+  auto stats = buffer.get_shared_stats();
+  ASSERT_EQ(1000u, stats.packets);
+  ASSERT_EQ(1500000u, stats.bytes);
+  ASSERT_EQ(250u, buffer.get_port_stats(2).packets);
+  ASSERT_EQ(1000u, buffer.get_node_stats(1).nb_admitted);
+  // No account for ports past the buffer, nor for nodes past the limit
+  ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, nb_ports, -1, 64));
+  ASSERT_EQ(1001u, buffer.get_shared_stats().packets);
+  ASSERT_EQ(0u, buffer.get_port_stats(nb_ports).packets);
+}
+
+TEST(BufferManager, StaticLimits) {
+  BufferManager buffer(nb_ports);
+  BufferConfig config;
+  config.max_packets = 9;
+  config.port.max_bytes = 3000;
+  buffer.configure(config);
+  BufferLimits leaf;
+  leaf.max_packets = 1;
+
+  ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, 0, 1, 1000, leaf));
+  ASSERT_EQ(AdmitVerdict::DropNode, offer(&buffer, 0, 1, 1000, leaf));
+  ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, 0, 2, 1000));
+  ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, 0, 2, 1000));
+  ASSERT_EQ(AdmitVerdict::DropPort, offer(&buffer, 0, 2, 1));
+  for (uint32_t port = 1; port < nb_ports; port++) {
+    for (int i = 0; i < 2; i++)
+      ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, port, 3, 64));
+  }
+  ASSERT_EQ(AdmitVerdict::DropShared, offer(&buffer, 1, 3, 64));
+
+  ASSERT_EQ(1u, buffer.get_nb_drops(AdmitVerdict::DropNode));
+  ASSERT_EQ(1u, buffer.get_nb_drops(AdmitVerdict::DropPort));
+  ASSERT_EQ(1u, buffer.get_nb_drops(AdmitVerdict::DropShared));
+  ASSERT_EQ(3u, buffer.get_shared_stats().nb_drops);
+  ASSERT_EQ(2u, buffer.get_port_stats(0).nb_drops);
+  ASSERT_EQ(1u, buffer.get_node_stats(1).nb_drops);
+
+  // Released packets make room again
+  buffer.release(0, 1, 1000);
+  ASSERT_EQ(AdmitVerdict::Admit, offer(&buffer, 0, 1, 1000, leaf));
+}
+
+TEST(BufferManager, DynamicThreshold) {
+  BufferManager buffer(nb_ports);
+  BufferConfig config;
+  config.max_packets = 90;
+  config.port.alpha = 2.0;
+  buffer.configure(config);
+
+  // A single congested port stops at alpha / (1 + alpha) of the buffer
+  int nb_admitted = 0;
+  while (offer(&buffer, 0, 1, 64) == AdmitVerdict::Admit) nb_admitted++;
+  ASSERT_EQ(60, nb_admitted);
+  ASSERT_EQ(1u, buffer.get_nb_drops(AdmitVerdict::DropPort));
+  // Another port still gets its share of what is left
+  nb_admitted = 0;
+  while (offer(&buffer, 1, 2, 64) == AdmitVerdict::Admit) nb_admitted++;
+  ASSERT_EQ(20, nb_admitted);
+
+  auto occupancies = buffer.get_occupancies(1, 2);
+  ASSERT_EQ(20u, occupancies[static_cast<size_t>(BufferScope::Node)].packets);
+  ASSERT_EQ(20u, occupancies[static_cast<size_t>(BufferScope::Port)].packets);
+  ASSERT_EQ(80u,
+            occupancies[static_cast<size_t>(BufferScope::Shared)].packets);
+  ASSERT_EQ(60u, buffer.get_port_stats(0).peak_packets);
+}
+
+TEST(BufferManager, Config) {
+  BufferConfig config;
+  ASSERT_EQ(ConfigSection::Valid, bm::ConfigParser::parse_buffer(R"({
+      "tmconfig": {
+      "buffer": {"packets": 2048, "port": {"bytes": 100000, "alpha": 0.5}},
+      "tmnodes": []}})", &config));
+  ASSERT_EQ(2048u, config.max_packets);
+  ASSERT_EQ(0u, config.max_bytes);
+  ASSERT_EQ(100000u, config.port.max_bytes);
+  ASSERT_EQ(0.5, config.port.alpha);
+  ASSERT_EQ(ConfigSection::Absent,
+            bm::ConfigParser::parse_buffer(
+                R"({"tmconfig": {"tmnodes": []}})", &config));
+  ASSERT_EQ(ConfigSection::Invalid,
+            bm::ConfigParser::parse_buffer(
+                R"({"tmconfig": {"buffer": {"port": {"alpha": -1}}}})",
+                &config));
+  ASSERT_EQ(ConfigSection::Invalid,
+            bm::ConfigParser::parse_buffer(
+                R"({"tmconfig": {"buffer": []}})", &config));
+  ASSERT_EQ(2048u, config.max_packets);
+
+  bm::Hierarchy hierarchy = bm::ConfigParser::parse(R"({"tmconfig": {
+      "tmnodes": [{"tmnode": 0, "port": 1, "scheduler": "FIFO",
+                   "buffer": {"packets": 16, "alpha": 1}}]}})");
+  ASSERT_EQ(1u, hierarchy.size());
+  const BufferLimits &limits = hierarchy.get_node(0)->get_buffer_limits();
+  ASSERT_EQ(16u, limits.max_packets);
+  ASSERT_EQ(1.0, limits.alpha);
+}
+
+// The TM drops the packets over the limit of their leaf at enqueue() time,
+// they never reach the packet store
+TEST(BufferManager, TrafficManagerAdmission) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  bm::TrafficManager tm;
+  tm.reconfigure(bm::ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 1, "scheduler": "FIFO", "impl": "native"},
+      {"tmnode": 1, "parent": 0, "scheduler": "FIFO", "impl": "native",
+       "buffer": {"packets": 2}}]}})", &tm));
+  // No dequeue worker, the admitted packets stay in the buffer
+  for (int i = 0; i < 5; i++) {
+    tm.enqueue(1, std::make_unique<bm::Packet>(
+                      bm::Packet::make_new(phv_source.get())));
+  }
+  const BufferManager &buffer = tm.get_buffer_manager();
+  ASSERT_EQ(2u, buffer.get_node_stats(1).packets);
+  ASSERT_EQ(3u, buffer.get_nb_drops(AdmitVerdict::DropNode));
+  ASSERT_EQ(2u, buffer.get_port_stats(1).nb_admitted);
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/calendar_item_pool.h>
+#include <bm/bm_sim/phv_source.h>
+
+#include <memory>
+#include <set>
+#include <vector>
+
+using bm::CalendarItem;
+using bm::CalendarItemField;
+using bm::CalendarItemFieldMap;
+using bm::CalendarItemPool;
+using bm::HeaderType;
+using bm::Packet;
+using bm::PHVFactory;
+using bm::PHVSourceIface;
+
+class CalendarItemFieldsTest : public ::testing::Test {
+ protected:
+  PHVFactory phv_factory;
+  HeaderType std_meta_t{"standard_metadata_t", 0};
+  HeaderType scalars_t{"scalars_0", 1};
+  HeaderType ipv4_t{"ipv4_t", 2};
+  HeaderType udp_t{"udp_t", 3};
+  std::unique_ptr<PHVSourceIface> phv_source{
+      PHVSourceIface::make_phv_source()};
+
+  CalendarItemFieldsTest() {
+    std_meta_t.push_back_field("ingress_port", 9);
+    std_meta_t.push_back_field("egress_port", 9);
+    std_meta_t.push_back_field("_padding", 6);
+    scalars_t.push_back_field("metadata.color", 8);
+    ipv4_t.push_back_field("version", 4);
+    ipv4_t.push_back_field("ihl", 4);
+    ipv4_t.push_back_field("diffserv", 8);
+    udp_t.push_back_field("srcPort", 16);
+    udp_t.push_back_field("dstPort", 16);
+
+    phv_factory.push_back_header("standard_metadata", 0, std_meta_t, true);
+    phv_factory.push_back_header("scalars", 1, scalars_t, true);
+    phv_factory.push_back_header("ipv4", 2, ipv4_t);
+    phv_factory.push_back_header("udp", 3, udp_t);
+  }
+
+  void SetUp() override { phv_source->set_phv_factory(0, &phv_factory); }
+
+  std::unique_ptr<CalendarItem> make_item(Packet *packet,
+                                          const CalendarItemFieldMap &fields) {
+    return std::unique_ptr<CalendarItem>(new CalendarItem(packet, fields));
+  }
+};
+
+TEST_F(CalendarItemFieldsTest, Defaults) {
+  auto packet = Packet::make_new(phv_source.get());
+  auto *phv = packet.get_phv();
+  phv->get_field("standard_metadata.egress_port").set(3);
+  phv->get_field("scalars.metadata.color").set(2);
+  phv->get_field("ipv4.diffserv").set(46);
+  phv->get_header("ipv4").mark_valid();
+
+  CalendarItemFieldMap fields;
+  // egress_port, dscp and color, the other default fields are not in the PHV
+  ASSERT_EQ(3u, fields.resolve(*phv));
+  auto item = make_item(&packet, fields);
+  ASSERT_EQ(3u, item->get_egress_port());
+  ASSERT_EQ(2u, item->get_color());
+  ASSERT_EQ(46u, item->get_dscp());
+  ASSERT_EQ(0u, item->get_priority());
+}
+
+TEST_F(CalendarItemFieldsTest, InvalidHeader) {
+  auto packet = Packet::make_new(phv_source.get());
+  auto *phv = packet.get_phv();
+  phv->get_field("ipv4.diffserv").set(46);
+  phv->get_header("ipv4").mark_invalid();
+
+  CalendarItemFieldMap fields;
+  fields.resolve(*phv);
+  ASSERT_EQ(0u, make_item(&packet, fields)->get_dscp());
+}
+
+TEST_F(CalendarItemFieldsTest, Configured) {
+  auto packet = Packet::make_new(phv_source.get());
+  auto *phv = packet.get_phv();
+  phv->get_field("udp.srcPort").set(5000);
+  phv->get_field("udp.dstPort").set(4791);
+  phv->get_field("scalars.metadata.color").set(2);
+  phv->get_header("udp").mark_valid();
+
+  CalendarItemField field;
+  ASSERT_FALSE(CalendarItemFieldMap::field_from_string("ttl", &field));
+  ASSERT_TRUE(CalendarItemFieldMap::field_from_string("sport", &field));
+  ASSERT_EQ(CalendarItemField::Sport, field);
+
+  CalendarItemFieldMap fields;
+  fields.set_field_name(CalendarItemField::Sport, "udp.srcPort");
+  fields.set_field_name(CalendarItemField::Dport, "udp.dstPort");
+  fields.set_field_name(CalendarItemField::Color, "");
+  ASSERT_FALSE(fields.is_resolved());
+  fields.resolve(*phv);
+  ASSERT_TRUE(fields.is_resolved());
+
+  auto item = make_item(&packet, fields);
+  ASSERT_EQ(5000u, item->get_sport());
+  ASSERT_EQ(4791u, item->get_dport());
+  ASSERT_EQ(0u, item->get_color());
+}
+
+TEST_F(CalendarItemFieldsTest, Pool) {
+  auto packet = Packet::make_new(phv_source.get());
+  auto *phv = packet.get_phv();
+  phv->get_field("scalars.metadata.color").set(2);
+  CalendarItemFieldMap fields;
+  fields.resolve(*phv);
+
+  CalendarItemPool pool(4);
+  std::vector<CalendarItem *> items;
+  for (size_t i = 0; i < pool.get_capacity(); i++)
+    items.push_back(pool.acquire(&packet, fields));
+  std::set<CalendarItem *> slab(items.begin(), items.end());
+  ASSERT_EQ(4u, slab.size());
+  ASSERT_EQ(0u, pool.get_nb_overflows());
+
+  // Exhausted, the item comes from the heap
+  auto *overflow = pool.acquire(&packet, fields);
+  ASSERT_EQ(1u, pool.get_nb_overflows());
+  ASSERT_EQ(0u, slab.count(overflow));
+  CalendarItemPool::release(overflow);
+
+  // A recycled item is re-initialized for its new packet, whichever way it
+  // came back
+  items[0]->set_rank({3, 4});
+  items[0]->set_color(7);
+  for (size_t i = 0; i < items.size(); i++) {
+    if (i % 2 == 0)
+      CalendarItemPool::recycle(items[i]);
+    else
+      CalendarItemPool::release(items[i]);
+  }
+  for (size_t i = 0; i < pool.get_capacity(); i++) {
+    auto *item = pool.acquire(&packet, fields);
+    ASSERT_EQ(1u, slab.count(item));
+    ASSERT_EQ(std::make_pair(0, 0), item->get_rank());
+    ASSERT_EQ(2u, item->get_color());
+    ASSERT_EQ(&packet, item->get_packet_ptr());
+  }
+  ASSERT_EQ(1u, pool.get_nb_overflows());
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/calendar_queue.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <utility>
+
+using bm::BucketCalendarStore;
+using bm::CalendarKey;
+using bm::CalendarStore;
+using bm::CalendarStoreType;
+using bm::MapCalendarStore;
+
+using ::testing::TestWithParam;
+using ::testing::Values;
+
+class CalendarStoreTest : public TestWithParam<CalendarStoreType> {
+ protected:
+  std::unique_ptr<CalendarStore<int> > store;
+
+  virtual void SetUp() {
+    // the ring is rounded up to 64 days, tests which need the overflow map
+    // use days farther apart than that
+    store = bm::make_calendar_store<int>(GetParam(), 4);
+  }
+};
+
+TEST_P(CalendarStoreTest, Empty) {
+  ASSERT_TRUE(store->empty());
+  ASSERT_EQ(nullptr, store->lowest());
+  ASSERT_EQ(nullptr, store->lowest_for_day(0));
+  ASSERT_FALSE(store->has_day(0));
+  ASSERT_FALSE(store->take(std::make_pair(0, 1), nullptr));
+}
+
+TEST_P(CalendarStoreTest, Ordering) {
+  ASSERT_TRUE(store->insert(std::make_pair(2, 1), 21));
+  ASSERT_TRUE(store->insert(std::make_pair(0, 3), 3));
+  ASSERT_TRUE(store->insert(std::make_pair(0, 1), 1));
+  ASSERT_TRUE(store->insert(std::make_pair(1, 5), 15));
+  ASSERT_EQ(4u, store->size());
+
+  CalendarKey key;
+  ASSERT_EQ(1, *store->lowest(&key));
+  ASSERT_EQ(std::make_pair(0, 1), key);
+  ASSERT_EQ(15, *store->lowest_for_day(1));
+  ASSERT_EQ(3, *store->lowest_for_day(0, 2));
+  ASSERT_TRUE(store->has_day(2));
+  ASSERT_FALSE(store->has_day(3));
+
+  int v;
+  ASSERT_TRUE(store->take(std::make_pair(0, 1), &v));
+  ASSERT_EQ(1, v);
+  ASSERT_TRUE(store->take(std::make_pair(0, 3), &v));
+  ASSERT_EQ(15, *store->lowest(&key));
+  ASSERT_EQ(std::make_pair(1, 5), key);
+}
+
+TEST_P(CalendarStoreTest, DuplicateKey) {
+  ASSERT_TRUE(store->insert(std::make_pair(0, 1), 1));
+  ASSERT_FALSE(store->insert(std::make_pair(0, 1), 2));
+  ASSERT_EQ(1u, store->size());
+  ASSERT_EQ(1, *store->lowest());
+}
+
+TEST_P(CalendarStoreTest, FarDays) {
+  // days 0 and 100 cannot share a 64-day ring
+  ASSERT_TRUE(store->insert(std::make_pair(100, 1), 100));
+  ASSERT_TRUE(store->insert(std::make_pair(0, 1), 0));
+  ASSERT_TRUE(store->insert(std::make_pair(101, 1), 101));
+  ASSERT_EQ(0, *store->lowest());
+  ASSERT_TRUE(store->take(std::make_pair(0, 1), nullptr));
+  ASSERT_EQ(100, *store->lowest());
+  ASSERT_TRUE(store->take(std::make_pair(100, 1), nullptr));
+  ASSERT_EQ(101, *store->lowest());
+  ASSERT_TRUE(store->take(std::make_pair(101, 1), nullptr));
+  ASSERT_TRUE(store->empty());
+}
+
+INSTANTIATE_TEST_SUITE_P(CalendarStoreTypes, CalendarStoreTest,
+                         Values(CalendarStoreType::Map,
+                                CalendarStoreType::Bucket));
+
+// Overflow days are moved into the ring as soon as the window reaches them,
+// not only once the ring is empty
+TEST(CalendarQueue, MigratesAsWindowSlides) {
+  BucketCalendarStore<int> cq;
+  ASSERT_EQ(64u, cq.nb_days());
+  ASSERT_TRUE(cq.insert(std::make_pair(0, 1), 0));
+  ASSERT_TRUE(cq.insert(std::make_pair(50, 1), 50));
+  ASSERT_TRUE(cq.insert(std::make_pair(100, 1), 100));
+  ASSERT_TRUE(cq.insert(std::make_pair(120, 1), 120));
+  ASSERT_EQ(2u, cq.overflow_size());
+  ASSERT_TRUE(cq.take(std::make_pair(0, 1), nullptr));
+  ASSERT_EQ(1u, cq.overflow_size());
+  ASSERT_TRUE(cq.has_day(100));
+  ASSERT_TRUE(cq.take(std::make_pair(50, 1), nullptr));
+  ASSERT_EQ(0u, cq.overflow_size());
+  CalendarKey key;
+  ASSERT_EQ(100, *cq.lowest(&key));
+  ASSERT_EQ(std::make_pair(100, 1), key);
+  ASSERT_EQ(120, *cq.lowest_for_day(120));
+}
+
+// Random operations, the bucketed calendar queue must always agree with the
+// reference map implementation. Days span three times the ring (which is
+// rounded up to 64 days), so that the window slides and items go through the
+// overflow map and back
+TEST(CalendarQueue, SameAsMap) {
+  std::mt19937 gen(42);
+  MapCalendarStore<int> ref;
+  BucketCalendarStore<int> cq(8);
+  ASSERT_EQ(64u, cq.nb_days());
+  size_t max_overflow = 0;
+  for (int i = 0; i < 20000; i++) {
+    CalendarKey key(static_cast<int>(gen() % 192),
+                    static_cast<int>(gen() % 64));
+    switch (gen() % 4) {
+      case 0:
+      case 1: {
+        int v = static_cast<int>(gen());
+        ASSERT_EQ(ref.insert(key, v), cq.insert(key, v));
+        break;
+      }
+      case 2: {
+        int v1 = 0, v2 = 0;
+        ASSERT_EQ(ref.take(key, &v1), cq.take(key, &v2));
+        ASSERT_EQ(v1, v2);
+        break;
+      }
+      default: {
+        CalendarKey k1, k2;
+        const int *p1 = ref.lowest(&k1);
+        const int *p2 = cq.lowest(&k2);
+        ASSERT_EQ(p1 == nullptr, p2 == nullptr);
+        if (p1 == nullptr) break;
+        ASSERT_EQ(k1, k2);
+        ASSERT_EQ(*p1, *p2);
+        ASSERT_TRUE(ref.take(k1, nullptr));
+        ASSERT_TRUE(cq.take(k2, nullptr));
+      }
+    }
+    ASSERT_EQ(ref.size(), cq.size());
+    ASSERT_EQ(ref.has_day(key.first), cq.has_day(key.first));
+    max_overflow = std::max(max_overflow, cq.overflow_size());
+  }
+  ASSERT_LT(0u, max_overflow);
+}
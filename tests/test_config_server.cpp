@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/config_server.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+using bm::ConfigMessage;
+using bm::ConfigServer;
+
+namespace {
+
+constexpr std::chrono::milliseconds timeout(2000);
+
+class Client {
+ public:
+  explicit Client(int port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connected =
+        connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    struct timeval read_timeout {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout,
+               sizeof(read_timeout));
+  }
+
+  ~Client() { close(fd); }
+
+  void send(const std::string &data) const {
+    ASSERT_EQ(static_cast<ssize_t>(data.size()),
+              ::send(fd, data.data(), data.size(), MSG_NOSIGNAL));
+  }
+
+  void shutdown_write() const { shutdown(fd, SHUT_WR); }
+
+  // Next reply line, empty once the server closed the session
+  std::string read_line() {
+    size_t end;
+    while ((end = buffer.find('\n')) == std::string::npos) {
+      char data[4096];
+      ssize_t bytes_read = read(fd, data, sizeof(data));
+      if (bytes_read <= 0) return "";
+      buffer.append(data, bytes_read);
+    }
+    std::string line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return line;
+  }
+
+  bool connected{false};
+
+ private:
+  int fd;
+  std::string buffer;
+};
+
+const char *ok = R"({"status":"ok"})";
+
+}  // namespace
+
+class ConfigServerTest : public ::testing::Test {
+ protected:
+  ConfigServer server{0};
+
+  void SetUp() override { ASSERT_TRUE(server.start()); }
+
+  // Answers the next message and returns it
+  std::string answer(const std::string &error = "") {
+    ConfigMessage message;
+    if (!server.wait_message(&message, timeout)) return "";
+    server.reply(message.session_id, error);
+    return message.text;
+  }
+};
+
+TEST_F(ConfigServerTest, Framing) {
+  Client client(server.get_port());
+  ASSERT_TRUE(client.connected);
+  // Two messages in one write, then one split over several writes, with
+  // braces in its strings
+  client.send("{\"a\": 1}\n {\"b\": {\"c\": [2]}}");
+  client.send("{\"d\": \"}{\\\"");
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  client.send("}\"}");
+
+  ASSERT_EQ("{\"a\": 1}", answer());
+  ASSERT_EQ("{\"b\": {\"c\": [2]}}", answer());
+  ASSERT_EQ("{\"d\": \"}{\\\"}\"}", answer());
+  ASSERT_EQ(ok, client.read_line());
+  ASSERT_EQ(ok, client.read_line());
+  ASSERT_EQ(ok, client.read_line());
+}
+
+TEST_F(ConfigServerTest, LargeMessage) {
+  Client client(server.get_port());
+  std::string message = "{\"data\": \"" + std::string(1 << 20, 'x') + "\"}";
+  client.send(message);
+  ASSERT_EQ(message, answer());
+  ASSERT_EQ(ok, client.read_line());
+}
+
+// The session stays open across messages, several sessions at once
+TEST_F(ConfigServerTest, Sessions) {
+  Client client_1(server.get_port());
+  Client client_2(server.get_port());
+  for (int i = 0; i < 3; i++) {
+    client_1.send("{\"from\": 1}");
+    ASSERT_EQ("{\"from\": 1}", answer());
+    ASSERT_EQ(ok, client_1.read_line());
+    client_2.send("{\"from\": 2}");
+    ASSERT_EQ("{\"from\": 2}", answer("rejected"));
+    ASSERT_EQ(R"({"error":"rejected","status":"error"})",
+              client_2.read_line());
+  }
+  ASSERT_EQ(2u, server.get_nb_sessions());
+}
+
+// Clients sending a configuration file then closing their side still get
+// their answer
+TEST_F(ConfigServerTest, OneShotClient) {
+  Client client(server.get_port());
+  client.send("{\"tmconfig\": {}}\n");
+  client.shutdown_write();
+  ASSERT_EQ("{\"tmconfig\": {}}", answer());
+  ASSERT_EQ(ok, client.read_line());
+  // Then the server closes the session
+  ASSERT_EQ("", client.read_line());
+}
+
+TEST_F(ConfigServerTest, InvalidFraming) {
+  Client client(server.get_port());
+  client.send("{\"a\": 1} tmconfig");
+  ASSERT_EQ("{\"a\": 1}", answer());
+  ASSERT_EQ(ok, client.read_line());
+  ASSERT_NE(std::string::npos, client.read_line().find("\"error\""));
+  ASSERT_EQ("", client.read_line());
+  // The server keeps serving the other sessions
+  Client other(server.get_port());
+  other.send("{}");
+  ASSERT_EQ("{}", answer());
+  ASSERT_EQ(ok, other.read_line());
+}
+
+TEST_F(ConfigServerTest, Stop) {
+  std::thread consumer([this]() {
+    ConfigMessage message;
+    ASSERT_FALSE(server.wait_message(&message, std::chrono::seconds(60)));
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto start = std::chrono::steady_clock::now();
+  server.stop();
+  consumer.join();
+  ASSERT_GT(std::chrono::seconds(1), std::chrono::steady_clock::now() - start);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/mpsc_ring.h>
+
+#include <thread>
+#include <vector>
+
+using bm::MPSCRing;
+
+TEST(MPSCRing, Bounded) {
+  MPSCRing<int> ring(4);
+  ASSERT_EQ(4u, ring.get_capacity());
+  ASSERT_TRUE(ring.empty());
+  for (int i = 0; i < 4; i++) ASSERT_TRUE(ring.try_push(int(i)));
+  ASSERT_FALSE(ring.try_push(4));
+
+  int out[8];
+  ASSERT_EQ(3u, ring.pop_batch(out, 3));
+  ASSERT_EQ(0, out[0]);
+  ASSERT_EQ(2, out[2]);
+  ASSERT_TRUE(ring.try_push(4));
+  ASSERT_EQ(2u, ring.pop_batch(out, 8));
+  ASSERT_EQ(3, out[0]);
+  ASSERT_EQ(4, out[1]);
+  ASSERT_TRUE(ring.empty());
+  ASSERT_EQ(0u, ring.pop_batch(out, 8));
+}
+
+TEST(MPSCRing, Wake) {
+  MPSCRing<int> ring(4);
+  int out[4];
+  std::thread consumer([&ring, &out]() {
+    ASSERT_EQ(0u, ring.wait_pop_batch(out, 4));
+  });
+  ring.wake();
+  consumer.join();
+}
+
+// Several producers push increasing sequences, the consumer must see every
+// item exactly once and in order for each producer
+TEST(MPSCRing, MultiProducer) {
+  constexpr int nb_producers = 4;
+  constexpr int nb_items = 100000;
+  MPSCRing<int> ring(64);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < nb_producers; p++) {
+    producers.emplace_back([&ring, p]() {
+      for (int i = 0; i < nb_items; i++) ring.push(p * nb_items + i);
+    });
+  }
+
+  std::vector<int> next(nb_producers, 0);
+  int received = 0;
+  int out[16];
+  while (received < nb_producers * nb_items) {
+    size_t n = ring.wait_pop_batch(out, 16);
+    for (size_t i = 0; i < n; i++) {
+      int p = out[i] / nb_items;
+      ASSERT_EQ(next[p], out[i] % nb_items);
+      next[p]++;
+    }
+    received += static_cast<int>(n);
+  }
+
+  for (auto &t : producers) t.join();
+  ASSERT_TRUE(ring.empty());
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/native_scheduler.h>
+
+#include <algorithm>  // std::find
+#include <cstdint>  // SIZE_MAX
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using bm::BucketCalendarStore;
+using bm::CalendarItem;
+using bm::CalendarKey;
+using bm::NativeScheduler;
+using bm::NativeSchedulerMap;
+using bm::NodeCalendar;
+
+namespace {
+
+// Scheduler of a module: pFabric-like, the smallest packet goes first
+class ShortestFirst : public NativeScheduler {
+ public:
+  explicit ShortestFirst(const std::vector<uint32_t> &weights) {
+    (void) weights;
+  }
+
+  CalendarKey calculate_rank(const CalendarItem &item) override {
+    return {static_cast<int>(item.get_packet_size()), ++last_time};
+  }
+
+  CalendarKey evaluate_predicate(const NodeCalendar &calendar) override {
+    CalendarKey key;
+    if (calendar.lowest(&key) == nullptr) return {0, 0};
+    return key;
+  }
+
+ private:
+  int last_time{0};
+};
+
+BM_REGISTER_NATIVE_SCHEDULER_W_NAME(SHORTEST_FIRST, ShortestFirst)
+
+
+// Calendar of a Node, driven the way the Node drives its scheduler
+class Calendar {
+ public:
+  explicit Calendar(std::unique_ptr<NativeScheduler> scheduler)
+      : scheduler(std::move(scheduler)) {}
+
+  // Packet i is color colors[i] and sizes[i] bytes (64 if not given)
+  void enqueue(const std::vector<int> &colors,
+               const std::vector<size_t> &sizes = {}) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      items.emplace_back(new CalendarItem());
+      CalendarItem *item = items.back().get();
+      item->set_packet_id(static_cast<uint32_t>(items.size() - 1));
+      item->set_color(static_cast<uint8_t>(colors[i]));
+      item->set_packet_size(sizes.empty() ? 64 : sizes[i]);
+      item->set_rank(scheduler->calculate_rank(*item));
+      ASSERT_TRUE(calendar.insert(item->get_rank(), item));
+    }
+  }
+
+  // New scheduler parameters, the way the Node hands them over
+  void set_params(const bm::SchedulerParams &params) {
+    scheduler->set_params(*bm::SchedulerParams::Pin(params));
+  }
+
+  // Release up to nb_packets predicate winners, returns their colors
+  std::vector<int> dequeue(size_t nb_packets = SIZE_MAX) {
+    std::vector<int> colors;
+    while (colors.size() < nb_packets) {
+      CalendarKey predicate = scheduler->evaluate_predicate(calendar);
+      if (predicate == CalendarKey(0, 0)) break;
+      CalendarItem *item;
+      if (!calendar.take(predicate, &item)) break;
+      scheduler->dequeued(*item);
+      colors.push_back(item->get_color());
+    }
+    return colors;
+  }
+
+  size_t size() const { return calendar.size(); }
+
+ private:
+  std::unique_ptr<NativeScheduler> scheduler;
+  BucketCalendarStore<CalendarItem *> calendar;
+  std::vector<std::unique_ptr<CalendarItem>> items;
+};
+
+}  // namespace
+
+TEST(NativeScheduler, Fifo) {
+  Calendar calendar(NativeScheduler::make("FIFO"));
+  calendar.enqueue({2, 0, 1, 0});
+  ASSERT_EQ(std::vector<int>({2, 0, 1, 0}), calendar.dequeue());
+  ASSERT_EQ(0u, calendar.size());
+}
+
+// Arrival times stay positive and skip the null predicate when they wrap
+TEST(NativeScheduler, TimeWrap) {
+  uint32_t last_time = std::numeric_limits<int>::max() - 1;
+  ASSERT_EQ(std::numeric_limits<int>::max(),
+            NativeScheduler::next_time(&last_time));
+  ASSERT_EQ(1, NativeScheduler::next_time(&last_time));
+  ASSERT_EQ(2, NativeScheduler::next_time(&last_time));
+}
+
+TEST(NativeScheduler, StrictPriority) {
+  Calendar calendar(NativeScheduler::make("SP"));
+  calendar.enqueue({2, 1, 0, 2, 1, 0});
+  ASSERT_EQ(std::vector<int>({0, 0, 1}), calendar.dequeue(3));
+  // A higher priority packet overtakes the backlog
+  calendar.enqueue({0});
+  ASSERT_EQ(std::vector<int>({0, 1, 2, 2}), calendar.dequeue());
+  // Colors past the last priority share it
+  calendar.enqueue({7, 2, 1});
+  ASSERT_EQ(std::vector<int>({1, 7, 2}), calendar.dequeue());
+}
+
+TEST(NativeScheduler, WeightedRoundRobin) {
+  Calendar calendar(NativeScheduler::make("WRR", {2, 1}));
+  calendar.enqueue({0, 0, 0, 0, 1, 1, 1, 1});
+  ASSERT_EQ(std::vector<int>({0, 0, 1, 0, 0, 1, 1, 1}), calendar.dequeue());
+}
+
+TEST(NativeScheduler, WeightedRoundRobinIdleColor) {
+  Calendar calendar(NativeScheduler::make("WRR", {1, 1}));
+  calendar.enqueue({0, 0, 0, 0, 0, 0});
+  ASSERT_EQ(std::vector<int>({0, 0, 0}), calendar.dequeue(3));
+  // Color 1 was idle, it joins the round being served instead of taking all
+  // the rounds it missed
+  calendar.enqueue({1, 1});
+  ASSERT_EQ(std::vector<int>({1, 0, 1, 0, 0}), calendar.dequeue());
+}
+
+TEST(NativeScheduler, WeightedRoundRobinUpdate) {
+  Calendar calendar(NativeScheduler::make("WRR", {1, 1}));
+  calendar.enqueue({0, 0, 1, 1});
+  ASSERT_EQ(std::vector<int>({0, 1, 0, 1}), calendar.dequeue());
+  // Color 1 gets 3 packets per round from now on
+  bm::SchedulerParams params;
+  ASSERT_TRUE(params.set(0, {1, 3}));
+  calendar.set_params(params);
+  calendar.enqueue({0, 0, 1, 1, 1, 1, 1, 1});
+  ASSERT_EQ(std::vector<int>({0, 1, 1, 1, 0, 1, 1, 1}), calendar.dequeue());
+}
+
+TEST(NativeScheduler, DeficitRoundRobin) {
+  Calendar calendar(NativeScheduler::make("DRR", {1500, 1500}));
+  // Color 0 sends 1000 bytes packets, color 1 500 bytes ones: 1 then 2
+  // packets of color 0 per round (deficit carried over), 3 of color 1
+  calendar.enqueue({0, 0, 0, 1, 1, 1, 1, 1, 1},
+                   {1000, 1000, 1000, 500, 500, 500, 500, 500, 500});
+  ASSERT_EQ(std::vector<int>({0, 1, 1, 1, 0, 0, 1, 1, 1}),
+            calendar.dequeue());
+}
+
+TEST(NativeScheduler, UnknownType) {
+  ASSERT_THROW(NativeScheduler::make("PIFO"), std::invalid_argument);
+}
+
+TEST(NativeScheduler, Plugin) {
+  auto names = NativeSchedulerMap::get_instance()->get_names();
+  ASSERT_EQ(std::vector<std::string>({"FIFO", "SP", "WRR", "DRR"}),
+            std::vector<std::string>(names.begin(), names.begin() + 4));
+  ASSERT_NE(names.end(),
+            std::find(names.begin(), names.end(), "SHORTEST_FIRST"));
+
+  Calendar calendar(NativeScheduler::make("SHORTEST_FIRST"));
+  calendar.enqueue({0, 1, 2, 3}, {1500, 64, 512, 64});
+  ASSERT_EQ(std::vector<int>({1, 3, 2, 0}), calendar.dequeue());
+}
+
+TEST(NativeScheduler, PluginRegistration) {
+  auto *schedulers = NativeSchedulerMap::get_instance();
+  auto factory = [](const std::vector<uint32_t> &weights) {
+    return std::unique_ptr<NativeScheduler>(new ShortestFirst(weights));
+  };
+  // Built-in schedulers cannot be replaced
+  ASSERT_FALSE(schedulers->register_scheduler(
+      "FIFO", BM_NATIVE_SCHEDULER_ABI_VERSION, factory));
+  // Neither can those of other modules
+  ASSERT_FALSE(schedulers->register_scheduler(
+      "SHORTEST_FIRST", BM_NATIVE_SCHEDULER_ABI_VERSION, factory));
+  // Module built against another ABI
+  ASSERT_FALSE(schedulers->register_scheduler(
+      "OLD_ABI", BM_NATIVE_SCHEDULER_ABI_VERSION + 1, factory));
+  try {
+    NativeScheduler::make("OLD_ABI");
+    FAIL();
+  } catch (const std::invalid_argument &e) {
+    ASSERT_NE(std::string::npos, std::string(e.what()).find("ABI"));
+  }
+}
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/packet_store.h>
+#include <bm/bm_sim/phv.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/tm_simulator.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using bm::Packet;
+using bm::PacketHandle;
+using bm::PacketStore;
+using bm::PHVFactory;
+using bm::PHVSourceIface;
+
+class PacketStoreTest : public ::testing::Test {
+ protected:
+  PHVFactory phv_factory;
+  std::unique_ptr<PHVSourceIface> phv_source{
+      PHVSourceIface::make_phv_source()};
+
+  void SetUp() override { phv_source->set_phv_factory(0, &phv_factory); }
+
+  std::unique_ptr<Packet> make_packet(bm::packet_id_t id, int port = 0) {
+    auto packet = std::make_unique<Packet>(Packet::make_new(
+        0, 0, id, 0, 64, bm::PacketBuffer(128), phv_source.get()));
+    packet->set_egress_port(port);
+    return packet;
+  }
+};
+
+// Packets are taken by handle, in any order
+TEST_F(PacketStoreTest, TakeByHandle) {
+  PacketStore store(8);
+  std::vector<PacketHandle> handles;
+  std::vector<Packet *> packets;
+  for (int i = 0; i < 8; i++) {
+    auto packet = make_packet(i);
+    packets.push_back(packet.get());
+    handles.push_back(store.insert(std::move(packet)));
+    ASSERT_NE(bm::INVALID_PACKET_HANDLE, handles.back());
+  }
+  ASSERT_EQ(8u, store.size());
+
+  for (int i : {5, 0, 7, 2, 1, 6, 3, 4}) {
+    ASSERT_EQ(packets[i], store.get(handles[i]));
+    auto packet = store.take(handles[i]);
+    ASSERT_EQ(packets[i], packet.get());
+  }
+  ASSERT_TRUE(store.empty());
+}
+
+// A taken handle stays invalid once its slot is reused
+TEST_F(PacketStoreTest, StaleHandle) {
+  PacketStore store(1);
+  PacketHandle old_handle = store.insert(make_packet(0));
+  ASSERT_NE(nullptr, store.take(old_handle));
+  ASSERT_EQ(nullptr, store.take(old_handle));
+
+  PacketHandle new_handle = store.insert(make_packet(1));
+  ASSERT_NE(old_handle, new_handle);
+  ASSERT_EQ(nullptr, store.get(old_handle));
+  ASSERT_EQ(nullptr, store.take(old_handle));
+  ASSERT_EQ(1u, store.size());
+  ASSERT_NE(nullptr, store.take(new_handle));
+}
+
+TEST_F(PacketStoreTest, BlocksWhenFull) {
+  PacketStore store(2);
+  PacketHandle first = store.insert(make_packet(0));
+  store.insert(make_packet(1));
+
+  std::thread producer([this, &store]() { store.insert(make_packet(2)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(2u, store.size());
+
+  store.take(first);
+  producer.join();
+  ASSERT_EQ(2u, store.size());
+}
+
+// Mixed-port traffic through a TrafficManager, in virtual time: each port has
+// its own root, all the packets arrive at once. The first packet of each port
+// leaves right away, the others wait in the calendar of the root. The egress
+// order must be the order of the scheduler, so the TM took from the store
+// exactly the packet each root picked.
+class PacketStoreTMTest : public ::testing::Test {
+ protected:
+  static constexpr uint32_t nb_ports = 3;
+  static constexpr int nb_colors = 3;
+  static constexpr uint64_t nb_packets = 90;
+
+  // Colors interleaved differently on each port, the first packet of a port
+  // is of color 0
+  static uint8_t color_of(uint64_t i) {
+    const uint64_t k = i / nb_ports;
+    const uint64_t port = i % nb_ports;
+    return static_cast<uint8_t>((k * (port + 1) + k / 2) % nb_colors);
+  }
+
+  std::vector<bm::SimPacket> make_packets() const {
+    std::vector<bm::SimPacket> packets;
+    for (uint64_t i = 0; i < nb_packets; i++) {
+      bm::SimPacket packet{};
+      packet.packet_id = i;
+      packet.egress_port = static_cast<uint32_t>(i % nb_ports);
+      packet.packet_size = 1000;
+      packet.color = color_of(i);
+      packets.push_back(packet);
+    }
+    return packets;
+  }
+
+  // Ids of the packets of each port, in egress order
+  std::vector<std::vector<uint64_t>> run(const std::string &root) const {
+    std::string config = R"({"tmconfig": {"tmnodes": [)";
+    for (uint32_t port = 0; port < nb_ports; port++) {
+      if (port > 0) config += ",";
+      config += R"({"tmnode": )" + std::to_string(port) + R"(, "port": )" +
+                std::to_string(port) + ", " + root + "}";
+    }
+    config += "]}}";
+    bm::TMSimulator simulator;
+    std::string error;
+    EXPECT_TRUE(simulator.configure(config, &error)) << error;
+    simulator.set_default_port({1000000000, 1});
+    std::vector<std::vector<uint64_t>> egress(nb_ports);
+    const auto packets = make_packets();
+    bm::SimStats stats = simulator.run(
+        packets, [&egress](const bm::SimPacket &packet, uint64_t) {
+          egress[packet.egress_port].push_back(packet.packet_id);
+        });
+    EXPECT_EQ(nb_packets, stats.nb_departures);
+    return egress;
+  }
+
+  // Packets of @p port by color, in arrival order
+  static std::vector<std::vector<uint64_t>> by_color(uint32_t port) {
+    std::vector<std::vector<uint64_t>> colors(nb_colors);
+    for (uint64_t i = port; i < nb_packets; i += nb_ports)
+      colors[color_of(i)].push_back(i);
+    return colors;
+  }
+};
+
+// Strict priority: color 0 first, arrival order within a color
+TEST_F(PacketStoreTMTest, StrictPriorityOrder) {
+  auto egress = run(R"("scheduler": "SP", "impl": "native")");
+  for (uint32_t port = 0; port < nb_ports; port++) {
+    std::vector<uint64_t> expected;
+    for (const auto &color : by_color(port))
+      expected.insert(expected.end(), color.begin(), color.end());
+    ASSERT_EQ(expected, egress[port]) << "port " << port;
+  }
+}
+
+// Weighted round robin, weights 3:2:1: the k-th packet of a color goes in
+// round k / weight, arrival order within a round
+TEST_F(PacketStoreTMTest, WeightedRoundRobinOrder) {
+  const uint64_t weights[nb_colors] = {3, 2, 1};
+  auto egress = run(
+      R"("scheduler": "WRR", "impl": "native", "weights": [3, 2, 1])");
+  for (uint32_t port = 0; port < nb_ports; port++) {
+    std::vector<std::tuple<uint64_t, uint64_t>> ranks;
+    uint64_t nb_of_color[nb_colors] = {};
+    for (uint64_t i = port; i < nb_packets; i += nb_ports) {
+      const uint8_t color = color_of(i);
+      ranks.emplace_back(nb_of_color[color]++ / weights[color], i);
+    }
+    std::sort(ranks.begin(), ranks.end());
+    std::vector<uint64_t> expected;
+    for (const auto &rank : ranks) expected.push_back(std::get<1>(rank));
+    ASSERT_EQ(expected, egress[port]) << "port " << port;
+  }
+}
+
+// A batch fills the free slots, the rest is left to the caller
+TEST_F(PacketStoreTest, InsertBatch) {
+  PacketStore store(4);
+  store.insert(make_packet(0));
+  std::vector<std::unique_ptr<Packet>> packets;
+  std::vector<Packet *> pointers;
+  for (int i = 1; i <= 5; i++) {
+    packets.push_back(make_packet(i));
+    pointers.push_back(packets.back().get());
+  }
+  std::vector<PacketHandle> handles(packets.size());
+  ASSERT_EQ(3u, store.insert_batch(packets.data(), packets.size(),
+                                   handles.data()));
+  ASSERT_EQ(4u, store.size());
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_EQ(nullptr, packets[i]);
+    ASSERT_EQ(pointers[i], store.get(handles[i]));
+  }
+  ASSERT_NE(nullptr, packets[3]);
+  ASSERT_NE(nullptr, packets[4]);
+
+  // Full, waits for one slot
+  std::thread producer([&store, &packets, &handles]() {
+    store.insert_batch(&packets[3], 2, &handles[3]);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(4u, store.size());
+  store.take(handles[0]);
+  producer.join();
+  ASSERT_EQ(pointers[3], store.get(handles[3]));
+  ASSERT_NE(nullptr, packets[4]);
+}
@@ -27,6 +27,7 @@
 #include <array>
 #include <vector>
 #include <algorithm>  // for std::count, std::max
+#include <random>
 
 using std::unique_ptr;
 
@@ -222,6 +223,23 @@ struct RndInputPri {
   size_t priority;
 };
 
+TEST(QueueingPriRL, FreeSlots) {
+  QueueingLogicPriRL<unique_ptr<int>, WorkerMapper> queue(
+      1u, 3u, WorkerMapper(1u), 2u);
+  // queue not created yet
+  ASSERT_EQ(3u, queue.free_slots(0u, 0u));
+  ASSERT_EQ(1, queue.push_front(0u, 0u, unique_ptr<int>(new int(0))));
+  ASSERT_EQ(2u, queue.free_slots(0u, 0u));
+  ASSERT_EQ(3u, queue.free_slots(0u, 1u));
+  ASSERT_EQ(1, queue.push_front(0u, 0u, unique_ptr<int>(new int(1))));
+  ASSERT_EQ(1, queue.push_front(0u, 0u, unique_ptr<int>(new int(2))));
+  ASSERT_EQ(0u, queue.free_slots(0u, 0u));
+  ASSERT_EQ(0, queue.push_front(0u, 0u, unique_ptr<int>(new int(3))));
+  // capacity lowered below the occupancy
+  queue.set_capacity(0u, 0u, 1u);
+  ASSERT_EQ(0u, queue.free_slots(0u, 0u));
+}
+
 #ifndef SKIP_UNDETERMINISTIC_TESTS
 
 class QueueingPriRLTest : public ::testing::Test {
@@ -326,4 +344,76 @@ TEST_F(QueueingPriRLTest, PriRateLimiter) {
   ASSERT_LT(diff, std::max(priority_0, priority_1) * 0.2);
 }
 
+// The packets of a queue limited in bps leave at that rate whatever their
+// sizes: the bits before the last packet take the time between the first and
+// the last departure
+class QueueingPriRLBpsTest : public ::testing::TestWithParam<int> {
+ protected:
+  using T = std::unique_ptr<int>;
+  static constexpr size_t nb_packets = 200u;
+  static constexpr double duration_s = 0.1;
+
+  QueueingLogicPriRL<T, WorkerMapper> queue{1u, nb_packets, WorkerMapper(1u),
+                                            2u};
+  std::vector<size_t> sizes;
+
+  void SetUp() override {
+    std::mt19937 rng(GetParam());
+    std::uniform_int_distribution<size_t> uniform(64, 1500);
+    for (size_t i = 0; i < nb_packets; i++) {
+      switch (GetParam()) {
+        case 0: sizes.push_back(64); break;
+        case 1: sizes.push_back(1500); break;
+        case 2: sizes.push_back(uniform(rng)); break;
+        default: sizes.push_back(i % 3 ? 64 : 1500); break;
+      }
+    }
+  }
+
+  // Rate for all the packets but the last to take duration_s
+  uint64_t target_bps() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i + 1 < sizes.size(); i++) bytes += sizes[i];
+    return static_cast<uint64_t>(bytes * 8 / duration_s);
+  }
+
+  double measure_bps(size_t priority) {
+    using clock = std::chrono::high_resolution_clock;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      queue.push_front(0u, priority, unique_ptr<int>(new int(i)), sizes[i]);
+    }
+    clock::time_point first, last;
+    size_t bits = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      size_t queue_id, pri;
+      unique_ptr<int> v;
+      queue.pop_back(0u, &queue_id, &pri, &v);
+      EXPECT_EQ(i, static_cast<size_t>(*v));
+      if (i == 0) first = clock::now();
+      if (i + 1 < sizes.size()) bits += sizes[i] * 8;
+      last = clock::now();
+    }
+    std::chrono::duration<double> elapsed = last - first;
+    return bits / elapsed.count();
+  }
+};
+
+TEST_P(QueueingPriRLBpsTest, Queue) {
+  const uint64_t bps = target_bps();
+  queue.set_rate_bps(0u, bps);
+  double measured = measure_bps(1u);
+  ASSERT_NEAR(bps, measured, bps * 0.01);
+}
+
+TEST_P(QueueingPriRLBpsTest, PriorityQueue) {
+  const uint64_t bps = target_bps();
+  queue.set_rate_bps(0u, 0u, bps);
+  double measured = measure_bps(0u);
+  ASSERT_NEAR(bps, measured, bps * 0.01);
+}
+
+// Minimum-size, maximum-size, uniform and bimodal packets
+INSTANTIATE_TEST_SUITE_P(SizeMixes, QueueingPriRLBpsTest,
+                         ::testing::Range(0, 4));
+
 #endif  // SKIP_UNDETERMINISTIC_TESTS
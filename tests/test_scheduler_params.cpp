@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/scheduler_params.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using bm::SchedulerParams;
+
+TEST(SchedulerParams, Set) {
+  SchedulerParams params;
+  ASSERT_EQ(0u, params.get_version());
+  ASSERT_EQ(0u, SchedulerParams::Pin(params)->sizes[0]);
+
+  ASSERT_TRUE(params.set(3, {10, 20, 30}));
+  ASSERT_EQ(1u, params.get_version());
+  {
+    SchedulerParams::Pin pin(params);
+    ASSERT_EQ(3u, pin->sizes[3]);
+    ASSERT_EQ(20u, pin->values[3][1]);
+  }
+
+  // Fewer values, the old ones are not kept
+  ASSERT_TRUE(params.set(3, {7}));
+  {
+    SchedulerParams::Pin pin(params);
+    ASSERT_EQ(1u, pin->sizes[3]);
+    ASSERT_EQ(7u, pin->values[3][0]);
+    ASSERT_EQ(0u, pin->values[3][1]);
+  }
+
+  params.clear();
+  ASSERT_EQ(0u, SchedulerParams::Pin(params)->sizes[3]);
+}
+
+TEST(SchedulerParams, OutOfBounds) {
+  SchedulerParams params;
+  ASSERT_FALSE(params.set(SchedulerParams::MAX_PARAMS, {1}));
+  ASSERT_FALSE(params.set(
+      0, std::vector<uint64_t>(SchedulerParams::MAX_VALUES + 1, 1)));
+  // None of the updates is applied if one is invalid
+  ASSERT_FALSE(params.set({{0, {1}}, {SchedulerParams::MAX_PARAMS, {1}}}));
+  ASSERT_EQ(0u, params.get_version());
+  ASSERT_EQ(0u, SchedulerParams::Pin(params)->sizes[0]);
+}
+
+TEST(SchedulerParams, PinKeepsVersion) {
+  SchedulerParams params;
+  ASSERT_TRUE(params.set(0, {1}));
+  SchedulerParams::Pin pin(params);
+  // The update goes to the other buffer, the pinned one is left as is
+  ASSERT_TRUE(params.set(0, {2}));
+  ASSERT_EQ(1u, pin->values[0][0]);
+  ASSERT_EQ(2u, SchedulerParams::Pin(params)->values[0][0]);
+}
+
+// Each update writes the same value to all the values of two parameters, a
+// reader must never see two different values under one pin
+TEST(SchedulerParams, ConcurrentUpdates) {
+  constexpr uint64_t nb_updates = 20000;
+  SchedulerParams params;
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> nb_torn{0};
+
+  std::thread reader([&params, &done, &nb_torn]() {
+    while (!done.load()) {
+      SchedulerParams::Pin pin(params);
+      const uint64_t value = pin->values[0][0];
+      for (size_t i = 0; i < SchedulerParams::MAX_VALUES; i++) {
+        if (pin->values[0][i] != value || pin->values[1][i] != value)
+          nb_torn++;
+      }
+    }
+  });
+
+  for (uint64_t update = 1; update <= nb_updates; update++) {
+    std::vector<uint64_t> values(SchedulerParams::MAX_VALUES, update);
+    ASSERT_TRUE(params.set({{0, values}, {1, values}}));
+  }
+  done = true;
+  reader.join();
+
+  ASSERT_EQ(0u, nb_torn.load());
+  ASSERT_EQ(nb_updates, params.get_version());
+  ASSERT_EQ(nb_updates, SchedulerParams::Pin(params)->values[1][0]);
+}
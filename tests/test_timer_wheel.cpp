@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/timer_wheel.h>
+
+#include <vector>
+
+using bm::TimerWheel;
+
+namespace {
+
+// Advance one tick at a time, callbacks cannot call back into the wheel
+void advance(TimerWheel *wheel, uint64_t nb_ticks, uint64_t *now) {
+  for (uint64_t i = 0; i < nb_ticks; i++) {
+    (*now)++;
+    wheel->advance(1);
+  }
+}
+
+}  // namespace
+
+TEST(TimerWheel, Periodic) {
+  TimerWheel wheel;
+  uint64_t now = 0;
+  std::vector<uint64_t> fired_3, fired_5;
+  wheel.add(3, [&]() { fired_3.push_back(now); });
+  wheel.add(5, [&]() { fired_5.push_back(now); });
+  ASSERT_EQ(2u, wheel.size());
+
+  advance(&wheel, 2, &now);
+  ASSERT_TRUE(fired_3.empty());
+  advance(&wheel, 13, &now);
+  ASSERT_EQ(15u, wheel.get_now());
+  ASSERT_EQ(std::vector<uint64_t>({3, 6, 9, 12, 15}), fired_3);
+  ASSERT_EQ(std::vector<uint64_t>({5, 10, 15}), fired_5);
+}
+
+// Intervals spanning several levels fire on time after cascading
+TEST(TimerWheel, Levels) {
+  TimerWheel wheel;
+  uint64_t now = 0;
+  const uint64_t slots = TimerWheel::TIMER_WHEEL_SLOTS;
+  for (uint64_t interval : {slots - 1, slots, slots + 1, slots * slots + 7,
+                            3 * slots * slots * slots + 11}) {
+    std::vector<uint64_t> fired;
+    advance(&wheel, 5, &now);  // Not aligned on a slot boundary
+    uint64_t start = now;
+    auto id = wheel.add(interval, [&]() { fired.push_back(now); });
+    advance(&wheel, 2 * interval + 1, &now);
+    ASSERT_EQ(std::vector<uint64_t>({start + interval, start + 2 * interval}),
+              fired);
+    ASSERT_TRUE(wheel.remove(id));
+  }
+}
+
+TEST(TimerWheel, Remove) {
+  TimerWheel wheel;
+  int nb_fired_1 = 0, nb_fired_2 = 0;
+  auto id_1 = wheel.add(4, [&]() { nb_fired_1++; });
+  wheel.advance(4);
+  ASSERT_EQ(1, nb_fired_1);
+  ASSERT_TRUE(wheel.remove(id_1));
+  ASSERT_FALSE(wheel.remove(id_1));
+
+  // The slot of the removed timer is reused, its stale entries are ignored
+  auto id_2 = wheel.add(100, [&]() { nb_fired_2++; });
+  ASSERT_NE(id_1, id_2);
+  ASSERT_FALSE(wheel.remove(id_1));
+  wheel.advance(99);
+  ASSERT_EQ(1, nb_fired_1);
+  ASSERT_EQ(0, nb_fired_2);
+  wheel.advance(1);
+  ASSERT_EQ(1, nb_fired_2);
+  ASSERT_EQ(1u, wheel.size());
+}
@@ -0,0 +1,497 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/thread_mapper.h>
+#include <bm/bm_sim/tm_adapter.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Egress side of a test target: keeps the packets in transmission order
+class RecordingSink : public bm::TMEgressSink {
+ public:
+  size_t get_free_slots(uint32_t, size_t) override { return 4; }
+
+  bool transmit(uint32_t egress_port, size_t priority,
+                std::unique_ptr<bm::Packet> &&packet, size_t bytes) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    ports.push_back(egress_port);
+    priorities.push_back(priority);
+    sizes.push_back(bytes);
+    packets.push_back(std::move(packet));
+    cvar.notify_all();
+    return true;
+  }
+
+  bool wait_for(size_t nb_packets) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cvar.wait_for(lock, std::chrono::seconds(5), [this, nb_packets]() {
+      return packets.size() >= nb_packets;
+    });
+  }
+
+  std::mutex mutex;
+  std::condition_variable cvar;
+  std::vector<uint32_t> ports;
+  std::vector<size_t> priorities;
+  std::vector<size_t> sizes;
+  std::vector<std::unique_ptr<bm::Packet>> packets;
+};
+
+// Takes no packet until opened, like an egress buffer that the target starts
+// to drain
+class GatedSink : public RecordingSink {
+ public:
+  size_t get_free_slots(uint32_t, size_t) override { return open ? 4 : 0; }
+
+  void open_gate() {
+    open = true;
+    slot_freed();
+  }
+
+  std::atomic<bool> open{false};
+};
+
+// Records the names the TM looks up, has no action
+class RecordingActionSource : public bm::TMActionSource {
+ public:
+  bm::ActionFn *get_action(const std::string &name) const override {
+    names.insert(name);
+    return nullptr;
+  }
+
+  mutable std::set<std::string> names;
+};
+
+// One message to the configuration server of a TM, returns the reply line or
+// an empty string after 2 seconds
+std::string send_config(int port, const std::string &message) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  struct timeval read_timeout {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout,
+             sizeof(read_timeout));
+  std::string reply;
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+      ::send(fd, message.data(), message.size(), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(message.size())) {
+    char data[256];
+    ssize_t bytes_read;
+    while (reply.find('\n') == std::string::npos &&
+           (bytes_read = read(fd, data, sizeof(data))) > 0) {
+      reply.append(data, bytes_read);
+    }
+  }
+  close(fd);
+  return reply.substr(0, reply.find('\n'));
+}
+
+const char *const fifo_config = R"({"tmconfig": {"tmnodes": [
+    {"tmnode": 0, "port": 1, "scheduler": "FIFO", "impl": "native"},
+    {"tmnode": 1, "port": 2, "scheduler": "FIFO", "impl": "native"}]}})";
+
+}  // namespace
+
+// The packets scheduled by the roots go to the egress sink of the target, in
+// scheduling order, with their size
+TEST(TMAdapter, EgressSink) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  RecordingSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    for (bm::packet_id_t i = 0; i < 100; i++) {
+      auto packet = std::make_unique<bm::Packet>(bm::Packet::make_new(
+          0, 0, i, 0, 0, bm::PacketBuffer(256), phv_source.get()));
+      tm.enqueue(1 + i % 2, std::move(packet));
+    }
+    ASSERT_TRUE(sink.wait_for(100));
+  }
+  std::vector<bm::packet_id_t> port_1, port_2;
+  for (size_t i = 0; i < sink.packets.size(); i++) {
+    auto id = sink.packets[i]->get_packet_id();
+    ASSERT_EQ(1 + id % 2, sink.ports[i]);
+    ASSERT_EQ(sink.packets[i]->get_data_size(), sink.sizes[i]);
+    (sink.ports[i] == 1 ? port_1 : port_2).push_back(id);
+  }
+  ASSERT_EQ(50u, port_1.size());
+  for (size_t i = 0; i < port_1.size(); i++) {
+    ASSERT_EQ(2 * i, port_1[i]);
+    ASSERT_EQ(2 * i + 1, port_2[i]);
+  }
+}
+
+// Until a hierarchy is configured, a program without scheduler actions
+// (PSA, PNA) gets its packets straight to the egress sink
+TEST(TMAdapter, PassThrough) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  RecordingSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.bind_program(RecordingActionSource(), phv_factory);
+    for (bm::packet_id_t i = 0; i < 10; i++) {
+      auto packet = std::make_unique<bm::Packet>(bm::Packet::make_new(
+          0, 0, i, 0, 0, bm::PacketBuffer(256), phv_source.get()));
+      tm.enqueue(3, std::move(packet));
+    }
+    // No scheduling, the packets are there when enqueue() returns
+    ASSERT_EQ(10u, sink.packets.size());
+    ASSERT_EQ(10u, tm.get_port_stats(3).nb_transmitted);
+
+    // Port 3 has no leaf in the configured hierarchy
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    tm.enqueue(3, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                      0, 0, 10, 0, 0, bm::PacketBuffer(256),
+                      phv_source.get())));
+    ASSERT_EQ(1u, tm.get_buffer_manager().get_nb_drops(
+                      bm::AdmitVerdict::DropNoLeaf));
+  }
+  ASSERT_EQ(10u, sink.packets.size());
+  for (bm::packet_id_t i = 0; i < 10; i++)
+    ASSERT_EQ(i, sink.packets[i]->get_packet_id());
+}
+
+// A packet for a port without leaf is dropped, not sent by another port
+TEST(TMAdapter, NoLeaf) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  RecordingSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    for (bm::packet_id_t i = 0; i < 10; i++) {
+      auto packet = std::make_unique<bm::Packet>(bm::Packet::make_new(
+          0, 0, i, 0, 0, bm::PacketBuffer(256), phv_source.get()));
+      tm.enqueue(i < 5 ? 1 : 3, std::move(packet));
+    }
+    ASSERT_TRUE(sink.wait_for(5));
+    ASSERT_EQ(5u, tm.get_buffer_manager().get_nb_drops(
+                      bm::AdmitVerdict::DropNoLeaf));
+    ASSERT_EQ(5u, tm.get_buffer_manager().get_port_stats(3).nb_drops);
+  }
+  ASSERT_EQ(5u, sink.packets.size());
+  for (auto port : sink.ports) ASSERT_EQ(1u, port);
+}
+
+// A QueueingLogicRL without priorities as egress buffers, as in psa_switch
+TEST(TMAdapter, QueueingEgressSink) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  bm::QueueingLogicRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>
+      egress_buffers(1, 8, EgressThreadMapper(1));
+  bm::QueueingEgressSink<EgressThreadMapper> sink(&egress_buffers);
+  ASSERT_EQ(8u, sink.get_free_slots(1, 0));
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  bm::TrafficManager tm(adapter, -1, 1);
+  tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+  // More packets than the egress buffers take, the roots wait for credits
+  for (bm::packet_id_t i = 0; i < 32; i++) {
+    tm.enqueue(2, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                      0, 0, i, 0, 0, bm::PacketBuffer(256),
+                      phv_source.get())));
+  }
+  for (bm::packet_id_t i = 0; i < 32; i++) {
+    size_t port;
+    std::unique_ptr<bm::Packet> packet;
+    egress_buffers.pop_back(0, &port, &packet);
+    sink.slot_freed(port);
+    ASSERT_EQ(2u, port);
+    ASSERT_EQ(i, packet->get_packet_id());
+  }
+  ASSERT_EQ(0u, tm.get_port_stats(2).nb_drops);
+}
+
+// A QueueingLogicPriRL as egress buffers, as in psa_switch with priority
+// queueing: each packet goes to the priority queue it was enqueued with,
+// scheduled or not, and the credits of a root follow the capacity of that
+// queue
+TEST(TMAdapter, PriQueueingEgressSink) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  bm::QueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper>
+      egress_buffers(1, 8, EgressThreadMapper(1), 4);
+  egress_buffers.set_capacity(2, 0, 2);
+  bm::PriQueueingEgressSink<EgressThreadMapper> sink(&egress_buffers);
+  ASSERT_EQ(2u, sink.get_free_slots(2, 0));
+  ASSERT_EQ(8u, sink.get_free_slots(2, 3));
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  bm::TrafficManager tm(adapter, -1, 1);
+  tm.bind_program(RecordingActionSource(), phv_factory);
+  auto make_packet = [&phv_source](bm::packet_id_t id) {
+    return std::make_unique<bm::Packet>(bm::Packet::make_new(
+        0, 0, id, 0, 0, bm::PacketBuffer(256), phv_source.get()));
+  };
+  // Pass-through, then through the hierarchy
+  tm.enqueue(2, make_packet(0), 3);
+  tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+  for (bm::packet_id_t i = 1; i < 8; i++) tm.enqueue(2, make_packet(i), 3);
+  // More than the low priority queue takes, the root waits for credits
+  for (bm::packet_id_t i = 8; i < 12; i++) tm.enqueue(2, make_packet(i), 0);
+  // The highest priority queue is served first
+  for (bm::packet_id_t i = 0; i < 12; i++) {
+    size_t port, priority;
+    std::unique_ptr<bm::Packet> packet;
+    egress_buffers.pop_back(0, &port, &priority, &packet);
+    sink.slot_freed(port);
+    ASSERT_EQ(2u, port);
+    ASSERT_EQ(i, packet->get_packet_id());
+    ASSERT_EQ(i < 8 ? 3u : 0u, priority);
+  }
+  ASSERT_EQ(0u, tm.get_port_stats(2).nb_drops);
+}
+
+// A blocking queue shared by all the ports, as in pna_nic: a full queue holds
+// the TM back, in pass-through as with a hierarchy, nothing is dropped
+TEST(TMAdapter, BlockingQueueEgressSink) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  bm::Queue<std::unique_ptr<bm::Packet>> output_buffer(4);
+  bm::BlockingQueueEgressSink sink(&output_buffer, 4);
+  ASSERT_EQ(4u, sink.get_free_slots(2, 0));
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  bm::TrafficManager tm(adapter, -1, 1);
+  std::vector<bm::packet_id_t> received;
+  std::thread transmit_thread([&output_buffer, &sink, &received]() {
+    for (size_t i = 0; i < 64; i++) {
+      std::unique_ptr<bm::Packet> packet;
+      output_buffer.pop_back(&packet);
+      sink.slot_freed();
+      received.push_back(packet->get_packet_id());
+    }
+  });
+  for (bm::packet_id_t i = 0; i < 64; i++) {
+    if (i == 32) tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    tm.enqueue(2, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                      0, 0, i, 0, 0, bm::PacketBuffer(256),
+                      phv_source.get())));
+  }
+  transmit_thread.join();
+  ASSERT_EQ(64u, received.size());
+  for (bm::packet_id_t i = 0; i < 64; i++) ASSERT_EQ(i, received[i]);
+  ASSERT_EQ(0u, tm.get_port_stats(2).nb_drops);
+}
+
+// Every hook of every scheduler type is looked up in the action source
+TEST(TMAdapter, ActionSource) {
+  bm::PHVFactory phv_factory;
+  RecordingActionSource actions;
+  bm::TrafficManager tm;
+  tm.bind_program(actions, phv_factory);
+  for (const std::string hook : {"calculate_rank", "evaluate_predicate",
+                                 "dequeued", "periodic_timeout", "admit"}) {
+    ASSERT_EQ(1u, actions.names.count("FIFO_" + hook));
+    ASSERT_EQ(1u, actions.names.count("DRR_" + hook));
+  }
+  ASSERT_NE(nullptr, tm.get_timer_packet());
+}
+
+// A batch goes through as the same packets enqueued one by one, including a
+// batch larger than the packet store of a shard
+TEST(TMAdapter, EnqueueBatch) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  const size_t nb_packets = 4 * TM_PACKET_STORE_CAPACITY;
+  RecordingSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    std::vector<bm::TMPacket> batch;
+    for (bm::packet_id_t i = 0; i < nb_packets; i++) {
+      batch.push_back({static_cast<uint32_t>(1 + i % 2),
+                       std::make_unique<bm::Packet>(bm::Packet::make_new(
+                           0, 0, i, 0, 0, bm::PacketBuffer(256),
+                           phv_source.get()))});
+    }
+    tm.enqueue_batch(batch.data(), batch.size());
+    for (const auto &item : batch) ASSERT_EQ(nullptr, item.packet);
+    ASSERT_TRUE(sink.wait_for(nb_packets));
+  }
+  std::vector<bm::packet_id_t> port_1, port_2;
+  for (size_t i = 0; i < sink.packets.size(); i++) {
+    auto id = sink.packets[i]->get_packet_id();
+    ASSERT_EQ(1 + id % 2, sink.ports[i]);
+    (sink.ports[i] == 1 ? port_1 : port_2).push_back(id);
+  }
+  ASSERT_EQ(nb_packets / 2, port_1.size());
+  for (size_t i = 0; i < port_1.size(); i++) {
+    ASSERT_EQ(2 * i, port_1[i]);
+    ASSERT_EQ(2 * i + 1, port_2[i]);
+  }
+}
+
+// A reconfiguration does not wait for an enqueue() blocked on a full packet
+// store
+TEST(TMAdapter, ReconfigureWithFullStore) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  const size_t nb_packets = TM_PACKET_STORE_CAPACITY + 64;
+  GatedSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    std::atomic<bool> done{false};
+    std::thread sender([&]() {
+      for (bm::packet_id_t i = 0; i < nb_packets; i++) {
+        tm.enqueue(1, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                          0, 0, i, 0, 0, bm::PacketBuffer(256),
+                          phv_source.get())));
+      }
+      done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_FALSE(done);
+
+    auto start = std::chrono::steady_clock::now();
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(100));
+    ASSERT_FALSE(done);
+
+    sink.open_gate();
+    sender.join();
+    ASSERT_TRUE(sink.wait_for(nb_packets));
+  }
+  ASSERT_EQ(nb_packets, sink.packets.size());
+}
+
+// Same through the configuration server, with new fields and a new buffer
+// configuration: the enqueue() blocked on the full packet store holds the TM
+// lock, the configuration thread must not wait for it. Another enqueue()
+// waits for the lock across the swap, its wait is the reconfiguration stall
+TEST(TMAdapter, ConfigMessageWithFullStore) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  const size_t nb_packets = TM_PACKET_STORE_CAPACITY + 64;
+  GatedSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, 0, 1);
+    ASSERT_LT(0, tm.get_config_port());
+    ASSERT_EQ(R"({"status":"ok"})",
+              send_config(tm.get_config_port(), fifo_config));
+    std::atomic<bool> done{false};
+    std::thread sender([&]() {
+      for (bm::packet_id_t i = 0; i < nb_packets; i++) {
+        tm.enqueue(1, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                          0, 0, i, 0, 0, bm::PacketBuffer(256),
+                          phv_source.get())));
+      }
+      done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_FALSE(done);
+    std::thread waiting_sender([&]() {
+      tm.enqueue(2, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                        0, 0, nb_packets, 0, 0, bm::PacketBuffer(256),
+                        phv_source.get())));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(R"({"status":"ok"})", send_config(tm.get_config_port(), R"({
+        "tmconfig": {"fields": {"color": "scalars.color"},
+        "buffer": {"packets": 100000}, "tmnodes": [
+        {"tmnode": 0, "port": 1, "scheduler": "FIFO", "impl": "native"},
+        {"tmnode": 1, "port": 2, "scheduler": "FIFO", "impl": "native"}]}})"));
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(500));
+    ASSERT_EQ(2u, tm.get_reconfiguration_stats().nb_reconfigurations);
+    ASSERT_FALSE(done);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    sink.open_gate();
+    sender.join();
+    waiting_sender.join();
+    ASSERT_TRUE(sink.wait_for(nb_packets + 1));
+    // Taken by the enqueue() calls that followed
+    ASSERT_EQ(100000u, tm.get_buffer_manager().get_config().max_packets);
+    auto stats = tm.get_reconfiguration_stats();
+    ASSERT_GE(stats.last_stall_ns, 200000000u);
+    ASSERT_GE(stats.max_stall_ns, stats.last_stall_ns);
+  }
+  ASSERT_EQ(nb_packets + 1, sink.packets.size());
+}
+
+// A root without transmit credit does not poll, the egress sink wakes it up
+// when a slot is freed
+TEST(TMAdapter, CreditWait) {
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+  const size_t nb_packets = 10;
+
+  GatedSink sink;
+  bm::TMAdapter adapter;
+  adapter.egress_sink = &sink;
+  {
+    bm::TrafficManager tm(adapter, -1, 1);
+    tm.reconfigure(bm::ConfigParser::parse(fifo_config, &tm));
+    for (bm::packet_id_t i = 0; i < nb_packets; i++) {
+      tm.enqueue(1, std::make_unique<bm::Packet>(bm::Packet::make_new(
+                        0, 0, i, 0, 0, bm::PacketBuffer(256),
+                        phv_source.get())));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_TRUE(sink.packets.empty());
+    for (const auto &node : tm.get_node_stats())
+      ASSERT_EQ(0u, node.second.nb_timer_evaluations);
+
+    sink.open_gate();
+    ASSERT_TRUE(sink.wait_for(nb_packets));
+  }
+  ASSERT_EQ(nb_packets, sink.packets.size());
+}
@@ -0,0 +1,289 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/hierarchy.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/tm_simulator.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bm::ConfigParser;
+using bm::Hierarchy;
+using bm::Packet;
+using bm::PHVFactory;
+using bm::PHVSourceIface;
+
+namespace {
+
+// root 0 on port 1, inner nodes 1 and 2, leaves 3 (colors 0, 1) and 4
+// (color 2) under 1, leaf 5 (no classifier) under 2
+const char *three_levels = R"({
+  "tmconfig": {
+    "tmnodes": [
+      {"tmnode": 0, "scheduler": "SP", "port": 1, "children": [1, 2]},
+      {"tmnode": 1, "scheduler": "FIFO", "children": [3, 4]},
+      {"tmnode": 2, "scheduler": "FIFO"},
+      {"tmnode": 3, "scheduler": "FIFO",
+       "match": {"field": "color", "values": [0, 1]}},
+      {"tmnode": 4, "scheduler": "FIFO",
+       "match": {"field": "color", "values": [2]}},
+      {"tmnode": 5, "scheduler": "FIFO", "parent": 2}
+    ]
+  }
+})";
+
+std::unique_ptr<bm::CalendarItem> make_item(bm::Packet *packet, uint32_t port,
+                                            uint8_t color) {
+  auto item = std::make_unique<bm::CalendarItem>(packet);
+  item->set_egress_port(port);
+  item->set_color(color);
+  return item;
+}
+
+}  // namespace
+
+TEST(TMHierarchy, Tree) {
+  Hierarchy hierarchy = ConfigParser::parse(three_levels);
+  ASSERT_EQ(6u, hierarchy.size());
+  ASSERT_EQ(3u, hierarchy.get_depth());
+  ASSERT_EQ(1u, hierarchy.get_roots().size());
+  ASSERT_EQ(3u, hierarchy.get_leaves().size());
+
+  auto *root = hierarchy.get_node(0);
+  ASSERT_EQ(nullptr, root->get_parent());
+  ASSERT_EQ(2u, root->get_children().size());
+  ASSERT_EQ(root, hierarchy.get_node(1)->get_parent());
+  ASSERT_EQ(hierarchy.get_node(2), hierarchy.get_node(5)->get_parent());
+  ASSERT_TRUE(hierarchy.get_node(5)->is_leaf());
+  ASSERT_FALSE(hierarchy.get_node(1)->is_leaf());
+}
+
+class TMHierarchyFindLeaf : public ::testing::Test {
+ protected:
+  PHVFactory phv_factory;
+  std::unique_ptr<PHVSourceIface> phv_source{
+      PHVSourceIface::make_phv_source()};
+
+  void SetUp() override { phv_source->set_phv_factory(0, &phv_factory); }
+};
+
+TEST_F(TMHierarchyFindLeaf, Classifiers) {
+  Hierarchy hierarchy = ConfigParser::parse(three_levels);
+  auto packet = Packet::make_new(phv_source.get());
+
+  ASSERT_EQ(3, hierarchy.find_leaf(*make_item(&packet, 1, 1))->get_id());
+  ASSERT_EQ(4, hierarchy.find_leaf(*make_item(&packet, 1, 2))->get_id());
+  // Leaf 5 has no classifier and accepts the other colors
+  ASSERT_EQ(5, hierarchy.find_leaf(*make_item(&packet, 1, 7))->get_id());
+  // No leaf for port 3, the packet is dropped
+  ASSERT_EQ(nullptr, hierarchy.find_leaf(*make_item(&packet, 3, 0)));
+}
+
+TEST(TMHierarchy, Invalid) {
+  // Cycle, no root
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "parent": 1},
+      {"tmnode": 1, "scheduler": "FIFO", "parent": 0}]}})")
+                  .empty());
+  // Two parents
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "children": [2]},
+      {"tmnode": 1, "scheduler": "FIFO", "children": [2]},
+      {"tmnode": 2, "scheduler": "FIFO"}]}})")
+                  .empty());
+  // Unknown child
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "children": [4]}]}})")
+                  .empty());
+  // Unknown classifier field
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO",
+       "match": {"field": "ttl", "values": [1]}}]}})")
+                  .empty());
+  // Unknown calendar store
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "calendar": "mapp"}]}})")
+                  .empty());
+  // Wrong types in the links or the node list, must not throw
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "parent": "x"}]}})")
+                  .empty());
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "scheduler": "FIFO", "children": [{}]}]}})")
+                  .empty());
+  ASSERT_TRUE(ConfigParser::parse(R"({"tmconfig": []})").empty());
+  ASSERT_TRUE(ConfigParser::parse(R"([1, 2])").empty());
+}
+
+TEST(TMHierarchy, LegacyChildrenCount) {
+  // "children" used to be a number and is ignored
+  Hierarchy hierarchy = ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 3, "port": 1, "children": 0, "scheduler": "FIFO"}]}})");
+  ASSERT_EQ(1u, hierarchy.size());
+  ASSERT_TRUE(hierarchy.get_node(3)->is_leaf());
+}
+
+// Nodes without packets never evaluate their predicate and use no CPU
+TEST(TMHierarchy, IdleNodes) {
+  Hierarchy hierarchy = ConfigParser::parse(three_levels);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (const auto &node : hierarchy) {
+    auto stats = node->get_stats();
+    ASSERT_EQ(0u, stats.nb_predicate_evaluations);
+    ASSERT_GT(5000000u, stats.cpu_time_ns);
+  }
+}
+
+// The nodes of a simulated TM only run in run_pending(): all the requests
+// are made before the node gets to execute
+TEST(TMHierarchy, CoalescedPredicateRequests) {
+  bm::TMSimulator simulator;
+  Hierarchy hierarchy = ConfigParser::parse(three_levels, simulator.get_tm());
+  bm::NodeExecutor *executor = simulator.get_tm()->get_node_executor();
+  auto *node = hierarchy.get_node(0);
+  for (int i = 0; i < 1000; i++) node->request_predicate();
+  ASSERT_EQ(0u, node->get_stats().nb_predicate_evaluations);
+
+  ASSERT_EQ(1u, executor->run_pending());
+  auto stats = node->get_stats();
+  ASSERT_EQ(1000u, stats.nb_predicate_requests);
+  ASSERT_EQ(1u, stats.nb_predicate_evaluations);
+  ASSERT_EQ(0u, stats.nb_timer_evaluations);
+
+  // Empty calendar, no timer keeps the node busy
+  uint64_t timer_ns;
+  ASSERT_FALSE(executor->get_next_timer(&timer_ns));
+  ASSERT_EQ(0u, executor->run_pending());
+  ASSERT_EQ(1u, node->get_stats().nb_predicate_evaluations);
+}
+
+TEST(TMHierarchy, ExecutorWorkers) {
+  bm::NodeExecutor executor(2);
+  ASSERT_EQ(2u, executor.get_nb_workers());
+  // The nodes of a port share a worker, the ports spread over the workers
+  ASSERT_EQ(executor.get_worker(3, 0), executor.get_worker(3, 7));
+  ASSERT_NE(executor.get_worker(0, 0), executor.get_worker(1, 0));
+  // Nodes without port spread by id
+  ASSERT_NE(executor.get_worker(-1, 0), executor.get_worker(-1, 1));
+  ASSERT_EQ(1u, bm::NodeExecutor(0).get_nb_workers());
+}
+
+// Many more nodes than workers, all of them get to run
+TEST(TMHierarchy, ManyNodes) {
+  const int nb_nodes = 256;
+  std::string config = R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 1, "scheduler": "FIFO"})";
+  for (int i = 1; i < nb_nodes; i++) {
+    config += ", {\"tmnode\": " + std::to_string(i) +
+              ", \"parent\": 0, \"scheduler\": \"FIFO\"}";
+  }
+  config += "]}}";
+  Hierarchy hierarchy = ConfigParser::parse(config);
+  ASSERT_EQ(static_cast<size_t>(nb_nodes), hierarchy.size());
+
+  for (auto &node : hierarchy) node->request_predicate();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (const auto &node : hierarchy)
+    ASSERT_EQ(1u, node->get_stats().nb_predicate_evaluations);
+}
+
+TEST(TMHierarchy, PeriodicTimeout) {
+  Hierarchy hierarchy = ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 1, "scheduler": "FIFO", "timeout_ms": 4},
+      {"tmnode": 1, "parent": 0, "scheduler": "FIFO"}]}})");
+  auto *node = hierarchy.get_node(0);
+  ASSERT_EQ(4u, node->get_timeout_interval());
+  ASSERT_EQ(0u, hierarchy.get_node(1)->get_timeout_interval());
+
+  bm::TimerWheel wheel;
+  for (auto &n : hierarchy) n->start_periodic_timeout(&wheel);
+  ASSERT_EQ(1u, wheel.size());
+  wheel.advance(3);
+  wheel.advance(1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(1u, node->get_stats().nb_timeouts);
+
+  // Timeouts fired while one is still queued are coalesced
+  wheel.advance(40);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto nb_timeouts = node->get_stats().nb_timeouts;
+  ASSERT_LE(2u, nb_timeouts);
+  ASSERT_GE(11u, nb_timeouts);
+
+  // The timer goes away with its node
+  hierarchy = Hierarchy();
+  ASSERT_EQ(0u, wheel.size());
+}
+
+TEST(TMHierarchy, Edit) {
+  std::string config;
+  std::string error;
+  ASSERT_TRUE(ConfigParser::is_edit(R"({"tmedit": []})"));
+  ASSERT_FALSE(ConfigParser::is_edit(three_levels));
+  // Leaf 6 under 2, leaf 5 moves under 1, node 2 gets a native WRR
+  ASSERT_TRUE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "add_node", "tmnode": {"tmnode": 6, "scheduler": "FIFO",
+                                    "parent": 2}},
+      {"op": "retarget_node", "tmnode": 5, "parent": 1},
+      {"op": "set_scheduler", "tmnode": 2, "scheduler": "WRR",
+       "impl": "native", "weights": [1, 2]}]})", &config, &error))
+      << error;
+  Hierarchy hierarchy = ConfigParser::parse(config);
+  ASSERT_EQ(7u, hierarchy.size());
+  ASSERT_EQ(hierarchy.get_node(2), hierarchy.get_node(6)->get_parent());
+  ASSERT_EQ(hierarchy.get_node(1), hierarchy.get_node(5)->get_parent());
+  ASSERT_EQ("WRR", hierarchy.get_node(2)->get_scheduler_type());
+  ASSERT_TRUE(hierarchy.get_node(2)->is_native());
+
+  // Node 1 goes, its children with it, node 0 no longer lists it
+  ASSERT_TRUE(ConfigParser::apply_edit(config, R"({"tmedit": [
+      {"op": "remove_node", "tmnode": 3}, {"op": "remove_node", "tmnode": 4},
+      {"op": "remove_node", "tmnode": 5}, {"op": "remove_node", "tmnode": 1}
+      ]})", &config, &error))
+      << error;
+  hierarchy = ConfigParser::parse(config);
+  ASSERT_EQ(3u, hierarchy.size());
+  ASSERT_EQ(1u, hierarchy.get_node(0)->get_children().size());
+}
+
+// The edit tells which nodes lose their runtime updates
+TEST(TMHierarchy, EditedNodes) {
+  std::string config;
+  std::string error;
+  bm::EditedNodes edited;
+  ASSERT_TRUE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "remove_node", "tmnode": 5},
+      {"op": "set_scheduler", "tmnode": 1, "scheduler": "SP"},
+      {"op": "retarget_node", "tmnode": 4, "parent": 2}]})",
+                                       &config, &error, &edited))
+      << error;
+  ASSERT_EQ(std::vector<int>({5}), edited.removed);
+  ASSERT_EQ(std::vector<int>({1}), edited.rescheduled);
+  ASSERT_EQ(5u, ConfigParser::parse(config).size());
+}
+
+TEST(TMHierarchy, InvalidEdit) {
+  std::string config = "unchanged";
+  std::string error;
+  ASSERT_FALSE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "add_node", "tmnode": {"tmnode": 3, "scheduler": "FIFO"}}]})",
+      &config, &error));
+  ASSERT_FALSE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "remove_node", "tmnode": 9}]})", &config, &error));
+  ASSERT_FALSE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "retarget_node", "tmnode": 5, "parent": 9}]})", &config,
+      &error));
+  ASSERT_FALSE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "rename_node", "tmnode": 5}]})", &config, &error));
+  ASSERT_EQ("unchanged", config);
+
+  // The edit is valid but leaves node 5 without its parent
+  ASSERT_TRUE(ConfigParser::apply_edit(three_levels, R"({"tmedit": [
+      {"op": "remove_node", "tmnode": 2}]})", &config, &error));
+  ASSERT_TRUE(ConfigParser::parse(config).empty());
+}
@@ -0,0 +1,506 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/phv.h>
+#include <bm/bm_sim/tm_simulator.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using bm::SimPacket;
+using bm::SimPortConfig;
+using bm::SimStats;
+using bm::TMSimulator;
+
+namespace {
+
+// Input id and time of the departures, in departure order
+using Departures = std::vector<std::pair<uint64_t, uint64_t>>;
+
+SimPacket make_packet(uint64_t time_ns, uint64_t id, uint32_t port,
+                      uint32_t size, uint8_t color = 0) {
+  SimPacket packet{};
+  packet.time_ns = time_ns;
+  packet.packet_id = id;
+  packet.egress_port = port;
+  packet.packet_size = size;
+  packet.color = color;
+  return packet;
+}
+
+SimStats simulate(const std::string &config, const SimPortConfig &port,
+                  const std::vector<SimPacket> &packets,
+                  Departures *departures, TMSimulator *simulator) {
+  std::string error;
+  EXPECT_TRUE(simulator->configure(config, &error)) << error;
+  simulator->set_default_port(port);
+  return simulator->run(packets, [departures](const SimPacket &packet,
+                                              uint64_t departure_ns) {
+    departures->emplace_back(packet.packet_id, departure_ns);
+  });
+}
+
+// 2 ports, a DRR root over 2 DRR leaves of 2 colors each, with a buffer
+// small enough to drop
+const char *const drr_config = R"({"tmconfig": {
+    "buffer": {"packets": 64},
+    "tmnodes": [
+    {"tmnode": 0, "port": 0, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 3000]},
+    {"tmnode": 1, "parent": 0, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 1500], "match": {"field": "color", "values": [0, 1]}},
+    {"tmnode": 2, "parent": 0, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 1500], "match": {"field": "color", "values": [2, 3]}},
+    {"tmnode": 3, "port": 1, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 3000]},
+    {"tmnode": 4, "parent": 3, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 1500], "match": {"field": "color", "values": [0, 1]}},
+    {"tmnode": 5, "parent": 3, "scheduler": "DRR", "impl": "native",
+     "weights": [1500, 1500], "match": {"field": "color", "values": [2, 3]}}
+    ]}})";
+
+// A program without any scheduler action
+class NoActionSource : public bm::TMActionSource {
+ public:
+  bm::ActionFn *get_action(const std::string &) const override {
+    return nullptr;
+  }
+};
+
+}  // namespace
+
+// Back-to-back packets leave at the rate of the port, whatever the CPU
+TEST(TMSimulator, LineRate) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 100; i++)
+    packets.push_back(make_packet(0, i, 1, 1250));
+  TMSimulator simulator;
+  Departures departures;
+  SimStats stats = simulate(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 1, "scheduler": "FIFO", "impl": "native"}]}})",
+                            {1000000000, 2}, packets, &departures, &simulator);
+  ASSERT_EQ(100u, stats.nb_arrivals);
+  ASSERT_EQ(100u, stats.nb_departures);
+  ASSERT_EQ(0u, stats.nb_drops);
+  ASSERT_EQ(0u, stats.nb_left);
+  // 10000 bits at 1 Gbps
+  for (uint64_t i = 0; i < departures.size(); i++)
+    ASSERT_EQ(std::make_pair(i, (i + 1) * 10000), departures[i]);
+  ASSERT_EQ(1000000u, stats.end_time_ns);
+}
+
+// The backlog stays in the calendar of the root, which serves color 0 first
+TEST(TMSimulator, StrictPriority) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 40; i++)
+    packets.push_back(make_packet(0, i, 0, 1000, i % 2 ? 0 : 1));
+  TMSimulator simulator;
+  Departures departures;
+  simulate(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "SP", "impl": "native"}]}})",
+           {1000000000, 1}, packets, &departures, &simulator);
+  ASSERT_EQ(40u, departures.size());
+  // Alone in the TM, the first packet went out right away
+  ASSERT_EQ(0u, departures[0].first);
+  for (size_t i = 1; i <= 20; i++) ASSERT_EQ(2 * i - 1, departures[i].first);
+  for (size_t i = 21; i < 40; i++)
+    ASSERT_EQ(2 * (i - 20), departures[i].first);
+}
+
+// A rejected configuration leaves the TM as it was, buffer included
+TEST(TMSimulator, RejectedConfig) {
+  TMSimulator simulator;
+  std::string error;
+  ASSERT_FALSE(simulator.configure(R"({"tmconfig": {
+      "buffer": {"packets": 7, "bytes": 9}, "tmnodes": []}})", &error));
+  const auto &buffer = simulator.get_tm()->get_buffer_manager();
+  ASSERT_EQ(0u, buffer.get_config().max_packets);
+  ASSERT_EQ(0u, buffer.get_config().max_bytes);
+  // Valid nodes, but an invalid optional section
+  ASSERT_FALSE(simulator.configure(R"({"tmconfig": {
+      "buffer": [], "tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                   &error));
+  ASSERT_FALSE(simulator.configure(R"({"tmconfig": {
+      "fields": {"colour": "meta.color"}, "tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                   &error));
+  ASSERT_EQ(0u, simulator.get_tm()->get_reconfiguration_stats()
+                    .nb_reconfigurations);
+
+  ASSERT_TRUE(simulator.configure(R"({"tmconfig": {
+      "buffer": {"packets": 7, "bytes": 9}, "tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                  &error)) << error;
+  ASSERT_EQ(7u, buffer.get_config().max_packets);
+  ASSERT_EQ(9u, buffer.get_config().max_bytes);
+}
+
+// A message with values of the wrong type is rejected, nothing throws
+TEST(TMSimulator, MistypedConfig) {
+  TMSimulator simulator;
+  std::string error;
+  ASSERT_FALSE(simulator.configure(R"({"tmconfig": {
+      "fields": {"color": ["a"]}, "tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                   &error));
+  ASSERT_FALSE(error.empty());
+  ASSERT_TRUE(simulator.configure(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                  &error)) << error;
+  ASSERT_FALSE(simulator.configure(R"({"tmedit": [{"op": "add_node",
+      "tmnode": {"tmnode": 1, "scheduler": "FIFO", "parent": [0]}}]})",
+                                   &error));
+  ASSERT_FALSE(simulator.configure(R"({"tmparams": [{"tmnode": 0,
+      "params": [{"param": 0, "values": ["a"]}]}]})", &error));
+}
+
+// A "tmparams" message is applied whole or not at all: a node it cannot
+// update leaves the parameters of the other nodes as they were
+TEST(TMSimulator, RejectedParams) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 40; i++)
+    packets.push_back(make_packet(0, i, 0, 1250, i % 2));
+  const std::string config = R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "WRR", "impl": "native",
+       "weights": [1, 1]}]}})";
+  // Color 1 gets 3 packets for 1 of color 0
+  const std::string reweight =
+      R"({"tmnode": 0, "params": [{"param": 0, "values": [1, 3]}]})";
+  auto run = [&config, &packets](const std::string &params, bool applied) {
+    TMSimulator simulator;
+    Departures departures;
+    std::string error;
+    EXPECT_TRUE(simulator.configure(config, &error)) << error;
+    if (!params.empty())
+      EXPECT_EQ(applied, simulator.configure(params, &error)) << params;
+    simulator.set_default_port({1000000000, 2});
+    simulator.run(packets, [&departures](const SimPacket &packet,
+                                         uint64_t departure_ns) {
+      departures.emplace_back(packet.packet_id, departure_ns);
+    });
+    return departures;
+  };
+
+  const Departures unchanged = run("", false);
+  ASSERT_NE(unchanged, run(R"({"tmparams": [)" + reweight + "]}", true));
+  // Unknown node, then parameter out of bounds
+  ASSERT_EQ(unchanged,
+            run(R"({"tmparams": [)" + reweight + R"(, {"tmnode": 9,
+                "params": [{"param": 0, "values": [1]}]}]})",
+                false));
+  ASSERT_EQ(unchanged,
+            run(R"({"tmparams": [)" + reweight + R"(, {"tmnode": 0,
+                "params": [{"param": 99, "values": [1]}]}]})",
+                false));
+}
+
+// Once the program is bound, a P4 scheduler without its calculate_rank and
+// evaluate_predicate actions is rejected, its packets would never leave
+TEST(TMSimulator, MissingSchedulerActions) {
+  bm::PHVFactory phv_factory;
+  TMSimulator simulator;
+  simulator.get_tm()->bind_program(NoActionSource(), phv_factory);
+  std::string error;
+  ASSERT_FALSE(simulator.configure(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"},
+      {"tmnode": 1, "port": 1, "scheduler": "FIFO"}]}})",
+                                   &error));
+  ASSERT_NE(std::string::npos, error.find("FIFO_calculate_rank")) << error;
+  ASSERT_EQ(0u, simulator.get_tm()->get_reconfiguration_stats()
+                    .nb_reconfigurations);
+  ASSERT_TRUE(simulator.configure(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})",
+                                  &error)) << error;
+}
+
+// Two runs of the same input give the same departures at the same times
+TEST(TMSimulator, Deterministic) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> size(64, 1500);
+  std::uniform_int_distribution<int> color(0, 3);
+  std::exponential_distribution<double> gap(1.0 / 400);
+  std::vector<SimPacket> packets;
+  double time = 0;
+  for (uint64_t i = 0; i < 20000; i++) {
+    time += gap(rng);
+    packets.push_back(make_packet(static_cast<uint64_t>(time), i, i % 2,
+                                  size(rng), color(rng)));
+  }
+
+  Departures first, second;
+  SimStats first_stats, second_stats;
+  {
+    TMSimulator simulator;
+    first_stats = simulate(drr_config, {1000000000, 2}, packets, &first,
+                           &simulator);
+  }
+  {
+    TMSimulator simulator;
+    second_stats = simulate(drr_config, {1000000000, 2}, packets, &second,
+                            &simulator);
+  }
+  // The ports are overloaded, the buffer drops
+  ASSERT_LT(0u, first_stats.nb_drops);
+  ASSERT_EQ(0u, first_stats.nb_left);
+  ASSERT_EQ(first_stats.nb_departures + first_stats.nb_drops,
+            packets.size());
+  ASSERT_EQ(first_stats.nb_drops, second_stats.nb_drops);
+  ASSERT_EQ(first_stats.end_time_ns, second_stats.end_time_ns);
+  ASSERT_EQ(first, second);
+}
+
+// The periodic timeouts follow the virtual time
+TEST(TMSimulator, Timeouts) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 20; i++)
+    packets.push_back(make_packet(i * 1000000, i, 0, 100));
+  TMSimulator simulator;
+  Departures departures;
+  SimStats stats = simulate(R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native",
+       "timeout_ms": 1}]}})",
+                            {0, 2}, packets, &departures, &simulator);
+  ASSERT_EQ(20u, stats.nb_departures);
+  // Infinitely fast port, the last packet leaves when it arrives
+  ASSERT_EQ(19000000u, stats.end_time_ns);
+  uint64_t nb_timeouts = 0;
+  for (const auto &node : simulator.get_tm()->get_node_stats())
+    if (node.first == 0) nb_timeouts = node.second.nb_timeouts;
+  ASSERT_EQ(19u, nb_timeouts);
+}
+
+// A shaped node sends at its rate in bits whatever the packet sizes, here on
+// an infinitely fast port
+TEST(TMSimulator, Shaping) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<uint32_t> uniform(64, 1500);
+  const std::vector<std::function<uint32_t(uint64_t)>> mixes = {
+      [](uint64_t) { return 64u; },
+      [](uint64_t) { return 1500u; },
+      [&rng, &uniform](uint64_t) { return uniform(rng); },
+      [](uint64_t i) { return i % 3 ? 64u : 1500u; }};
+  const uint64_t rate_bps = 100000000;
+  for (const auto &mix : mixes) {
+    std::vector<SimPacket> packets;
+    for (uint64_t i = 0; i < 1000; i++)
+      packets.push_back(make_packet(0, i, 0, mix(i)));
+    TMSimulator simulator;
+    Departures departures;
+    simulate(R"({"tmconfig": {"tmnodes": [
+        {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native",
+         "shaping": {"bps": 100000000}}]}})",
+             {0, 2}, packets, &departures, &simulator);
+    ASSERT_EQ(packets.size(), departures.size());
+    uint64_t bits = 0;
+    for (size_t i = 0; i + 1 < departures.size(); i++)
+      bits += packets[departures[i].first].packet_size * 8;
+    const double elapsed_s =
+        (departures.back().second - departures.front().second) / 1e9;
+    ASSERT_NEAR(rate_bps, bits / elapsed_s, rate_bps * 0.01);
+  }
+}
+
+// Shaping a leaf leaves the bandwidth it does not use to its sibling; the
+// rate can be changed with a "tmshaping" message
+TEST(TMSimulator, ShapedLeaf) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 200; i++)
+    packets.push_back(make_packet(0, i, 0, 1250, i % 2 ? 2 : 0));
+  const std::string config = R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "SP", "impl": "native"},
+      {"tmnode": 1, "parent": 0, "scheduler": "FIFO", "impl": "native",
+       "match": {"field": "color", "values": [0, 1]},
+       "shaping": {"bps": 100000000}},
+      {"tmnode": 2, "parent": 0, "scheduler": "FIFO", "impl": "native",
+       "match": {"field": "color", "values": [2, 3]}}]}})";
+  TMSimulator simulator;
+  Departures departures;
+  simulate(config, {1000000000, 2}, packets, &departures, &simulator);
+  ASSERT_EQ(200u, departures.size());
+  // 10000 bits, 10 us at the port rate and 100 us at the rate of the leaf:
+  // all the packets of node 2 leave while node 1 waits for its tokens
+  uint64_t last_node_2 = 0, last_node_1 = 0;
+  for (const auto &departure : departures) {
+    if (departure.first % 2) {
+      last_node_2 = departure.second;
+    } else {
+      last_node_1 = departure.second;
+    }
+  }
+  // 100 packets of node 2 and the 11 of node 1 that conform meanwhile
+  ASSERT_EQ(111 * 10000u, last_node_2);
+  ASSERT_EQ(99 * 100000u + 10000u, last_node_1);
+
+  // A message with an unknown node is rejected whole, node 1 stays shaped
+  TMSimulator rejected;
+  std::string error;
+  ASSERT_TRUE(rejected.configure(config, &error)) << error;
+  ASSERT_FALSE(rejected.configure(R"({"tmshaping": [
+      {"tmnode": 1, "bps": 0}, {"tmnode": 9, "bps": 1000}]})", &error));
+  rejected.set_default_port({1000000000, 2});
+  SimStats stats = rejected.run(
+      packets, [](const SimPacket &, uint64_t) {});
+  ASSERT_EQ(200u, stats.nb_departures);
+  ASSERT_EQ(99 * 100000u + 10000u, stats.end_time_ns);
+
+  TMSimulator unshaped;
+  ASSERT_TRUE(unshaped.configure(config, &error)) << error;
+  ASSERT_TRUE(unshaped.configure(
+      R"({"tmshaping": [{"tmnode": 1, "bps": 0}]})", &error)) << error;
+  ASSERT_FALSE(unshaped.configure(
+      R"({"tmshaping": [{"tmnode": 9, "bps": 1000}]})", &error));
+  unshaped.set_default_port({1000000000, 2});
+  stats = unshaped.run(
+      packets, [](const SimPacket &, uint64_t) {});
+  // The port is the bottleneck again
+  ASSERT_EQ(200u, stats.nb_departures);
+  ASSERT_EQ(200 * 10000u, stats.end_time_ns);
+}
+
+// The runtime shaping of a node survives the edits of the hierarchy, not a
+// new configuration
+TEST(TMSimulator, RuntimeUpdatesAndEdits) {
+  std::vector<SimPacket> packets;
+  for (uint64_t i = 0; i < 100; i++)
+    packets.push_back(make_packet(0, i, 0, 1250));
+  const std::string config = R"({"tmconfig": {"tmnodes": [
+      {"tmnode": 0, "port": 0, "scheduler": "FIFO", "impl": "native"}]}})";
+  const std::string shaping = R"({"tmshaping": [
+      {"tmnode": 0, "bps": 100000000}]})";
+  std::string error;
+
+  TMSimulator edited;
+  ASSERT_TRUE(edited.configure(config, &error)) << error;
+  ASSERT_TRUE(edited.configure(shaping, &error)) << error;
+  ASSERT_TRUE(edited.configure(R"({"tmedit": [{"op": "add_node", "tmnode":
+      {"tmnode": 1, "port": 1, "scheduler": "FIFO", "impl": "native"}}]})",
+                               &error)) << error;
+  edited.set_default_port({1000000000, 2});
+  SimStats stats = edited.run(packets, [](const SimPacket &, uint64_t) {});
+  ASSERT_EQ(100u, stats.nb_departures);
+  // 10000 bits every 100 us
+  ASSERT_EQ(99 * 100000u + 10000u, stats.end_time_ns);
+
+  TMSimulator replaced;
+  ASSERT_TRUE(replaced.configure(config, &error)) << error;
+  ASSERT_TRUE(replaced.configure(shaping, &error)) << error;
+  ASSERT_TRUE(replaced.configure(config, &error)) << error;
+  replaced.set_default_port({1000000000, 2});
+  stats = replaced.run(packets, [](const SimPacket &, uint64_t) {});
+  ASSERT_EQ(100u, stats.nb_departures);
+  ASSERT_EQ(100 * 10000u, stats.end_time_ns);
+}
+
+TEST(TMSimulator, ReadCsv) {
+  const std::string path = testing::TempDir() + "tm_simulator_test.csv";
+  {
+    std::ofstream file(path);
+    file << "Timestamp,PacketID,EgressPort,PacketSize,Priority,DSCP,Color,"
+            "VLANID,Sport,Dport\n"
+         << "5000,7,2,1500,1,46,3,10,1234,80\n"
+         << "1000,8,1,64\n";
+  }
+  std::vector<SimPacket> packets;
+  std::string error;
+  ASSERT_TRUE(TMSimulator::read_csv(path, &packets, &error)) << error;
+  ASSERT_EQ(2u, packets.size());
+  TMSimulator::normalize(&packets);
+  ASSERT_EQ(8u, packets[0].packet_id);
+  ASSERT_EQ(0u, packets[0].time_ns);
+  ASSERT_EQ(0u, packets[0].color);
+  ASSERT_EQ(4000u, packets[1].time_ns);
+  ASSERT_EQ(2u, packets[1].egress_port);
+  ASSERT_EQ(1500u, packets[1].packet_size);
+  ASSERT_EQ(46u, packets[1].dscp);
+  ASSERT_EQ(3u, packets[1].color);
+  ASSERT_EQ(80u, packets[1].dport);
+
+  {
+    std::ofstream file(path);
+    file << "1000,8,1,large\n";
+  }
+  ASSERT_FALSE(TMSimulator::read_csv(path, &packets, &error));
+  // Trailing characters are not ignored
+  for (const char *line : {"1000abc,8,1,64\n", "1000,8,1,64x\n",
+                           "12:34:56,8,1,64\n", "1000,-8,1,64\n"}) {
+    {
+      std::ofstream file(path);
+      file << line;
+    }
+    ASSERT_FALSE(TMSimulator::read_csv(path, &packets, &error)) << line;
+  }
+  std::remove(path.c_str());
+}
+
+// Lines of the packet_log CSV files, as written by tools/tm_trace_to_csv.py
+TEST(TMSimulator, ReadPacketLog) {
+  const std::string path = testing::TempDir() + "packet_log_in0.csv";
+  {
+    std::ofstream file(path);
+    file << "Timestamp,PacketID,EgressPort,PacketSize,Priority,DSCP,Color,"
+            "VLANID,Sport,Dport\n"
+         << "13:05:42.017.000250,4,1,1500,0,46,2,0,5000,80\r\n"
+         << "13:05:42.018.004000,5,1,64,0,0,0,0,5000,80\r\n"
+         << "13:05:43.000.000000,6,1,64,0,0,0,0,5000,80\r\n";
+  }
+  std::vector<SimPacket> packets;
+  std::string error;
+  ASSERT_TRUE(TMSimulator::read_csv(path, &packets, &error)) << error;
+  ASSERT_EQ(3u, packets.size());
+  TMSimulator::normalize(&packets);
+  ASSERT_EQ(0u, packets[0].time_ns);
+  ASSERT_EQ(1003750u, packets[1].time_ns);
+  ASSERT_EQ(982999750u, packets[2].time_ns);
+  ASSERT_EQ(1500u, packets[0].packet_size);
+  ASSERT_EQ(2u, packets[0].color);
+  std::remove(path.c_str());
+}
+
+TEST(TMSimulator, ReadPcap) {
+  const std::string path = testing::TempDir() + "tm_simulator_test.pcap";
+  {
+    std::ofstream file(path, std::ios::binary);
+    const uint32_t global_header[] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};
+    file.write(reinterpret_cast<const char *>(global_header), 24);
+    // Ethernet, VLAN 5 with PCP 3, IPv4 with diffserv 0xb8, UDP 1000 -> 53
+    std::vector<unsigned char> frame(14 + 4 + 20 + 8, 0);
+    frame[12] = 0x81;
+    frame[14] = 0x60;
+    frame[15] = 0x05;
+    frame[16] = 0x08;
+    frame[18] = 0x45;
+    frame[19] = 0xb8;
+    frame[27] = 17;
+    frame[38] = 0x03;
+    frame[39] = 0xe8;
+    frame[41] = 53;
+    for (uint32_t i = 0; i < 2; i++) {
+      const uint32_t record_header[] = {
+          100, 250 + i * 10, static_cast<uint32_t>(frame.size()),
+          static_cast<uint32_t>(frame.size())};
+      file.write(reinterpret_cast<const char *>(record_header), 16);
+      file.write(reinterpret_cast<const char *>(frame.data()), frame.size());
+    }
+  }
+  std::vector<SimPacket> packets;
+  std::string error;
+  ASSERT_TRUE(TMSimulator::read_pcap(path, 3, &packets, &error)) << error;
+  ASSERT_EQ(2u, packets.size());
+  TMSimulator::normalize(&packets);
+  ASSERT_EQ(10000u, packets[1].time_ns);
+  ASSERT_EQ(3u, packets[0].egress_port);
+  ASSERT_EQ(46u, packets[0].packet_size);
+  ASSERT_EQ(3u, packets[0].priority);
+  ASSERT_EQ(5u, packets[0].vlan_id);
+  ASSERT_EQ(0xb8u, packets[0].dscp);
+  ASSERT_EQ(1000u, packets[0].sport);
+  ASSERT_EQ(53u, packets[0].dport);
+  ASSERT_FALSE(TMSimulator::read_pcap(path + ".missing", 3, &packets, &error));
+  std::remove(path.c_str());
+}
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/calendar_item.h>
+#include <bm/bm_sim/config_server.h>
+#include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/tm_trace.h>
+#include <bm/bm_sim/traffic_manager.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bm::CalendarItem;
+using bm::TMTrace;
+using bm::TraceEvent;
+using bm::TraceRecord;
+
+namespace {
+
+std::string trace_path() { return testing::TempDir() + "tm_trace_test.bin"; }
+
+// Records of a trace file, after checking its header
+std::vector<TraceRecord> read_trace(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[8];
+  uint32_t version, record_size;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&record_size), sizeof(record_size));
+  EXPECT_TRUE(file.good());
+  EXPECT_EQ(0, std::memcmp(magic, bm::TM_TRACE_MAGIC, sizeof(magic)));
+  EXPECT_EQ(1u, version);
+  EXPECT_EQ(sizeof(TraceRecord), record_size);
+  std::vector<TraceRecord> records;
+  TraceRecord record;
+  while (file.read(reinterpret_cast<char *>(&record), sizeof(record)))
+    records.push_back(record);
+  return records;
+}
+
+size_t count(const std::vector<TraceRecord> &records, TraceEvent event) {
+  size_t n = 0;
+  for (const auto &record : records)
+    if (record.event == static_cast<uint8_t>(event)) n++;
+  return n;
+}
+
+}  // namespace
+
+TEST(TMTrace, Disabled) {
+  TMTrace *trace = TMTrace::get();
+  ASSERT_FALSE(trace->is_enabled());
+  const uint64_t nb_records = trace->get_nb_records();
+  CalendarItem item;
+  TMTrace::record(TraceEvent::Enqueue, 1, item);
+  ASSERT_EQ(nb_records, trace->get_nb_records());
+  ASSERT_FALSE(trace->start("/nonexistent/dir/trace.bin"));
+  ASSERT_FALSE(trace->is_enabled());
+}
+
+// Every thread has its own ring, the records of a thread keep their order
+TEST(TMTrace, Threads) {
+  constexpr int nb_threads = 4;
+  constexpr uint32_t nb_packets = 5000;
+  TMTrace *trace = TMTrace::get();
+  ASSERT_TRUE(trace->start(trace_path()));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nb_threads; t++) {
+    threads.emplace_back([t]() {
+      CalendarItem item;
+      item.set_egress_port(t);
+      for (uint32_t i = 0; i < nb_packets; i++) {
+        item.set_packet_id(i);
+        item.set_rank({t, static_cast<int>(i)});
+        TMTrace::record(i % 2 ? TraceEvent::Dequeue : TraceEvent::Enqueue, t,
+                        item);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  trace->stop();
+  ASSERT_FALSE(trace->is_enabled());
+  ASSERT_EQ(0u, trace->get_nb_lost());
+  ASSERT_EQ(nb_threads * nb_packets, trace->get_nb_records());
+
+  auto records = read_trace(trace_path());
+  // At least the start and stop ones
+  ASSERT_LE(2u, count(records, TraceEvent::Clock));
+  ASSERT_EQ(nb_threads * nb_packets / 2, count(records, TraceEvent::Enqueue));
+  std::map<int, uint64_t> next_id;
+  for (const auto &record : records) {
+    if (record.event == static_cast<uint8_t>(TraceEvent::Clock)) continue;
+    ASSERT_EQ(next_id[record.node_id]++, record.packet_id);
+    ASSERT_EQ(record.node_id, record.egress_port);
+    ASSERT_EQ(record.node_id, record.rank_day);
+    ASSERT_EQ(static_cast<int>(record.packet_id), record.rank_time);
+  }
+  ASSERT_EQ(static_cast<size_t>(nb_threads), next_id.size());
+  std::remove(trace_path().c_str());
+}
+
+// Started and stopped by a message of the configuration server, the TM
+// records its drops and the nodes their enqueues
+TEST(TMTrace, TrafficManager) {
+  std::string path;
+  ASSERT_TRUE(bm::ConfigParser::parse_trace(
+      R"({"tmtrace": {"file": "trace.bin"}})", &path));
+  ASSERT_EQ("trace.bin", path);
+  ASSERT_TRUE(bm::ConfigParser::parse_trace(R"({"tmtrace": {}})", &path));
+  ASSERT_TRUE(path.empty());
+  ASSERT_FALSE(bm::ConfigParser::parse_trace(
+      R"({"tmtrace": {"file": 1}})", &path));
+  ASSERT_FALSE(bm::ConfigParser::parse_trace(
+      R"({"tmconfig": {"tmnodes": []}})", &path));
+
+  bm::PHVFactory phv_factory;
+  auto phv_source = bm::PHVSourceIface::make_phv_source();
+  phv_source->set_phv_factory(0, &phv_factory);
+  TMTrace *trace = TMTrace::get();
+  ASSERT_TRUE(trace->start(trace_path()));
+  {
+    bm::TrafficManager tm;
+    tm.reconfigure(bm::ConfigParser::parse(R"({"tmconfig": {"tmnodes": [
+        {"tmnode": 0, "port": 1, "scheduler": "FIFO", "impl": "native"},
+        {"tmnode": 1, "parent": 0, "scheduler": "FIFO", "impl": "native",
+         "buffer": {"packets": 1}}]}})", &tm));
+    for (int i = 0; i < 3; i++) {
+      tm.enqueue(1, std::make_unique<bm::Packet>(
+                        bm::Packet::make_new(phv_source.get())));
+    }
+    // The admitted packet goes through the leaf and the root, without egress
+    // buffer it then waits for a dequeue worker
+    auto dequeued_by_root = [&tm]() {
+      for (const auto &stats : tm.get_node_stats())
+        if (stats.first == 0) return stats.second.nb_dequeued == 1;
+      return false;
+    };
+    while (!dequeued_by_root())
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  trace->stop();
+
+  auto records = read_trace(trace_path());
+  ASSERT_EQ(2u, count(records, TraceEvent::Drop));
+  ASSERT_EQ(2u, count(records, TraceEvent::Enqueue));
+  ASSERT_EQ(2u, count(records, TraceEvent::Dequeue));
+  std::vector<int> nodes;
+  for (const auto &record : records) {
+    if (record.event == static_cast<uint8_t>(TraceEvent::Drop))
+      ASSERT_EQ(1, record.node_id);
+    else if (record.event != static_cast<uint8_t>(TraceEvent::Clock))
+      nodes.push_back(record.node_id);
+  }
+  // In and out of the leaf, then of the root, on the worker of the port
+  ASSERT_EQ(std::vector<int>({1, 1, 0, 0}), nodes);
+  std::remove(trace_path().c_str());
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Converts a binary trace of the Traffic Manager (simple_switch --tm-trace, or
+# a {"tmtrace": {"file": ...}} message to the TM configuration server) to the
+# per-node packet_log_in<node>.csv / packet_log_out<node>.csv files.
+# The record layout is TraceRecord in include/bm/bm_sim/tm_trace.h.
+
+import argparse
+import bisect
+import os
+import struct
+import sys
+import time
+
+MAGIC = b'BMTMTRC1'
+HEADER = struct.Struct('<8sII')
+RECORD = struct.Struct('<QQiiiIHHHHBBBBI')
+
+EVENT_CLOCK = 0
+EVENT_ENQUEUE = 1
+EVENT_DEQUEUE = 2
+EVENT_DROP = 3
+
+CSV_HEADER = ('Timestamp,PacketID,EgressPort,PacketSize,Priority,DSCP,Color,'
+              'VLANID,Sport,Dport\n')
+
+
+def read_trace(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit('{}: not a TM trace'.format(path))
+    magic, version, record_size = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit('{}: not a TM trace, or an unsupported version'.format(path))
+    # A trace cut by a crash ends with a partial record
+    end = HEADER.size + (len(data) - HEADER.size) // RECORD.size * RECORD.size
+    return [RECORD.unpack_from(data, offset)
+            for offset in range(HEADER.size, end, RECORD.size)]
+
+
+class Clock(object):
+    """Timestamps to wall-clock ns, interpolated between the Clock records"""
+
+    def __init__(self, clock_records):
+        points = sorted(set((r[0], r[1]) for r in clock_records))
+        if not points:
+            sys.exit('No clock record in the trace')
+        if len(points) == 1:
+            sys.stderr.write('Single clock record, assuming 1 tick per ns\n')
+            points.append((points[0][0] + 1, points[0][1] + 1))
+        self.ticks = [p[0] for p in points]
+        self.ns = [p[1] for p in points]
+
+    def to_ns(self, ticks):
+        # Segment of the timestamp, the first / last one outside of the trace
+        i = bisect.bisect_right(self.ticks, ticks) - 1
+        i = min(max(i, 0), len(self.ticks) - 2)
+        t0, t1 = self.ticks[i], self.ticks[i + 1]
+        n0, n1 = self.ns[i], self.ns[i + 1]
+        return n0 + (ticks - t0) * (n1 - n0) // (t1 - t0)
+
+
+# Same format as the logs of the nodes: local time, then the milliseconds and
+# the nanoseconds modulo 1ms
+def format_time(ns):
+    seconds = ns // 1000000000
+    return '{}.{:03d}.{:06d}'.format(
+        time.strftime('%H:%M:%S', time.localtime(seconds)),
+        (ns // 1000000) % 1000, ns % 1000000)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a binary TM trace to packet_log CSV files')
+    parser.add_argument('trace', help='Trace file')
+    parser.add_argument('--out-dir', default='.',
+                        help='Directory of the CSV files (default: .)')
+    args = parser.parse_args()
+
+    records = read_trace(args.trace)
+    clock = Clock([r for r in records if r[10] == EVENT_CLOCK])
+    events = sorted((r for r in records if r[10] != EVENT_CLOCK),
+                    key=lambda r: r[0])
+
+    files = {}
+
+    def get_file(direction, node_id):
+        key = (direction, node_id)
+        if key not in files:
+            path = os.path.join(args.out_dir, 'packet_log_{}{}.csv'.format(
+                direction, node_id))
+            files[key] = open(path, 'w')
+            files[key].write(CSV_HEADER)
+        return files[key]
+
+    nb_drops = 0
+    for (timestamp, packet_id, node_id, _, _, packet_size, egress_port,
+         vlan_id, sport, dport, event, priority, dscp, color, _) in events:
+        if event == EVENT_DROP:
+            nb_drops += 1
+            continue
+        direction = 'in' if event == EVENT_ENQUEUE else 'out'
+        get_file(direction, node_id).write(
+            '{},{},{},{},{},{},{},{},{},{}\n'.format(
+                format_time(clock.to_ns(timestamp)), packet_id, egress_port,
+                packet_size, priority, dscp, color, vlan_id, sport, dport))
+    for f in files.values():
+        f.close()
+
+    print('{} events, {} drops, {} files written to {}'.format(
+        len(events), nb_drops, len(files), args.out_dir))
+
+
+if __name__ == '__main__':
+    main()